@@ -1002,6 +1002,8 @@ chat_components_edit_ok(PurpleChat *chat, PurpleRequestFields *allfields)
 			}
 		}
 	}
+
+	purple_blist_save_node(purple_blist_get_default(), PURPLE_BLIST_NODE(chat));
 }
 
 static void
@@ -3148,6 +3150,18 @@ finch_buddy_list_finalize(GObject *obj)
 	G_OBJECT_CLASS(finch_buddy_list_parent_class)->finalize(obj);
 }
 
+static void
+finch_blist_bulk_update(PurpleBuddyList *list, GList *removed)
+{
+	/* The redraw resets the UI data of every node */
+	for (; ggblist && removed != NULL; removed = removed->next) {
+		if (ggblist->tagged)
+			ggblist->tagged = g_list_remove(ggblist->tagged, removed->data);
+	}
+
+	redraw_blist(NULL, PURPLE_PREF_NONE, NULL, NULL);
+}
+
 static void
 finch_buddy_list_class_init(FinchBuddyListClass *klass)
 {
@@ -3164,6 +3178,7 @@ finch_buddy_list_class_init(FinchBuddyListClass *klass)
 	purple_blist_class->request_add_buddy = finch_request_add_buddy;
 	purple_blist_class->request_add_chat = finch_request_add_chat;
 	purple_blist_class->request_add_group = finch_request_add_group;
+	purple_blist_class->bulk_update = finch_blist_bulk_update;
 }
 
 /**************************************************************************
@@ -35,6 +35,7 @@
 #include "account.h"
 #include "debug.h"
 #include "log.h"
+#include "logindex.h"
 #include "notify.h"
 #include "request.h"
 #include "util.h"
@@ -132,7 +133,9 @@ static void search_cb(GntWidget *button, FinchLogViewer *lv)
 	gnt_tree_remove_all(GNT_TREE(lv->tree));
 	gnt_text_view_clear(GNT_TEXT_VIEW(lv->text));
 
-	for (logs = lv->logs; logs != NULL; logs = logs->next) {
+	/* The index rules most of the logs out without reading them */
+	logs = purple_log_index_narrow(lv->logs, search_term);
+	for (; logs != NULL; logs = g_list_delete_link(logs, logs)) {
 		char *read = purple_log_read((PurpleLog*)logs->data, NULL);
 		if (read && *read && purple_strcasestr(read, search_term)) {
 			PurpleLog *log = logs->data;
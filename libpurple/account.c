@@ -1665,6 +1665,9 @@ purple_account_set_protocol_id(PurpleAccount *account, const char *protocol_id)
 	g_free(priv->protocol_id);
 	priv->protocol_id = g_strdup(protocol_id);
 
+	/* another protocol may normalize names differently */
+	purple_normalize_cache_clear(account);
+
 	g_object_notify_by_pspec(G_OBJECT(account), properties[PROP_PROTOCOL_ID]);
 
 	purple_accounts_schedule_save();
@@ -1680,6 +1683,9 @@ purple_account_set_connection(PurpleAccount *account, PurpleConnection *gc)
 	priv = purple_account_get_instance_private(account);
 	priv->gc = gc;
 
+	/* Protocols may normalize names differently while connected */
+	purple_normalize_cache_clear(account);
+
 	g_object_notify_by_pspec(G_OBJECT(account), properties[PROP_CONNECTION]);
 }
 
@@ -68,7 +68,8 @@ sync_accounts(void)
 
 	node = accounts_to_xmlnode();
 	data = purple_xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_config_file("accounts.xml", data, -1);
+	if (purple_util_write_data_to_config_file("accounts.xml", data, -1))
+		_purple_xmlnode_write_snapshot(purple_config_dir(), "accounts.xml", node);
 	g_free(data);
 	purple_xmlnode_free(node);
 }
@@ -540,7 +541,9 @@ load_accounts(void)
 
 	accounts_loaded = TRUE;
 
-	node = purple_util_read_xml_from_config_file("accounts.xml", _("accounts"));
+	node = _purple_xmlnode_from_snapshot(purple_config_dir(), "accounts.xml");
+	if (node == NULL)
+		node = purple_util_read_xml_from_config_file("accounts.xml", _("accounts"));
 
 	if (node == NULL)
 		return;
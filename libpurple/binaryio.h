@@ -0,0 +1,148 @@
+/* purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#ifndef PURPLE_BINARYIO_H
+#define PURPLE_BINARYIO_H
+/*
+ * SECTION:binaryio
+ * @section_id: libpurple-binaryio
+ * @short_description: <filename>binaryio.h</filename>
+ * @title: Binary cache file helpers
+ *
+ * This file is internal to libpurple. Do not use!
+ * Also, any public API should not depend on this file.
+ *
+ * The binary caches (xmlnode snapshots, the caps store, the log index and
+ * the log metadata and binary logs) share these.  Numbers are stored little
+ * endian.  Strings are stored as their length and their NUL-terminated
+ * bytes, or G_MAXUINT32 for NULL.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#define _PURPLE_FNV1A_INIT 2166136261u
+
+typedef struct
+{
+	const guchar *cur;
+	const guchar *end;
+} PurpleBinaryReader;
+
+/* Continues an FNV-1a checksum, start with _PURPLE_FNV1A_INIT */
+static inline guint32
+_purple_fnv1a_update(guint32 hash, const guchar *data, gsize len)
+{
+	gsize i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static inline guint32
+_purple_fnv1a(const guchar *data, gsize len)
+{
+	return _purple_fnv1a_update(_PURPLE_FNV1A_INIT, data, len);
+}
+
+static inline void
+_purple_binary_put_uint32(GByteArray *out, guint32 value)
+{
+	value = GUINT32_TO_LE(value);
+	g_byte_array_append(out, (const guint8 *)&value, sizeof(value));
+}
+
+static inline void
+_purple_binary_put_int64(GByteArray *out, gint64 value)
+{
+	value = GINT64_TO_LE(value);
+	g_byte_array_append(out, (const guint8 *)&value, sizeof(value));
+}
+
+static inline void
+_purple_binary_put_string(GByteArray *out, const char *str)
+{
+	gsize len;
+
+	if (str == NULL) {
+		_purple_binary_put_uint32(out, G_MAXUINT32);
+		return;
+	}
+
+	len = strlen(str);
+	_purple_binary_put_uint32(out, len);
+	g_byte_array_append(out, (const guint8 *)str, len + 1);
+}
+
+static inline gboolean
+_purple_binary_get_uint32(PurpleBinaryReader *reader, guint32 *value)
+{
+	if ((gsize)(reader->end - reader->cur) < sizeof(*value))
+		return FALSE;
+
+	memcpy(value, reader->cur, sizeof(*value));
+	*value = GUINT32_FROM_LE(*value);
+	reader->cur += sizeof(*value);
+
+	return TRUE;
+}
+
+static inline gboolean
+_purple_binary_get_int64(PurpleBinaryReader *reader, gint64 *value)
+{
+	if ((gsize)(reader->end - reader->cur) < sizeof(*value))
+		return FALSE;
+
+	memcpy(value, reader->cur, sizeof(*value));
+	*value = GINT64_FROM_LE(*value);
+	reader->cur += sizeof(*value);
+
+	return TRUE;
+}
+
+/* On success, *str points into the data and is NUL-terminated. */
+static inline gboolean
+_purple_binary_get_string(PurpleBinaryReader *reader, const char **str)
+{
+	guint32 len;
+
+	if (!_purple_binary_get_uint32(reader, &len))
+		return FALSE;
+
+	if (len == G_MAXUINT32) {
+		*str = NULL;
+		return TRUE;
+	}
+
+	if ((gsize)(reader->end - reader->cur) <= len || reader->cur[len] != '\0')
+		return FALSE;
+
+	*str = (const char *)reader->cur;
+	reader->cur += len + 1;
+
+	return TRUE;
+}
+
+#endif /* PURPLE_BINARYIO_H */
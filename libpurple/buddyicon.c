@@ -26,6 +26,9 @@
 #include "image.h"
 #include "util.h"
 
+/* The default limit on the memory used by decoded icons. */
+#define PURPLE_BUDDY_ICONS_DECODED_CACHE_SIZE (8 * 1024 * 1024)
+
 /* NOTE: Instances of this struct are allocated without zeroing the memory, so
  * NOTE: be sure to update purple_buddy_icon_new() if you add members. */
 struct _PurpleBuddyIcon
@@ -38,6 +41,22 @@ struct _PurpleBuddyIcon
 	unsigned int ref_count;    /* The buddy icon reference count.      */
 };
 
+typedef struct
+{
+	PurpleAccount *account;    /* The account the user is on.          */
+	char *username;            /* The username the icon belongs to.    */
+	char *filename;            /* The icon cache file being read.      */
+	GList *tasks;              /* The GTasks waiting for the icon.     */
+} PurpleBuddyIconLoad;
+
+typedef struct
+{
+	GList link;                /* The link in decoded_lru.             */
+	char *filename;            /* The key in decoded_cache.            */
+	GObject *decoded;          /* The UI's decoded copy of the icon.   */
+	gsize size;                /* The memory used by decoded.          */
+} PurpleBuddyIconDecoded;
+
 /*
  * This is the big grand daddy hash table that contains references to
  * everybody's buddy icons.
@@ -92,6 +111,34 @@ static GHashTable *icon_file_cache = NULL;
  */
 static GHashTable *pointer_icon_cache = NULL;
 
+/*
+ * This hash table contains the buddy icons that are being read from the
+ * on-disk icon cache in a worker thread, so that several requests for the
+ * same icon only read it once.
+ *
+ * Key is a PurpleBuddyIconLoad, matched on its account and username.
+ * The value is the same PurpleBuddyIconLoad.
+ */
+static GHashTable *icon_loads = NULL;
+
+/*
+ * This hash table contains the icons that UIs have decoded for display,
+ * so that redrawing the buddy list doesn't decode the same image again.
+ *
+ * Key is the filename for the image as constructed by
+ * purple_image_generate_filename(), so buddies with the same icon share
+ * the decoded copy as well.
+ *
+ * The value is a PurpleBuddyIconDecoded, which is also linked into
+ * decoded_lru, most recently used first.  When the total size of the
+ * decoded icons goes over decoded_max, the least recently used ones are
+ * dropped.
+ */
+static GHashTable *decoded_cache = NULL;
+static GQueue      decoded_lru   = G_QUEUE_INIT;
+static gsize       decoded_size  = 0;
+static gsize       decoded_max   = PURPLE_BUDDY_ICONS_DECODED_CACHE_SIZE;
+
 static char       *cache_dir     = NULL;
 
 /* "Should icons be cached to disk?" */
@@ -524,6 +571,14 @@ purple_buddy_icon_get_extension(const PurpleBuddyIcon *icon)
 	return NULL;
 }
 
+PurpleImage *
+purple_buddy_icon_get_image(const PurpleBuddyIcon *icon)
+{
+	g_return_val_if_fail(icon != NULL, NULL);
+
+	return icon->img;
+}
+
 void
 purple_buddy_icons_set_for_user(PurpleAccount *account, const char *username,
                                 void *icon_data, size_t icon_len,
@@ -617,24 +672,57 @@ read_icon_file(const char *path, guchar **data, size_t *len)
 	return TRUE;
 }
 
+static PurpleBuddyIcon *
+buddy_icon_lookup(PurpleAccount *account, const char *username)
+{
+	GHashTable *icon_cache = g_hash_table_lookup(account_cache, account);
+
+	return (icon_cache ? g_hash_table_lookup(icon_cache, username) : NULL);
+}
+
+/* Creates the icon for a buddy from data read from the on-disk icon cache.
+ * This takes ownership of data. */
+static PurpleBuddyIcon *
+buddy_icon_new_from_cache(PurpleAccount *account, const char *username,
+                          PurpleBuddy *buddy, guchar *data, size_t len)
+{
+	PurpleBuddyIcon *icon;
+	const char *checksum;
+	gboolean caching;
+
+	caching = purple_buddy_icons_is_caching();
+	/* By disabling caching temporarily, we avoid a loop
+	 * and don't have to add special code through several
+	 * functions. */
+	purple_buddy_icons_set_caching(FALSE);
+
+	icon = purple_buddy_icon_create(account, username);
+	icon->img = NULL;
+	checksum = purple_blist_node_get_string((PurpleBlistNode *)buddy,
+	                                        "icon_checksum");
+	purple_buddy_icon_set_data(icon, data, len, checksum);
+
+	purple_buddy_icons_set_caching(caching);
+
+	return icon;
+}
+
 PurpleBuddyIcon *
 purple_buddy_icons_find(PurpleAccount *account, const char *username)
 {
-	GHashTable *icon_cache;
-	PurpleBuddyIcon *icon = NULL;
+	PurpleBuddyIcon *icon;
 
 	g_return_val_if_fail(account  != NULL, NULL);
 	g_return_val_if_fail(username != NULL, NULL);
 
-	icon_cache = g_hash_table_lookup(account_cache, account);
+	icon = buddy_icon_lookup(account, username);
 
-	if ((icon_cache == NULL) || ((icon = g_hash_table_lookup(icon_cache, username)) == NULL))
+	if (icon == NULL)
 	{
 		/* The icon is not currently cached in memory--try reading from disk */
 		PurpleBuddy *b = purple_blist_find_buddy(account, username);
 		const char *protocol_icon_file;
 		const char *dirname;
-		gboolean caching;
 		gchar *path;
 		guchar *data;
 		size_t len;
@@ -649,33 +737,359 @@ purple_buddy_icons_find(PurpleAccount *account, const char *username)
 
 		dirname = purple_buddy_icons_get_cache_dir();
 
-		caching = purple_buddy_icons_is_caching();
-		/* By disabling caching temporarily, we avoid a loop
-		 * and don't have to add special code through several
-		 * functions. */
-		purple_buddy_icons_set_caching(FALSE);
-
 		path = g_build_filename(dirname, protocol_icon_file, NULL);
 		if (read_icon_file(path, &data, &len)) {
-			const char *checksum;
-
-			icon = purple_buddy_icon_create(account, username);
-			icon->img = NULL;
-			checksum = purple_blist_node_get_string((PurpleBlistNode *)b,
-			                                        "icon_checksum");
-			purple_buddy_icon_set_data(icon, data, len, checksum);
+			icon = buddy_icon_new_from_cache(account, username, b,
+			                                 data, len);
 		} else {
 			delete_buddy_icon_settings((PurpleBlistNode *)b, "buddy_icon");
 		}
 
 		g_free(path);
-
-		purple_buddy_icons_set_caching(caching);
 	}
 
 	return (icon ? purple_buddy_icon_ref(icon) : NULL);
 }
 
+PurpleBuddyIcon *
+purple_buddy_icons_find_cached(PurpleAccount *account, const char *username)
+{
+	PurpleBuddyIcon *icon;
+
+	g_return_val_if_fail(account  != NULL, NULL);
+	g_return_val_if_fail(username != NULL, NULL);
+
+	icon = buddy_icon_lookup(account, username);
+
+	return (icon ? purple_buddy_icon_ref(icon) : NULL);
+}
+
+/*
+ * Begin functions for loading icons from the on-disk cache asynchronously
+ */
+
+static guint
+buddy_icon_load_hash(gconstpointer key)
+{
+	const PurpleBuddyIconLoad *load = key;
+
+	return g_direct_hash(load->account) ^ g_str_hash(load->username);
+}
+
+static gboolean
+buddy_icon_load_equal(gconstpointer a, gconstpointer b)
+{
+	const PurpleBuddyIconLoad *load_a = a;
+	const PurpleBuddyIconLoad *load_b = b;
+
+	return (load_a->account == load_b->account &&
+	        purple_strequal(load_a->username, load_b->username));
+}
+
+static void
+buddy_icon_load_free(PurpleBuddyIconLoad *load)
+{
+	g_list_free_full(load->tasks, g_object_unref);
+	g_object_unref(load->account);
+	g_free(load->username);
+	g_free(load->filename);
+	g_free(load);
+}
+
+static void
+buddy_icon_load_return(PurpleBuddyIconLoad *load, PurpleBuddyIcon *icon)
+{
+	GList *tasks, *l;
+
+	tasks = load->tasks;
+	load->tasks = NULL;
+
+	for (l = tasks; l != NULL; l = l->next) {
+		g_task_return_pointer(G_TASK(l->data),
+		                      icon ? purple_buddy_icon_ref(icon) : NULL,
+		                      (GDestroyNotify)purple_buddy_icon_unref);
+	}
+
+	g_list_free_full(tasks, g_object_unref);
+}
+
+/* Runs in a worker thread, so this must not touch anything but the path. */
+static void
+buddy_icon_read_thread(GTask *task, gpointer source, gpointer task_data,
+                       GCancellable *cancellable)
+{
+	const gchar *path = task_data;
+	gchar *contents;
+	gsize len;
+	GError *error = NULL;
+
+	if (!g_file_get_contents(path, &contents, &len, &error)) {
+		g_task_return_error(task, error);
+		return;
+	}
+
+	g_task_return_pointer(task, g_bytes_new_take(contents, len),
+	                      (GDestroyNotify)g_bytes_unref);
+}
+
+static void
+buddy_icon_read_cb(GObject *source, GAsyncResult *res, gpointer data)
+{
+	PurpleBuddyIconLoad *load = data;
+	PurpleBuddyIcon *icon;
+	PurpleBuddy *buddy;
+	const char *filename;
+	GBytes *bytes;
+	GError *error = NULL;
+
+	bytes = g_task_propagate_pointer(G_TASK(res), &error);
+
+	/* purple_buddy_icons_uninit() has already cancelled the requests. */
+	if (icon_loads == NULL) {
+		if (bytes != NULL)
+			g_bytes_unref(bytes);
+		g_clear_error(&error);
+		buddy_icon_load_free(load);
+		return;
+	}
+
+	g_hash_table_remove(icon_loads, load);
+
+	/* The protocol may have set the icon while we were reading it. */
+	icon = buddy_icon_lookup(load->account, load->username);
+	if (icon != NULL) {
+		purple_buddy_icon_ref(icon);
+	} else {
+		buddy = purple_blist_find_buddy(load->account, load->username);
+		filename = buddy ? purple_blist_node_get_string(
+			(PurpleBlistNode *)buddy, "buddy_icon") : NULL;
+
+		/* If the buddy is gone, or its icon changed while we were
+		 * reading the old one, there is nothing to return. */
+		if (!purple_strequal(filename, load->filename)) {
+			icon = NULL;
+		} else if (bytes != NULL) {
+			gsize len;
+			guchar *contents = g_bytes_unref_to_data(bytes, &len);
+
+			bytes = NULL;
+			icon = buddy_icon_new_from_cache(load->account,
+			                                 load->username, buddy,
+			                                 contents, len);
+		} else {
+			purple_debug_error("buddyicon", "Error reading %s: %s\n",
+			                   filename, error->message);
+			delete_buddy_icon_settings((PurpleBlistNode *)buddy,
+			                           "buddy_icon");
+		}
+	}
+
+	buddy_icon_load_return(load, icon);
+
+	purple_buddy_icon_unref(icon);
+	if (bytes != NULL)
+		g_bytes_unref(bytes);
+	g_clear_error(&error);
+	buddy_icon_load_free(load);
+}
+
+void
+purple_buddy_icons_find_async(PurpleAccount *account, const char *username,
+                              GCancellable *cancellable,
+                              GAsyncReadyCallback callback, gpointer data)
+{
+	PurpleBuddyIconLoad key, *load;
+	PurpleBuddyIcon *icon;
+	PurpleBuddy *buddy;
+	const char *filename;
+	GTask *task;
+
+	g_return_if_fail(PURPLE_IS_ACCOUNT(account));
+	g_return_if_fail(username != NULL);
+
+	task = g_task_new(NULL, cancellable, callback, data);
+	g_task_set_source_tag(task, purple_buddy_icons_find_async);
+
+	icon = buddy_icon_lookup(account, username);
+	if (icon != NULL) {
+		g_task_return_pointer(task, purple_buddy_icon_ref(icon),
+		                      (GDestroyNotify)purple_buddy_icon_unref);
+		g_object_unref(task);
+		return;
+	}
+
+	buddy = purple_blist_find_buddy(account, username);
+	filename = buddy ? purple_blist_node_get_string(
+		(PurpleBlistNode *)buddy, "buddy_icon") : NULL;
+
+	if (filename == NULL) {
+		g_task_return_pointer(task, NULL, NULL);
+		g_object_unref(task);
+		return;
+	}
+
+	key.account = account;
+	key.username = (char *)username;
+	load = g_hash_table_lookup(icon_loads, &key);
+
+	if (load == NULL) {
+		GTask *read;
+
+		load = g_new0(PurpleBuddyIconLoad, 1);
+		load->account = g_object_ref(account);
+		load->username = g_strdup(username);
+		load->filename = g_strdup(filename);
+		g_hash_table_add(icon_loads, load);
+
+		read = g_task_new(NULL, NULL, buddy_icon_read_cb, load);
+		g_task_set_task_data(read,
+			g_build_filename(purple_buddy_icons_get_cache_dir(),
+			                 filename, NULL),
+			g_free);
+		g_task_run_in_thread(read, buddy_icon_read_thread);
+		g_object_unref(read);
+	}
+
+	load->tasks = g_list_append(load->tasks, task);
+}
+
+PurpleBuddyIcon *
+purple_buddy_icons_find_finish(GAsyncResult *res, GError **error)
+{
+	g_return_val_if_fail(g_task_is_valid(res, NULL), NULL);
+
+	return g_task_propagate_pointer(G_TASK(res), error);
+}
+
+void
+purple_buddy_icons_prefetch(GList *buddies)
+{
+	for (; buddies != NULL; buddies = buddies->next) {
+		PurpleBuddy *buddy = buddies->data;
+
+		g_return_if_fail(PURPLE_IS_BUDDY(buddy));
+
+		/* Either the icon is already in memory or there is none. */
+		if (purple_buddy_get_icon(buddy) != NULL ||
+		    purple_blist_node_get_string((PurpleBlistNode *)buddy,
+		                                 "buddy_icon") == NULL)
+			continue;
+
+		/* Loading the icon sets it on the buddy, which updates the
+		 * buddy list, so there's nothing to do when it's done. */
+		purple_buddy_icons_find_async(purple_buddy_get_account(buddy),
+		                              purple_buddy_get_name(buddy),
+		                              NULL, NULL, NULL);
+	}
+}
+
+/*
+ * End functions for loading icons from the on-disk cache asynchronously
+ */
+
+/*
+ * Begin functions for dealing with the decoded icon cache
+ */
+
+static void
+decoded_free(PurpleBuddyIconDecoded *entry)
+{
+	g_free(entry->filename);
+	g_object_unref(entry->decoded);
+	g_free(entry);
+}
+
+static void
+decoded_remove(PurpleBuddyIconDecoded *entry)
+{
+	g_queue_unlink(&decoded_lru, &entry->link);
+	decoded_size -= entry->size;
+
+	/* This frees entry. */
+	g_hash_table_remove(decoded_cache, entry->filename);
+}
+
+static void
+decoded_trim(gsize max)
+{
+	while (decoded_size > max && decoded_lru.tail != NULL)
+		decoded_remove(decoded_lru.tail->data);
+}
+
+GObject *
+purple_buddy_icons_get_decoded(PurpleImage *image)
+{
+	PurpleBuddyIconDecoded *entry;
+	const gchar *filename;
+
+	g_return_val_if_fail(PURPLE_IS_IMAGE(image), NULL);
+
+	filename = purple_image_generate_filename(image);
+	if (filename == NULL)
+		return NULL;
+
+	entry = g_hash_table_lookup(decoded_cache, filename);
+	if (entry == NULL)
+		return NULL;
+
+	g_queue_unlink(&decoded_lru, &entry->link);
+	g_queue_push_head_link(&decoded_lru, &entry->link);
+
+	return g_object_ref(entry->decoded);
+}
+
+void
+purple_buddy_icons_set_decoded(PurpleImage *image, GObject *decoded,
+                               gsize size)
+{
+	PurpleBuddyIconDecoded *entry;
+	const gchar *filename;
+
+	g_return_if_fail(PURPLE_IS_IMAGE(image));
+	g_return_if_fail(G_IS_OBJECT(decoded));
+
+	filename = purple_image_generate_filename(image);
+	if (filename == NULL)
+		return;
+
+	entry = g_hash_table_lookup(decoded_cache, filename);
+	if (entry != NULL)
+		decoded_remove(entry);
+
+	/* It would only push everything else out. */
+	if (size > decoded_max)
+		return;
+
+	entry = g_new0(PurpleBuddyIconDecoded, 1);
+	entry->link.data = entry;
+	entry->filename = g_strdup(filename);
+	entry->decoded = g_object_ref(decoded);
+	entry->size = size;
+
+	g_hash_table_insert(decoded_cache, entry->filename, entry);
+	g_queue_push_head_link(&decoded_lru, &entry->link);
+	decoded_size += size;
+
+	decoded_trim(decoded_max);
+}
+
+void
+purple_buddy_icons_set_decoded_cache_size(gsize size)
+{
+	decoded_max = size;
+	decoded_trim(decoded_max);
+}
+
+gsize
+purple_buddy_icons_get_decoded_cache_size(void)
+{
+	return decoded_max;
+}
+
+/*
+ * End functions for dealing with the decoded icon cache
+ */
+
 PurpleImage *
 purple_buddy_icons_find_account_icon(PurpleAccount *account)
 {
@@ -1086,6 +1500,9 @@ purple_buddy_icons_init()
 	icon_file_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
 	                                        g_free, NULL);
 	pointer_icon_cache = g_hash_table_new(g_direct_hash, g_direct_equal);
+	icon_loads = g_hash_table_new(buddy_icon_load_hash, buddy_icon_load_equal);
+	decoded_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+	                                      NULL, (GDestroyNotify)decoded_free);
 
 	if (!cache_dir)
 		cache_dir = g_build_filename(purple_cache_dir(), "icons", NULL);
@@ -1094,8 +1511,32 @@ purple_buddy_icons_init()
 void
 purple_buddy_icons_uninit()
 {
+	GHashTableIter iter;
+	PurpleBuddyIconLoad *load;
+
 	purple_signals_disconnect_by_handle(purple_buddy_icons_get_handle());
 
+	/* The reads still running will free their loads when they finish. */
+	g_hash_table_iter_init(&iter, icon_loads);
+	while (g_hash_table_iter_next(&iter, (gpointer *)&load, NULL)) {
+		GList *l;
+
+		for (l = load->tasks; l != NULL; l = l->next) {
+			g_task_return_new_error(G_TASK(l->data), G_IO_ERROR,
+			                        G_IO_ERROR_CANCELLED,
+			                        "Buddy icons are shutting down");
+		}
+		g_list_free_full(load->tasks, g_object_unref);
+		load->tasks = NULL;
+	}
+	g_hash_table_destroy(icon_loads);
+	icon_loads = NULL;
+
+	g_hash_table_destroy(decoded_cache);
+	decoded_cache = NULL;
+	g_queue_init(&decoded_lru);
+	decoded_size = 0;
+
 	g_hash_table_destroy(account_cache);
 	g_hash_table_destroy(icon_data_cache);
 	g_hash_table_destroy(icon_file_cache);
@@ -44,6 +44,8 @@ typedef struct _PurpleBuddyIcon PurpleBuddyIcon;
 
 typedef struct _PurpleBuddyIconSpec PurpleBuddyIconSpec;
 
+#include <gio/gio.h>
+
 #include "account.h"
 #include "buddylist.h"
 #include "image.h"
@@ -219,6 +221,16 @@ gconstpointer purple_buddy_icon_get_data(const PurpleBuddyIcon *icon, size_t *le
  */
 const char *purple_buddy_icon_get_extension(const PurpleBuddyIcon *icon);
 
+/**
+ * purple_buddy_icon_get_image:
+ * @icon: The buddy icon.
+ *
+ * Returns the image holding the buddy icon's data.
+ *
+ * Returns: (transfer none): The image, or %NULL if the icon has no data.
+ */
+PurpleImage *purple_buddy_icon_get_image(const PurpleBuddyIcon *icon);
+
 /**
  * purple_buddy_icon_get_full_path:
  * @icon: The buddy icon
@@ -284,6 +296,119 @@ purple_buddy_icons_get_checksum_for_user(PurpleBuddy *buddy);
 PurpleBuddyIcon *
 purple_buddy_icons_find(PurpleAccount *account, const char *username);
 
+/**
+ * purple_buddy_icons_find_cached:
+ * @account:  The account the user is on.
+ * @username: The username of the user.
+ *
+ * Returns the buddy icon information for a user if it is already in memory.
+ *
+ * Unlike purple_buddy_icons_find(), this never reads the icon from the
+ * on-disk cache, so it is cheap enough to call while drawing.  Use
+ * purple_buddy_icons_find_async() or purple_buddy_icons_prefetch() to
+ * load icons which aren't in memory yet.
+ *
+ * Returns: The icon (with a reference for the caller) if it is in memory,
+ *          or %NULL otherwise.
+ */
+PurpleBuddyIcon *
+purple_buddy_icons_find_cached(PurpleAccount *account, const char *username);
+
+/**
+ * purple_buddy_icons_find_async:
+ * @account:     The account the user is on.
+ * @username:    The username of the user.
+ * @cancellable: (nullable): A #GCancellable, or %NULL.
+ * @callback:    (scope async): The callback to call when the icon is found.
+ * @data:        (closure): The data to pass to @callback.
+ *
+ * Finds the buddy icon information for a user, like
+ * purple_buddy_icons_find(), but reads the icon from the on-disk cache in
+ * a worker thread.  Requests for the same icon while it is being read
+ * share that read.
+ *
+ * Once loaded, the icon is set on the user's buddies as usual, which
+ * updates them in the buddy list.  So UIs can draw a placeholder until
+ * then and need not use the result at all.
+ */
+void
+purple_buddy_icons_find_async(PurpleAccount *account, const char *username,
+                              GCancellable *cancellable,
+                              GAsyncReadyCallback callback, gpointer data);
+
+/**
+ * purple_buddy_icons_find_finish:
+ * @res:   The #GAsyncResult passed to the callback.
+ * @error: Return location for a #GError, or %NULL.
+ *
+ * Finishes a purple_buddy_icons_find_async() call.
+ *
+ * Returns: The icon (with a reference for the caller), or %NULL if the user
+ *          has no icon or @error is set.
+ */
+PurpleBuddyIcon *
+purple_buddy_icons_find_finish(GAsyncResult *res, GError **error);
+
+/**
+ * purple_buddy_icons_prefetch:
+ * @buddies: (element-type PurpleBuddy): The buddies whose icons to load.
+ *
+ * Starts loading the icons of @buddies which have one in the on-disk cache
+ * but not in memory, as with purple_buddy_icons_find_async().  UIs call
+ * this for the buddies they are about to show.
+ */
+void
+purple_buddy_icons_prefetch(GList *buddies);
+
+/**
+ * purple_buddy_icons_get_decoded:
+ * @image: The icon's image.
+ *
+ * Returns the copy of @image that a UI decoded for display and stored with
+ * purple_buddy_icons_set_decoded(), if it is still cached.
+ *
+ * Returns: (transfer full) (nullable): The decoded icon, or %NULL.
+ */
+GObject *
+purple_buddy_icons_get_decoded(PurpleImage *image);
+
+/**
+ * purple_buddy_icons_set_decoded:
+ * @image:   The icon's image.
+ * @decoded: The UI's decoded copy of @image, such as a GdkPixbuf.
+ * @size:    The memory used by @decoded, in bytes.
+ *
+ * Stores a decoded copy of an icon, so that it can be drawn again without
+ * decoding it.  Icons with the same data share the entry.  The least
+ * recently used entries are dropped once the cache grows past the size set
+ * with purple_buddy_icons_set_decoded_cache_size().
+ *
+ * The decoded copy is shared, so it must not be modified.
+ */
+void
+purple_buddy_icons_set_decoded(PurpleImage *image, GObject *decoded,
+                               gsize size);
+
+/**
+ * purple_buddy_icons_set_decoded_cache_size:
+ * @size: The maximum memory used by decoded icons, in bytes.
+ *
+ * Sets how much memory purple_buddy_icons_set_decoded() may use.
+ * The default is 8 MiB.  A size of 0 disables the cache.
+ */
+void
+purple_buddy_icons_set_decoded_cache_size(gsize size);
+
+/**
+ * purple_buddy_icons_get_decoded_cache_size:
+ *
+ * Returns how much memory purple_buddy_icons_set_decoded() may use.
+ *
+ * Returns: The maximum memory used by decoded icons, in bytes.
+ */
+gsize
+purple_buddy_icons_get_decoded_cache_size(void);
+
 /**
  * purple_buddy_icons_find_account_icon:
  * @account: The account
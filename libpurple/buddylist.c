@@ -57,10 +57,62 @@ static GHashTable *buddies_cache = NULL;
  */
 static GHashTable *groups_cache = NULL;
 
+/*
+ * A hash table used for efficient lookups of chats by name.
+ * PurpleAccount* => GHashTable*, with the inner hash table being
+ * normalized chat name => PurpleChat*. The inner tables are built when
+ * first needed, and dropped when the chats of the account change.
+ */
+static GHashTable *chats_cache = NULL;
+
 static guint          save_timer = 0;
 static gboolean       blist_loaded = FALSE;
+static gsize          blist_save_size = 4096;
+static guint          blist_bulk_update = 0;
 static gchar *localized_default_group_name = NULL;
 
+/*
+ * The serialized XML of a contact, kept on the contact between saves of
+ * the buddy list and dropped whenever the contact or one of its buddies
+ * changes.
+ */
+typedef struct
+{
+	char *xml;
+	gsize stamp;
+} PurpleBlistFragment;
+
+G_DEFINE_QUARK(purple-blist-fragment, purple_blist_fragment);
+
+static void
+purple_blist_fragment_free(PurpleBlistFragment *fragment)
+{
+	g_free(fragment->xml);
+	g_free(fragment);
+}
+
+#define BLIST_JOURNAL           "blist.xml.journal"
+#define BLIST_JOURNAL_MAGIC     "purple-blist-journal"
+#define BLIST_JOURNAL_MIN_SIZE  (64 * 1024)
+#define BLIST_DIGEST_SIZE       20
+
+/*
+ * The child elements of a group, or of <privacy>, as written to disk. Only
+ * the digests are kept after a save, to find what changed by the next one.
+ */
+typedef struct
+{
+	char *name;           /* Of a group, NULL for the default group */
+	GPtrArray *lines;     /* The serialized child elements */
+	GByteArray *digests;  /* The SHA-1 digest of every line */
+} PurpleBlistSection;
+
+static guint       blist_generation = 0;
+static gsize       blist_journal_size = 0;
+static GPtrArray  *blist_saved_groups = NULL;
+static PurpleBlistSection *blist_saved_privacy = NULL;
+static char       *blist_saved_attributes = NULL;
+
 /*********************************************************************
  * Private utility functions                                         *
  *********************************************************************/
@@ -141,6 +193,64 @@ static void
 purple_blist_buddies_cache_remove_account(const PurpleAccount *account)
 {
 	g_hash_table_remove(buddies_cache, account);
+	g_hash_table_remove(chats_cache, account);
+}
+
+static GHashTable *
+purple_blist_chats_cache_get_account(PurpleAccount *account,
+		PurpleProtocol *protocol)
+{
+	GHashTable *account_chats;
+	PurpleProtocolChatEntry *pce;
+	PurpleBlistNode *node, *group;
+	GList *parts;
+	const char *chat_name, *normname;
+
+	account_chats = g_hash_table_lookup(chats_cache, account);
+	if (account_chats != NULL)
+		return account_chats;
+
+	account_chats = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	g_hash_table_insert(chats_cache, account, account_chats);
+
+	parts = purple_protocol_chat_iface_info(protocol,
+			purple_account_get_connection(account));
+	if (parts == NULL)
+		return account_chats;
+
+	pce = parts->data;
+
+	for (group = purple_blist_get_default_root(); group != NULL;
+	     group = group->next) {
+		for (node = group->child; node != NULL; node = node->next) {
+			if (!PURPLE_IS_CHAT(node) ||
+			    purple_chat_get_account(PURPLE_CHAT(node)) != account)
+				continue;
+
+			chat_name = g_hash_table_lookup(
+					purple_chat_get_components(PURPLE_CHAT(node)),
+					pce->identifier);
+			if (chat_name == NULL)
+				continue;
+
+			/* The first chat in the list wins, as it used to */
+			normname = purple_normalize(account, chat_name);
+			if (normname != NULL &&
+			    !g_hash_table_contains(account_chats, normname))
+				g_hash_table_insert(account_chats, g_strdup(normname), node);
+		}
+	}
+
+	g_list_free_full(parts, g_free);
+
+	return account_chats;
+}
+
+static void
+purple_blist_chats_cache_invalidate(PurpleAccount *account)
+{
+	if (chats_cache != NULL)
+		g_hash_table_remove(chats_cache, account);
 }
 
 /*********************************************************************
@@ -291,19 +401,127 @@ chat_to_xmlnode(PurpleChat *chat)
 	return node;
 }
 
-static PurpleXmlNode *
-group_to_xmlnode(PurpleGroup *group)
+static gsize
+contact_fragment_stamp(PurpleContact *contact)
 {
+	PurpleBlistNode *bnode;
+	gsize stamp = 0;
+
+	/* Buddies moving in or out of a contact do not always notify the
+	 * contact itself, so the saved fragment also records which buddies
+	 * it was built from. */
+	for (bnode = PURPLE_BLIST_NODE(contact)->child; bnode != NULL; bnode = bnode->next)
+	{
+		if (purple_blist_node_is_transient(bnode))
+			continue;
+		stamp = (stamp * 31) + GPOINTER_TO_SIZE(bnode);
+	}
+
+	return stamp;
+}
+
+static const char *
+contact_to_str(PurpleContact *contact)
+{
+	PurpleBlistFragment *fragment;
+	PurpleXmlNode *node;
+	gsize stamp;
+
+	stamp = contact_fragment_stamp(contact);
+	fragment = g_object_get_qdata(G_OBJECT(contact),
+			purple_blist_fragment_quark());
+
+	if (fragment == NULL || fragment->stamp != stamp)
+	{
+		node = contact_to_xmlnode(contact);
+
+		fragment = g_new(PurpleBlistFragment, 1);
+		fragment->xml = purple_xmlnode_to_str(node, NULL);
+		fragment->stamp = stamp;
+		g_object_set_qdata_full(G_OBJECT(contact),
+				purple_blist_fragment_quark(), fragment,
+				(GDestroyNotify)purple_blist_fragment_free);
+
+		purple_xmlnode_free(node);
+	}
+
+	return fragment->xml;
+}
+
+static void
+purple_blist_section_free(PurpleBlistSection *section)
+{
+	if (section == NULL)
+		return;
+
+	g_free(section->name);
+	if (section->lines != NULL)
+		g_ptr_array_free(section->lines, TRUE);
+	g_byte_array_free(section->digests, TRUE);
+	g_free(section);
+}
+
+static PurpleBlistSection *
+purple_blist_section_new(const char *name)
+{
+	PurpleBlistSection *section = g_new0(PurpleBlistSection, 1);
+
+	section->name = g_strdup(name);
+	section->lines = g_ptr_array_new_with_free_func(g_free);
+	section->digests = g_byte_array_new();
+
+	return section;
+}
+
+static void
+purple_blist_section_add(PurpleBlistSection *section, GChecksum *checksum,
+		char *line)
+{
+	guint8 digest[BLIST_DIGEST_SIZE];
+	gsize len = sizeof(digest);
+
+	g_checksum_reset(checksum);
+	g_checksum_update(checksum, (const guchar *)line, -1);
+	g_checksum_get_digest(checksum, digest, &len);
+
+	g_ptr_array_add(section->lines, line);
+	g_byte_array_append(section->digests, digest, sizeof(digest));
+}
+
+static void
+purple_blist_section_add_children(PurpleBlistSection *section,
+		GChecksum *checksum, PurpleXmlNode *node)
+{
+	PurpleXmlNode *child;
+
+	for (child = node->child; child != NULL; child = child->next)
+	{
+		if (child->type != PURPLE_XMLNODE_TYPE_TAG)
+			continue;
+
+		purple_blist_section_add(section, checksum,
+				purple_xmlnode_to_str(child, NULL));
+	}
+}
+
+static PurpleBlistSection *
+group_to_section(PurpleGroup *group, GChecksum *checksum)
+{
+	PurpleBlistSection *section;
 	PurpleXmlNode *node, *child;
 	PurpleBlistNode *cnode;
 
-	node = purple_xmlnode_new("group");
 	if (group != purple_blist_get_default_group())
-		purple_xmlnode_set_attrib(node, "name", purple_group_get_name(group));
+		section = purple_blist_section_new(purple_group_get_name(group));
+	else
+		section = purple_blist_section_new(NULL);
 
 	/* Write settings */
+	node = purple_xmlnode_new("group");
 	g_hash_table_foreach(purple_blist_node_get_settings(PURPLE_BLIST_NODE(group)),
 			value_to_xmlnode, node);
+	purple_blist_section_add_children(section, checksum, node);
+	purple_xmlnode_free(node);
 
 	/* Write contacts and chats */
 	for (cnode = PURPLE_BLIST_NODE(group)->child; cnode != NULL; cnode = cnode->next)
@@ -312,17 +530,53 @@ group_to_xmlnode(PurpleGroup *group)
 			continue;
 		if (PURPLE_IS_CONTACT(cnode))
 		{
-			child = contact_to_xmlnode(PURPLE_CONTACT(cnode));
-			purple_xmlnode_insert_child(node, child);
+			purple_blist_section_add(section, checksum,
+					g_strdup(contact_to_str(PURPLE_CONTACT(cnode))));
 		}
 		else if (PURPLE_IS_CHAT(cnode))
 		{
 			child = chat_to_xmlnode(PURPLE_CHAT(cnode));
-			purple_xmlnode_insert_child(node, child);
+			purple_blist_section_add(section, checksum,
+					purple_xmlnode_to_str(child, NULL));
+			purple_xmlnode_free(child);
 		}
 	}
 
-	return node;
+	return section;
+}
+
+static void
+group_section_to_str(GString *str, PurpleBlistSection *section,
+		gboolean pretty)
+{
+	char *data;
+	guint i;
+
+	if (pretty)
+		g_string_append(str, "\t\t");
+
+	if (section->name != NULL)
+	{
+		data = g_markup_escape_text(section->name, -1);
+		g_string_append_printf(str, "<group name='%s'>", data);
+		g_free(data);
+	}
+	else
+		g_string_append(str, "<group>");
+
+	if (pretty)
+		g_string_append_c(str, '\n');
+
+	for (i = 0; i < section->lines->len; i++)
+	{
+		if (pretty)
+			g_string_append(str, "\t\t\t");
+		g_string_append(str, g_ptr_array_index(section->lines, i));
+		if (pretty)
+			g_string_append_c(str, '\n');
+	}
+
+	g_string_append(str, pretty ? "\t\t</group>\n" : "</group>");
 }
 
 static PurpleXmlNode *
@@ -354,54 +608,334 @@ accountprivacy_to_xmlnode(PurpleAccount *account)
 }
 
 static PurpleXmlNode *
-blist_to_xmlnode(void)
+privacy_to_xmlnode(void)
 {
-	PurpleXmlNode *node, *child, *grandchild;
-	PurpleBlistNode *gnode;
+	PurpleXmlNode *node;
 	GList *cur;
+
+	node = purple_xmlnode_new("privacy");
+	for (cur = purple_accounts_get_all(); cur != NULL; cur = cur->next)
+	{
+		purple_xmlnode_insert_child(node,
+				accountprivacy_to_xmlnode(cur->data));
+	}
+
+	return node;
+}
+
+static PurpleBlistSection *
+privacy_to_section(GChecksum *checksum)
+{
+	PurpleBlistSection *section;
+	PurpleXmlNode *node;
+
+	section = purple_blist_section_new(NULL);
+
+	node = privacy_to_xmlnode();
+	purple_blist_section_add_children(section, checksum, node);
+	purple_xmlnode_free(node);
+
+	return section;
+}
+
+static void
+privacy_section_to_str(GString *str, PurpleBlistSection *section,
+		gboolean pretty)
+{
+	guint i;
+
+	if (section->lines->len == 0) {
+		g_string_append(str, pretty ? "\t<privacy/>\n" : "<privacy/>");
+		return;
+	}
+
+	g_string_append(str, pretty ? "\t<privacy>\n" : "<privacy>");
+	for (i = 0; i < section->lines->len; i++)
+	{
+		if (pretty)
+			g_string_append(str, "\t\t");
+		g_string_append(str, g_ptr_array_index(section->lines, i));
+		if (pretty)
+			g_string_append_c(str, '\n');
+	}
+	g_string_append(str, pretty ? "\t</privacy>\n" : "</privacy>");
+}
+
+static const gchar *
+blist_localized_default_group(void)
+{
+	if (!purple_strequal(_("Buddies"), "Buddies"))
+		return _("Buddies");
+
+	return localized_default_group_name;
+}
+
+/* The attributes of the <blist> element, other than the journal generation */
+static char *
+blist_attributes_to_str(void)
+{
 	const gchar *localized_default;
+	char *data, *attributes;
+
+	localized_default = blist_localized_default_group();
+	if (localized_default == NULL)
+		return g_strdup("");
+
+	data = g_markup_escape_text(localized_default, -1);
+	attributes = g_strdup_printf(" localized-default-group='%s'", data);
+	g_free(data);
 
-	node = purple_xmlnode_new("purple");
-	purple_xmlnode_set_attrib(node, "version", "1.0");
+	return attributes;
+}
+
+/*
+ * The buddy list is written out as text directly rather than through one
+ * big PurpleXmlNode tree, so that the XML of contacts which have not
+ * changed since the last save can be reused as-is.
+ */
+static char *
+blist_to_str(const char *attributes, GPtrArray *groups,
+		PurpleBlistSection *privacy)
+{
+	GString *str;
+	guint i;
+
+	str = g_string_sized_new(blist_save_size);
+	g_string_append(str, "<?xml version='1.0' encoding='UTF-8' ?>\n\n"
+	                     "<purple version='1.0'>\n");
 
 	/* Write groups */
-	child = purple_xmlnode_new_child(node, "blist");
+	g_string_append_printf(str, "\t<blist journal='%u'%s>\n",
+			blist_generation, attributes);
 
-	localized_default = localized_default_group_name;
-	if (!purple_strequal(_("Buddies"), "Buddies"))
-		localized_default = _("Buddies");
-	if (localized_default != NULL) {
-		purple_xmlnode_set_attrib(child,
-			"localized-default-group", localized_default);
+	for (i = 0; i < groups->len; i++)
+		group_section_to_str(str, g_ptr_array_index(groups, i), TRUE);
+
+	g_string_append(str, "\t</blist>\n");
+
+	/* Write privacy settings */
+	privacy_section_to_str(str, privacy, TRUE);
+
+	g_string_append(str, "</purple>\n");
+
+	blist_save_size = str->len;
+
+	return g_string_free(str, FALSE);
+}
+
+/*********************************************************************
+ * The journal                                                       *
+ *********************************************************************/
+
+/*
+ * Between two full writes of blist.xml, saves only append what changed to
+ * blist.xml.journal, which load_blist() replays on top of blist.xml.
+ *
+ * The journal starts with a line naming the generation of blist.xml it
+ * applies to, which is the journal attribute of <blist>. Every full write
+ * bumps the generation before removing the journal, so a journal left
+ * behind by a crash in between is never replayed onto the wrong file.
+ *
+ * Each record is its length in bytes on a line of its own, followed by
+ * one XML element and a newline:
+ *  - <group>: replaces the group with the same name, or adds it at the end.
+ *  - <update group='name' index='n'>: replaces the nth child element of a
+ *    group with the element inside it. The default group has no name.
+ *  - <privacy>: replaces the privacy settings.
+ * A record cut short by a crash ends the replay.
+ */
+static void
+blist_journal_add_record(GString *records, GString *record)
+{
+	g_string_append_printf(records, "%" G_GSIZE_FORMAT "\n", record->len);
+	g_string_append_len(records, record->str, record->len);
+	g_string_append_c(records, '\n');
+	g_string_truncate(record, 0);
+}
+
+/*
+ * Returns the journal records which turn what was saved last into the
+ * given sections, or NULL if only a full write can do it.
+ */
+static GString *
+blist_journal_records(GPtrArray *groups, PurpleBlistSection *privacy)
+{
+	PurpleBlistSection *saved, *section;
+	GString *records, *record;
+	char *data;
+	guint i, j;
+
+	if (groups->len != blist_saved_groups->len)
+		return NULL;
+
+	for (i = 0; i < groups->len; i++)
+	{
+		saved = g_ptr_array_index(blist_saved_groups, i);
+		section = g_ptr_array_index(groups, i);
+
+		/* Groups being added, removed or reordered are rare */
+		if (!purple_strequal(saved->name, section->name))
+			return NULL;
 	}
 
-	for (gnode = purple_blist_get_default_root(); gnode != NULL;
-	     gnode = gnode->next) {
-		if (purple_blist_node_is_transient(gnode))
+	records = g_string_new(NULL);
+	record = g_string_new(NULL);
+
+	for (i = 0; i < groups->len; i++)
+	{
+		saved = g_ptr_array_index(blist_saved_groups, i);
+		section = g_ptr_array_index(groups, i);
+
+		if (saved->digests->len != section->digests->len)
+		{
+			group_section_to_str(record, section, FALSE);
+			blist_journal_add_record(records, record);
 			continue;
-		if (PURPLE_IS_GROUP(gnode))
+		}
+
+		for (j = 0; j < section->lines->len; j++)
 		{
-			grandchild = group_to_xmlnode(PURPLE_GROUP(gnode));
-			purple_xmlnode_insert_child(child, grandchild);
+			if (memcmp(saved->digests->data + j * BLIST_DIGEST_SIZE,
+			           section->digests->data + j * BLIST_DIGEST_SIZE,
+			           BLIST_DIGEST_SIZE) == 0)
+				continue;
+
+			g_string_append(record, "<update");
+			if (section->name != NULL)
+			{
+				data = g_markup_escape_text(section->name, -1);
+				g_string_append_printf(record, " group='%s'", data);
+				g_free(data);
+			}
+			g_string_append_printf(record, " index='%u'>%s</update>", j,
+					(char *)g_ptr_array_index(section->lines, j));
+			blist_journal_add_record(records, record);
 		}
 	}
 
-	/* Write privacy settings */
-	child = purple_xmlnode_new_child(node, "privacy");
-	for (cur = purple_accounts_get_all(); cur != NULL; cur = cur->next)
+	if (blist_saved_privacy->digests->len != privacy->digests->len ||
+	    memcmp(blist_saved_privacy->digests->data, privacy->digests->data,
+	           privacy->digests->len) != 0)
 	{
-		grandchild = accountprivacy_to_xmlnode(cur->data);
-		purple_xmlnode_insert_child(child, grandchild);
+		privacy_section_to_str(record, privacy, FALSE);
+		blist_journal_add_record(records, record);
 	}
 
-	return node;
+	g_string_free(record, TRUE);
+
+	return records;
+}
+
+static gboolean
+blist_journal_append(GString *records)
+{
+	GFile *file;
+	GFileOutputStream *stream;
+	GString *data;
+	GError *error = NULL;
+	char *filename;
+	gboolean written;
+
+	data = g_string_new(NULL);
+	if (blist_journal_size == 0)
+		g_string_append_printf(data, BLIST_JOURNAL_MAGIC " %u\n",
+				blist_generation);
+	g_string_append_len(data, records->str, records->len);
+
+	filename = g_build_filename(purple_config_dir(), BLIST_JOURNAL, NULL);
+	file = g_file_new_for_path(filename);
+
+	/* A new journal replaces whatever an earlier one left behind */
+	if (blist_journal_size == 0)
+		stream = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_PRIVATE,
+				NULL, &error);
+	else
+		stream = g_file_append_to(file, G_FILE_CREATE_PRIVATE, NULL, &error);
+
+	written = stream != NULL &&
+		g_output_stream_write_all(G_OUTPUT_STREAM(stream), data->str,
+				data->len, NULL, NULL, &error) &&
+		g_output_stream_close(G_OUTPUT_STREAM(stream), NULL, &error);
+
+	if (written) {
+		blist_journal_size += data->len;
+	} else {
+		purple_debug_error("buddylist", "Error writing %s: %s\n",
+				filename, error->message);
+		g_clear_error(&error);
+	}
+
+	g_clear_object(&stream);
+	g_object_unref(file);
+	g_free(filename);
+	g_string_free(data, TRUE);
+
+	return written;
+}
+
+static gboolean
+blist_write_full(const char *attributes, GPtrArray *groups,
+		PurpleBlistSection *privacy)
+{
+	PurpleXmlNode *node;
+	char *data, *filename;
+	gboolean written;
+
+	blist_generation++;
+
+	data = blist_to_str(attributes, groups, privacy);
+	written = purple_util_write_data_to_config_file("blist.xml", data, -1);
+
+	if (!written) {
+		g_free(data);
+		blist_generation--;
+		return FALSE;
+	}
+
+	/* Appending to the journal leaves blist.xml alone, so its snapshot stays
+	 * good until the next full write. It's made of the very text that was
+	 * written, which reuses the cached XML of unchanged contacts. */
+	node = purple_xmlnode_from_str(data, -1);
+	if (node != NULL) {
+		_purple_xmlnode_write_snapshot(purple_config_dir(), "blist.xml",
+				node);
+		purple_xmlnode_free(node);
+	}
+	g_free(data);
+
+	filename = g_build_filename(purple_config_dir(), BLIST_JOURNAL, NULL);
+	g_unlink(filename);
+	g_free(filename);
+	blist_journal_size = 0;
+
+	return TRUE;
+}
+
+static void
+blist_saved_clear(void)
+{
+	if (blist_saved_groups != NULL)
+		g_ptr_array_free(blist_saved_groups, TRUE);
+	blist_saved_groups = NULL;
+
+	purple_blist_section_free(blist_saved_privacy);
+	blist_saved_privacy = NULL;
+
+	g_free(blist_saved_attributes);
+	blist_saved_attributes = NULL;
 }
 
 static void
 purple_blist_sync(void)
 {
-	PurpleXmlNode *node;
-	char *data;
+	GChecksum *checksum;
+	GPtrArray *groups;
+	GString *records = NULL;
+	PurpleBlistSection *privacy;
+	PurpleBlistNode *gnode;
+	char *attributes;
+	gboolean written = FALSE;
+	guint i;
 
 	if (!blist_loaded)
 	{
@@ -410,11 +944,69 @@ purple_blist_sync(void)
 		return;
 	}
 
-	node = blist_to_xmlnode();
-	data = purple_xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_config_file("blist.xml", data, -1);
-	g_free(data);
-	purple_xmlnode_free(node);
+	checksum = g_checksum_new(G_CHECKSUM_SHA1);
+
+	attributes = blist_attributes_to_str();
+
+	groups = g_ptr_array_new_with_free_func(
+			(GDestroyNotify)purple_blist_section_free);
+	for (gnode = purple_blist_get_default_root(); gnode != NULL;
+	     gnode = gnode->next) {
+		if (purple_blist_node_is_transient(gnode))
+			continue;
+		if (PURPLE_IS_GROUP(gnode))
+			g_ptr_array_add(groups, group_to_section(PURPLE_GROUP(gnode),
+					checksum));
+	}
+
+	privacy = privacy_to_section(checksum);
+
+	g_checksum_free(checksum);
+
+	/* The first save of a session always writes all of blist.xml, which
+	 * also folds in the journal replayed at startup. */
+	if (blist_saved_groups != NULL &&
+	    purple_strequal(attributes, blist_saved_attributes))
+		records = blist_journal_records(groups, privacy);
+
+	if (records != NULL && records->len == 0)
+		written = TRUE;
+	else if (records != NULL &&
+	         blist_journal_size + records->len <=
+	         MAX(BLIST_JOURNAL_MIN_SIZE, blist_save_size / 2))
+		written = blist_journal_append(records);
+
+	if (!written)
+		written = blist_write_full(attributes, groups, privacy);
+
+	if (records != NULL)
+		g_string_free(records, TRUE);
+
+	blist_saved_clear();
+
+	if (!written) {
+		/* The journal may end in a partial record now, so nothing more
+		 * can be appended to it. */
+		g_ptr_array_free(groups, TRUE);
+		purple_blist_section_free(privacy);
+		g_free(attributes);
+		return;
+	}
+
+	/* Only the digests are needed to compare with the next save */
+	for (i = 0; i < groups->len; i++)
+	{
+		PurpleBlistSection *section = g_ptr_array_index(groups, i);
+
+		g_ptr_array_free(section->lines, TRUE);
+		section->lines = NULL;
+	}
+	g_ptr_array_free(privacy->lines, TRUE);
+	privacy->lines = NULL;
+
+	blist_saved_groups = groups;
+	blist_saved_privacy = privacy;
+	blist_saved_attributes = attributes;
 }
 
 static gboolean
@@ -432,23 +1024,40 @@ purple_blist_real_schedule_save(void)
 		save_timer = g_timeout_add_seconds(5, save_cb, NULL);
 }
 
+static void
+purple_blist_invalidate_node(PurpleBlistNode *node)
+{
+	if (PURPLE_IS_BUDDY(node))
+		node = node->parent;
+
+	if (node != NULL && PURPLE_IS_CONTACT(node))
+		g_object_set_qdata(G_OBJECT(node), purple_blist_fragment_quark(), NULL);
+}
+
 static void
 purple_blist_real_save_account(PurpleBuddyList *list, PurpleAccount *account)
 {
-#if 1
-	purple_blist_real_schedule_save();
-#else
+	GHashTable *account_buddies;
+	GHashTableIter iter;
+	gpointer buddy;
+
 	if (account != NULL) {
-		/* Save the buddies and privacy data for this account */
-	} else {
-		/* Save all buddies and privacy data */
+		/* The account name is written out with every buddy */
+		account_buddies = g_hash_table_lookup(buddies_cache, account);
+		if (account_buddies != NULL) {
+			g_hash_table_iter_init(&iter, account_buddies);
+			while (g_hash_table_iter_next(&iter, NULL, &buddy))
+				purple_blist_invalidate_node(PURPLE_BLIST_NODE(buddy));
+		}
 	}
-#endif
+
+	purple_blist_real_schedule_save();
 }
 
 static void
 purple_blist_real_save_node(PurpleBuddyList *list, PurpleBlistNode *node)
 {
+	purple_blist_invalidate_node(node);
 	purple_blist_real_schedule_save();
 }
 
@@ -629,6 +1238,177 @@ parse_group(PurpleXmlNode *groupnode)
 	}
 }
 
+static void
+blist_xmlnode_unlink(PurpleXmlNode *node)
+{
+	PurpleXmlNode *parent = node->parent, *prev = NULL;
+
+	if (parent == NULL)
+		return;
+
+	if (parent->child == node) {
+		parent->child = node->next;
+	} else {
+		for (prev = parent->child; prev->next != node; prev = prev->next)
+			;
+		prev->next = node->next;
+	}
+
+	if (parent->lastchild == node)
+		parent->lastchild = prev;
+
+	node->parent = NULL;
+	node->next = NULL;
+}
+
+/* Puts node, which isn't part of any tree, where old is and frees old */
+static void
+blist_xmlnode_replace(PurpleXmlNode *old, PurpleXmlNode *node)
+{
+	node->parent = old->parent;
+	node->next = old->next;
+	old->next = node;
+	if (old->parent->lastchild == old)
+		old->parent->lastchild = node;
+
+	blist_xmlnode_unlink(old);
+	purple_xmlnode_free(old);
+}
+
+static PurpleXmlNode *
+blist_xmlnode_find_group(PurpleXmlNode *blist, const char *name)
+{
+	PurpleXmlNode *group;
+
+	for (group = purple_xmlnode_get_child(blist, "group"); group != NULL;
+	     group = purple_xmlnode_get_next_twin(group)) {
+		if (purple_strequal(purple_xmlnode_get_attrib(group, "name"), name))
+			return group;
+	}
+
+	return NULL;
+}
+
+/* Applies one journal record, returns FALSE if it doesn't fit the tree */
+static gboolean
+blist_journal_apply(PurpleXmlNode *purple, PurpleXmlNode *blist,
+		PurpleXmlNode *record)
+{
+	PurpleXmlNode *group, *old, *node;
+	const char *index;
+	guint64 n;
+
+	if (purple_strequal(record->name, "group")) {
+		old = blist_xmlnode_find_group(blist,
+				purple_xmlnode_get_attrib(record, "name"));
+		if (old != NULL)
+			blist_xmlnode_replace(old, record);
+		else
+			purple_xmlnode_insert_child(blist, record);
+		return TRUE;
+	}
+
+	if (purple_strequal(record->name, "privacy")) {
+		old = purple_xmlnode_get_child(purple, "privacy");
+		if (old != NULL)
+			blist_xmlnode_replace(old, record);
+		else
+			purple_xmlnode_insert_child(purple, record);
+		return TRUE;
+	}
+
+	if (!purple_strequal(record->name, "update"))
+		return FALSE;
+
+	group = blist_xmlnode_find_group(blist,
+			purple_xmlnode_get_attrib(record, "group"));
+	index = purple_xmlnode_get_attrib(record, "index");
+	for (node = record->child; node != NULL; node = node->next) {
+		if (node->type == PURPLE_XMLNODE_TYPE_TAG)
+			break;
+	}
+	if (group == NULL || index == NULL || node == NULL)
+		return FALSE;
+
+	n = g_ascii_strtoull(index, NULL, 10);
+	for (old = group->child; old != NULL; old = old->next) {
+		if (old->type == PURPLE_XMLNODE_TYPE_TAG && n-- == 0)
+			break;
+	}
+	if (old == NULL)
+		return FALSE;
+
+	blist_xmlnode_unlink(node);
+	blist_xmlnode_replace(old, node);
+	purple_xmlnode_free(record);
+
+	return TRUE;
+}
+
+static void
+blist_journal_replay(PurpleXmlNode *purple, PurpleXmlNode *blist)
+{
+	PurpleXmlNode *record;
+	char *filename, *contents, *header;
+	const char *cur, *end;
+	gchar *eol;
+	gsize length;
+	guint64 len;
+	guint records = 0;
+
+	filename = g_build_filename(purple_config_dir(), BLIST_JOURNAL, NULL);
+	if (!g_file_get_contents(filename, &contents, &length, NULL)) {
+		g_free(filename);
+		return;
+	}
+	g_free(filename);
+
+	cur = contents;
+	end = contents + length;
+
+	header = g_strdup_printf(BLIST_JOURNAL_MAGIC " %u\n", blist_generation);
+	if (length < strlen(header) ||
+	    strncmp(contents, header, strlen(header)) != 0) {
+		purple_debug_info("buddylist", "Ignoring a journal which doesn't "
+				"belong to blist.xml\n");
+		g_free(header);
+		g_free(contents);
+		return;
+	}
+	cur += strlen(header);
+	g_free(header);
+
+	while (cur < end) {
+		len = g_ascii_strtoull(cur, &eol, 10);
+		if (eol == cur || eol >= end || *eol != '\n')
+			break;
+		cur = eol + 1;
+
+		if (len >= (guint64)(end - cur) || cur[len] != '\n')
+			break;
+
+		record = purple_xmlnode_from_str(cur, len);
+		if (record == NULL)
+			break;
+		if (!blist_journal_apply(purple, blist, record)) {
+			purple_xmlnode_free(record);
+			break;
+		}
+
+		cur += len + 1;
+		records++;
+	}
+
+	if (cur < end)
+		purple_debug_warning("buddylist", "Ignoring the end of the "
+				"journal after %u records\n", records);
+	else
+		purple_debug_info("buddylist", "Replayed %u journal records\n",
+				records);
+
+	g_free(contents);
+}
+
 static void
 load_blist(void)
 {
@@ -636,7 +1416,9 @@ load_blist(void)
 
 	blist_loaded = TRUE;
 
-	purple = purple_util_read_xml_from_config_file("blist.xml", _("buddy list"));
+	purple = _purple_xmlnode_from_snapshot(purple_config_dir(), "blist.xml");
+	if (purple == NULL)
+		purple = purple_util_read_xml_from_config_file("blist.xml", _("buddy list"));
 
 	if (purple == NULL)
 		return;
@@ -644,6 +1426,13 @@ load_blist(void)
 	blist = purple_xmlnode_get_child(purple, "blist");
 	if (blist) {
 		PurpleXmlNode *groupnode;
+		const char *generation;
+
+		generation = purple_xmlnode_get_attrib(blist, "journal");
+		if (generation != NULL) {
+			blist_generation = strtoul(generation, NULL, 10);
+			blist_journal_replay(purple, blist);
+		}
 
 		localized_default_group_name = g_strdup(
 			purple_xmlnode_get_attrib(blist,
@@ -729,6 +1518,9 @@ purple_blist_boot(void)
 
 	groups_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 
+	chats_cache = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					 NULL, (GDestroyNotify)g_hash_table_destroy);
+
 	for (account = purple_accounts_get_all(); account != NULL; account = account->next)
 	{
 		purple_blist_buddies_cache_add_account(account->data);
@@ -868,6 +1660,8 @@ void purple_blist_add_chat(PurpleChat *chat, PurpleGroup *group, PurpleBlistNode
 	g_return_if_fail(PURPLE_IS_BUDDY_LIST(purplebuddylist));
 	klass = PURPLE_BUDDY_LIST_GET_CLASS(purplebuddylist);
 
+	purple_blist_chats_cache_invalidate(purple_chat_get_account(chat));
+
 	if (node == NULL) {
 		if (group == NULL)
 			group = purple_group_new(_("Chats"));
@@ -1516,6 +2310,8 @@ void purple_blist_remove_chat(PurpleChat *chat)
 
 	klass = PURPLE_BUDDY_LIST_GET_CLASS(purplebuddylist);
 	node = (PurpleBlistNode *)chat;
+
+	purple_blist_chats_cache_invalidate(purple_chat_get_account(chat));
 	gnode = node->parent;
 	group = (PurpleGroup *)gnode;
 
@@ -1742,13 +2538,9 @@ purple_blist_get_default_group(void)
 PurpleChat *
 purple_blist_find_chat(PurpleAccount *account, const char *name)
 {
-	char *chat_name;
-	PurpleChat *chat;
 	PurpleProtocol *protocol = NULL;
-	PurpleProtocolChatEntry *pce;
-	PurpleBlistNode *node, *group;
-	GList *parts;
-	char *normname;
+	GHashTable *account_chats;
+	const char *normname;
 
 	g_return_val_if_fail(PURPLE_IS_BUDDY_LIST(purplebuddylist), NULL);
 	g_return_val_if_fail((name != NULL) && (*name != '\0'), NULL);
@@ -1761,36 +2553,13 @@ purple_blist_find_chat(PurpleAccount *account, const char *name)
 	if (PURPLE_PROTOCOL_IMPLEMENTS(protocol, CLIENT, find_blist_chat))
 		return purple_protocol_client_iface_find_blist_chat(protocol, account, name);
 
-	normname = g_strdup(purple_normalize(account, name));
-	for (group = purple_blist_get_default_root(); group != NULL;
-	     group = group->next) {
-		for (node = group->child; node != NULL; node = node->next) {
-			if (PURPLE_IS_CHAT(node)) {
-
-				chat = (PurpleChat*)node;
-
-				if (account != purple_chat_get_account(chat))
-					continue;
+	account_chats = purple_blist_chats_cache_get_account(account, protocol);
 
-				parts = purple_protocol_chat_iface_info(protocol, 
-					purple_account_get_connection(purple_chat_get_account(chat)));
-
-				pce = parts->data;
-				chat_name = g_hash_table_lookup(purple_chat_get_components(chat),
-												pce->identifier);
-				g_list_free_full(parts, g_free);
-
-				if (purple_chat_get_account(chat) == account && chat_name != NULL &&
-					purple_strequal(purple_normalize(account, chat_name), normname)) {
-					g_free(normname);
-					return chat;
-				}
-			}
-		}
-	}
+	normname = purple_normalize(account, name);
+	if (normname == NULL)
+		return NULL;
 
-	g_free(normname);
-	return NULL;
+	return g_hash_table_lookup(account_chats, normname);
 }
 
 void purple_blist_add_account(PurpleAccount *account)
@@ -1802,6 +2571,9 @@ void purple_blist_add_account(PurpleAccount *account)
 	g_return_if_fail(PURPLE_IS_BUDDY_LIST(purplebuddylist));
 
 	klass = PURPLE_BUDDY_LIST_GET_CLASS(purplebuddylist);
+
+	/* The protocol may describe chats differently per connection */
+	purple_blist_chats_cache_invalidate(account);
 	if (!klass || !klass->update) {
 		return;
 	}
@@ -1856,93 +2628,120 @@ void purple_blist_remove_account(PurpleAccount *account)
 	PurpleChat *chat;
 	PurpleContact *contact;
 	PurpleGroup *group;
-	GList *list = NULL, *iter = NULL;
+	GHashTable *account_buddies, *presences, *contacts;
+	GHashTableIter iter;
+	GList *removed = NULL;
+	gpointer key;
+	gboolean bulk;
+	time_t now = time(NULL);
 
 	g_return_if_fail(PURPLE_IS_BUDDY_LIST(purplebuddylist));
 	klass = PURPLE_BUDDY_LIST_GET_CLASS(purplebuddylist);
 
-	for (gnode = purple_blist_get_default_root(); gnode;
-	     gnode = gnode->next) {
-		if (!PURPLE_IS_GROUP(gnode))
-			continue;
+	/* The protocol may describe chats differently per connection */
+	purple_blist_chats_cache_invalidate(account);
 
-		group = (PurpleGroup *)gnode;
+	/* With many nodes changing at once, let the UI redraw the list once
+	 * rather than once per node. */
+	bulk = (klass && klass->bulk_update);
+	if (bulk)
+		blist_bulk_update++;
 
-		for (cnode = gnode->child; cnode; cnode = cnode->next) {
-			if (PURPLE_IS_CONTACT(cnode)) {
-				gboolean recompute = FALSE;
-				contact = (PurpleContact *)cnode;
+	presences = g_hash_table_new(g_direct_hash, g_direct_equal);
+	contacts = g_hash_table_new(g_direct_hash, g_direct_equal);
 
-				for (bnode = cnode->child; bnode; bnode = bnode->next) {
-					if (!PURPLE_IS_BUDDY(bnode))
-						continue;
+	account_buddies = g_hash_table_lookup(buddies_cache, account);
+	if (account_buddies != NULL) {
+		g_hash_table_iter_init(&iter, account_buddies);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&buddy)) {
+			PurplePresence *presence;
+
+			bnode = PURPLE_BLIST_NODE(buddy);
+			cnode = bnode->parent;
+			if (cnode == NULL || !PURPLE_IS_CONTACT(cnode))
+				continue;
 
-					buddy = (PurpleBuddy *)bnode;
-					if (account == purple_buddy_get_account(buddy)) {
-						PurplePresence *presence;
+			contact = PURPLE_CONTACT(cnode);
+			presence = purple_buddy_get_presence(buddy);
+			contact_counter = PURPLE_COUNTING_NODE(contact);
+			group_counter = PURPLE_COUNTING_NODE(cnode->parent);
 
-						presence = purple_buddy_get_presence(buddy);
-						contact_counter = PURPLE_COUNTING_NODE(contact);
-						group_counter = PURPLE_COUNTING_NODE(group);
+			if(purple_presence_is_online(presence)) {
+				purple_counting_node_change_online_count(contact_counter, -1);
+				if (purple_counting_node_get_online_count(contact_counter) == 0)
+					purple_counting_node_change_online_count(group_counter, -1);
 
-						if(purple_presence_is_online(presence)) {
-							purple_counting_node_change_online_count(contact_counter, -1);
-							if (purple_counting_node_get_online_count(contact_counter) == 0)
-								purple_counting_node_change_online_count(group_counter, -1);
+				purple_blist_node_set_int(bnode, "last_seen", now);
+			}
 
-							purple_blist_node_set_int(PURPLE_BLIST_NODE(buddy),
-													"last_seen", time(NULL));
-						}
+			purple_counting_node_change_current_size(contact_counter, -1);
+			if (purple_counting_node_get_current_size(contact_counter) == 0)
+				purple_counting_node_change_current_size(group_counter, -1);
 
-						purple_counting_node_change_current_size(contact_counter, -1);
-						if (purple_counting_node_get_current_size(contact_counter) == 0)
-							purple_counting_node_change_current_size(group_counter, -1);
+			g_hash_table_add(presences, presence);
 
-						if (!g_list_find(list, presence))
-							list = g_list_prepend(list, presence);
+			if (purple_contact_get_priority_buddy(contact) == buddy)
+				purple_contact_invalidate_priority_buddy(contact);
+			else
+				g_hash_table_add(contacts, contact);
 
-						if (purple_contact_get_priority_buddy(contact) == buddy)
-							purple_contact_invalidate_priority_buddy(contact);
-						else
-							recompute = TRUE;
+			if (bulk) {
+				removed = g_list_prepend(removed, bnode);
+			} else if (klass && klass->remove) {
+				klass->remove(purplebuddylist, bnode);
+			}
+		}
+	}
 
-						if (klass && klass->remove) {
-							klass->remove(
-							        purplebuddylist,
-							        bnode);
-						}
-					}
-				}
-				if (recompute) {
-					purple_contact_invalidate_priority_buddy(contact);
+	g_hash_table_iter_init(&iter, contacts);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		purple_contact_invalidate_priority_buddy(key);
 
-					if (klass && klass->update) {
-						klass->update(purplebuddylist,
-						              cnode);
-					}
-				}
-			} else if (PURPLE_IS_CHAT(cnode)) {
-				chat = PURPLE_CHAT(cnode);
+		if (!bulk && klass && klass->update) {
+			klass->update(purplebuddylist, key);
+		}
+	}
 
-				if(purple_chat_get_account(chat) == account) {
-					group_counter = PURPLE_COUNTING_NODE(group);
-					purple_counting_node_change_current_size(group_counter, -1);
-					purple_counting_node_change_online_count(group_counter, -1);
+	for (gnode = purple_blist_get_default_root(); gnode;
+	     gnode = gnode->next) {
+		if (!PURPLE_IS_GROUP(gnode))
+			continue;
 
-					if (klass && klass->remove) {
-						klass->remove(purplebuddylist,
-						              cnode);
-					}
+		group = (PurpleGroup *)gnode;
+
+		for (cnode = gnode->child; cnode; cnode = cnode->next) {
+			if (!PURPLE_IS_CHAT(cnode))
+				continue;
+
+			chat = PURPLE_CHAT(cnode);
+
+			if(purple_chat_get_account(chat) == account) {
+				group_counter = PURPLE_COUNTING_NODE(group);
+				purple_counting_node_change_current_size(group_counter, -1);
+				purple_counting_node_change_online_count(group_counter, -1);
+
+				if (bulk) {
+					removed = g_list_prepend(removed, cnode);
+				} else if (klass && klass->remove) {
+					klass->remove(purplebuddylist, cnode);
 				}
 			}
 		}
 	}
 
-	for (iter = list; iter; iter = iter->next)
-	{
-		purple_presence_set_status_active(iter->data, "offline", TRUE);
+	g_hash_table_iter_init(&iter, presences);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		purple_presence_set_status_active(key, "offline", TRUE);
+	}
+
+	g_hash_table_destroy(presences);
+	g_hash_table_destroy(contacts);
+
+	if (bulk) {
+		blist_bulk_update--;
+		klass->bulk_update(purplebuddylist, removed);
+		g_list_free(removed);
 	}
-	g_list_free(list);
 }
 
 void
@@ -2044,6 +2843,10 @@ purple_blist_update_node(PurpleBuddyList *list, PurpleBlistNode *node)
 
 	g_return_if_fail(PURPLE_IS_BUDDY_LIST(list));
 
+	/* The UI is told about the whole list once the bulk change is done */
+	if (blist_bulk_update > 0)
+		return;
+
 	klass = PURPLE_BUDDY_LIST_GET_CLASS(list);
 	if (klass && klass->update) {
 		klass->update(list, node);
@@ -2057,6 +2860,10 @@ purple_blist_save_node(PurpleBuddyList *list, PurpleBlistNode *node)
 
 	g_return_if_fail(PURPLE_IS_BUDDY_LIST(list));
 
+	/* The components of the chat may have changed */
+	if (PURPLE_IS_CHAT(node))
+		purple_blist_chats_cache_invalidate(purple_chat_get_account(PURPLE_CHAT(node)));
+
 	klass = PURPLE_BUDDY_LIST_GET_CLASS(list);
 	if (klass && klass->save_node) {
 		klass->save_node(list, node);
@@ -2214,11 +3021,17 @@ purple_blist_uninit(void)
 
 	purple_debug(PURPLE_DEBUG_INFO, "buddylist", "Destroying\n");
 
+	blist_saved_clear();
+	blist_generation = 0;
+	blist_journal_size = 0;
+
 	g_hash_table_destroy(buddies_cache);
 	g_hash_table_destroy(groups_cache);
+	g_hash_table_destroy(chats_cache);
 
 	buddies_cache = NULL;
 	groups_cache = NULL;
+	chats_cache = NULL;
 
 	g_clear_object(&purplebuddylist);
 
@@ -103,6 +103,19 @@ typedef void (*PurpleBlistWalkFunc)(PurpleBlistNode *node, gpointer data);
  *                libpurple versions.
  *                <sbr/>@account: The account whose data to save. If %NULL,
  *                                save all data for all accounts.
+ * @bulk_update:  Called once after many nodes have changed at the same time,
+ *                for example when an account disconnects. While such a change
+ *                is being made, @update and @remove are not called for the
+ *                nodes involved. The UI must do for every node in @removed
+ *                what it would have done in @remove, such as closing the
+ *                requests using the node as their handle and freeing the
+ *                node's UI data, and then bring its view of the whole list up
+ *                to date.
+ *                <sbr/>Implementation of this method is
+ *                <emphasis>OPTIONAL</emphasis>. If not implemented, @update
+ *                and @remove are called for every node instead.
+ *                <sbr/>@removed: (element-type PurpleBlistNode): The nodes
+ *                                that would have been passed to @remove.
  *
  * Buddy list operations.
  *
@@ -136,8 +149,10 @@ struct _PurpleBuddyListClass {
 
 	void (*save_account)(PurpleBuddyList *list, PurpleAccount *account);
 
+	void (*bulk_update)(PurpleBuddyList *list, GList *removed);
+
 	/*< private >*/
-	gpointer reserved[4];
+	gpointer reserved[3];
 };
 
 G_BEGIN_DECLS
@@ -51,7 +51,13 @@ struct _PurpleConversationPrivate
 	PurpleConversationUiOps *ui_ops;  /* UI-specific operations.           */
 
 	PurpleConnectionFlags features;   /* The supported features            */
-	GList *message_history; /* Message history, as a GList of PurpleMessages */
+	GQueue message_history;           /* PurpleMessages, newest first      */
+	guint history_size;               /* How many of those to keep         */
+	guint history_packed;             /* Older messages, packed into...    */
+	GByteArray *history_records;      /* ...this buffer...                 */
+	FILE *history_file;               /* ...or spilled to this file        */
+	char *history_path;
+	GList *history_paged;             /* The whole history, paged back in  */
 
 	/* The list of remote smileys. This should be per-buddy (PurpleBuddy),
 	 * but we don't have any class for people not on our buddy
@@ -134,6 +140,8 @@ common_send(PurpleConversation *conv, const char *message, PurpleMessageFlags ms
 			purple_signal_emit(purple_conversations_get_handle(),
 				"sent-im-msg", account, msg);
 		}
+
+		g_object_unref(msg);
 	}
 	else if (PURPLE_IS_CHAT_CONVERSATION(conv)) {
 		int id = purple_chat_conversation_get_id(PURPLE_CHAT_CONVERSATION(conv));
@@ -149,6 +157,8 @@ common_send(PurpleConversation *conv, const char *message, PurpleMessageFlags ms
 			purple_signal_emit(purple_conversations_get_handle(),
 				"sent-chat-msg", account, msg, id);
 		}
+
+		g_object_unref(msg);
 	}
 
 	if (err < 0) {
@@ -187,6 +197,273 @@ common_send(PurpleConversation *conv, const char *message, PurpleMessageFlags ms
 	g_free(displayed);
 }
 
+/**************************************************************************
+ * Message history
+ **************************************************************************/
+
+/* Messages that fall out of the in-memory history are packed into records
+ * of their id (u32), time (u64), flags (u32), author, author alias,
+ * recipient and contents. Numbers are little-endian, strings are a u32
+ * length followed by the bytes, with a length of G_MAXUINT32 standing for
+ * NULL. */
+
+static void
+history_pack_string(GByteArray *buf, const char *str)
+{
+	guint32 len = str ? strlen(str) : G_MAXUINT32;
+	guint32 len_le = GUINT32_TO_LE(len);
+
+	g_byte_array_append(buf, (const guint8 *)&len_le, sizeof(len_le));
+	if (str != NULL)
+		g_byte_array_append(buf, (const guint8 *)str, len);
+}
+
+static void
+history_pack(GByteArray *buf, PurpleMessage *msg)
+{
+	guint32 id = GUINT32_TO_LE(purple_message_get_id(msg));
+	guint64 msgtime = GUINT64_TO_LE(purple_message_get_time(msg));
+	guint32 flags = GUINT32_TO_LE(purple_message_get_flags(msg));
+
+	g_byte_array_append(buf, (const guint8 *)&id, sizeof(id));
+	g_byte_array_append(buf, (const guint8 *)&msgtime, sizeof(msgtime));
+	g_byte_array_append(buf, (const guint8 *)&flags, sizeof(flags));
+	history_pack_string(buf, purple_message_get_author(msg));
+	history_pack_string(buf, purple_message_get_author_alias(msg));
+	history_pack_string(buf, purple_message_get_recipient(msg));
+	history_pack_string(buf, purple_message_get_contents(msg));
+}
+
+static gboolean
+history_unpack_string(const guint8 *data, gsize len, gsize *pos, char **str)
+{
+	guint32 slen;
+
+	if (len - *pos < sizeof(slen))
+		return FALSE;
+	memcpy(&slen, data + *pos, sizeof(slen));
+	slen = GUINT32_FROM_LE(slen);
+	*pos += sizeof(slen);
+
+	if (slen == G_MAXUINT32) {
+		*str = NULL;
+		return TRUE;
+	}
+
+	if (len - *pos < slen)
+		return FALSE;
+	*str = g_strndup((const char *)data + *pos, slen);
+	*pos += slen;
+
+	return TRUE;
+}
+
+static PurpleMessage *
+history_unpack(const guint8 *data, gsize len, gsize *pos)
+{
+	PurpleMessage *msg = NULL;
+	guint32 id;
+	guint64 msgtime;
+	guint32 flags;
+	char *str[4] = { NULL, NULL, NULL, NULL };
+	gsize i;
+
+	if (len - *pos < sizeof(id) + sizeof(msgtime) + sizeof(flags))
+		return NULL;
+	memcpy(&id, data + *pos, sizeof(id));
+	id = GUINT32_FROM_LE(id);
+	*pos += sizeof(id);
+	memcpy(&msgtime, data + *pos, sizeof(msgtime));
+	*pos += sizeof(msgtime);
+	memcpy(&flags, data + *pos, sizeof(flags));
+	*pos += sizeof(flags);
+
+	for (i = 0; i < G_N_ELEMENTS(str); i++) {
+		if (!history_unpack_string(data, len, pos, &str[i]))
+			goto out;
+	}
+
+	/* Hand out the same message again if something still holds on to it,
+	 * otherwise recreate it under its old id. */
+	msg = id > 0 ? purple_message_find_by_id(id) : NULL;
+	if (msg != NULL) {
+		g_object_ref(msg);
+		goto out;
+	}
+
+	msg = g_object_new(PURPLE_TYPE_MESSAGE,
+		"author", str[0],
+		"author-alias", str[1],
+		"recipient", str[2],
+		"contents", str[3],
+		"time", GUINT64_FROM_LE(msgtime),
+		"flags", GUINT32_FROM_LE(flags),
+		NULL);
+	if (id > 0)
+		_purple_message_set_id(msg, id);
+
+out:
+	for (i = 0; i < G_N_ELEMENTS(str); i++)
+		g_free(str[i]);
+
+	return msg;
+}
+
+static void
+history_forget_paged(PurpleConversationPrivate *priv)
+{
+	g_list_free_full(priv->history_paged, g_object_unref);
+	priv->history_paged = NULL;
+}
+
+static void
+history_close_file(PurpleConversationPrivate *priv)
+{
+	if (priv->history_file == NULL)
+		return;
+
+	fclose(priv->history_file);
+	priv->history_file = NULL;
+	g_unlink(priv->history_path);
+	g_free(priv->history_path);
+	priv->history_path = NULL;
+}
+
+/* Moves the records spilled so far, the first @end bytes of the file,
+ * back into memory and stops spilling. */
+static void
+history_unspill(PurpleConversationPrivate *priv, long end)
+{
+	gchar *contents = NULL;
+	gsize len = 0;
+
+	fflush(priv->history_file);
+	if (end >= 0 &&
+			g_file_get_contents(priv->history_path, &contents, &len, NULL) &&
+			len >= (gsize)end) {
+		priv->history_records = g_byte_array_new_take((guint8 *)contents,
+			end);
+	} else {
+		purple_debug_error("conversation",
+			"Unable to read back spilled message history, dropping "
+			"%u messages\n", priv->history_packed);
+		g_free(contents);
+		priv->history_records = g_byte_array_new();
+		priv->history_packed = 0;
+	}
+
+	history_close_file(priv);
+}
+
+static void
+history_pack_oldest(PurpleConversationPrivate *priv, PurpleMessage *msg)
+{
+	GByteArray *record;
+
+	if (priv->history_file == NULL && priv->history_records == NULL &&
+			purple_prefs_get_bool("/purple/conversations/message_history_spill")) {
+		GError *error = NULL;
+		int fd = g_file_open_tmp("purple-history-XXXXXX",
+			&priv->history_path, &error);
+
+		if (fd >= 0)
+			priv->history_file = fdopen(fd, "w+b");
+
+		if (priv->history_file == NULL) {
+			purple_debug_warning("conversation",
+				"Unable to spill message history to disk, keeping it "
+				"in memory: %s\n",
+				error ? error->message : g_strerror(errno));
+			if (fd >= 0) {
+				close(fd);
+				g_unlink(priv->history_path);
+			}
+			g_free(priv->history_path);
+			priv->history_path = NULL;
+			g_clear_error(&error);
+		}
+	}
+
+	if (priv->history_file != NULL) {
+		long end = ftell(priv->history_file);
+
+		record = g_byte_array_new();
+		history_pack(record, msg);
+		if (end >= 0 && fwrite(record->data, 1, record->len,
+				priv->history_file) == record->len) {
+			g_byte_array_free(record, TRUE);
+			priv->history_packed++;
+			return;
+		}
+		g_byte_array_free(record, TRUE);
+
+		purple_debug_error("conversation",
+			"Error spilling message history, keeping it in memory: %s\n",
+			g_strerror(errno));
+		history_unspill(priv, end);
+	}
+
+	if (priv->history_records == NULL)
+		priv->history_records = g_byte_array_new();
+	history_pack(priv->history_records, msg);
+
+	priv->history_packed++;
+}
+
+static void
+history_trim(PurpleConversationPrivate *priv)
+{
+	if (priv->history_size == 0)
+		return;
+
+	while (g_queue_get_length(&priv->message_history) > priv->history_size) {
+		PurpleMessage *msg = g_queue_pop_tail(&priv->message_history);
+
+		history_pack_oldest(priv, msg);
+		g_object_unref(msg);
+	}
+}
+
+/* Builds the whole history, newest message first, with the packed
+ * messages turned back into PurpleMessages. */
+static GList *
+history_page_in(PurpleConversationPrivate *priv)
+{
+	GList *older = NULL;
+	gchar *contents = NULL;
+	const guint8 *data;
+	gsize len, pos = 0;
+
+	if (priv->history_file != NULL) {
+		fflush(priv->history_file);
+		if (!g_file_get_contents(priv->history_path, &contents, &len, NULL)) {
+			purple_debug_error("conversation",
+				"Unable to read back spilled message history\n");
+			len = 0;
+		}
+		data = (const guint8 *)contents;
+	} else {
+		data = priv->history_records->data;
+		len = priv->history_records->len;
+	}
+
+	/* The records are oldest first */
+	while (pos < len) {
+		PurpleMessage *msg = history_unpack(data, len, &pos);
+
+		if (msg == NULL) {
+			purple_debug_error("conversation",
+				"Packed message history is truncated\n");
+			break;
+		}
+		older = g_list_prepend(older, msg);
+	}
+	g_free(contents);
+
+	return g_list_concat(g_list_copy_deep(priv->message_history.head,
+		(GCopyFunc)g_object_ref, NULL), older);
+}
+
 /**************************************************************************
  * Conversation API
  **************************************************************************/
@@ -576,8 +853,9 @@ _purple_conversation_write_common(PurpleConversation *conv, PurpleMessage *pmsg)
 			ops->write_conv(conv, pmsg);
 	}
 
-	g_object_ref(pmsg);
-	priv->message_history = g_list_prepend(priv->message_history, pmsg);
+	g_queue_push_head(&priv->message_history, g_object_ref(pmsg));
+	history_forget_paged(priv);
+	history_trim(priv);
 
 	purple_signal_emit(purple_conversations_get_handle(),
 		(PURPLE_IS_IM_CONVERSATION(conv) ? "wrote-im-msg" : "wrote-chat-msg"),
@@ -600,8 +878,10 @@ purple_conversation_write_message(PurpleConversation *conv, PurpleMessage *msg)
 void purple_conversation_write_system_message(PurpleConversation *conv,
 	const gchar *message, PurpleMessageFlags flags)
 {
-	_purple_conversation_write_common(conv,
-		purple_message_new_system(message, flags));
+	PurpleMessage *msg = purple_message_new_system(message, flags);
+
+	_purple_conversation_write_common(conv, msg);
+	g_object_unref(msg);
 }
 
 void
@@ -728,14 +1008,20 @@ purple_conversation_get_extended_menu(PurpleConversation *conv)
 void purple_conversation_clear_message_history(PurpleConversation *conv)
 {
 	PurpleConversationPrivate *priv = NULL;
-	GList *list;
 
 	g_return_if_fail(PURPLE_IS_CONVERSATION(conv));
 
 	priv = purple_conversation_get_instance_private(conv);
-	list = priv->message_history;
-	g_list_free_full(list, g_object_unref);
-	priv->message_history = NULL;
+	g_queue_foreach(&priv->message_history, (GFunc)g_object_unref, NULL);
+	g_queue_clear(&priv->message_history);
+
+	history_forget_paged(priv);
+	history_close_file(priv);
+	if (priv->history_records != NULL) {
+		g_byte_array_free(priv->history_records, TRUE);
+		priv->history_records = NULL;
+	}
+	priv->history_packed = 0;
 
 	purple_signal_emit(purple_conversations_get_handle(),
 			"cleared-message-history", conv);
@@ -748,7 +1034,40 @@ GList *purple_conversation_get_message_history(PurpleConversation *conv)
 	g_return_val_if_fail(PURPLE_IS_CONVERSATION(conv), NULL);
 
 	priv = purple_conversation_get_instance_private(conv);
-	return priv->message_history;
+
+	if (priv->history_packed == 0)
+		return priv->message_history.head;
+
+	if (priv->history_paged == NULL)
+		priv->history_paged = history_page_in(priv);
+
+	return priv->history_paged;
+}
+
+void
+purple_conversation_set_message_history_size(PurpleConversation *conv,
+                                              guint size)
+{
+	PurpleConversationPrivate *priv = NULL;
+
+	g_return_if_fail(PURPLE_IS_CONVERSATION(conv));
+
+	priv = purple_conversation_get_instance_private(conv);
+	priv->history_size = size;
+
+	history_forget_paged(priv);
+	history_trim(priv);
+}
+
+guint
+purple_conversation_get_message_history_size(PurpleConversation *conv)
+{
+	PurpleConversationPrivate *priv = NULL;
+
+	g_return_val_if_fail(PURPLE_IS_CONVERSATION(conv), 0);
+
+	priv = purple_conversation_get_instance_private(conv);
+	return priv->history_size;
 }
 
 void purple_conversation_set_ui_data(PurpleConversation *conv, gpointer ui_data)
@@ -916,6 +1235,12 @@ purple_conversation_get_property(GObject *obj, guint param_id, GValue *value,
 static void
 purple_conversation_init(PurpleConversation *conv)
 {
+	PurpleConversationPrivate *priv =
+			purple_conversation_get_instance_private(conv);
+
+	g_queue_init(&priv->message_history);
+	priv->history_size = MAX(0,
+		purple_prefs_get_int("/purple/conversations/message_history_size"));
 }
 
 /* Called when done constructing */
@@ -537,6 +537,15 @@ void purple_conversation_update(PurpleConversation *conv, PurpleConversationUpda
  *
  * Retrieve the message history of a conversation.
  *
+ * Messages beyond purple_conversation_get_message_history_size() are stored
+ * packed, and turned back into #PurpleMessage's here. The list is only valid
+ * until the next message is written to @conv.
+ *
+ * Once anything was packed, this is expensive: the first call after a new
+ * message unpacks the whole history, reading it back from the spill file if
+ * there is one, and keeps all of it in memory until the next message. Don't
+ * call it for every message written.
+ *
  * Returns: (element-type PurpleMessage) (transfer none):
  *          A GList of PurpleMessage's. You must not modify the
  *          list or the data within. The list contains the newest message at
@@ -544,6 +553,28 @@ void purple_conversation_update(PurpleConversation *conv, PurpleConversationUpda
  */
 GList *purple_conversation_get_message_history(PurpleConversation *conv);
 
+/**
+ * purple_conversation_set_message_history_size:
+ * @conv: The conversation
+ * @size: The number of messages, or 0 for no limit
+ *
+ * Sets how many of the most recent messages @conv keeps as #PurpleMessage's.
+ * Older ones are packed, or spilled to a temporary file if the
+ * /purple/conversations/message_history_spill preference is set. The
+ * default comes from /purple/conversations/message_history_size.
+ */
+void purple_conversation_set_message_history_size(PurpleConversation *conv,
+		guint size);
+
+/**
+ * purple_conversation_get_message_history_size:
+ * @conv: The conversation
+ *
+ * Returns: How many messages @conv keeps as #PurpleMessage's, 0 means
+ *          there's no limit.
+ */
+guint purple_conversation_get_message_history_size(PurpleConversation *conv);
+
 /**
  * purple_conversation_clear_message_history:
  * @conv:  The conversation
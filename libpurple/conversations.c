@@ -33,6 +33,13 @@ static PurpleConversationUiOps *default_ops = NULL;
  */
 static GHashTable *conversation_cache = NULL;
 
+/*
+ * A hash table used for efficient lookups of chats by their id.
+ * int => GList* of PurpleChatConversation*. Chats of different connections
+ * may share an id, so each list is searched for the right connection.
+ */
+static GHashTable *chat_id_cache = NULL;
+
 struct _purple_hconv {
 	gboolean im;
 	char *name;
@@ -60,6 +67,36 @@ _purple_conversations_hconv_free_key(struct _purple_hconv *hc)
 	g_free(hc);
 }
 
+static void
+_purple_conversations_chat_id_add(PurpleChatConversation *chat, int id)
+{
+	gpointer key = GINT_TO_POINTER(id);
+	GList *list;
+
+	list = g_hash_table_lookup(chat_id_cache, key);
+	g_hash_table_steal(chat_id_cache, key);
+	g_hash_table_insert(chat_id_cache, key, g_list_prepend(list, chat));
+}
+
+static gboolean
+_purple_conversations_chat_id_remove(PurpleChatConversation *chat, int id)
+{
+	gpointer key = GINT_TO_POINTER(id);
+	GList *list, *link;
+
+	list = g_hash_table_lookup(chat_id_cache, key);
+	link = g_list_find(list, chat);
+	if (link == NULL)
+		return FALSE;
+
+	list = g_list_delete_link(list, link);
+	g_hash_table_steal(chat_id_cache, key);
+	if (list != NULL)
+		g_hash_table_insert(chat_id_cache, key, list);
+
+	return TRUE;
+}
+
 void
 purple_conversations_add(PurpleConversation *conv)
 {
@@ -73,10 +110,13 @@ purple_conversations_add(PurpleConversation *conv)
 
 	conversations = g_list_prepend(conversations, conv);
 
-	if (PURPLE_IS_IM_CONVERSATION(conv))
+	if (PURPLE_IS_IM_CONVERSATION(conv)) {
 		ims = g_list_prepend(ims, conv);
-	else
+	} else {
 		chats = g_list_prepend(chats, conv);
+		_purple_conversations_chat_id_add(PURPLE_CHAT_CONVERSATION(conv),
+				purple_chat_conversation_get_id(PURPLE_CHAT_CONVERSATION(conv)));
+	}
 
 	account = purple_conversation_get_account(conv);
 
@@ -99,10 +139,13 @@ purple_conversations_remove(PurpleConversation *conv)
 
 	conversations = g_list_remove(conversations, conv);
 
-	if (PURPLE_IS_IM_CONVERSATION(conv))
+	if (PURPLE_IS_IM_CONVERSATION(conv)) {
 		ims = g_list_remove(ims, conv);
-	else
+	} else {
 		chats = g_list_remove(chats, conv);
+		_purple_conversations_chat_id_remove(PURPLE_CHAT_CONVERSATION(conv),
+				purple_chat_conversation_get_id(PURPLE_CHAT_CONVERSATION(conv)));
+	}
 
 	account = purple_conversation_get_account(conv);
 
@@ -142,6 +185,17 @@ _purple_conversations_update_cache(PurpleConversation *conv, const char *name,
 	g_hash_table_insert(conversation_cache, hc, conv);
 }
 
+void
+_purple_conversations_update_chat_id(PurpleChatConversation *chat,
+		int old_id, int new_id)
+{
+	g_return_if_fail(chat != NULL);
+
+	/* Chats which haven't been added yet are indexed when they are */
+	if (_purple_conversations_chat_id_remove(chat, old_id))
+		_purple_conversations_chat_id_add(chat, new_id);
+}
+
 GList *
 purple_conversations_get_all(void)
 {
@@ -224,11 +278,11 @@ purple_conversations_find_chat(const PurpleConnection *gc, int id)
 	GList *l;
 	PurpleChatConversation *chat;
 
-	for (l = purple_conversations_get_chats(); l != NULL; l = l->next) {
+	l = g_hash_table_lookup(chat_id_cache, GINT_TO_POINTER(id));
+	for (; l != NULL; l = l->next) {
 		chat = (PurpleChatConversation *)l->data;
 
-		if (purple_chat_conversation_get_id(chat) == id &&
-				purple_conversation_get_connection(PURPLE_CONVERSATION(chat)) == gc)
+		if (purple_conversation_get_connection(PURPLE_CONVERSATION(chat)) == gc)
 			return chat;
 	}
 
@@ -263,6 +317,8 @@ purple_conversations_init(void)
 	conversation_cache = g_hash_table_new_full((GHashFunc)_purple_conversations_hconv_hash,
 						(GEqualFunc)_purple_conversations_hconv_equal,
 						(GDestroyNotify)_purple_conversations_hconv_free_key, NULL);
+	chat_id_cache = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+						NULL, (GDestroyNotify)g_list_free);
 
 	/**********************************************************************
 	 * Register preferences
@@ -270,6 +326,8 @@ purple_conversations_init(void)
 
 	/* Conversations */
 	purple_prefs_add_none("/purple/conversations");
+	purple_prefs_add_int("/purple/conversations/message_history_size", 100);
+	purple_prefs_add_bool("/purple/conversations/message_history_spill", FALSE);
 
 	/* Conversations -> Chat */
 	purple_prefs_add_none("/purple/conversations/chat");
@@ -464,5 +522,6 @@ purple_conversations_uninit(void)
 		g_object_unref(G_OBJECT(conversations->data));
 
 	g_hash_table_destroy(conversation_cache);
+	g_hash_table_destroy(chat_id_cache);
 	purple_signals_unregister_by_instance(purple_conversations_get_handle());
 }
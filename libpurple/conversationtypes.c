@@ -774,12 +774,17 @@ void
 purple_chat_conversation_set_id(PurpleChatConversation *chat, int id)
 {
 	PurpleChatConversationPrivate *priv = NULL;
+	int old_id;
 
 	g_return_if_fail(PURPLE_IS_CHAT_CONVERSATION(chat));
 
 	priv = purple_chat_conversation_get_instance_private(chat);
+	old_id = priv->id;
 	priv->id = id;
 
+	if (old_id != id)
+		_purple_conversations_update_chat_id(chat, old_id, id);
+
 	g_object_notify_by_pspec(G_OBJECT(chat), chat_properties[CHAT_PROP_ID]);
 }
 
@@ -58,18 +58,11 @@ purple_debug_vargs(PurpleDebugLevel level, const char *category,
 	g_return_if_fail(level != PURPLE_DEBUG_ALL);
 	g_return_if_fail(format != NULL);
 
-	ops = purple_debug_get_ui();
-	if (!ops)
-		return;
-	iface = PURPLE_DEBUG_UI_GET_IFACE(ops);
-	if (!iface)
+	if (!purple_debug_is_active(level, category))
 		return;
 
-	if (!debug_enabled &&
-	    ((iface->print == NULL) ||
-	     (iface->is_enabled && !iface->is_enabled(ops, level, category)))) {
-		return;
-	}
+	ops = purple_debug_get_ui();
+	iface = PURPLE_DEBUG_UI_GET_IFACE(ops);
 
 	arg_s = g_strdup_vprintf(format, args);
 	g_strchomp(arg_s); /* strip trailing linefeeds */
@@ -203,6 +196,30 @@ purple_debug_is_enabled()
 	return debug_enabled;
 }
 
+gboolean
+purple_debug_is_active(PurpleDebugLevel level, const char *category)
+{
+	PurpleDebugUi *ops;
+	PurpleDebugUiInterface *iface;
+
+	ops = purple_debug_get_ui();
+	if (!ops)
+		return FALSE;
+	iface = PURPLE_DEBUG_UI_GET_IFACE(ops);
+	if (!iface)
+		return FALSE;
+
+	if (debug_enabled)
+		return TRUE;
+
+	if (iface->print == NULL)
+		return FALSE;
+	if (iface->is_enabled && !iface->is_enabled(ops, level, category))
+		return FALSE;
+
+	return TRUE;
+}
+
 void
 purple_debug_set_ui(PurpleDebugUi *ops)
 {
@@ -195,6 +195,19 @@ void purple_debug_set_enabled(gboolean enabled);
  */
 gboolean purple_debug_is_enabled(void);
 
+/**
+ * purple_debug_is_active:
+ * @level:    The debug level.
+ * @category: The category (or %NULL).
+ *
+ * Checks, if a message of the given @level and @category would be printed
+ * anywhere. It may be used to avoid preparing expensive debug output, that
+ * would be discarded anyway.
+ *
+ * Returns: TRUE if the message would be printed, FALSE if it would not.
+ */
+gboolean purple_debug_is_active(PurpleDebugLevel level, const char *category);
+
 /**
  * purple_debug_set_verbose:
  * @verbose: TRUE to enable verbose debugging or FALSE to disable it.
@@ -290,6 +290,20 @@ void _purple_connection_remove_active_chat(PurpleConnection *gc,
 void _purple_conversations_update_cache(PurpleConversation *conv,
 		const char *name, PurpleAccount *account);
 
+/**
+ * _purple_conversations_update_chat_id:
+ * @chat:   The chat conversation.
+ * @old_id: The id the chat had until now.
+ * @new_id: The new id of the chat.
+ *
+ * Updates the chat id index used by purple_conversations_find_chat().
+ *
+ * Note: This function should only be called by
+ *       purple_chat_conversation_set_id() in conversationtypes.c.
+ */
+void _purple_conversations_update_chat_id(PurpleChatConversation *chat,
+		int old_id, int new_id);
+
 /**
  * _purple_statuses_get_primitive_scores:
  *
@@ -351,6 +365,32 @@ _purple_message_init(void);
 void
 _purple_message_uninit(void);
 
+/**
+ * _purple_message_set_id: (skip)
+ * @msg: The message.
+ * @id:  The id it had before, which no live message may be using.
+ *
+ * Gives a message that was recreated from a packed copy its old id back.
+ */
+void
+_purple_message_set_id(PurpleMessage *msg, guint id);
+
+/**
+ * _purple_log_index_init: (skip)
+ *
+ * Loads the log index and schedules indexing the logs on disk.
+ */
+void
+_purple_log_index_init(void);
+
+/**
+ * _purple_log_index_uninit: (skip)
+ *
+ * Saves and frees the log index.
+ */
+void
+_purple_log_index_uninit(void);
+
 void
 _purple_assert_connection_is_valid(PurpleConnection *gc,
 	const gchar *file, int line);
@@ -373,4 +413,31 @@ _purple_assert_connection_is_valid(PurpleConnection *gc,
 void
 _purple_conversation_write_common(PurpleConversation *conv, PurpleMessage *msg);
 
+/**
+ * _purple_xmlnode_from_snapshot:
+ * @dir:      The directory of the XML file.
+ * @filename: The name of the XML file.
+ *
+ * Reads an XML file from its binary snapshot, which is much faster than
+ * parsing it. The snapshot is only used while it matches the XML file.
+ *
+ * Returns: The root node, or %NULL if there is no up-to-date snapshot.
+ *          The caller should fall back to the XML file then.
+ */
+PurpleXmlNode *
+_purple_xmlnode_from_snapshot(const char *dir, const char *filename);
+
+/**
+ * _purple_xmlnode_write_snapshot:
+ * @dir:      The directory of the XML file.
+ * @filename: The name of the XML file.
+ * @node:     The root node the XML file was just written from.
+ *
+ * Writes a binary snapshot of an XML file next to it. This must be called
+ * after the XML file itself has been written.
+ */
+void
+_purple_xmlnode_write_snapshot(const char *dir, const char *filename,
+	const PurpleXmlNode *node);
+
 #endif /* PURPLE_INTERNAL_H */
@@ -20,11 +20,16 @@
  */
 
 #include "internal.h"
+
+#include <gio/gio.h>
+
 #include "account.h"
+#include "binaryio.h"
 #include "debug.h"
 #include "glibcompat.h" /* for purple_g_stat on win32 */
 #include "image-store.h"
 #include "log.h"
+#include "logindex.h"
 #include "prefs.h"
 #include "util.h"
 #include "time.h"
@@ -33,6 +38,7 @@ static GSList *loggers = NULL;
 
 static PurpleLogLogger *html_logger;
 static PurpleLogLogger *txt_logger;
+static PurpleLogLogger *binary_logger;
 
 struct _purple_logsize_user {
 	char *name;
@@ -41,8 +47,43 @@ struct _purple_logsize_user {
 static GHashTable *logsize_users = NULL;
 static GHashTable *logsize_users_decayed = NULL;
 
+typedef enum {
+	LOG_WRITER_WRITE,
+	LOG_WRITER_CLOSE,
+	LOG_WRITER_STOP
+} PurpleLogWriterOpType;
+
+typedef struct {
+	PurpleLogWriterOpType type;
+	FILE *file;
+	gchar *text;
+	gsize len;
+} PurpleLogWriterOp;
+
+static GThread *log_writer = NULL;
+static GAsyncQueue *log_writer_queue = NULL;
+/* read by the writer thread, so only touched atomically */
+static gint log_writer_interval = 1000;
+static gint log_writer_size = 65536;
+
 static void log_get_log_sets_common(GHashTable *sets);
 
+static void log_writer_start(void);
+static void log_writer_stop(void);
+
+typedef struct _PurpleLogMetaDir PurpleLogMetaDir;
+static PurpleLogMetaDir *log_meta_get_dir(const char *path);
+static GList *log_meta_get_names(const char *path);
+static void log_meta_add_file(const char *path, GDateTime *start);
+static void log_meta_file_written(const char *path, gsize bytes,
+		guint messages);
+static void log_meta_remove_file(const char *path);
+static gint log_meta_get_message_count(const char *path);
+static void log_meta_init(void);
+static void log_meta_uninit(void);
+static double log_meta_activity(PurpleLogType type, const char *name,
+		PurpleAccount *account, const char *ext, GDateTime *now);
+
 static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
                                const char *from, GDateTime *time, const char *message);
 static void html_logger_finalize(PurpleLog *log);
@@ -59,6 +100,14 @@ static GList *txt_logger_list_syslog(PurpleAccount *account);
 static char *txt_logger_read(PurpleLog *log, PurpleLogReadFlags *flags);
 static int txt_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account);
 
+static gsize binary_logger_write(PurpleLog *log, PurpleMessageFlags type,
+                                 const char *from, GDateTime *time, const char *message);
+static void binary_logger_finalize(PurpleLog *log);
+static GList *binary_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account);
+static GList *binary_logger_list_syslog(PurpleAccount *account);
+static char *binary_logger_read(PurpleLog *log, PurpleLogReadFlags *flags);
+static int binary_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account);
+
 /**************************************************************************
  * PUBLIC LOGGING FUNCTIONS ***********************************************
  **************************************************************************/
@@ -111,6 +160,16 @@ void purple_log_write(PurpleLog *log, PurpleMessageFlags type,
 	g_return_if_fail(log->logger->write);
 
 	written = (log->logger->write)(log, type, from, time, message);
+	if (written > 0) {
+		purple_log_index_add(log, message);
+
+		if (log->logger == html_logger || log->logger == txt_logger) {
+			PurpleLogCommonLoggerData *data = log->logger_data;
+
+			if (data != NULL && data->path != NULL)
+				log_meta_file_written(data->path, written, 1);
+		}
+	}
 
 	lu = g_new(struct _purple_logsize_user, 1);
 
@@ -162,6 +221,22 @@ int purple_log_get_size(PurpleLog *log)
 	return 0;
 }
 
+gint purple_log_get_message_count(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data;
+
+	g_return_val_if_fail(log != NULL, -1);
+
+	if (log->logger != html_logger && log->logger != txt_logger)
+		return -1;
+
+	data = log->logger_data;
+	if (data == NULL || data->path == NULL)
+		return -1;
+
+	return log_meta_get_message_count(data->path);
+}
+
 static guint _purple_logsize_user_hash(struct _purple_logsize_user *lu)
 {
 	return g_str_hash(lu->name);
@@ -241,7 +316,18 @@ gint purple_log_get_activity_score(PurpleLogType type, const char *name, PurpleA
 		for (n = loggers; n; n = n->next) {
 			PurpleLogLogger *logger = n->data;
 
-			if(logger->list) {
+			/* The common loggers' sizes and start times are cached, so
+			 * there's no need to list their logs. */
+			if (logger == html_logger) {
+				score_double += log_meta_activity(type, name, account,
+					".html", now);
+			} else if (logger == txt_logger) {
+				score_double += log_meta_activity(type, name, account,
+					".txt", now);
+			} else if (logger == binary_logger) {
+				score_double += log_meta_activity(type, name, account,
+					".purplelog", now);
+			} else if(logger->list) {
 				GList *logs = (logger->list)(type, name, account);
 
 				while (logs) {
@@ -286,8 +372,10 @@ gboolean purple_log_delete(PurpleLog *log)
 	g_return_val_if_fail(log != NULL, FALSE);
 	g_return_val_if_fail(log->logger != NULL, FALSE);
 
-	if (log->logger->remove != NULL)
-		return log->logger->remove(log);
+	if (log->logger->remove != NULL && log->logger->remove(log)) {
+		purple_log_index_remove(log);
+		return TRUE;
+	}
 
 	return FALSE;
 }
@@ -599,6 +687,8 @@ void purple_log_init(void)
 	purple_prefs_add_bool("/purple/logging/log_system", FALSE);
 
 	purple_prefs_add_string("/purple/logging/format", "html");
+	purple_prefs_add_int("/purple/logging/flush_interval", 1000);
+	purple_prefs_add_int("/purple/logging/flush_size", 65536);
 
 	html_logger = purple_log_logger_new("html", _("HTML"), 11,
 									  NULL,
@@ -628,6 +718,20 @@ void purple_log_init(void)
 									 purple_log_common_is_deletable);
 	purple_log_logger_add(txt_logger);
 
+	binary_logger = purple_log_logger_new("binary", _("Binary (compressed)"), 11,
+									 NULL,
+									 binary_logger_write,
+									 binary_logger_finalize,
+									 binary_logger_list,
+									 binary_logger_read,
+									 purple_log_common_sizer,
+									 binary_logger_total_size,
+									 binary_logger_list_syslog,
+									 NULL,
+									 purple_log_common_deleter,
+									 purple_log_common_is_deletable);
+	purple_log_logger_add(binary_logger);
+
 	purple_signal_register(handle, "log-timestamp",
 			     purple_marshal_POINTER__POINTER_POINTER_BOOLEAN,
 	                     G_TYPE_STRING, 3,
@@ -639,6 +743,10 @@ void purple_log_init(void)
 							    logger_pref_cb, NULL);
 	purple_prefs_trigger_callback("/purple/logging/format");
 
+	log_meta_init();
+	log_writer_start();
+	_purple_log_index_init();
+
 	logsize_users = g_hash_table_new_full((GHashFunc)_purple_logsize_user_hash,
 			(GEqualFunc)_purple_logsize_user_equal,
 			(GDestroyNotify)_purple_logsize_user_free_key, NULL);
@@ -652,6 +760,8 @@ purple_log_uninit(void)
 {
 	purple_signals_unregister_by_instance(purple_log_get_handle());
 
+	_purple_log_index_uninit();
+
 	purple_log_logger_remove(html_logger);
 	purple_log_logger_free(html_logger);
 	html_logger = NULL;
@@ -660,6 +770,15 @@ purple_log_uninit(void)
 	purple_log_logger_free(txt_logger);
 	txt_logger = NULL;
 
+	purple_log_logger_remove(binary_logger);
+	purple_log_logger_free(binary_logger);
+	binary_logger = NULL;
+
+	/* everything still queued goes out before we return */
+	log_writer_stop();
+
+	log_meta_uninit();
+
 	g_hash_table_destroy(logsize_users);
 	g_hash_table_destroy(logsize_users_decayed);
 }
@@ -692,790 +811,2945 @@ purple_log_get_type(void)
 }
 
 /****************************************************************************
- * LOGGERS ******************************************************************
+ * LOG WRITER ***************************************************************
  ****************************************************************************/
 
-static char *log_get_timestamp(PurpleLog *log, GDateTime *when)
-{
-	gboolean show_date;
-	char *date;
-	GDateTime *dt;
+/* The built-in loggers format messages on the main thread and hand the
+ * text over to the writer thread, so disk latency never holds up the UI.
+ * Writes pile up in stdio's buffers and all files are flushed together
+ * once the oldest unflushed write has waited /purple/logging/flush_interval
+ * milliseconds, or /purple/logging/flush_size bytes have piled up. Closing
+ * a file flushes it as well. Operations run in the order they're queued,
+ * and purple_log_uninit() waits for all of them. */
 
-	dt = g_date_time_new_now_utc();
-	show_date = (log->type == PURPLE_LOG_SYSTEM) || (g_date_time_difference(dt, when) > 20L * G_TIME_SPAN_MINUTE);
-	g_date_time_unref(dt);
+static void
+log_writer_op_free(PurpleLogWriterOp *op)
+{
+	g_free(op->text);
+	g_free(op);
+}
 
-	date = purple_signal_emit_return_1(purple_log_get_handle(),
-	                          "log-timestamp",
-	                          log, when, show_date);
-	if (date != NULL)
-		return date;
+static gboolean
+log_writer_report_error(gpointer data)
+{
+	purple_debug_error("log", "Error writing log: %s\n", (const char *)data);
+	g_free(data);
 
-	dt = g_date_time_to_local(when);
-	if (show_date)
-		date = g_date_time_format(dt, _("%x %X"));
-	else
-		date = g_date_time_format(dt, "%X");
-	g_date_time_unref(dt);
+	return G_SOURCE_REMOVE;
+}
 
-	return date;
+static void
+log_writer_error(void)
+{
+	/* purple_debug isn't safe to call from here */
+	g_idle_add(log_writer_report_error, g_strdup(g_strerror(errno)));
 }
 
-/* NOTE: This can return msg (which you may or may not want to g_free())
- * NOTE: or a newly allocated string which you MUST g_free().
- * TODO: XXX: does it really works?
- */
-static char *
-convert_image_tags(const PurpleLog *log, const char *msg)
+static void
+log_writer_flush(GHashTable *dirty)
 {
-	const char *tmp;
-	const char *start;
-	const char *end;
-	GData *attributes;
-	GString *newmsg = NULL;
+	GHashTableIter iter;
+	gpointer file;
 
-	tmp = msg;
+	g_hash_table_iter_init(&iter, dirty);
+	while (g_hash_table_iter_next(&iter, &file, NULL)) {
+		if (fflush(file) != 0)
+			log_writer_error();
+	}
 
-	while (purple_markup_find_tag("img", tmp, &start, &end, &attributes)) {
-		int imgid = 0;
-		char *idstr = NULL;
+	g_hash_table_remove_all(dirty);
+}
 
-		if (newmsg == NULL)
-			newmsg = g_string_new("");
+static gpointer
+log_writer_thread(gpointer data)
+{
+	GHashTable *dirty = g_hash_table_new(g_direct_hash, g_direct_equal);
+	gint64 deadline = 0;
+	gsize pending = 0;
 
-		/* copy any text before the img tag */
-		if (tmp < start)
-			g_string_append_len(newmsg, tmp, start - tmp);
+	for (;;) {
+		PurpleLogWriterOp *op;
 
-		if ((idstr = g_datalist_get_data(&attributes, "id")) != NULL)
-			imgid = atoi(idstr);
+		if (g_hash_table_size(dirty) == 0) {
+			op = g_async_queue_pop(log_writer_queue);
+		} else {
+			gint64 now = g_get_monotonic_time();
 
-		if (imgid != 0)
-		{
-			FILE *image_file;
-			char *dir;
-			PurpleImage *image;
-			gconstpointer image_data;
-			const gchar *new_filename = NULL;
-			char *path = NULL;
-			size_t image_byte_count;
+			op = NULL;
+			if (now < deadline)
+				op = g_async_queue_timeout_pop(log_writer_queue,
+					deadline - now);
 
-			image = purple_image_store_get(imgid);
-			if (image == NULL)
-			{
-				/* This should never happen. */
-				/* This *does* happen for failed Direct-IMs -DAA */
-				g_string_free(newmsg, TRUE);
-				g_return_val_if_reached((char *)msg);
+			if (op == NULL) {
+				log_writer_flush(dirty);
+				pending = 0;
+				continue;
 			}
+		}
 
-			image_data       = purple_image_get_data(image);
-			image_byte_count = purple_image_get_data_size(image);
-			dir              = purple_log_get_log_dir(log->type, log->name, log->account);
-			new_filename = purple_image_generate_filename(image);
-
-			path = g_build_filename(dir, new_filename, NULL);
-
-			/* Only save unique files. */
-			if (!g_file_test(path, G_FILE_TEST_EXISTS))
-			{
-				if ((image_file = g_fopen(path, "wb")) != NULL)
-				{
-					if (!fwrite(image_data, image_byte_count, 1, image_file))
-					{
-						purple_debug_error("log", "Error writing %s: %s\n",
-						                   path, g_strerror(errno));
-						fclose(image_file);
+		switch (op->type) {
+			case LOG_WRITER_WRITE:
+				if (fwrite(op->text, 1, op->len, op->file) != op->len)
+					log_writer_error();
 
-						/* Attempt to not leave half-written files around. */
-						if (g_unlink(path)) {
-							purple_debug_error("log", "Error deleting partial "
-									"file %s: %s\n", path, g_strerror(errno));
-						}
-					}
-					else
-					{
-						purple_debug_info("log", "Wrote image file: %s\n", path);
-						fclose(image_file);
-					}
-				}
-				else
-				{
-					purple_debug_error("log", "Unable to create file %s: %s\n",
-					                   path, g_strerror(errno));
+				if (g_hash_table_size(dirty) == 0) {
+					deadline = g_get_monotonic_time() +
+						g_atomic_int_get(&log_writer_interval) *
+						G_TIME_SPAN_MILLISECOND;
 				}
-			}
+				g_hash_table_add(dirty, op->file);
 
-			/* Write the new image tag */
-			g_string_append_printf(newmsg, "<img src=\"%s\">", new_filename);
-			g_free(path);
-			g_free(dir);
+				pending += op->len;
+				if (pending >= (gsize)g_atomic_int_get(&log_writer_size)) {
+					log_writer_flush(dirty);
+					pending = 0;
+				}
+				break;
+
+			case LOG_WRITER_CLOSE:
+				if (op->len > 0 &&
+						fwrite(op->text, 1, op->len, op->file) != op->len)
+					log_writer_error();
+				g_hash_table_remove(dirty, op->file);
+				if (fclose(op->file) != 0)
+					log_writer_error();
+				if (g_hash_table_size(dirty) == 0)
+					pending = 0;
+				break;
+
+			case LOG_WRITER_STOP:
+				log_writer_flush(dirty);
+				g_hash_table_destroy(dirty);
+				log_writer_op_free(op);
+				return NULL;
 		}
 
-		/* Continue from the end of the tag */
-		tmp = end + 1;
+		log_writer_op_free(op);
 	}
+}
 
-	if (newmsg == NULL)
-	{
-		/* No images were found to change. */
-		return (char *)msg;
+/* Takes ownership of text */
+static void
+log_writer_push(PurpleLogWriterOpType type, FILE *file, gchar *text,
+                gsize len)
+{
+	PurpleLogWriterOp *op;
+
+	if (log_writer_queue == NULL) {
+		/* Not running (anymore), do it right away */
+		if (text != NULL && fwrite(text, 1, len, file) != len)
+			purple_debug_error("log", "Error writing log: %s\n",
+				g_strerror(errno));
+		if (type == LOG_WRITER_CLOSE)
+			fclose(file);
+		else if (file != NULL)
+			fflush(file);
+		g_free(text);
+		return;
 	}
 
-	/* Append any remaining message data */
-	g_string_append(newmsg, tmp);
+	op = g_new(PurpleLogWriterOp, 1);
+	op->type = type;
+	op->file = file;
+	op->text = text;
+	op->len = len;
 
-	return g_string_free(newmsg, FALSE);
+	g_async_queue_push(log_writer_queue, op);
 }
 
-void purple_log_common_writer(PurpleLog *log, const char *ext)
+/* Hands the formatted text over to the writer, returns how much that was */
+static gsize
+log_writer_write(FILE *file, GString *out)
 {
-	PurpleLogCommonLoggerData *data = log->logger_data;
+	gsize len = out->len;
 
-	if (data == NULL)
-	{
-		/* This log is new */
-		char *dir;
-		GDateTime *dt;
-		const char *tz;
-		gchar *date;
-		char *filename;
-		char *path;
-
-		dir = purple_log_get_log_dir(log->type, log->name, log->account);
-		if (dir == NULL)
-			return;
-
-		g_mkdir_with_parents(dir, S_IRUSR | S_IWUSR | S_IXUSR);
+	if (len == 0) {
+		g_string_free(out, TRUE);
+		return 0;
+	}
 
-		dt = g_date_time_to_local(log->time);
-		tz = purple_escape_filename(g_date_time_get_timezone_abbreviation(dt));
-		date = g_date_time_format(dt, "%Y-%m-%d.%H%M%S%z");
-		g_date_time_unref(dt);
+	log_writer_push(LOG_WRITER_WRITE, file, g_string_free(out, FALSE), len);
 
-		filename = g_strdup_printf("%s%s%s", date, tz, ext ? ext : "");
+	return len;
+}
 
-		path = g_build_filename(dir, filename, NULL);
-		g_free(dir);
-		g_free(date);
-		g_free(filename);
+static void
+log_writer_pref_cb(const char *name, PurplePrefType type,
+                   gconstpointer value, gpointer data)
+{
+	gint *setting = data;
 
-		log->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
+	g_atomic_int_set(setting, MAX(0, GPOINTER_TO_INT(value)));
+}
 
-		data->file = g_fopen(path, "a");
-		if (data->file == NULL)
-		{
-			purple_debug(PURPLE_DEBUG_ERROR, "log",
-					"Could not create log file %s\n", path);
+static void
+log_writer_start(void)
+{
+	purple_prefs_connect_callback(NULL, "/purple/logging/flush_interval",
+		log_writer_pref_cb, &log_writer_interval);
+	purple_prefs_connect_callback(NULL, "/purple/logging/flush_size",
+		log_writer_pref_cb, &log_writer_size);
+	purple_prefs_trigger_callback("/purple/logging/flush_interval");
+	purple_prefs_trigger_callback("/purple/logging/flush_size");
+
+	log_writer_queue = g_async_queue_new();
+	log_writer = g_thread_new("log-writer", log_writer_thread, NULL);
+}
 
-			if (log->conv != NULL)
-				purple_conversation_write_system_message(log->conv,
-					_("Logging of this conversation failed."),
-					PURPLE_MESSAGE_ERROR);
+static void
+log_writer_stop(void)
+{
+	log_writer_push(LOG_WRITER_STOP, NULL, NULL, 0);
+	g_thread_join(log_writer);
+	log_writer = NULL;
 
-			g_free(path);
-			return;
-		}
-		g_free(path);
-	}
+	g_async_queue_unref(log_writer_queue);
+	log_writer_queue = NULL;
 }
 
-GList *purple_log_common_lister(PurpleLogType type, const char *name, PurpleAccount *account, const char *ext, PurpleLogLogger *logger)
-{
-	GDir *dir;
-	GList *list = NULL;
-	const char *filename;
-	char *path;
+/****************************************************************************
+ * LOG METADATA *************************************************************
+ ****************************************************************************/
 
-	if(!account)
-		return NULL;
+/* Sizing, listing and scoring logs from the common directory layout used to
+ * read every directory and stat every file in it. Instead, the names of the
+ * conversation directories of each account, and the name, start time, size
+ * and message count of the files in each of them are kept here, and in the
+ * cache directory between sessions. A directory is only read again when its
+ * mtime changed, i.e. a file was added or removed. The sizes of the logs
+ * written by us are kept up to date as we go; logs appended to by anybody
+ * else are only noticed when their directory changes. */
+
+#define LOG_META_MAGIC   "PURPLELM"
+#define LOG_META_VERSION 1
+
+typedef struct {
+	gint64 time;       /* when the log started */
+	gint64 size;
+	guint32 messages;  /* G_MAXUINT32 if not known */
+} PurpleLogMetaFile;
+
+struct _PurpleLogMetaDir {
+	gint64 mtime;      /* of the directory when it was read, 0 to read it again */
+	GHashTable *files; /* filename -> PurpleLogMetaFile */
+};
 
-	path = purple_log_get_log_dir(type, name, account);
-	if (path == NULL)
-		return NULL;
+typedef struct {
+	char *cache;       /* where this is kept between sessions */
+	gint64 mtime;      /* of the account's directory when it was read */
+	GHashTable *dirs;  /* directory name -> PurpleLogMetaDir */
+	gboolean dirty;
+} PurpleLogMetaAccount;
 
-	if (!(dir = g_dir_open(path, 0, NULL)))
-	{
-		g_free(path);
-		return NULL;
-	}
+/* account log directory -> PurpleLogMetaAccount */
+static GHashTable *log_meta = NULL;
 
-	while ((filename = g_dir_read_name(dir)))
-	{
-		if (g_str_has_suffix(filename, ext) &&
-		    strlen(filename) >= (17 + strlen(ext))) {
-			PurpleLog *log;
-			PurpleLogCommonLoggerData *data;
-			GDateTime *stamp = purple_str_to_date_time(purple_unescape_filename(filename), FALSE);
+static PurpleLogMetaDir *
+log_meta_dir_new(void)
+{
+	PurpleLogMetaDir *dir = g_new0(PurpleLogMetaDir, 1);
 
-			log = purple_log_new(type, name, account, NULL, stamp);
-			log->logger = logger;
-			log->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
+	dir->files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+		g_free);
 
-			data->path = g_build_filename(path, filename, NULL);
-			list = g_list_prepend(list, log);
+	return dir;
+}
 
-			g_date_time_unref(stamp);
-		}
-	}
-	g_dir_close(dir);
-	g_free(path);
-	return list;
+static void
+log_meta_dir_free(PurpleLogMetaDir *dir)
+{
+	g_hash_table_destroy(dir->files);
+	g_free(dir);
 }
 
-int purple_log_common_total_sizer(PurpleLogType type, const char *name, PurpleAccount *account, const char *ext)
+static void
+log_meta_account_free(PurpleLogMetaAccount *acct)
 {
-	GDir *dir;
-	int size = 0;
-	const char *filename;
-	char *path;
+	g_free(acct->cache);
+	g_hash_table_destroy(acct->dirs);
+	g_free(acct);
+}
 
-	if(!account)
-		return 0;
+/* Returns -1 if path doesn't exist. Unless trust_recent is set, a directory
+ * that changed within the last second comes back as 0, since another change
+ * within the same second wouldn't change its mtime. */
+static gint64
+log_meta_mtime(const char *path, gboolean trust_recent)
+{
+	GStatBuf st;
+
+	if (g_stat(path, &st) != 0)
+		return -1;
+
+	if (!trust_recent && st.st_mtime >= time(NULL) - 1)
+		return 0;
+
+	return st.st_mtime;
+}
+
+static gboolean
+log_meta_load_data(PurpleLogMetaAccount *acct, const guchar *data, gsize len)
+{
+	PurpleBinaryReader reader;
+	guint32 version, ndirs, i;
+
+	if (len < strlen(LOG_META_MAGIC) ||
+			memcmp(data, LOG_META_MAGIC, strlen(LOG_META_MAGIC)) != 0)
+		return FALSE;
+
+	reader.cur = data + strlen(LOG_META_MAGIC);
+	reader.end = data + len;
+
+	if (!_purple_binary_get_uint32(&reader, &version) ||
+			version != LOG_META_VERSION ||
+			!_purple_binary_get_int64(&reader, &acct->mtime) ||
+			!_purple_binary_get_uint32(&reader, &ndirs))
+		return FALSE;
+
+	for (i = 0; i < ndirs; i++) {
+		PurpleLogMetaDir *dir;
+		const char *name;
+		guint32 nfiles, j;
+
+		dir = log_meta_dir_new();
+		if (!_purple_binary_get_string(&reader, &name) || name == NULL ||
+				!_purple_binary_get_int64(&reader, &dir->mtime) ||
+				!_purple_binary_get_uint32(&reader, &nfiles)) {
+			log_meta_dir_free(dir);
+			return FALSE;
+		}
+		g_hash_table_replace(acct->dirs, g_strdup(name), dir);
+
+		for (j = 0; j < nfiles; j++) {
+			PurpleLogMetaFile *file = g_new(PurpleLogMetaFile, 1);
+			const char *filename;
+
+			if (!_purple_binary_get_string(&reader, &filename) ||
+					filename == NULL ||
+					!_purple_binary_get_int64(&reader, &file->time) ||
+					!_purple_binary_get_int64(&reader, &file->size) ||
+					!_purple_binary_get_uint32(&reader, &file->messages)) {
+				g_free(file);
+				return FALSE;
+			}
+			g_hash_table_replace(dir->files, g_strdup(filename), file);
+		}
+	}
+
+	return reader.cur == reader.end;
+}
+
+static PurpleLogMetaAccount *
+log_meta_get_account(const char *path)
+{
+	PurpleLogMetaAccount *acct = g_hash_table_lookup(log_meta, path);
+	char *protocol_path, *protocol, *username, *filename;
+	gchar *data;
+	gsize len;
+
+	if (acct != NULL)
+		return acct;
+
+	/* path is .../logs/<protocol>/<username> */
+	protocol_path = g_path_get_dirname(path);
+	protocol = g_path_get_basename(protocol_path);
+	username = g_path_get_basename(path);
+	filename = g_strconcat(username, ".bin", NULL);
+
+	acct = g_new0(PurpleLogMetaAccount, 1);
+	acct->cache = g_build_filename(purple_cache_dir(), "log-metadata",
+		protocol, filename, NULL);
+	acct->dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+		(GDestroyNotify)log_meta_dir_free);
+	g_hash_table_insert(log_meta, g_strdup(path), acct);
+
+	g_free(protocol_path);
+	g_free(protocol);
+	g_free(username);
+	g_free(filename);
+
+	if (g_file_get_contents(acct->cache, &data, &len, NULL)) {
+		if (!log_meta_load_data(acct, (const guchar *)data, len)) {
+			purple_debug_warning("log", "Discarding damaged log metadata "
+				"in %s\n", acct->cache);
+			g_hash_table_remove_all(acct->dirs);
+			acct->mtime = 0;
+		}
+		g_free(data);
+	}
+
+	return acct;
+}
+
+static void
+log_meta_scan_dir(PurpleLogMetaDir *dir, const char *path)
+{
+	GHashTable *files = g_hash_table_new_full(g_str_hash, g_str_equal,
+		g_free, g_free);
+	GDir *gdir = g_dir_open(path, 0, NULL);
+	const char *filename;
+
+	while (gdir != NULL && (filename = g_dir_read_name(gdir)) != NULL) {
+		PurpleLogMetaFile *old = g_hash_table_lookup(dir->files, filename);
+		PurpleLogMetaFile *file;
+		char *file_path = g_build_filename(path, filename, NULL);
+		GStatBuf st;
+
+		if (g_stat(file_path, &st) != 0 || !S_ISREG(st.st_mode)) {
+			g_free(file_path);
+			continue;
+		}
+		g_free(file_path);
+
+		file = g_new(PurpleLogMetaFile, 1);
+		file->size = st.st_size;
+		if (old != NULL) {
+			file->time = old->time;
+			file->messages = old->size == st.st_size ? old->messages : G_MAXUINT32;
+		} else {
+			GDateTime *stamp = purple_str_to_date_time(
+				purple_unescape_filename(filename), FALSE);
+
+			file->time = stamp ? g_date_time_to_unix(stamp) : 0;
+			file->messages = G_MAXUINT32;
+			if (stamp)
+				g_date_time_unref(stamp);
+		}
+
+		g_hash_table_insert(files, g_strdup(filename), file);
+	}
+
+	if (gdir != NULL)
+		g_dir_close(gdir);
+
+	g_hash_table_destroy(dir->files);
+	dir->files = files;
+}
+
+/* Returns the up to date metadata of the logs in the conversation
+ * directory path, or NULL if it doesn't exist. */
+static PurpleLogMetaDir *
+log_meta_get_dir(const char *path)
+{
+	char *account_path = g_path_get_dirname(path);
+	char *name = g_path_get_basename(path);
+	PurpleLogMetaAccount *acct = log_meta_get_account(account_path);
+	PurpleLogMetaDir *dir = g_hash_table_lookup(acct->dirs, name);
+	gint64 mtime = log_meta_mtime(path, FALSE);
+
+	if (mtime < 0) {
+		if (dir != NULL) {
+			g_hash_table_remove(acct->dirs, name);
+			acct->dirty = TRUE;
+		}
+		dir = NULL;
+	} else if (dir == NULL || mtime == 0 || dir->mtime != mtime) {
+		if (dir == NULL) {
+			dir = log_meta_dir_new();
+			g_hash_table_insert(acct->dirs, g_strdup(name), dir);
+		}
+		log_meta_scan_dir(dir, path);
+		dir->mtime = mtime;
+		acct->dirty = TRUE;
+	}
+
+	g_free(account_path);
+	g_free(name);
+
+	return dir;
+}
+
+/* Returns the (escaped) names of the conversation directories in the
+ * account directory path. */
+static GList *
+log_meta_get_names(const char *path)
+{
+	PurpleLogMetaAccount *acct = log_meta_get_account(path);
+	gint64 mtime = log_meta_mtime(path, FALSE);
+
+	if (mtime < 0)
+		return NULL;
+
+	if (mtime == 0 || acct->mtime != mtime) {
+		GDir *gdir = g_dir_open(path, 0, NULL);
+		GHashTable *seen = g_hash_table_new(g_str_hash, g_str_equal);
+		GHashTableIter iter;
+		const char *name;
+		gpointer key;
+
+		while (gdir != NULL && (name = g_dir_read_name(gdir)) != NULL) {
+			if (!g_hash_table_lookup_extended(acct->dirs, name, &key, NULL)) {
+				PurpleLogMetaDir *dir = log_meta_dir_new();
+
+				key = g_strdup(name);
+				g_hash_table_insert(acct->dirs, key, dir);
+			}
+			g_hash_table_add(seen, key);
+		}
+		if (gdir != NULL)
+			g_dir_close(gdir);
+
+		g_hash_table_iter_init(&iter, acct->dirs);
+		while (g_hash_table_iter_next(&iter, &key, NULL)) {
+			if (!g_hash_table_contains(seen, key))
+				g_hash_table_iter_remove(&iter);
+		}
+		g_hash_table_destroy(seen);
+
+		acct->mtime = mtime;
+		acct->dirty = TRUE;
+	}
+
+	return g_hash_table_get_keys(acct->dirs);
+}
+
+/* Looks up the metadata of the log file path without checking the disk. */
+static PurpleLogMetaFile *
+log_meta_lookup_file(const char *path, PurpleLogMetaAccount **acct,
+                     PurpleLogMetaDir **dir)
+{
+	char *dir_path = g_path_get_dirname(path);
+	char *account_path = g_path_get_dirname(dir_path);
+	char *name = g_path_get_basename(dir_path);
+	char *filename = g_path_get_basename(path);
+	PurpleLogMetaFile *file = NULL;
+
+	*acct = log_meta_get_account(account_path);
+	*dir = g_hash_table_lookup((*acct)->dirs, name);
+	if (*dir != NULL)
+		file = g_hash_table_lookup((*dir)->files, filename);
+
+	g_free(dir_path);
+	g_free(account_path);
+	g_free(name);
+	g_free(filename);
+
+	return file;
+}
+
+/* Called for a log file we just created. Its directory must have been
+ * looked up with log_meta_get_dir() right before creating it. */
+static void
+log_meta_add_file(const char *path, GDateTime *start)
+{
+	char *dir_path = g_path_get_dirname(path);
+	char *account_path = g_path_get_dirname(dir_path);
+	char *name = g_path_get_basename(dir_path);
+	PurpleLogMetaAccount *acct = log_meta_get_account(account_path);
+	PurpleLogMetaDir *dir = g_hash_table_lookup(acct->dirs, name);
+	PurpleLogMetaFile *file;
+	gboolean known;
+
+	if (dir == NULL) {
+		/* The directory was just created, so this is all there is in
+		 * it. The account's directory changed as well. */
+		dir = log_meta_dir_new();
+		g_hash_table_insert(acct->dirs, g_strdup(name), dir);
+		acct->mtime = 0;
+		known = TRUE;
+	} else {
+		known = dir->mtime != 0;
+	}
+
+	file = g_new(PurpleLogMetaFile, 1);
+	file->time = g_date_time_to_unix(start);
+	file->size = 0;
+	file->messages = 0;
+	g_hash_table_replace(dir->files, g_path_get_basename(path), file);
+
+	/* We know what changed, unless we didn't know all of it before. A
+	 * directory read again keeps the entry as long as the size matches. */
+	dir->mtime = known ? log_meta_mtime(dir_path, TRUE) : 0;
+	acct->dirty = TRUE;
+
+	g_free(dir_path);
+	g_free(account_path);
+	g_free(name);
+}
+
+static void
+log_meta_file_written(const char *path, gsize bytes, guint messages)
+{
+	PurpleLogMetaAccount *acct;
+	PurpleLogMetaDir *dir;
+	PurpleLogMetaFile *file = log_meta_lookup_file(path, &acct, &dir);
+
+	if (file == NULL)
+		return;
+
+	file->size += bytes;
+	if (file->messages != G_MAXUINT32)
+		file->messages += messages;
+	acct->dirty = TRUE;
+}
+
+static void
+log_meta_remove_file(const char *path)
+{
+	PurpleLogMetaAccount *acct;
+	PurpleLogMetaDir *dir;
+	char *filename;
+
+	log_meta_lookup_file(path, &acct, &dir);
+	if (dir == NULL)
+		return;
+
+	filename = g_path_get_basename(path);
+	g_hash_table_remove(dir->files, filename);
+	g_free(filename);
+
+	/* read it again next time rather than guess the new mtime */
+	dir->mtime = 0;
+	acct->dirty = TRUE;
+}
+
+static gint
+log_meta_get_message_count(const char *path)
+{
+	PurpleLogMetaAccount *acct;
+	PurpleLogMetaDir *dir;
+	PurpleLogMetaFile *file = log_meta_lookup_file(path, &acct, &dir);
+
+	/* Only read the directory if we don't know the file yet: a log being
+	 * written may not be all on the disk, and reading it would make its
+	 * count unknown. */
+	if (file == NULL) {
+		char *dir_path = g_path_get_dirname(path);
+
+		log_meta_get_dir(dir_path);
+		g_free(dir_path);
+		file = log_meta_lookup_file(path, &acct, &dir);
+	}
+
+	if (file == NULL || file->messages == G_MAXUINT32)
+		return -1;
+
+	return MIN(file->messages, G_MAXINT);
+}
+
+static void
+log_meta_save_account(PurpleLogMetaAccount *acct)
+{
+	GByteArray *out = g_byte_array_new();
+	GHashTableIter iter, files;
+	gpointer name, value, filename, fvalue;
+	char *cache_dir;
+
+	g_byte_array_append(out, (const guint8 *)LOG_META_MAGIC,
+		strlen(LOG_META_MAGIC));
+	_purple_binary_put_uint32(out, LOG_META_VERSION);
+	_purple_binary_put_int64(out, acct->mtime);
+	_purple_binary_put_uint32(out, g_hash_table_size(acct->dirs));
+
+	g_hash_table_iter_init(&iter, acct->dirs);
+	while (g_hash_table_iter_next(&iter, &name, &value)) {
+		PurpleLogMetaDir *dir = value;
+
+		_purple_binary_put_string(out, name);
+		_purple_binary_put_int64(out, dir->mtime);
+		_purple_binary_put_uint32(out, g_hash_table_size(dir->files));
+
+		g_hash_table_iter_init(&files, dir->files);
+		while (g_hash_table_iter_next(&files, &filename, &fvalue)) {
+			PurpleLogMetaFile *file = fvalue;
+
+			_purple_binary_put_string(out, filename);
+			_purple_binary_put_int64(out, file->time);
+			_purple_binary_put_int64(out, file->size);
+			_purple_binary_put_uint32(out, file->messages);
+		}
+	}
+
+	cache_dir = g_path_get_dirname(acct->cache);
+	g_mkdir_with_parents(cache_dir, S_IRUSR | S_IWUSR | S_IXUSR);
+	g_free(cache_dir);
+
+	if (purple_util_write_data_to_file_absolute(acct->cache,
+			(const char *)out->data, out->len))
+		acct->dirty = FALSE;
+
+	g_byte_array_free(out, TRUE);
+}
+
+static void
+log_meta_init(void)
+{
+	log_meta = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+		(GDestroyNotify)log_meta_account_free);
+}
+
+static void
+log_meta_uninit(void)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init(&iter, log_meta);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		PurpleLogMetaAccount *acct = value;
+
+		if (acct->dirty)
+			log_meta_save_account(acct);
+	}
+
+	g_hash_table_destroy(log_meta);
+	log_meta = NULL;
+}
+
+static gboolean
+log_meta_is_log(const char *filename, const char *ext)
+{
+	return g_str_has_suffix(filename, ext) &&
+		strlen(filename) >= (17 + strlen(ext));
+}
+
+/* Activity score of the logs with extension ext, see
+ * purple_log_get_activity_score() */
+static double
+log_meta_activity(PurpleLogType type, const char *name, PurpleAccount *account,
+                  const char *ext, GDateTime *now)
+{
+	char *path = purple_log_get_log_dir(type, name, account);
+	PurpleLogMetaDir *dir;
+	GHashTableIter iter;
+	gpointer filename, value;
+	gint64 now_unix = g_date_time_to_unix(now);
+	double score = 0.0;
 
-	path = purple_log_get_log_dir(type, name, account);
 	if (path == NULL)
+		return 0.0;
+
+	dir = log_meta_get_dir(path);
+	g_free(path);
+	if (dir == NULL)
+		return 0.0;
+
+	g_hash_table_iter_init(&iter, dir->files);
+	while (g_hash_table_iter_next(&iter, &filename, &value)) {
+		PurpleLogMetaFile *file = value;
+
+		if (!log_meta_is_log(filename, ext))
+			continue;
+
+		score += file->size *
+			pow(0.5, (double)(now_unix - file->time) / (14 * 24 * 60 * 60));
+	}
+
+	return score;
+}
+
+/****************************************************************************
+ * LOGGERS ******************************************************************
+ ****************************************************************************/
+
+static char *log_get_timestamp(PurpleLog *log, GDateTime *when)
+{
+	gboolean show_date;
+	char *date;
+	GDateTime *dt;
+
+	dt = g_date_time_new_now_utc();
+	show_date = (log->type == PURPLE_LOG_SYSTEM) || (g_date_time_difference(dt, when) > 20L * G_TIME_SPAN_MINUTE);
+	g_date_time_unref(dt);
+
+	date = purple_signal_emit_return_1(purple_log_get_handle(),
+	                          "log-timestamp",
+	                          log, when, show_date);
+	if (date != NULL)
+		return date;
+
+	dt = g_date_time_to_local(when);
+	if (show_date)
+		date = g_date_time_format(dt, _("%x %X"));
+	else
+		date = g_date_time_format(dt, "%X");
+	g_date_time_unref(dt);
+
+	return date;
+}
+
+/* NOTE: This can return msg (which you may or may not want to g_free())
+ * NOTE: or a newly allocated string which you MUST g_free().
+ * TODO: XXX: does it really works?
+ */
+static char *
+convert_image_tags(const PurpleLog *log, const char *msg)
+{
+	const char *tmp;
+	const char *start;
+	const char *end;
+	GData *attributes;
+	GString *newmsg = NULL;
+
+	tmp = msg;
+
+	while (purple_markup_find_tag("img", tmp, &start, &end, &attributes)) {
+		int imgid = 0;
+		char *idstr = NULL;
+
+		if (newmsg == NULL)
+			newmsg = g_string_new("");
+
+		/* copy any text before the img tag */
+		if (tmp < start)
+			g_string_append_len(newmsg, tmp, start - tmp);
+
+		if ((idstr = g_datalist_get_data(&attributes, "id")) != NULL)
+			imgid = atoi(idstr);
+
+		if (imgid != 0)
+		{
+			FILE *image_file;
+			char *dir;
+			PurpleImage *image;
+			gconstpointer image_data;
+			const gchar *new_filename = NULL;
+			char *path = NULL;
+			size_t image_byte_count;
+
+			image = purple_image_store_get(imgid);
+			if (image == NULL)
+			{
+				/* This should never happen. */
+				/* This *does* happen for failed Direct-IMs -DAA */
+				g_string_free(newmsg, TRUE);
+				g_return_val_if_reached((char *)msg);
+			}
+
+			image_data       = purple_image_get_data(image);
+			image_byte_count = purple_image_get_data_size(image);
+			dir              = purple_log_get_log_dir(log->type, log->name, log->account);
+			new_filename = purple_image_generate_filename(image);
+
+			path = g_build_filename(dir, new_filename, NULL);
+
+			/* Only save unique files. */
+			if (!g_file_test(path, G_FILE_TEST_EXISTS))
+			{
+				if ((image_file = g_fopen(path, "wb")) != NULL)
+				{
+					if (!fwrite(image_data, image_byte_count, 1, image_file))
+					{
+						purple_debug_error("log", "Error writing %s: %s\n",
+						                   path, g_strerror(errno));
+						fclose(image_file);
+
+						/* Attempt to not leave half-written files around. */
+						if (g_unlink(path)) {
+							purple_debug_error("log", "Error deleting partial "
+									"file %s: %s\n", path, g_strerror(errno));
+						}
+					}
+					else
+					{
+						purple_debug_info("log", "Wrote image file: %s\n", path);
+						fclose(image_file);
+					}
+				}
+				else
+				{
+					purple_debug_error("log", "Unable to create file %s: %s\n",
+					                   path, g_strerror(errno));
+				}
+			}
+
+			/* Write the new image tag */
+			g_string_append_printf(newmsg, "<img src=\"%s\">", new_filename);
+			g_free(path);
+			g_free(dir);
+		}
+
+		/* Continue from the end of the tag */
+		tmp = end + 1;
+	}
+
+	if (newmsg == NULL)
+	{
+		/* No images were found to change. */
+		return (char *)msg;
+	}
+
+	/* Append any remaining message data */
+	g_string_append(newmsg, tmp);
+
+	return g_string_free(newmsg, FALSE);
+}
+
+void purple_log_common_writer(PurpleLog *log, const char *ext)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+
+	if (data == NULL)
+	{
+		/* This log is new */
+		char *dir;
+		GDateTime *dt;
+		const char *tz;
+		gchar *date;
+		char *filename;
+		char *path;
+
+		dir = purple_log_get_log_dir(log->type, log->name, log->account);
+		if (dir == NULL)
+			return;
+
+		/* bring the metadata up to date before we change the directory */
+		log_meta_get_dir(dir);
+		g_mkdir_with_parents(dir, S_IRUSR | S_IWUSR | S_IXUSR);
+
+		dt = g_date_time_to_local(log->time);
+		tz = purple_escape_filename(g_date_time_get_timezone_abbreviation(dt));
+		date = g_date_time_format(dt, "%Y-%m-%d.%H%M%S%z");
+		g_date_time_unref(dt);
+
+		filename = g_strdup_printf("%s%s%s", date, tz, ext ? ext : "");
+
+		path = g_build_filename(dir, filename, NULL);
+		g_free(dir);
+		g_free(date);
+		g_free(filename);
+
+		log->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
+
+		data->file = g_fopen(path, "a");
+		if (data->file == NULL)
+		{
+			purple_debug(PURPLE_DEBUG_ERROR, "log",
+					"Could not create log file %s\n", path);
+
+			if (log->conv != NULL)
+				purple_conversation_write_system_message(log->conv,
+					_("Logging of this conversation failed."),
+					PURPLE_MESSAGE_ERROR);
+
+			g_free(path);
+			return;
+		}
+
+		log_meta_add_file(path, log->time);
+
+		/* kept to find the log's metadata as it's written */
+		data->path = path;
+	}
+}
+
+GList *purple_log_common_lister(PurpleLogType type, const char *name, PurpleAccount *account, const char *ext, PurpleLogLogger *logger)
+{
+	PurpleLogMetaDir *dir;
+	GHashTableIter iter;
+	GList *list = NULL;
+	gpointer key;
+	char *path;
+
+	if(!account)
+		return NULL;
+
+	path = purple_log_get_log_dir(type, name, account);
+	if (path == NULL)
+		return NULL;
+
+	if (!(dir = log_meta_get_dir(path)))
+	{
+		g_free(path);
+		return NULL;
+	}
+
+	g_hash_table_iter_init(&iter, dir->files);
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+	{
+		const char *filename = key;
+
+		if (log_meta_is_log(filename, ext)) {
+			PurpleLog *log;
+			PurpleLogCommonLoggerData *data;
+			GDateTime *stamp = purple_str_to_date_time(purple_unescape_filename(filename), FALSE);
+
+			log = purple_log_new(type, name, account, NULL, stamp);
+			log->logger = logger;
+			log->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
+
+			data->path = g_build_filename(path, filename, NULL);
+			list = g_list_prepend(list, log);
+
+			g_date_time_unref(stamp);
+		}
+	}
+	g_free(path);
+	return list;
+}
+
+int purple_log_common_total_sizer(PurpleLogType type, const char *name, PurpleAccount *account, const char *ext)
+{
+	PurpleLogMetaDir *dir;
+	GHashTableIter iter;
+	gpointer filename, value;
+	int size = 0;
+	char *path;
+
+	if(!account)
+		return 0;
+
+	path = purple_log_get_log_dir(type, name, account);
+	if (path == NULL)
+		return 0;
+
+	dir = log_meta_get_dir(path);
+	g_free(path);
+	if (dir == NULL)
+		return 0;
+
+	g_hash_table_iter_init(&iter, dir->files);
+	while (g_hash_table_iter_next(&iter, &filename, &value))
+	{
+		PurpleLogMetaFile *file = value;
+
+		if (log_meta_is_log(filename, ext))
+			size += file->size;
+	}
+	return size;
+}
+
+int purple_log_common_sizer(PurpleLog *log)
+{
+	GStatBuf st;
+	PurpleLogCommonLoggerData *data = log->logger_data;
+
+	g_return_val_if_fail(data != NULL, 0);
+
+	if (!data->path || g_stat(data->path, &st))
+		st.st_size = 0;
+
+	return st.st_size;
+}
+
+/* This will build log sets for all loggers that use the common logger
+ * functions because they use the same directory structure. */
+static void log_get_log_sets_common(GHashTable *sets)
+{
+	gchar *log_path = g_build_filename(purple_data_dir(), "logs", NULL);
+	GDir *log_dir = g_dir_open(log_path, 0, NULL);
+	const gchar *protocol;
+
+	if (log_dir == NULL) {
+		g_free(log_path);
+		return;
+	}
+
+	while ((protocol = g_dir_read_name(log_dir)) != NULL) {
+		gchar *protocol_path = g_build_filename(log_path, protocol, NULL);
+		GDir *protocol_dir;
+		const gchar *username;
+		gchar *protocol_unescaped;
+		GList *account_iter;
+		GList *accounts = NULL;
+
+		if ((protocol_dir = g_dir_open(protocol_path, 0, NULL)) == NULL) {
+			g_free(protocol_path);
+			continue;
+		}
+
+		/* Using g_strdup() to cover the one-in-a-million chance that a
+		 * protocol's list_icon function uses purple_unescape_filename(). */
+		protocol_unescaped = g_strdup(purple_unescape_filename(protocol));
+
+		/* Find all the accounts for protocol. */
+		for (account_iter = purple_accounts_get_all() ; account_iter != NULL ; account_iter = account_iter->next) {
+			PurpleProtocol *protocol;
+
+			protocol = purple_protocols_find(purple_account_get_protocol_id((PurpleAccount *)account_iter->data));
+			if (!protocol)
+				continue;
+
+			if (purple_strequal(protocol_unescaped, purple_protocol_class_list_icon(protocol, (PurpleAccount *)account_iter->data, NULL)))
+				accounts = g_list_prepend(accounts, account_iter->data);
+		}
+		g_free(protocol_unescaped);
+
+		while ((username = g_dir_read_name(protocol_dir)) != NULL) {
+			gchar *username_path = g_build_filename(protocol_path, username, NULL);
+			GList *names, *name_iter;
+			const gchar *username_unescaped;
+			PurpleAccount *account = NULL;
+			gchar *name;
+
+			/* the conversation directories come from the log metadata */
+			if ((names = log_meta_get_names(username_path)) == NULL) {
+				g_free(username_path);
+				continue;
+			}
+
+			/* Find the account for username in the list of accounts for protocol. */
+			username_unescaped = purple_unescape_filename(username);
+			for (account_iter = g_list_first(accounts) ; account_iter != NULL ; account_iter = account_iter->next) {
+				if (purple_strequal(purple_account_get_username((PurpleAccount *)account_iter->data), username_unescaped)) {
+					account = account_iter->data;
+					break;
+				}
+			}
+
+			for (name_iter = names; name_iter != NULL; name_iter = name_iter->next) {
+				size_t len;
+				PurpleLogSet *set;
+
+				/* IMPORTANT: Always initialize all members of PurpleLogSet */
+				set = g_slice_new(PurpleLogSet);
+
+				/* Unescape the filename. */
+				name = g_strdup(purple_unescape_filename(name_iter->data));
+
+				/* Get the (possibly new) length of name. */
+				len = strlen(name);
+
+				set->type = PURPLE_LOG_IM;
+				set->name = name;
+				set->account = account;
+				/* set->buddy is always set below */
+				set->normalized_name = g_strdup(purple_normalize(account, name));
+
+				/* Check for .chat or .system at the end of the name to determine the type. */
+				if (len >= 7) {
+					gchar *tmp = &name[len - 7];
+					if (purple_strequal(tmp, ".system")) {
+						set->type = PURPLE_LOG_SYSTEM;
+						*tmp = '\0';
+					}
+				}
+				if (len > 5) {
+					gchar *tmp = &name[len - 5];
+					if (purple_strequal(tmp, ".chat")) {
+						set->type = PURPLE_LOG_CHAT;
+						*tmp = '\0';
+					}
+				}
+
+				/* Determine if this (account, name) combination exists as a buddy. */
+				if (account != NULL && *name != '\0')
+					set->buddy = (purple_blist_find_buddy(account, name) != NULL);
+				else
+					set->buddy = FALSE;
+
+				log_add_log_set_to_hash(sets, set);
+			}
+			g_free(username_path);
+			g_list_free(names);
+		}
+		g_free(protocol_path);
+		g_list_free(accounts);
+		g_dir_close(protocol_dir);
+	}
+	g_free(log_path);
+	g_dir_close(log_dir);
+}
+
+gboolean purple_log_common_deleter(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data;
+	int ret;
+
+	g_return_val_if_fail(log != NULL, FALSE);
+
+	data = log->logger_data;
+	if (data == NULL)
+		return FALSE;
+
+	if (data->path == NULL)
+		return FALSE;
+
+	ret = g_unlink(data->path);
+	if (ret == 0) {
+		log_meta_remove_file(data->path);
+		return TRUE;
+	}
+	else if (ret == -1)
+	{
+		purple_debug_error("log", "Failed to delete: %s - %s\n", data->path, g_strerror(errno));
+	}
+	else
+	{
+		/* I'm not sure that g_unlink() will ever return
+		 * something other than 0 or -1. -- rlaager */
+		purple_debug_error("log", "Failed to delete: %s\n", data->path);
+	}
+
+	return FALSE;
+}
+
+gboolean purple_log_common_is_deletable(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data;
+#ifndef _WIN32
+	gchar *dirname;
+#endif
+
+	g_return_val_if_fail(log != NULL, FALSE);
+
+	data = log->logger_data;
+	if (data == NULL)
+		return FALSE;
+
+	if (data->path == NULL)
+		return FALSE;
+
+#ifndef _WIN32
+	dirname = g_path_get_dirname(data->path);
+	if (g_access(dirname, W_OK) == 0)
+	{
+		g_free(dirname);
+		return TRUE;
+	}
+	purple_debug_info("log", "access(%s) failed: %s\n", dirname, g_strerror(errno));
+	g_free(dirname);
+#else
+	/* Unless and until someone writes equivalent win32 code,
+	 * we'll assume the file is deletable. */
+	return TRUE;
+#endif
+
+	return FALSE;
+}
+
+static char *process_txt_log(char *txt, char *to_free)
+{
+	char *tmp;
+
+	/* The to_free argument allows us to save a
+	 * g_strdup() in some cases. */
+
+	if (to_free == NULL)
+		to_free = txt;
+
+	/* g_markup_escape_text requires valid UTF-8 */
+	if (!g_utf8_validate(txt, -1, NULL))
+	{
+		tmp = purple_utf8_salvage(txt);
+		g_free(to_free);
+		to_free = txt = tmp;
+	}
+
+	tmp = g_markup_escape_text(txt, -1);
+	g_free(to_free);
+	txt = purple_markup_linkify(tmp);
+	g_free(tmp);
+
+	return txt;
+}
+
+/****************************
+ ** HTML LOGGER *************
+ ****************************/
+
+/* Appends a message the way the html logger writes it. msg_fixed may be
+ * changed by purple_message_meify(). */
+static void
+log_html_format_message(GString *out, PurpleLog *log, PurpleMessageFlags type,
+                        const char *date, const char *escaped_from,
+                        char *msg_fixed)
+{
+	if(log->type == PURPLE_LOG_SYSTEM){
+		g_string_append_printf(out, "---- %s @ %s ----<br/>\n", msg_fixed, date);
+	} else {
+		if (type & PURPLE_MESSAGE_SYSTEM)
+			g_string_append_printf(out, "<font size=\"2\">(%s)</font><b> %s</b><br/>\n", date, msg_fixed);
+		else if (type & PURPLE_MESSAGE_RAW)
+			g_string_append_printf(out, "<font size=\"2\">(%s)</font> %s<br/>\n", date, msg_fixed);
+		else if (type & PURPLE_MESSAGE_ERROR)
+			g_string_append_printf(out, "<font color=\"#FF0000\"><font size=\"2\">(%s)</font><b> %s</b></font><br/>\n", date, msg_fixed);
+		else if (type & PURPLE_MESSAGE_AUTO_RESP) {
+			if (type & PURPLE_MESSAGE_SEND)
+				g_string_append_printf(out, _("<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, escaped_from, msg_fixed);
+			else if (type & PURPLE_MESSAGE_RECV)
+				g_string_append_printf(out, _("<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, escaped_from, msg_fixed);
+		} else if (type & PURPLE_MESSAGE_RECV) {
+			if(purple_message_meify(msg_fixed, -1))
+				g_string_append_printf(out, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
+						date, escaped_from, msg_fixed);
+			else
+				g_string_append_printf(out, "<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
+						date, escaped_from, msg_fixed);
+		} else if (type & PURPLE_MESSAGE_SEND) {
+			if(purple_message_meify(msg_fixed, -1))
+				g_string_append_printf(out, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
+						date, escaped_from, msg_fixed);
+			else
+				g_string_append_printf(out, "<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
+						date, escaped_from, msg_fixed);
+		} else {
+			purple_debug_error("log", "Unhandled message type.\n");
+			g_string_append_printf(out, "<font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n",
+						date, escaped_from, msg_fixed);
+		}
+	}
+}
+
+static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
+                               const char *from, GDateTime *time, const char *message)
+{
+	char *msg_fixed;
+	char *image_corrected_msg;
+	char *date;
+	char *header;
+	char *escaped_from;
+	PurpleProtocol *protocol =
+			purple_protocols_find(purple_account_get_protocol_id(log->account));
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	GString *out = g_string_new(NULL);
+
+	if(!data) {
+		const char *proto = purple_protocol_class_list_icon(protocol, log->account, NULL);
+		GDateTime *dt;
+		gchar *date;
+		purple_log_common_writer(log, ".html");
+
+		data = log->logger_data;
+
+		/* if we can't write to the file, give up before we hurt ourselves */
+		if (!data || !data->file) {
+			g_string_free(out, TRUE);
+			return 0;
+		}
+
+		dt = g_date_time_to_local(log->time);
+		date = g_date_time_format(dt, "%c");
+		g_date_time_unref(dt);
+
+		g_string_append_printf(out, "<html><head>");
+		g_string_append_printf(out, "<meta http-equiv=\"content-type\" content=\"text/html; charset=UTF-8\">");
+		g_string_append_printf(out, "<title>");
+		if (log->type == PURPLE_LOG_SYSTEM)
+			header = g_strdup_printf("System log for account %s (%s) connected at %s",
+					purple_account_get_username(log->account), proto, date);
+		else
+			header = g_strdup_printf("Conversation with %s at %s on %s (%s)",
+					log->name, date, purple_account_get_username(log->account), proto);
+
+		g_string_append_printf(out, "%s", header);
+		g_string_append_printf(out, "</title></head><body>");
+		g_string_append_printf(out, "<h3>%s</h3>\n", header);
+		g_free(date);
+		g_free(header);
+	}
+
+	/* if we can't write to the file, give up before we hurt ourselves */
+	if(!data->file) {
+		g_string_free(out, TRUE);
+		return 0;
+	}
+
+	escaped_from = g_markup_escape_text(from != NULL ? from : "<NULL>",
+			-1);
+
+	image_corrected_msg = convert_image_tags(log, message);
+	purple_markup_html_to_xhtml(image_corrected_msg, &msg_fixed, NULL);
+
+	/* Yes, this breaks encapsulation.  But it's a static function and
+	 * this saves a needless strdup(). */
+	if (image_corrected_msg != message)
+		g_free(image_corrected_msg);
+
+	date = log_get_timestamp(log, time);
+
+	log_html_format_message(out, log, type, date, escaped_from, msg_fixed);
+	g_free(date);
+	g_free(msg_fixed);
+	g_free(escaped_from);
+
+	return log_writer_write(data->file, out);
+}
+
+static void html_logger_finalize(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	if (data) {
+		if(data->file) {
+			log_writer_push(LOG_WRITER_CLOSE, data->file,
+				g_strdup("</body></html>\n"), strlen("</body></html>\n"));
+			log_meta_file_written(data->path,
+				strlen("</body></html>\n"), 0);
+		}
+		g_free(data->path);
+
+		g_slice_free(PurpleLogCommonLoggerData, data);
+	}
+}
+
+static GList *html_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account)
+{
+	return purple_log_common_lister(type, sn, account, ".html", html_logger);
+}
+
+static GList *html_logger_list_syslog(PurpleAccount *account)
+{
+	return purple_log_common_lister(PURPLE_LOG_SYSTEM, ".system", account, ".html", html_logger);
+}
+
+static char *html_logger_read(PurpleLog *log, PurpleLogReadFlags *flags)
+{
+	char *read;
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	*flags = PURPLE_LOG_READ_NO_NEWLINE;
+	if (!data || !data->path)
+		return g_strdup(_("<font color=\"red\"><b>Unable to find log path!</b></font>"));
+	if (g_file_get_contents(data->path, &read, NULL, NULL)) {
+		char *minus_header = strchr(read, '\n');
+
+		if (!minus_header)
+			return read;
+
+		minus_header = g_strdup(minus_header + 1);
+		g_free(read);
+
+		return minus_header;
+	}
+	return g_strdup_printf(_("<font color=\"red\"><b>Could not read file: %s</b></font>"), data->path);
+}
+
+static int html_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account)
+{
+	return purple_log_common_total_sizer(type, name, account, ".html");
+}
+
+
+/****************************
+ ** PLAIN TEXT LOGGER *******
+ ****************************/
+
+static gsize txt_logger_write(PurpleLog *log, PurpleMessageFlags type,
+                              const char *from, GDateTime *time, const char *message)
+{
+	char *date;
+	PurpleProtocol *protocol =
+			purple_protocols_find(purple_account_get_protocol_id(log->account));
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	char *stripped = NULL;
+	GString *out = g_string_new(NULL);
+
+	if (data == NULL) {
+		/* This log is new.  We could use the loggers 'new' function, but
+		 * creating a new file there would result in empty files in the case
+		 * that you open a convo with someone, but don't say anything.
+		 */
+		const char *proto = purple_protocol_class_list_icon(protocol, log->account, NULL);
+		GDateTime *dt;
+		gchar *date;
+		purple_log_common_writer(log, ".txt");
+
+		data = log->logger_data;
+
+		/* if we can't write to the file, give up before we hurt ourselves */
+		if(!data || !data->file) {
+			g_string_free(out, TRUE);
+			return 0;
+		}
+
+		dt = g_date_time_to_local(log->time);
+		date = g_date_time_format(dt, "%c");
+		if (log->type == PURPLE_LOG_SYSTEM)
+			g_string_append_printf(out, "System log for account %s (%s) connected at %s\n",
+				purple_account_get_username(log->account), proto,
+				date);
+		else
+			g_string_append_printf(out, "Conversation with %s at %s on %s (%s)\n",
+				log->name, date,
+				purple_account_get_username(log->account), proto);
+		g_free(date);
+		g_date_time_unref(dt);
+	}
+
+	/* if we can't write to the file, give up before we hurt ourselves */
+	if(!data->file) {
+		g_string_free(out, TRUE);
 		return 0;
+	}
 
-	if (!(dir = g_dir_open(path, 0, NULL)))
-	{
-		g_free(path);
+	stripped = purple_markup_strip_html(message);
+	date = log_get_timestamp(log, time);
+
+	if(log->type == PURPLE_LOG_SYSTEM){
+		g_string_append_printf(out, "---- %s @ %s ----\n", stripped, date);
+	} else {
+		if (type & PURPLE_MESSAGE_SEND ||
+			type & PURPLE_MESSAGE_RECV) {
+			if (type & PURPLE_MESSAGE_AUTO_RESP) {
+				g_string_append_printf(out, _("(%s) %s <AUTO-REPLY>: %s\n"), date,
+						from, stripped);
+			} else {
+				if(purple_message_meify(stripped, -1))
+					g_string_append_printf(out, "(%s) ***%s %s\n", date, from,
+							stripped);
+				else
+					g_string_append_printf(out, "(%s) %s: %s\n", date, from,
+							stripped);
+			}
+		} else if (type & PURPLE_MESSAGE_SYSTEM ||
+			type & PURPLE_MESSAGE_ERROR ||
+			type & PURPLE_MESSAGE_RAW)
+			g_string_append_printf(out, "(%s) %s\n", date, stripped);
+		else if (type & PURPLE_MESSAGE_NO_LOG) {
+			/* This shouldn't happen */
+			g_free(date);
+			g_free(stripped);
+			return log_writer_write(data->file, out);
+		} else
+			g_string_append_printf(out, "(%s) %s%s %s\n", date, from ? from : "",
+					from ? ":" : "", stripped);
+	}
+	g_free(date);
+	g_free(stripped);
+
+	return log_writer_write(data->file, out);
+}
+
+static void txt_logger_finalize(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	if (data) {
+		if(data->file)
+			log_writer_push(LOG_WRITER_CLOSE, data->file, NULL, 0);
+		g_free(data->path);
+
+		g_slice_free(PurpleLogCommonLoggerData, data);
+	}
+}
+
+static GList *txt_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account)
+{
+	return purple_log_common_lister(type, sn, account, ".txt", txt_logger);
+}
+
+static GList *txt_logger_list_syslog(PurpleAccount *account)
+{
+	return purple_log_common_lister(PURPLE_LOG_SYSTEM, ".system", account, ".txt", txt_logger);
+}
+
+static char *txt_logger_read(PurpleLog *log, PurpleLogReadFlags *flags)
+{
+	char *read, *minus_header;
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	*flags = 0;
+	if (!data || !data->path)
+		return g_strdup(_("<font color=\"red\"><b>Unable to find log path!</b></font>"));
+	if (g_file_get_contents(data->path, &read, NULL, NULL)) {
+		minus_header = strchr(read, '\n');
+
+		if (minus_header)
+			return process_txt_log(minus_header + 1, read);
+		else
+			return process_txt_log(read, NULL);
+	}
+	return g_strdup_printf(_("<font color=\"red\"><b>Could not read file: %s</b></font>"), data->path);
+}
+
+static int txt_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account)
+{
+	return purple_log_common_total_sizer(type, name, account, ".txt");
+}
+
+
+/****************************
+ ** BINARY LOGGER ***********
+ ****************************/
+
+/* A binary log is a header followed by frames:
+ *
+ *   header: "PURPLEBL", u32 version
+ *   frame:  u32 type, u32 stored length, u32 raw length, u32 count,
+ *           i64 first time, i64 last time, u32 compression, u32 checksum,
+ *           then the payload of stored length bytes
+ *
+ * A block frame holds count messages, each its u32 flags, i64 time, and its
+ * author and contents as strings. The payload is raw deflate, unless that
+ * doesn't make it any smaller. Messages are collected until a block has
+ * LOG_BINARY_BLOCK_SIZE bytes of them, is LOG_BINARY_BLOCK_AGE seconds old
+ * or the log is closed, and then handed to the log writer. A message that
+ * would take a block past LOG_BINARY_MAX_RAW starts a new one, and a message
+ * larger than that on its own is stored, uncompressed, as the only one in
+ * its block.
+ *
+ * Closing a log appends an index frame listing the offset, times and count
+ * of every block. It ends in its own offset and LOG_BINARY_INDEX_MAGIC, so
+ * it's found from the end of the file. Logs without one (still being
+ * written, or never closed) are indexed by hopping from frame to frame.
+ * Either way, only the blocks holding the messages asked for are read.
+ *
+ * All numbers are little-endian. The checksum is FNV-1a over the frame,
+ * except the checksum itself, and its payload. Nothing read from a frame is
+ * trusted before its length was checked against the file and
+ * LOG_BINARY_MAX_RAW (or, for a stored block of one message, the stored
+ * length), and its checksum against its contents. */
+
+#define LOG_BINARY_EXT          ".purplelog"
+#define LOG_BINARY_MAGIC        "PURPLEBL"
+#define LOG_BINARY_VERSION      1
+#define LOG_BINARY_INDEX_MAGIC  "PLBINDEX"
+#define LOG_BINARY_HEADER_SIZE  12
+#define LOG_BINARY_FRAME_SIZE   40
+#define LOG_BINARY_TRAILER_SIZE 16
+#define LOG_BINARY_ENTRY_SIZE   28
+#define LOG_BINARY_BLOCK_SIZE   32768
+#define LOG_BINARY_BLOCK_AGE    30
+#define LOG_BINARY_MAX_RAW      (16 * 1024 * 1024)
+/* flags, time and the lengths and NULs of author and contents */
+#define LOG_BINARY_RECORD_SIZE  22
+
+typedef enum {
+	LOG_BINARY_FRAME_BLOCK = 1,
+	LOG_BINARY_FRAME_INDEX = 2
+} PurpleLogBinaryFrameType;
+
+typedef enum {
+	LOG_BINARY_STORED = 0,
+	LOG_BINARY_DEFLATED = 1
+} PurpleLogBinaryCompression;
+
+typedef struct {
+	guint32 type;
+	guint32 stored;
+	guint32 raw;
+	guint32 count;
+	gint64 first;
+	gint64 last;
+	guint32 compression;
+	guint32 checksum;
+} PurpleLogBinaryFrame;
+
+typedef struct {
+	gint64 offset;  /* of the frame */
+	gint64 first;
+	gint64 last;
+	guint32 count;
+} PurpleLogBinaryBlock;
+
+typedef struct {
+	GByteArray *records;  /* of the block being filled */
+	guint32 count;
+	gint64 first;
+	gint64 last;
+	gint64 offset;        /* where the next frame goes */
+	GArray *blocks;       /* PurpleLogBinaryBlock, the ones written so far */
+	guint timeout;
+} PurpleLogBinaryWriter;
+
+typedef void (*PurpleLogBinaryRecordFunc)(PurpleMessageFlags flags,
+		gint64 when, const char *author, const char *contents,
+		gpointer data);
+
+/* Checksums the frame header, up to its checksum, and len bytes of payload */
+static guint32
+log_binary_checksum(const guint8 *header, const guint8 *payload, gsize len)
+{
+	guint32 hash = _purple_fnv1a(header, LOG_BINARY_FRAME_SIZE - 4);
+
+	return _purple_fnv1a_update(hash, payload, len);
+}
+
+/* Runs len bytes of data through converter, returns NULL on errors or once
+ * the output would get larger than max, if that isn't 0 */
+static GByteArray *
+log_binary_convert_data(GConverter *converter, const guint8 *data, gsize len,
+                        gsize hint, gsize max)
+{
+	GByteArray *out = g_byte_array_new();
+	gsize in = 0, used = 0;
+
+	g_byte_array_set_size(out, MAX(hint, 256));
+
+	for (;;) {
+		GConverterResult result;
+		GError *error = NULL;
+		gsize bytes_read = 0, bytes_written = 0;
+
+		result = g_converter_convert(converter, data + in, len - in,
+			out->data + used, out->len - used, G_CONVERTER_INPUT_AT_END,
+			&bytes_read, &bytes_written, &error);
+
+		if (result == G_CONVERTER_ERROR) {
+			if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NO_SPACE) &&
+					(max == 0 || out->len < max)) {
+				g_error_free(error);
+				g_byte_array_set_size(out, max == 0 ? out->len * 2 :
+					MIN(out->len * 2, max));
+				continue;
+			}
+
+			purple_debug_error("log", "Error (de)compressing log block: %s\n",
+				error->message);
+			g_error_free(error);
+			g_byte_array_free(out, TRUE);
+			return NULL;
+		}
+
+		in += bytes_read;
+		used += bytes_written;
+
+		if (result == G_CONVERTER_FINISHED)
+			break;
+
+		if (used == out->len) {
+			if (max != 0 && out->len >= max) {
+				purple_debug_error("log", "Log block larger than it says\n");
+				g_byte_array_free(out, TRUE);
+				return NULL;
+			}
+			g_byte_array_set_size(out, max == 0 ? out->len * 2 :
+				MIN(out->len * 2, max));
+		}
+	}
+
+	g_byte_array_set_size(out, used);
+
+	return out;
+}
+
+static void
+log_binary_put_header(GByteArray *out)
+{
+	g_byte_array_append(out, (const guint8 *)LOG_BINARY_MAGIC,
+		strlen(LOG_BINARY_MAGIC));
+	_purple_binary_put_uint32(out, LOG_BINARY_VERSION);
+}
+
+static void
+log_binary_put_frame(GByteArray *out, const PurpleLogBinaryFrame *frame,
+                     const guint8 *payload)
+{
+	guint start = out->len;
+
+	_purple_binary_put_uint32(out, frame->type);
+	_purple_binary_put_uint32(out, frame->stored);
+	_purple_binary_put_uint32(out, frame->raw);
+	_purple_binary_put_uint32(out, frame->count);
+	_purple_binary_put_int64(out, frame->first);
+	_purple_binary_put_int64(out, frame->last);
+	_purple_binary_put_uint32(out, frame->compression);
+	_purple_binary_put_uint32(out,
+		log_binary_checksum(out->data + start, payload, frame->stored));
+	g_byte_array_append(out, payload, frame->stored);
+}
+
+static gboolean
+log_binary_get_frame(const guint8 *data, PurpleLogBinaryFrame *frame)
+{
+	PurpleBinaryReader reader;
+
+	reader.cur = data;
+	reader.end = data + LOG_BINARY_FRAME_SIZE;
+
+	return _purple_binary_get_uint32(&reader, &frame->type) &&
+		_purple_binary_get_uint32(&reader, &frame->stored) &&
+		_purple_binary_get_uint32(&reader, &frame->raw) &&
+		_purple_binary_get_uint32(&reader, &frame->count) &&
+		_purple_binary_get_int64(&reader, &frame->first) &&
+		_purple_binary_get_int64(&reader, &frame->last) &&
+		_purple_binary_get_uint32(&reader, &frame->compression) &&
+		_purple_binary_get_uint32(&reader, &frame->checksum);
+}
+
+/* Whether the lengths of the frame at offset can be right, before anything
+ * is allocated for them */
+static gboolean
+log_binary_frame_fits(const PurpleLogBinaryFrame *frame, gint64 offset,
+                      gint64 size)
+{
+	if (frame->stored > frame->raw ||
+			offset + LOG_BINARY_FRAME_SIZE + (gint64)frame->stored > size)
+		return FALSE;
+
+	/* a larger one is only the single message that didn't fit any block,
+	 * its length is the stored one checked above */
+	if (frame->raw > LOG_BINARY_MAX_RAW &&
+			(frame->type != LOG_BINARY_FRAME_BLOCK || frame->count != 1 ||
+			 frame->compression != LOG_BINARY_STORED))
+		return FALSE;
+
+	if (frame->compression == LOG_BINARY_STORED)
+		return frame->stored == frame->raw;
+
+	return frame->compression == LOG_BINARY_DEFLATED;
+}
+
+static PurpleLogBinaryWriter *
+log_binary_writer_new(gint64 offset)
+{
+	PurpleLogBinaryWriter *writer = g_new0(PurpleLogBinaryWriter, 1);
+
+	writer->records = g_byte_array_new();
+	writer->blocks = g_array_new(FALSE, FALSE, sizeof(PurpleLogBinaryBlock));
+	writer->offset = offset;
+
+	return writer;
+}
+
+static void
+log_binary_writer_free(PurpleLogBinaryWriter *writer)
+{
+	if (writer->timeout != 0)
+		g_source_remove(writer->timeout);
+
+	g_byte_array_free(writer->records, TRUE);
+	g_array_free(writer->blocks, TRUE);
+	g_free(writer);
+}
+
+/* Whether the message would take the block being filled past what a reader
+ * takes, so that has to be sealed first */
+static gboolean
+log_binary_writer_full(PurpleLogBinaryWriter *writer, const char *author,
+                       const char *contents)
+{
+	gsize size = LOG_BINARY_RECORD_SIZE + (author ? strlen(author) : 0) +
+		(contents ? strlen(contents) : 0);
+
+	return writer->count > 0 &&
+		writer->records->len + size > LOG_BINARY_MAX_RAW;
+}
+
+/* Adds a message to the block being filled, returns its size */
+static gsize
+log_binary_writer_add(PurpleLogBinaryWriter *writer, PurpleMessageFlags flags,
+                      gint64 when, const char *author, const char *contents)
+{
+	guint len = writer->records->len;
+	gsize author_len = author ? strlen(author) : 0;
+	gsize contents_len = contents ? strlen(contents) : 0;
+
+	/* frame lengths are 32 bits */
+	if (author_len + contents_len >
+			G_MAXUINT32 - LOG_BINARY_RECORD_SIZE - writer->records->len) {
+		purple_debug_error("log", "Message too large for a binary log\n");
 		return 0;
 	}
 
-	while ((filename = g_dir_read_name(dir)))
-	{
-		if (g_str_has_suffix(filename, ext) &&
-		    strlen(filename) >= (17 + strlen(ext))) {
-			char *tmp = g_build_filename(path, filename, NULL);
-			GStatBuf st;
-			if (g_stat(tmp, &st))
-			{
-				purple_debug_error("log", "Error stating log file: %s\n", tmp);
-				g_free(tmp);
-				continue;
-			}
-			g_free(tmp);
-			size += st.st_size;
+	_purple_binary_put_uint32(writer->records, flags);
+	_purple_binary_put_int64(writer->records, when);
+	_purple_binary_put_string(writer->records, author);
+	_purple_binary_put_string(writer->records, contents);
+
+	if (writer->count == 0) {
+		writer->first = writer->last = when;
+	} else {
+		writer->first = MIN(writer->first, when);
+		writer->last = MAX(writer->last, when);
+	}
+	writer->count++;
+
+	return writer->records->len - len;
+}
+
+/* Appends the block being filled to out, if there's anything in it */
+static void
+log_binary_writer_seal(PurpleLogBinaryWriter *writer, GByteArray *out)
+{
+	PurpleLogBinaryFrame frame;
+	PurpleLogBinaryBlock block;
+	GZlibCompressor *compressor;
+	GByteArray *deflated = NULL;
+	guint len = out->len;
+
+	if (writer->count == 0)
+		return;
+
+	/* readers only inflate blocks up to LOG_BINARY_MAX_RAW */
+	if (writer->records->len <= LOG_BINARY_MAX_RAW) {
+		compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, -1);
+		deflated = log_binary_convert_data(G_CONVERTER(compressor),
+			writer->records->data, writer->records->len,
+			writer->records->len / 2, 0);
+		g_object_unref(compressor);
+	}
+
+	frame.type = LOG_BINARY_FRAME_BLOCK;
+	frame.raw = writer->records->len;
+	frame.count = writer->count;
+	frame.first = writer->first;
+	frame.last = writer->last;
+
+	if (deflated != NULL && deflated->len < writer->records->len) {
+		frame.stored = deflated->len;
+		frame.compression = LOG_BINARY_DEFLATED;
+		log_binary_put_frame(out, &frame, deflated->data);
+	} else {
+		frame.stored = writer->records->len;
+		frame.compression = LOG_BINARY_STORED;
+		log_binary_put_frame(out, &frame, writer->records->data);
+	}
+
+	if (deflated != NULL)
+		g_byte_array_free(deflated, TRUE);
+
+	block.offset = writer->offset;
+	block.first = writer->first;
+	block.last = writer->last;
+	block.count = writer->count;
+	g_array_append_val(writer->blocks, block);
+
+	writer->offset += out->len - len;
+	g_byte_array_set_size(writer->records, 0);
+	writer->count = 0;
+}
+
+/* Appends the index of the blocks written so far to out */
+static void
+log_binary_writer_put_index(PurpleLogBinaryWriter *writer, GByteArray *out)
+{
+	PurpleLogBinaryFrame frame;
+	GByteArray *payload = g_byte_array_new();
+	guint i;
+
+	frame.type = LOG_BINARY_FRAME_INDEX;
+	frame.count = writer->blocks->len;
+	frame.first = G_MAXINT64;
+	frame.last = G_MININT64;
+	frame.compression = LOG_BINARY_STORED;
+
+	for (i = 0; i < writer->blocks->len; i++) {
+		PurpleLogBinaryBlock *block = &g_array_index(writer->blocks,
+			PurpleLogBinaryBlock, i);
+
+		_purple_binary_put_int64(payload, block->offset);
+		_purple_binary_put_int64(payload, block->first);
+		_purple_binary_put_int64(payload, block->last);
+		_purple_binary_put_uint32(payload, block->count);
+
+		frame.first = MIN(frame.first, block->first);
+		frame.last = MAX(frame.last, block->last);
+	}
+
+	_purple_binary_put_int64(payload, writer->offset);
+	g_byte_array_append(payload, (const guint8 *)LOG_BINARY_INDEX_MAGIC,
+		strlen(LOG_BINARY_INDEX_MAGIC));
+
+	frame.stored = frame.raw = payload->len;
+	log_binary_put_frame(out, &frame, payload->data);
+	g_byte_array_free(payload, TRUE);
+}
+
+/* Reads len bytes at offset, returns NULL if they aren't all there */
+static guint8 *
+log_binary_read_at(FILE *file, gint64 offset, gsize len)
+{
+	guint8 *data;
+
+	if (fseek(file, offset, SEEK_SET) != 0)
+		return NULL;
+
+	data = g_malloc(MAX(len, 1));
+	if (fread(data, 1, len, file) != len) {
+		g_free(data);
+		return NULL;
+	}
+
+	return data;
+}
+
+/* Reads the index frame at the end of the file, if there's a valid one */
+static GArray *
+log_binary_read_trailing_index(FILE *file, gint64 size)
+{
+	PurpleLogBinaryFrame frame;
+	PurpleBinaryReader reader;
+	GArray *blocks;
+	guint8 *data;
+	gint64 offset;
+	guint32 i;
+
+	if (size < LOG_BINARY_HEADER_SIZE + LOG_BINARY_FRAME_SIZE +
+			LOG_BINARY_TRAILER_SIZE)
+		return NULL;
+
+	data = log_binary_read_at(file, size - LOG_BINARY_TRAILER_SIZE,
+		LOG_BINARY_TRAILER_SIZE);
+	if (data == NULL)
+		return NULL;
+
+	reader.cur = data;
+	reader.end = data + LOG_BINARY_TRAILER_SIZE;
+	if (memcmp(data + 8, LOG_BINARY_INDEX_MAGIC, 8) != 0 ||
+			!_purple_binary_get_int64(&reader, &offset) ||
+			offset < LOG_BINARY_HEADER_SIZE ||
+			offset > size - LOG_BINARY_FRAME_SIZE - LOG_BINARY_TRAILER_SIZE) {
+		g_free(data);
+		return NULL;
+	}
+	g_free(data);
+
+	data = log_binary_read_at(file, offset, size - offset);
+	if (data == NULL)
+		return NULL;
+
+	if (!log_binary_get_frame(data, &frame) ||
+			frame.type != LOG_BINARY_FRAME_INDEX ||
+			frame.stored != size - offset - LOG_BINARY_FRAME_SIZE ||
+			frame.stored != (guint64)frame.count * LOG_BINARY_ENTRY_SIZE +
+				LOG_BINARY_TRAILER_SIZE ||
+			frame.checksum != log_binary_checksum(data,
+				data + LOG_BINARY_FRAME_SIZE, frame.stored)) {
+		g_free(data);
+		return NULL;
+	}
+
+	blocks = g_array_sized_new(FALSE, FALSE, sizeof(PurpleLogBinaryBlock),
+		frame.count);
+	reader.cur = data + LOG_BINARY_FRAME_SIZE;
+	reader.end = reader.cur + frame.stored;
+	for (i = 0; i < frame.count; i++) {
+		PurpleLogBinaryBlock block;
+
+		_purple_binary_get_int64(&reader, &block.offset);
+		_purple_binary_get_int64(&reader, &block.first);
+		_purple_binary_get_int64(&reader, &block.last);
+		_purple_binary_get_uint32(&reader, &block.count);
+
+		/* blocks can only be between the header and the index */
+		if (block.offset < LOG_BINARY_HEADER_SIZE ||
+				block.offset > offset - LOG_BINARY_FRAME_SIZE) {
+			g_array_free(blocks, TRUE);
+			g_free(data);
+			return NULL;
+		}
+
+		g_array_append_val(blocks, block);
+	}
+	g_free(data);
+
+	return blocks;
+}
+
+/* Returns where the blocks of file are, or NULL if it's no binary log. The
+ * size of the file goes into size. */
+static GArray *
+log_binary_read_index(FILE *file, gint64 *size_out)
+{
+	GArray *blocks;
+	guint8 *data;
+	gint64 size, offset;
+
+	data = log_binary_read_at(file, 0, LOG_BINARY_HEADER_SIZE);
+	if (data == NULL)
+		return NULL;
+
+	if (memcmp(data, LOG_BINARY_MAGIC, strlen(LOG_BINARY_MAGIC)) != 0 ||
+			GUINT32_FROM_LE(*(guint32 *)(data + 8)) != LOG_BINARY_VERSION) {
+		g_free(data);
+		return NULL;
+	}
+	g_free(data);
+
+	if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0)
+		return NULL;
+	*size_out = size;
+
+	blocks = log_binary_read_trailing_index(file, size);
+	if (blocks != NULL)
+		return blocks;
+
+	/* no index, hop from one frame to the next; a frame cut short by a
+	 * crash ends the log */
+	blocks = g_array_new(FALSE, FALSE, sizeof(PurpleLogBinaryBlock));
+	offset = LOG_BINARY_HEADER_SIZE;
+	while (offset + LOG_BINARY_FRAME_SIZE <= size) {
+		PurpleLogBinaryFrame frame;
+
+		data = log_binary_read_at(file, offset, LOG_BINARY_FRAME_SIZE);
+		if (data == NULL || !log_binary_get_frame(data, &frame) ||
+				!log_binary_frame_fits(&frame, offset, size)) {
+			g_free(data);
+			break;
+		}
+		g_free(data);
+
+		if (frame.type == LOG_BINARY_FRAME_BLOCK) {
+			PurpleLogBinaryBlock block;
+
+			block.offset = offset;
+			block.first = frame.first;
+			block.last = frame.last;
+			block.count = frame.count;
+			g_array_append_val(blocks, block);
 		}
+
+		offset += LOG_BINARY_FRAME_SIZE + frame.stored;
 	}
-	g_dir_close(dir);
-	g_free(path);
-	return size;
+
+	return blocks;
 }
 
-int purple_log_common_sizer(PurpleLog *log)
+/* Calls func for every message in block of the size bytes long file */
+static gboolean
+log_binary_read_block(FILE *file, gint64 size,
+                      const PurpleLogBinaryBlock *block,
+                      PurpleLogBinaryRecordFunc func, gpointer user_data)
 {
-	GStatBuf st;
-	PurpleLogCommonLoggerData *data = log->logger_data;
+	PurpleLogBinaryFrame frame;
+	PurpleBinaryReader reader;
+	GByteArray *inflated = NULL;
+	guint8 *data, *payload;
+	guint32 i;
+
+	data = log_binary_read_at(file, block->offset, LOG_BINARY_FRAME_SIZE);
+	if (data == NULL || !log_binary_get_frame(data, &frame) ||
+			frame.type != LOG_BINARY_FRAME_BLOCK ||
+			!log_binary_frame_fits(&frame, block->offset, size)) {
+		purple_debug_warning("log", "Skipping damaged log block at %"
+			G_GINT64_FORMAT "\n", block->offset);
+		g_free(data);
+		return FALSE;
+	}
+	g_free(data);
+
+	data = log_binary_read_at(file, block->offset,
+		LOG_BINARY_FRAME_SIZE + frame.stored);
+	payload = data ? data + LOG_BINARY_FRAME_SIZE : NULL;
+	if (data == NULL || frame.checksum !=
+			log_binary_checksum(data, payload, frame.stored)) {
+		purple_debug_warning("log", "Skipping damaged log block at %"
+			G_GINT64_FORMAT "\n", block->offset);
+		g_free(data);
+		return FALSE;
+	}
 
-	g_return_val_if_fail(data != NULL, 0);
+	if (frame.compression == LOG_BINARY_DEFLATED) {
+		GZlibDecompressor *decompressor =
+			g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW);
 
-	if (!data->path || g_stat(data->path, &st))
-		st.st_size = 0;
+		inflated = log_binary_convert_data(G_CONVERTER(decompressor),
+			payload, frame.stored, frame.raw, frame.raw);
+		g_object_unref(decompressor);
+		g_free(data);
 
-	return st.st_size;
-}
+		if (inflated == NULL || inflated->len != frame.raw) {
+			if (inflated != NULL)
+				g_byte_array_free(inflated, TRUE);
+			return FALSE;
+		}
 
-/* This will build log sets for all loggers that use the common logger
- * functions because they use the same directory structure. */
-static void log_get_log_sets_common(GHashTable *sets)
-{
-	gchar *log_path = g_build_filename(purple_data_dir(), "logs", NULL);
-	GDir *log_dir = g_dir_open(log_path, 0, NULL);
-	const gchar *protocol;
+		reader.cur = inflated->data;
+		reader.end = inflated->data + inflated->len;
+	} else {
+		reader.cur = payload;
+		reader.end = payload + frame.stored;
+	}
 
-	if (log_dir == NULL) {
-		g_free(log_path);
-		return;
+	for (i = 0; i < frame.count; i++) {
+		guint32 flags;
+		gint64 when;
+		const char *author, *contents;
+
+		if (!_purple_binary_get_uint32(&reader, &flags) ||
+				!_purple_binary_get_int64(&reader, &when) ||
+				!_purple_binary_get_string(&reader, &author) ||
+				!_purple_binary_get_string(&reader, &contents))
+			break;
+
+		func(flags, when, author, contents ? contents : "", user_data);
 	}
 
-	while ((protocol = g_dir_read_name(log_dir)) != NULL) {
-		gchar *protocol_path = g_build_filename(log_path, protocol, NULL);
-		GDir *protocol_dir;
-		const gchar *username;
-		gchar *protocol_unescaped;
-		GList *account_iter;
-		GList *accounts = NULL;
+	if (inflated != NULL)
+		g_byte_array_free(inflated, TRUE);
+	else
+		g_free(data);
 
-		if ((protocol_dir = g_dir_open(protocol_path, 0, NULL)) == NULL) {
-			g_free(protocol_path);
-			continue;
-		}
+	return i == frame.count;
+}
 
-		/* Using g_strdup() to cover the one-in-a-million chance that a
-		 * protocol's list_icon function uses purple_unescape_filename(). */
-		protocol_unescaped = g_strdup(purple_unescape_filename(protocol));
+/* Opens the file of a binary log and finds its blocks and size */
+static FILE *
+log_binary_open(PurpleLog *log, GArray **blocks, gint64 *size)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	FILE *file;
 
-		/* Find all the accounts for protocol. */
-		for (account_iter = purple_accounts_get_all() ; account_iter != NULL ; account_iter = account_iter->next) {
-			PurpleProtocol *protocol;
+	if (data == NULL || data->path == NULL)
+		return NULL;
 
-			protocol = purple_protocols_find(purple_account_get_protocol_id((PurpleAccount *)account_iter->data));
-			if (!protocol)
-				continue;
+	file = g_fopen(data->path, "rb");
+	if (file == NULL) {
+		purple_debug_error("log", "Unable to open %s: %s\n", data->path,
+			g_strerror(errno));
+		return NULL;
+	}
 
-			if (purple_strequal(protocol_unescaped, purple_protocol_class_list_icon(protocol, (PurpleAccount *)account_iter->data, NULL)))
-				accounts = g_list_prepend(accounts, account_iter->data);
-		}
-		g_free(protocol_unescaped);
+	*blocks = log_binary_read_index(file, size);
+	if (*blocks == NULL) {
+		purple_debug_error("log", "%s is not a binary log\n", data->path);
+		fclose(file);
+		return NULL;
+	}
 
-		while ((username = g_dir_read_name(protocol_dir)) != NULL) {
-			gchar *username_path = g_build_filename(protocol_path, username, NULL);
-			GDir *username_dir;
-			const gchar *username_unescaped;
-			PurpleAccount *account = NULL;
-			gchar *name;
+	return file;
+}
 
-			if ((username_dir = g_dir_open(username_path, 0, NULL)) == NULL) {
-				g_free(username_path);
-				continue;
-			}
+static PurpleMessage *
+log_binary_message_new(PurpleMessageFlags flags, gint64 when,
+                       const char *author, const char *contents)
+{
+	return g_object_new(PURPLE_TYPE_MESSAGE,
+		"author", author,
+		"author-alias", author,
+		"contents", contents,
+		"time", (guint64)when,
+		"flags", flags,
+		NULL);
+}
 
-			/* Find the account for username in the list of accounts for protocol. */
-			username_unescaped = purple_unescape_filename(username);
-			for (account_iter = g_list_first(accounts) ; account_iter != NULL ; account_iter = account_iter->next) {
-				if (purple_strequal(purple_account_get_username((PurpleAccount *)account_iter->data), username_unescaped)) {
-					account = account_iter->data;
-					break;
-				}
-			}
+typedef struct {
+	gint64 start;
+	gint64 end;
+	GQueue messages;
+} PurpleLogBinaryRange;
 
-			/* Don't worry about the cast, name will point to dynamically allocated memory shortly. */
-			while ((name = (gchar *)g_dir_read_name(username_dir)) != NULL) {
-				size_t len;
-				PurpleLogSet *set;
+static void
+log_binary_collect_cb(PurpleMessageFlags flags, gint64 when,
+                      const char *author, const char *contents, gpointer data)
+{
+	PurpleLogBinaryRange *range = data;
 
-				/* IMPORTANT: Always initialize all members of PurpleLogSet */
-				set = g_slice_new(PurpleLogSet);
+	if (when >= range->start && when <= range->end)
+		g_queue_push_tail(&range->messages,
+			log_binary_message_new(flags, when, author, contents));
+}
 
-				/* Unescape the filename. */
-				name = g_strdup(purple_unescape_filename(name));
+GList *
+purple_log_binary_read_range(PurpleLog *log, GDateTime *start, GDateTime *end)
+{
+	PurpleLogBinaryRange range;
+	GArray *blocks;
+	FILE *file;
+	gint64 size;
+	guint i;
 
-				/* Get the (possibly new) length of name. */
-				len = strlen(name);
+	g_return_val_if_fail(log != NULL, NULL);
+	g_return_val_if_fail(log->logger == binary_logger, NULL);
 
-				set->type = PURPLE_LOG_IM;
-				set->name = name;
-				set->account = account;
-				/* set->buddy is always set below */
-				set->normalized_name = g_strdup(purple_normalize(account, name));
+	file = log_binary_open(log, &blocks, &size);
+	if (file == NULL)
+		return NULL;
 
-				/* Check for .chat or .system at the end of the name to determine the type. */
-				if (len >= 7) {
-					gchar *tmp = &name[len - 7];
-					if (purple_strequal(tmp, ".system")) {
-						set->type = PURPLE_LOG_SYSTEM;
-						*tmp = '\0';
-					}
-				}
-				if (len > 5) {
-					gchar *tmp = &name[len - 5];
-					if (purple_strequal(tmp, ".chat")) {
-						set->type = PURPLE_LOG_CHAT;
-						*tmp = '\0';
-					}
-				}
+	range.start = start ? g_date_time_to_unix(start) : G_MININT64;
+	range.end = end ? g_date_time_to_unix(end) : G_MAXINT64;
+	g_queue_init(&range.messages);
 
-				/* Determine if this (account, name) combination exists as a buddy. */
-				if (account != NULL && *name != '\0')
-					set->buddy = (purple_blist_find_buddy(account, name) != NULL);
-				else
-					set->buddy = FALSE;
+	for (i = 0; i < blocks->len; i++) {
+		PurpleLogBinaryBlock *block = &g_array_index(blocks,
+			PurpleLogBinaryBlock, i);
 
-				log_add_log_set_to_hash(sets, set);
-			}
-			g_free(username_path);
-			g_dir_close(username_dir);
-		}
-		g_free(protocol_path);
-		g_list_free(accounts);
-		g_dir_close(protocol_dir);
+		if (block->last >= range.start && block->first <= range.end)
+			log_binary_read_block(file, size, block, log_binary_collect_cb,
+				&range);
 	}
-	g_free(log_path);
-	g_dir_close(log_dir);
+
+	g_array_free(blocks, TRUE);
+	fclose(file);
+
+	return range.messages.head;
 }
 
-gboolean purple_log_common_deleter(PurpleLog *log)
+GList *
+purple_log_binary_read_last(PurpleLog *log, guint count)
 {
-	PurpleLogCommonLoggerData *data;
-	int ret;
+	PurpleLogBinaryRange range;
+	GArray *blocks;
+	FILE *file;
+	gint64 size;
+	guint first, total = 0;
 
-	g_return_val_if_fail(log != NULL, FALSE);
+	g_return_val_if_fail(log != NULL, NULL);
+	g_return_val_if_fail(log->logger == binary_logger, NULL);
 
-	data = log->logger_data;
-	if (data == NULL)
-		return FALSE;
+	if (count == 0)
+		return NULL;
 
-	if (data->path == NULL)
-		return FALSE;
+	file = log_binary_open(log, &blocks, &size);
+	if (file == NULL)
+		return NULL;
 
-	ret = g_unlink(data->path);
-	if (ret == 0)
-		return TRUE;
-	else if (ret == -1)
-	{
-		purple_debug_error("log", "Failed to delete: %s - %s\n", data->path, g_strerror(errno));
+	/* walk back until the blocks hold enough messages */
+	first = blocks->len;
+	while (first > 0 && total < count) {
+		first--;
+		total += g_array_index(blocks, PurpleLogBinaryBlock, first).count;
 	}
-	else
-	{
-		/* I'm not sure that g_unlink() will ever return
-		 * something other than 0 or -1. -- rlaager */
-		purple_debug_error("log", "Failed to delete: %s\n", data->path);
+
+	range.start = G_MININT64;
+	range.end = G_MAXINT64;
+	g_queue_init(&range.messages);
+
+	for (; first < blocks->len; first++) {
+		log_binary_read_block(file, size,
+			&g_array_index(blocks, PurpleLogBinaryBlock, first),
+			log_binary_collect_cb, &range);
 	}
 
-	return FALSE;
+	while (range.messages.length > count)
+		g_object_unref(g_queue_pop_head(&range.messages));
+
+	g_array_free(blocks, TRUE);
+	fclose(file);
+
+	return range.messages.head;
 }
 
-gboolean purple_log_common_is_deletable(PurpleLog *log)
+/* Hands the block being filled to the log writer */
+static void
+log_binary_flush(PurpleLog *log)
 {
-	PurpleLogCommonLoggerData *data;
-#ifndef _WIN32
-	gchar *dirname;
-#endif
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	PurpleLogBinaryWriter *writer = data->extra_data;
+	GByteArray *out;
+	guint32 count = writer->count;
+	guint len;
+
+	if (writer->timeout != 0) {
+		g_source_remove(writer->timeout);
+		writer->timeout = 0;
+	}
 
-	g_return_val_if_fail(log != NULL, FALSE);
+	if (count == 0)
+		return;
 
-	data = log->logger_data;
-	if (data == NULL)
-		return FALSE;
+	out = g_byte_array_new();
+	log_binary_writer_seal(writer, out);
+	len = out->len;
 
-	if (data->path == NULL)
-		return FALSE;
+	log_meta_file_written(data->path, len, count);
+	log_writer_push(LOG_WRITER_WRITE, data->file,
+		(gchar *)g_byte_array_free(out, FALSE), len);
+}
 
-#ifndef _WIN32
-	dirname = g_path_get_dirname(data->path);
-	if (g_access(dirname, W_OK) == 0)
-	{
-		g_free(dirname);
-		return TRUE;
-	}
-	purple_debug_info("log", "access(%s) failed: %s\n", dirname, g_strerror(errno));
-	g_free(dirname);
-#else
-	/* Unless and until someone writes equivalent win32 code,
-	 * we'll assume the file is deletable. */
-	return TRUE;
-#endif
+static gboolean
+log_binary_flush_timeout(gpointer data)
+{
+	PurpleLog *log = data;
+	PurpleLogCommonLoggerData *common = log->logger_data;
+	PurpleLogBinaryWriter *writer = common->extra_data;
 
-	return FALSE;
+	writer->timeout = 0;
+	log_binary_flush(log);
+
+	return G_SOURCE_REMOVE;
 }
 
-static char *process_txt_log(char *txt, char *to_free)
+static PurpleLogBinaryWriter *
+log_binary_writer_open(PurpleLogCommonLoggerData *data)
 {
-	char *tmp;
+	PurpleLogBinaryWriter *writer;
+	GStatBuf st;
 
-	/* The to_free argument allows us to save a
-	 * g_strdup() in some cases. */
+	if (g_stat(data->path, &st) == 0 && st.st_size > 0) {
+		/* Appending to a log that's already there, its blocks go into
+		 * our index as well. */
+		FILE *file = g_fopen(data->path, "rb");
+		gint64 size;
+		GArray *blocks = file ? log_binary_read_index(file, &size) : NULL;
+
+		writer = log_binary_writer_new(st.st_size);
+		if (blocks != NULL) {
+			g_array_append_vals(writer->blocks, blocks->data, blocks->len);
+			g_array_free(blocks, TRUE);
+		}
+		if (file != NULL)
+			fclose(file);
+	} else {
+		GByteArray *out = g_byte_array_new();
+		guint len;
 
-	if (to_free == NULL)
-		to_free = txt;
+		log_binary_put_header(out);
+		len = out->len;
+		writer = log_binary_writer_new(len);
 
-	/* g_markup_escape_text requires valid UTF-8 */
-	if (!g_utf8_validate(txt, -1, NULL))
-	{
-		tmp = purple_utf8_salvage(txt);
-		g_free(to_free);
-		to_free = txt = tmp;
+		log_meta_file_written(data->path, len, 0);
+		log_writer_push(LOG_WRITER_WRITE, data->file,
+			(gchar *)g_byte_array_free(out, FALSE), len);
 	}
 
-	tmp = g_markup_escape_text(txt, -1);
-	g_free(to_free);
-	txt = purple_markup_linkify(tmp);
-	g_free(tmp);
-
-	return txt;
+	return writer;
 }
 
-/****************************
- ** HTML LOGGER *************
- ****************************/
-
-static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
-                               const char *from, GDateTime *time, const char *message)
+static gsize binary_logger_write(PurpleLog *log, PurpleMessageFlags type,
+                                 const char *from, GDateTime *time, const char *message)
 {
-	char *msg_fixed;
-	char *image_corrected_msg;
-	char *date;
-	char *header;
-	char *escaped_from;
-	PurpleProtocol *protocol =
-			purple_protocols_find(purple_account_get_protocol_id(log->account));
 	PurpleLogCommonLoggerData *data = log->logger_data;
-	gsize written = 0;
+	PurpleLogBinaryWriter *writer;
+	char *image_corrected_msg;
+	char *msg_fixed;
+	gsize len;
 
-	if(!data) {
-		const char *proto = purple_protocol_class_list_icon(protocol, log->account, NULL);
-		GDateTime *dt;
-		gchar *date;
-		purple_log_common_writer(log, ".html");
+	if (data == NULL) {
+		purple_log_common_writer(log, LOG_BINARY_EXT);
 
 		data = log->logger_data;
 
 		/* if we can't write to the file, give up before we hurt ourselves */
-		if (!data || !data->file) {
+		if (!data || !data->file)
 			return 0;
-		}
-
-		dt = g_date_time_to_local(log->time);
-		date = g_date_time_format(dt, "%c");
-		g_date_time_unref(dt);
-
-		written += fprintf(data->file, "<html><head>");
-		written += fprintf(data->file, "<meta http-equiv=\"content-type\" content=\"text/html; charset=UTF-8\">");
-		written += fprintf(data->file, "<title>");
-		if (log->type == PURPLE_LOG_SYSTEM)
-			header = g_strdup_printf("System log for account %s (%s) connected at %s",
-					purple_account_get_username(log->account), proto, date);
-		else
-			header = g_strdup_printf("Conversation with %s at %s on %s (%s)",
-					log->name, date, purple_account_get_username(log->account), proto);
 
-		written += fprintf(data->file, "%s", header);
-		written += fprintf(data->file, "</title></head><body>");
-		written += fprintf(data->file, "<h3>%s</h3>\n", header);
-		g_free(date);
-		g_free(header);
+		data->extra_data = log_binary_writer_open(data);
 	}
 
-	/* if we can't write to the file, give up before we hurt ourselves */
-	if(!data->file)
+	if (!data->file)
 		return 0;
 
-	escaped_from = g_markup_escape_text(from != NULL ? from : "<NULL>",
-			-1);
+	writer = data->extra_data;
 
 	image_corrected_msg = convert_image_tags(log, message);
 	purple_markup_html_to_xhtml(image_corrected_msg, &msg_fixed, NULL);
-
-	/* Yes, this breaks encapsulation.  But it's a static function and
-	 * this saves a needless strdup(). */
 	if (image_corrected_msg != message)
 		g_free(image_corrected_msg);
 
-	date = log_get_timestamp(log, time);
-
-	if(log->type == PURPLE_LOG_SYSTEM){
-		written += fprintf(data->file, "---- %s @ %s ----<br/>\n", msg_fixed, date);
-	} else {
-		if (type & PURPLE_MESSAGE_SYSTEM)
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font><b> %s</b><br/>\n", date, msg_fixed);
-		else if (type & PURPLE_MESSAGE_RAW)
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font> %s<br/>\n", date, msg_fixed);
-		else if (type & PURPLE_MESSAGE_ERROR)
-			written += fprintf(data->file, "<font color=\"#FF0000\"><font size=\"2\">(%s)</font><b> %s</b></font><br/>\n", date, msg_fixed);
-		else if (type & PURPLE_MESSAGE_AUTO_RESP) {
-			if (type & PURPLE_MESSAGE_SEND)
-				written += fprintf(data->file, _("<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, escaped_from, msg_fixed);
-			else if (type & PURPLE_MESSAGE_RECV)
-				written += fprintf(data->file, _("<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, escaped_from, msg_fixed);
-		} else if (type & PURPLE_MESSAGE_RECV) {
-			if(purple_message_meify(msg_fixed, -1))
-				written += fprintf(data->file, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
-						date, escaped_from, msg_fixed);
-			else
-				written += fprintf(data->file, "<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
-						date, escaped_from, msg_fixed);
-		} else if (type & PURPLE_MESSAGE_SEND) {
-			if(purple_message_meify(msg_fixed, -1))
-				written += fprintf(data->file, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
-						date, escaped_from, msg_fixed);
-			else
-				written += fprintf(data->file, "<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
-						date, escaped_from, msg_fixed);
-		} else {
-			purple_debug_error("log", "Unhandled message type.\n");
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n",
-						date, escaped_from, msg_fixed);
-		}
-	}
-	g_free(date);
+	if (log_binary_writer_full(writer, from, msg_fixed))
+		log_binary_flush(log);
+	len = log_binary_writer_add(writer, type, g_date_time_to_unix(time),
+		from, msg_fixed);
 	g_free(msg_fixed);
-	g_free(escaped_from);
-	fflush(data->file);
 
-	return written;
+	if (writer->records->len >= LOG_BINARY_BLOCK_SIZE)
+		log_binary_flush(log);
+	else if (writer->timeout == 0)
+		writer->timeout = g_timeout_add_seconds(LOG_BINARY_BLOCK_AGE,
+			log_binary_flush_timeout, log);
+
+	return len;
 }
 
-static void html_logger_finalize(PurpleLog *log)
+static void binary_logger_finalize(PurpleLog *log)
 {
 	PurpleLogCommonLoggerData *data = log->logger_data;
-	if (data) {
-		if(data->file) {
-			fprintf(data->file, "</body></html>\n");
-			fclose(data->file);
-		}
-		g_free(data->path);
+	PurpleLogBinaryWriter *writer;
 
-		g_slice_free(PurpleLogCommonLoggerData, data);
+	if (data == NULL)
+		return;
+
+	writer = data->extra_data;
+	if (writer != NULL) {
+		GByteArray *out = g_byte_array_new();
+		guint len;
+
+		log_binary_flush(log);
+		if (writer->blocks->len > 0)
+			log_binary_writer_put_index(writer, out);
+		len = out->len;
+
+		log_meta_file_written(data->path, len, 0);
+		log_writer_push(LOG_WRITER_CLOSE, data->file,
+			(gchar *)g_byte_array_free(out, FALSE), len);
+		log_binary_writer_free(writer);
+	} else if (data->file) {
+		log_writer_push(LOG_WRITER_CLOSE, data->file, NULL, 0);
 	}
+	g_free(data->path);
+
+	g_slice_free(PurpleLogCommonLoggerData, data);
 }
 
-static GList *html_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account)
+static GList *binary_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account)
 {
-	return purple_log_common_lister(type, sn, account, ".html", html_logger);
+	return purple_log_common_lister(type, sn, account, LOG_BINARY_EXT, binary_logger);
 }
 
-static GList *html_logger_list_syslog(PurpleAccount *account)
+static GList *binary_logger_list_syslog(PurpleAccount *account)
 {
-	return purple_log_common_lister(PURPLE_LOG_SYSTEM, ".system", account, ".html", html_logger);
+	return purple_log_common_lister(PURPLE_LOG_SYSTEM, ".system", account, LOG_BINARY_EXT, binary_logger);
 }
 
-static char *html_logger_read(PurpleLog *log, PurpleLogReadFlags *flags)
+typedef struct {
+	PurpleLog *log;
+	GString *out;
+	GDateTime *start;  /* of the log, local time */
+} PurpleLogBinaryFormat;
+
+static void
+log_binary_format_cb(PurpleMessageFlags flags, gint64 when,
+                     const char *author, const char *contents, gpointer data)
+{
+	PurpleLogBinaryFormat *format = data;
+	GDateTime *dt = g_date_time_new_from_unix_local(when);
+	char *date, *escaped_from, *msg_fixed;
+
+	/* like log_get_timestamp(), but the date is only needed once the day
+	 * changed since the log started */
+	if (format->log->type == PURPLE_LOG_SYSTEM ||
+			g_date_time_get_year(dt) != g_date_time_get_year(format->start) ||
+			g_date_time_get_day_of_year(dt) !=
+				g_date_time_get_day_of_year(format->start))
+		date = g_date_time_format(dt, _("%x %X"));
+	else
+		date = g_date_time_format(dt, "%X");
+	g_date_time_unref(dt);
+
+	escaped_from = g_markup_escape_text(author != NULL ? author : "<NULL>",
+			-1);
+	msg_fixed = g_strdup(contents);
+
+	log_html_format_message(format->out, format->log, flags, date,
+		escaped_from, msg_fixed);
+
+	g_free(date);
+	g_free(escaped_from);
+	g_free(msg_fixed);
+}
+
+static char *binary_logger_read(PurpleLog *log, PurpleLogReadFlags *flags)
 {
-	char *read;
 	PurpleLogCommonLoggerData *data = log->logger_data;
+	PurpleLogBinaryFormat format;
+	GArray *blocks;
+	FILE *file;
+	gint64 size;
+	guint i;
+
 	*flags = PURPLE_LOG_READ_NO_NEWLINE;
 	if (!data || !data->path)
 		return g_strdup(_("<font color=\"red\"><b>Unable to find log path!</b></font>"));
-	if (g_file_get_contents(data->path, &read, NULL, NULL)) {
-		char *minus_header = strchr(read, '\n');
 
-		if (!minus_header)
-			return read;
+	file = log_binary_open(log, &blocks, &size);
+	if (file == NULL)
+		return g_strdup_printf(_("<font color=\"red\"><b>Could not read file: %s</b></font>"), data->path);
 
-		minus_header = g_strdup(minus_header + 1);
-		g_free(read);
+	format.log = log;
+	format.out = g_string_new(NULL);
+	format.start = g_date_time_to_local(log->time);
 
-		return minus_header;
+	for (i = 0; i < blocks->len; i++) {
+		log_binary_read_block(file, size,
+			&g_array_index(blocks, PurpleLogBinaryBlock, i),
+			log_binary_format_cb, &format);
 	}
-	return g_strdup_printf(_("<font color=\"red\"><b>Could not read file: %s</b></font>"), data->path);
+
+	g_date_time_unref(format.start);
+	g_array_free(blocks, TRUE);
+	fclose(file);
+
+	return g_string_free(format.out, FALSE);
 }
 
-static int html_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account)
+static int binary_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account)
 {
-	return purple_log_common_total_sizer(type, name, account, ".html");
+	return purple_log_common_total_sizer(type, name, account, LOG_BINARY_EXT);
 }
 
+/* Converting html and txt logs */
 
-/****************************
- ** PLAIN TEXT LOGGER *******
- ****************************/
+typedef struct {
+	PurpleLog *log;
+	PurpleLogBinaryWriter *writer;
+	GByteArray *out;
+	GRegex *time_regex;
+	GDateTime *last;       /* time of the previous message, local time */
+
+	/* the message being parsed, until the next one starts */
+	PurpleMessageFlags flags;
+	gint64 when;
+	char *author;
+	GString *contents;     /* NULL if there's none */
+} PurpleLogBinaryConverter;
 
-static gsize txt_logger_write(PurpleLog *log, PurpleMessageFlags type,
-                              const char *from, GDateTime *time, const char *message)
+static void
+log_binary_convert_end(PurpleLogBinaryConverter *conv)
 {
-	char *date;
-	PurpleProtocol *protocol =
-			purple_protocols_find(purple_account_get_protocol_id(log->account));
-	PurpleLogCommonLoggerData *data = log->logger_data;
-	char *stripped = NULL;
+	if (conv->contents == NULL)
+		return;
+
+	if (log_binary_writer_full(conv->writer, conv->author,
+			conv->contents->str))
+		log_binary_writer_seal(conv->writer, conv->out);
+	log_binary_writer_add(conv->writer, conv->flags, conv->when,
+		conv->author, conv->contents->str);
+	if (conv->writer->records->len >= LOG_BINARY_BLOCK_SIZE)
+		log_binary_writer_seal(conv->writer, conv->out);
+
+	g_free(conv->author);
+	conv->author = NULL;
+	g_string_free(conv->contents, TRUE);
+	conv->contents = NULL;
+}
 
-	gsize written = 0;
+/* Turns a timestamp written by log_get_timestamp() back into a time. It's
+ * either "%X" or "%x %X", in whatever locale the log was written in. */
+static gint64
+log_binary_convert_time(PurpleLogBinaryConverter *conv, const char *stamp)
+{
+	GMatchInfo *info = NULL;
+	GDateTime *dt;
+	gchar *match;
+	gint year, month, day, hour, minute, second = 0;
+	gint start;
+	gboolean dated = FALSE;
+
+	if (!g_regex_match(conv->time_regex, stamp, 0, &info)) {
+		g_match_info_free(info);
+		return g_date_time_to_unix(conv->last);
+	}
 
-	if (data == NULL) {
-		/* This log is new.  We could use the loggers 'new' function, but
-		 * creating a new file there would result in empty files in the case
-		 * that you open a convo with someone, but don't say anything.
-		 */
-		const char *proto = purple_protocol_class_list_icon(protocol, log->account, NULL);
-		GDateTime *dt;
-		gchar *date;
-		purple_log_common_writer(log, ".txt");
+	match = g_match_info_fetch(info, 1);
+	hour = atoi(match);
+	g_free(match);
+	match = g_match_info_fetch(info, 2);
+	minute = atoi(match);
+	g_free(match);
+	match = g_match_info_fetch(info, 3);
+	if (match != NULL && *match != '\0')
+		second = atoi(match);
+	g_free(match);
+	match = g_match_info_fetch(info, 4);
+	if (match != NULL && *match != '\0') {
+		if (g_ascii_tolower(*match) == 'p' && hour < 12)
+			hour += 12;
+		else if (g_ascii_tolower(*match) == 'a' && hour == 12)
+			hour = 0;
+	}
+	g_free(match);
+
+	g_match_info_fetch_pos(info, 0, &start, NULL);
+	g_match_info_free(info);
+
+	g_date_time_get_ymd(conv->last, &year, &month, &day);
+	if (start > 0) {
+		gchar *date = g_strstrip(g_strndup(stamp, start));
+		GDate *parsed = g_date_new();
+
+		g_date_set_parse(parsed, date);
+		if (g_date_valid(parsed)) {
+			year = g_date_get_year(parsed);
+			month = g_date_get_month(parsed);
+			day = g_date_get_day(parsed);
+			dated = TRUE;
+		}
+		g_date_free(parsed);
+		g_free(date);
+	}
 
-		data = log->logger_data;
+	dt = g_date_time_new_local(year, month, day, hour, minute, second);
+	if (dt == NULL)
+		return g_date_time_to_unix(conv->last);
 
-		/* if we can't write to the file, give up before we hurt ourselves */
-		if(!data || !data->file)
-			return 0;
+	/* Without a date, going back in time by more than a bit means we
+	 * went past midnight. */
+	if (!dated && g_date_time_difference(conv->last, dt) > G_TIME_SPAN_HOUR) {
+		GDateTime *next = g_date_time_add_days(dt, 1);
 
-		dt = g_date_time_to_local(log->time);
-		date = g_date_time_format(dt, "%c");
-		if (log->type == PURPLE_LOG_SYSTEM)
-			written += fprintf(data->file, "System log for account %s (%s) connected at %s\n",
-				purple_account_get_username(log->account), proto,
-				date);
-		else
-			written += fprintf(data->file, "Conversation with %s at %s on %s (%s)\n",
-				log->name, date,
-				purple_account_get_username(log->account), proto);
-		g_free(date);
 		g_date_time_unref(dt);
+		dt = next;
 	}
 
-	/* if we can't write to the file, give up before we hurt ourselves */
-	if(!data->file)
-		return 0;
+	g_date_time_unref(conv->last);
+	conv->last = dt;
 
-	stripped = purple_markup_strip_html(message);
-	date = log_get_timestamp(log, time);
+	return g_date_time_to_unix(dt);
+}
 
-	if(log->type == PURPLE_LOG_SYSTEM){
-		written += fprintf(data->file, "---- %s @ %s ----\n", stripped, date);
-	} else {
-		if (type & PURPLE_MESSAGE_SEND ||
-			type & PURPLE_MESSAGE_RECV) {
-			if (type & PURPLE_MESSAGE_AUTO_RESP) {
-				written += fprintf(data->file, _("(%s) %s <AUTO-REPLY>: %s\n"), date,
-						from, stripped);
-			} else {
-				if(purple_message_meify(stripped, -1))
-					written += fprintf(data->file, "(%s) ***%s %s\n", date, from,
-							stripped);
-				else
-					written += fprintf(data->file, "(%s) %s: %s\n", date, from,
-							stripped);
-			}
-		} else if (type & PURPLE_MESSAGE_SYSTEM ||
-			type & PURPLE_MESSAGE_ERROR ||
-			type & PURPLE_MESSAGE_RAW)
-			written += fprintf(data->file, "(%s) %s\n", date, stripped);
-		else if (type & PURPLE_MESSAGE_NO_LOG) {
-			/* This shouldn't happen */
-			g_free(stripped);
-			return written;
-		} else
-			written += fprintf(data->file, "(%s) %s%s %s\n", date, from ? from : "",
-					from ? ":" : "", stripped);
-	}
-	g_free(date);
-	g_free(stripped);
-	fflush(data->file);
+static void
+log_binary_convert_begin(PurpleLogBinaryConverter *conv,
+                         PurpleMessageFlags flags, const char *stamp,
+                         const char *author, const char *contents)
+{
+	log_binary_convert_end(conv);
 
-	return written;
+	conv->flags = flags;
+	conv->when = log_binary_convert_time(conv, stamp);
+	conv->author = g_strdup(author);
+	conv->contents = g_string_new(contents);
 }
 
-static void txt_logger_finalize(PurpleLog *log)
+/* Lines that don't start a message continue the previous one */
+static void
+log_binary_convert_continue(PurpleLogBinaryConverter *conv,
+                            const char *contents)
 {
-	PurpleLogCommonLoggerData *data = log->logger_data;
-	if (data) {
-		if(data->file)
-			fclose(data->file);
-		g_free(data->path);
+	if (conv->contents == NULL)
+		return;
 
-		g_slice_free(PurpleLogCommonLoggerData, data);
-	}
+	g_string_append(conv->contents, "<br/>");
+	g_string_append(conv->contents, contents);
 }
 
-static GList *txt_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account)
+/* Which way a message went, if the log doesn't say */
+static PurpleMessageFlags
+log_binary_convert_direction(PurpleLogBinaryConverter *conv,
+                             const char *author)
 {
-	return purple_log_common_lister(type, sn, account, ".txt", txt_logger);
+	PurpleAccount *account = conv->log->account;
+
+	if (account != NULL && author != NULL &&
+			(purple_strequal(author, purple_account_get_username(account)) ||
+			 purple_strequal(author, purple_account_get_private_alias(account))))
+		return PURPLE_MESSAGE_SEND;
+
+	return PURPLE_MESSAGE_RECV;
 }
 
-static GList *txt_logger_list_syslog(PurpleAccount *account)
+/* "---- message @ time ----", the format of system logs */
+static gboolean
+log_binary_convert_system(PurpleLogBinaryConverter *conv, char *line)
 {
-	return purple_log_common_lister(PURPLE_LOG_SYSTEM, ".system", account, ".txt", txt_logger);
+	char *at;
+
+	if (conv->log->type != PURPLE_LOG_SYSTEM ||
+			!g_str_has_prefix(line, "---- ") || !g_str_has_suffix(line, " ----"))
+		return FALSE;
+
+	line[strlen(line) - strlen(" ----")] = '\0';
+	at = g_strrstr(line, " @ ");
+	if (at == NULL)
+		return FALSE;
+
+	*at = '\0';
+	log_binary_convert_begin(conv, PURPLE_MESSAGE_SYSTEM, at + strlen(" @ "),
+		NULL, line + strlen("---- "));
+
+	return TRUE;
 }
 
-static char *txt_logger_read(PurpleLog *log, PurpleLogReadFlags *flags)
+/* Parses a line the way html_logger_write() writes it */
+static void
+log_binary_convert_html_line(PurpleLogBinaryConverter *conv, char *line)
 {
-	char *read, *minus_header;
-	PurpleLogCommonLoggerData *data = log->logger_data;
-	*flags = 0;
-	if (!data || !data->path)
-		return g_strdup(_("<font color=\"red\"><b>Unable to find log path!</b></font>"));
-	if (g_file_get_contents(data->path, &read, NULL, NULL)) {
-		minus_header = strchr(read, '\n');
+	const char *font = "<font size=\"2\">(";
+	PurpleMessageFlags flags;
+	char *color = NULL;
+	char *rest, *end, *stamp, *author, *contents, *escaped;
 
-		if (minus_header)
-			return process_txt_log(minus_header + 1, read);
-		else
-			return process_txt_log(read, NULL);
+	if (g_str_has_suffix(line, "<br/>"))
+		line[strlen(line) - strlen("<br/>")] = '\0';
+
+	if (*line == '\0' || purple_strequal(line, "</body></html>"))
+		return;
+
+	if (log_binary_convert_system(conv, line))
+		return;
+
+	rest = line;
+	if (g_str_has_prefix(line, "<font color=\"#") && strlen(line) > 22 &&
+			line[20] == '"' && line[21] == '>') {
+		color = line + 13;
+		line[20] = '\0';
+		rest = line + 22;
 	}
-	return g_strdup_printf(_("<font color=\"red\"><b>Could not read file: %s</b></font>"), data->path);
+
+	if (!g_str_has_prefix(rest, font) ||
+			(end = strstr(rest, ")</font>")) == NULL) {
+		if (color != NULL)
+			line[20] = '"';
+		log_binary_convert_continue(conv, line);
+		return;
+	}
+
+	stamp = rest + strlen(font);
+	*end = '\0';
+	rest = end + strlen(")</font>");
+
+	if (color == NULL) {
+		if (g_str_has_prefix(rest, "<b> ") && g_str_has_suffix(rest, "</b>")) {
+			rest[strlen(rest) - strlen("</b>")] = '\0';
+			log_binary_convert_begin(conv, PURPLE_MESSAGE_SYSTEM, stamp, NULL,
+				rest + strlen("<b> "));
+		} else {
+			log_binary_convert_begin(conv, PURPLE_MESSAGE_RAW, stamp, NULL,
+				*rest == ' ' ? rest + 1 : rest);
+		}
+		return;
+	}
+
+	if (g_ascii_strcasecmp(color, "#FF0000") == 0) {
+		if (g_str_has_prefix(rest, "<b> "))
+			rest += strlen("<b> ");
+		if (g_str_has_suffix(rest, "</b></font>"))
+			rest[strlen(rest) - strlen("</b></font>")] = '\0';
+		log_binary_convert_begin(conv, PURPLE_MESSAGE_ERROR, stamp, NULL,
+			rest);
+		return;
+	}
+
+	/* " <b>author:</b></font> message" or " <b>***author</b></font> message" */
+	if (!g_str_has_prefix(rest, " <b>") ||
+			(end = strstr(rest, "</b></font>")) == NULL) {
+		log_binary_convert_begin(conv, PURPLE_MESSAGE_RAW, stamp, NULL, rest);
+		return;
+	}
+
+	escaped = rest + strlen(" <b>");
+	*end = '\0';
+	contents = end + strlen("</b></font>");
+	if (*contents == ' ')
+		contents++;
+
+	flags = 0;
+	if (g_str_has_prefix(escaped, "***")) {
+		escaped += strlen("***");
+		contents = g_strconcat("/me ", contents, NULL);
+	} else {
+		if (g_str_has_suffix(escaped, ":"))
+			escaped[strlen(escaped) - 1] = '\0';
+		if (g_str_has_suffix(escaped, " &lt;AUTO-REPLY&gt;")) {
+			escaped[strlen(escaped) - strlen(" &lt;AUTO-REPLY&gt;")] = '\0';
+			flags |= PURPLE_MESSAGE_AUTO_RESP;
+		}
+		contents = g_strdup(contents);
+	}
+
+	author = purple_unescape_html(escaped);
+	if (g_ascii_strcasecmp(color, "#16569E") == 0)
+		flags |= PURPLE_MESSAGE_SEND;
+	else if (g_ascii_strcasecmp(color, "#A82F2F") == 0)
+		flags |= PURPLE_MESSAGE_RECV;
+	else
+		flags |= log_binary_convert_direction(conv, author);
+
+	log_binary_convert_begin(conv, flags, stamp, author, contents);
+	g_free(author);
+	g_free(contents);
 }
 
-static int txt_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account)
+/* Parses a line the way txt_logger_write() writes it */
+static void
+log_binary_convert_txt_line(PurpleLogBinaryConverter *conv, char *line)
 {
-	return purple_log_common_total_sizer(type, name, account, ".txt");
+	PurpleMessageFlags flags = 0;
+	char *end, *stamp, *rest, *sep;
+	char *author = NULL, *contents, *escaped;
+
+	if (log_binary_convert_system(conv, line)) {
+		/* the message went in unescaped */
+		escaped = g_markup_escape_text(conv->contents->str, -1);
+		g_string_assign(conv->contents, escaped);
+		g_free(escaped);
+		return;
+	}
+
+	if (*line != '(' || (end = strstr(line, ") ")) == NULL) {
+		escaped = g_markup_escape_text(line, -1);
+		log_binary_convert_continue(conv, escaped);
+		g_free(escaped);
+		return;
+	}
+
+	stamp = line + 1;
+	*end = '\0';
+	rest = end + strlen(") ");
+
+	if (g_str_has_prefix(rest, "***")) {
+		author = rest + strlen("***");
+		sep = strchr(author, ' ');
+		if (sep != NULL)
+			*sep = '\0';
+		contents = g_strconcat("/me ", sep ? sep + 1 : "", NULL);
+		flags = log_binary_convert_direction(conv, author);
+	} else if ((sep = strstr(rest, " <AUTO-REPLY>: ")) != NULL) {
+		author = rest;
+		*sep = '\0';
+		contents = g_strdup(sep + strlen(" <AUTO-REPLY>: "));
+		flags = PURPLE_MESSAGE_AUTO_RESP |
+			log_binary_convert_direction(conv, author);
+	} else if ((sep = strstr(rest, ": ")) != NULL && sep != rest) {
+		author = rest;
+		*sep = '\0';
+		contents = g_strdup(sep + strlen(": "));
+		flags = log_binary_convert_direction(conv, author);
+	} else {
+		contents = g_strdup(rest);
+		flags = PURPLE_MESSAGE_SYSTEM;
+	}
+
+	escaped = g_markup_escape_text(contents, -1);
+	log_binary_convert_begin(conv, flags, stamp, author, escaped);
+	g_free(escaped);
+	g_free(contents);
+}
+
+PurpleLog *
+purple_log_binary_convert(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data;
+	PurpleLogBinaryConverter conv;
+	PurpleLog *converted;
+	GError *error = NULL;
+	gchar *text, *path, *dot, **lines;
+	gboolean html;
+	guint i;
+
+	g_return_val_if_fail(log != NULL, NULL);
+	g_return_val_if_fail(log->logger == html_logger ||
+		log->logger == txt_logger, NULL);
+
+	data = log->logger_data;
+	if (data == NULL || data->path == NULL)
+		return NULL;
+
+	path = g_strdup(data->path);
+	dot = strrchr(path, '.');
+	if (dot != NULL && strchr(dot, G_DIR_SEPARATOR) == NULL)
+		*dot = '\0';
+	dot = path;
+	path = g_strconcat(dot, LOG_BINARY_EXT, NULL);
+	g_free(dot);
+
+	if (g_file_test(path, G_FILE_TEST_EXISTS)) {
+		purple_debug_error("log", "Not converting %s, %s already exists\n",
+			data->path, path);
+		g_free(path);
+		return NULL;
+	}
+
+	if (!g_file_get_contents(data->path, &text, NULL, &error)) {
+		purple_debug_error("log", "Unable to read %s: %s\n", data->path,
+			error->message);
+		g_error_free(error);
+		g_free(path);
+		return NULL;
+	}
+
+	html = (log->logger == html_logger);
+
+	conv.log = log;
+	conv.out = g_byte_array_new();
+	log_binary_put_header(conv.out);
+	conv.writer = log_binary_writer_new(conv.out->len);
+	conv.time_regex = g_regex_new(
+		"(\\d{1,2}):(\\d{2})(?::(\\d{2}))?(?:\\s*([AaPp])\\.?[Mm]\\.?)?\\s*$",
+		G_REGEX_OPTIMIZE, 0, NULL);
+	conv.last = g_date_time_new_from_unix_local(
+		g_date_time_to_unix(log->time));
+	conv.author = NULL;
+	conv.contents = NULL;
+
+	/* the first line is the header */
+	lines = g_strsplit(text, "\n", -1);
+	g_free(text);
+	for (i = 1; lines[0] != NULL && lines[i] != NULL; i++) {
+		/* the newline ending the last message */
+		if (lines[i + 1] == NULL && *lines[i] == '\0')
+			break;
+
+		g_strchomp(lines[i]);
+		if (html)
+			log_binary_convert_html_line(&conv, lines[i]);
+		else
+			log_binary_convert_txt_line(&conv, lines[i]);
+	}
+	g_strfreev(lines);
+
+	log_binary_convert_end(&conv);
+	log_binary_writer_seal(conv.writer, conv.out);
+	if (conv.writer->blocks->len > 0)
+		log_binary_writer_put_index(conv.writer, conv.out);
+
+	converted = NULL;
+	if (purple_util_write_data_to_file_absolute(path,
+			(const gchar *)conv.out->data, conv.out->len)) {
+		PurpleLogCommonLoggerData *converted_data;
+
+		converted = purple_log_new(log->type, log->name, log->account, NULL,
+			log->time);
+		converted->logger = binary_logger;
+		converted->logger_data = converted_data =
+			g_slice_new0(PurpleLogCommonLoggerData);
+		converted_data->path = path;
+		path = NULL;
+	}
+
+	g_free(path);
+	g_date_time_unref(conv.last);
+	g_regex_unref(conv.time_regex);
+	log_binary_writer_free(conv.writer);
+	g_byte_array_free(conv.out, TRUE);
+
+	return converted;
 }
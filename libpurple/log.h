@@ -317,6 +317,17 @@ GList *purple_log_get_system_logs(PurpleAccount *account);
  */
 int purple_log_get_size(PurpleLog *log);
 
+/**
+ * purple_log_get_message_count:
+ * @log:                 The log
+ *
+ * Returns the number of messages in a log. This is only known for html and
+ * txt logs written since their message counts have been kept track of.
+ *
+ * Returns:                    The number of messages, or -1 if unknown
+ */
+gint purple_log_get_message_count(PurpleLog *log);
+
 /**
  * purple_log_get_total_size:
  * @type:                The type of the log
@@ -527,6 +538,57 @@ gboolean purple_log_common_deleter(PurpleLog *log);
  */
 gboolean purple_log_common_is_deletable(PurpleLog *log);
 
+/******************************************/
+/* Binary Log Functions                   */
+/******************************************/
+
+/**
+ * purple_log_binary_read_range:
+ * @log:   (transfer none): A log written by the binary logger.
+ * @start: (nullable): The earliest message to return, or %NULL for no limit.
+ * @end:   (nullable): The latest message to return, or %NULL for no limit.
+ *
+ * Reads the messages of @log sent between @start and @end. Only the parts
+ * of the log holding them are read and decompressed.
+ *
+ * Messages of a log that is still being written show up once they've been
+ * written to disk, which happens in blocks.
+ *
+ * Returns: (element-type PurpleMessage) (transfer full): The messages, oldest
+ *          first.
+ */
+GList *purple_log_binary_read_range(PurpleLog *log, GDateTime *start,
+		GDateTime *end);
+
+/**
+ * purple_log_binary_read_last:
+ * @log:   (transfer none): A log written by the binary logger.
+ * @count: How many messages to return.
+ *
+ * Reads the last @count messages of @log, without reading the rest of it.
+ *
+ * Returns: (element-type PurpleMessage) (transfer full): The messages, oldest
+ *          first.
+ */
+GList *purple_log_binary_read_last(PurpleLog *log, guint count);
+
+/**
+ * purple_log_binary_convert:
+ * @log: (transfer none): A log written by the HTML or plain text logger.
+ *
+ * Writes a copy of @log in the binary format next to it. @log itself is
+ * left alone, delete it with purple_log_delete() once it's no longer
+ * needed.
+ *
+ * The times, authors and kinds of messages are recovered from how the HTML
+ * and plain text loggers format them. This is a best effort: plain text
+ * logs don't tell apart sent and received messages, those written by the
+ * account's username or alias are taken as sent.
+ *
+ * Returns: (transfer full): The new log, or %NULL if it couldn't be written.
+ */
+PurpleLog *purple_log_binary_convert(PurpleLog *log);
+
 /******************************************/
 /* Logger Functions                       */
 /******************************************/
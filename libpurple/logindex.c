@@ -0,0 +1,1431 @@
+/* purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#include "internal.h"
+
+#include <math.h>
+
+#include "accounts.h"
+#include "binaryio.h"
+#include "debug.h"
+#include "logindex.h"
+#include "util.h"
+
+#define LOG_INDEX_FILENAME "log-index.bin"
+#define LOG_INDEX_MAGIC    "PURPLELI"
+#define LOG_INDEX_VERSION  1
+
+/* Words shorter than this (in bytes) aren't worth indexing. Longer ones,
+ * URLs and the like, are indexed by their beginning. */
+#define LOG_INDEX_MIN_WORD 2
+#define LOG_INDEX_MAX_WORD 64
+
+/* Dead documents are dropped once there are this many, and more of them
+ * than live ones. */
+#define LOG_INDEX_MAX_DEAD 64
+
+/* Don't slow down startup (seconds), and don't hog the main loop for longer
+ * than a slice at a time. */
+#define LOG_INDEX_BACKFILL_DELAY 10
+#define LOG_INDEX_BACKFILL_SLICE (20 * G_TIME_SPAN_MILLISECOND)
+
+/* BM25 parameters */
+#define LOG_INDEX_K1 1.2
+#define LOG_INDEX_B  0.75
+
+typedef struct {
+	char *logger;
+	PurpleLogType type;
+	char *protocol;
+	char *username;
+	char *name;      /* normalized */
+	gint64 time;
+	gint64 size;     /* of the log when it was indexed, -1 if unknown */
+	guint32 length;  /* in words */
+	gboolean dead;
+} PurpleLogIndexDoc;
+
+typedef struct {
+	guint32 doc;
+	guint32 count;
+} PurpleLogIndexPosting;
+
+typedef struct {
+	PurpleLogType type;
+	char *name;
+	char *username;
+	char *protocol;
+} PurpleLogIndexSet;
+
+static GPtrArray *docs = NULL;     /* id -> PurpleLogIndexDoc */
+static GHashTable *doc_ids = NULL; /* key -> id + 1 */
+static GHashTable *terms = NULL;   /* word -> GArray of PurpleLogIndexPosting */
+static GSequence *vocabulary = NULL; /* the words in terms, sorted */
+static guint live_docs = 0;
+static guint dead_docs = 0;
+static guint64 live_length = 0;
+static gboolean dirty = FALSE;
+
+static gboolean ready = FALSE;
+static guint backfill_source = 0;
+static GQueue backfill_sets = G_QUEUE_INIT;
+static GList *backfill_logs = NULL;
+
+/**************************************************************************
+ * Documents
+ **************************************************************************/
+
+static char *
+log_index_doc_key(const char *logger, PurpleLogType type,
+                  const char *protocol, const char *username,
+                  const char *name, gint64 time)
+{
+	return g_strdup_printf("%s\n%d\n%s\n%s\n%s\n%" G_GINT64_FORMAT,
+		logger, type, protocol, username, name, time);
+}
+
+static char *
+log_index_log_key(PurpleLog *log)
+{
+	if (log->logger == NULL || log->account == NULL || log->time == NULL)
+		return NULL;
+
+	return log_index_doc_key(log->logger->id, log->type,
+		purple_account_get_protocol_id(log->account),
+		purple_account_get_username(log->account),
+		purple_normalize(log->account, log->name),
+		g_date_time_to_unix(log->time));
+}
+
+static void
+log_index_doc_free(PurpleLogIndexDoc *doc)
+{
+	g_free(doc->logger);
+	g_free(doc->protocol);
+	g_free(doc->username);
+	g_free(doc->name);
+	g_free(doc);
+}
+
+static char *
+log_index_doc_get_key(PurpleLogIndexDoc *doc)
+{
+	return log_index_doc_key(doc->logger, doc->type, doc->protocol,
+		doc->username, doc->name, doc->time);
+}
+
+/* Takes ownership of doc */
+static guint32
+log_index_doc_add(PurpleLogIndexDoc *doc)
+{
+	guint32 id = docs->len;
+
+	g_ptr_array_add(docs, doc);
+	g_hash_table_replace(doc_ids, log_index_doc_get_key(doc),
+		GUINT_TO_POINTER(id + 1));
+
+	live_docs++;
+	live_length += doc->length;
+	dirty = TRUE;
+
+	return id;
+}
+
+static PurpleLogIndexDoc *
+log_index_doc_new(PurpleLog *log)
+{
+	PurpleLogIndexDoc *doc = g_new0(PurpleLogIndexDoc, 1);
+
+	doc->logger = g_strdup(log->logger->id);
+	doc->type = log->type;
+	doc->protocol = g_strdup(purple_account_get_protocol_id(log->account));
+	doc->username = g_strdup(purple_account_get_username(log->account));
+	doc->name = g_strdup(purple_normalize(log->account, log->name));
+	doc->time = g_date_time_to_unix(log->time);
+	doc->size = -1;
+
+	return doc;
+}
+
+static PurpleLogIndexDoc *
+log_index_doc_lookup(const char *key, guint32 *id)
+{
+	gpointer value;
+	PurpleLogIndexDoc *doc;
+
+	if (key == NULL)
+		return NULL;
+
+	value = g_hash_table_lookup(doc_ids, key);
+	if (value == NULL)
+		return NULL;
+
+	doc = g_ptr_array_index(docs, GPOINTER_TO_UINT(value) - 1);
+	if (doc->dead)
+		return NULL;
+
+	if (id != NULL)
+		*id = GPOINTER_TO_UINT(value) - 1;
+
+	return doc;
+}
+
+static gint
+log_index_word_compare(gconstpointer a, gconstpointer b, gpointer data)
+{
+	return strcmp(a, b);
+}
+
+static void
+log_index_vocabulary_remove(const char *word)
+{
+	GSequenceIter *iter = g_sequence_lookup(vocabulary, (gpointer)word,
+		log_index_word_compare, NULL);
+
+	if (iter != NULL)
+		g_sequence_remove(iter);
+}
+
+/* Drops the dead documents and their postings, renumbering the rest. */
+static void
+log_index_compact(void)
+{
+	guint32 *ids;
+	guint32 next = 0, i;
+	GHashTableIter iter;
+	gpointer word, value;
+
+	if (dead_docs == 0)
+		return;
+
+	ids = g_new(guint32, docs->len);
+	for (i = 0; i < docs->len; i++) {
+		PurpleLogIndexDoc *doc = g_ptr_array_index(docs, i);
+
+		if (doc->dead) {
+			ids[i] = G_MAXUINT32;
+			log_index_doc_free(doc);
+			continue;
+		}
+		ids[i] = next;
+		g_ptr_array_index(docs, next++) = doc;
+	}
+	g_ptr_array_set_free_func(docs, NULL);
+	g_ptr_array_set_size(docs, next);
+	g_ptr_array_set_free_func(docs, (GDestroyNotify)log_index_doc_free);
+
+	g_hash_table_iter_init(&iter, doc_ids);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		g_hash_table_iter_replace(&iter,
+			GUINT_TO_POINTER(ids[GPOINTER_TO_UINT(value) - 1] + 1));
+	}
+
+	g_hash_table_iter_init(&iter, terms);
+	while (g_hash_table_iter_next(&iter, &word, &value)) {
+		GArray *postings = value;
+		guint j, kept = 0;
+
+		for (j = 0; j < postings->len; j++) {
+			PurpleLogIndexPosting posting =
+				g_array_index(postings, PurpleLogIndexPosting, j);
+
+			if (ids[posting.doc] == G_MAXUINT32)
+				continue;
+			posting.doc = ids[posting.doc];
+			g_array_index(postings, PurpleLogIndexPosting, kept++) = posting;
+		}
+		g_array_set_size(postings, kept);
+
+		if (kept == 0) {
+			log_index_vocabulary_remove(word);
+			g_hash_table_iter_remove(&iter);
+		}
+	}
+
+	g_free(ids);
+	dead_docs = 0;
+}
+
+/* The postings of dead documents stay around until log_index_compact()
+ * drops them, when enough have piled up or the index is saved. */
+static void
+log_index_doc_kill(const char *key, PurpleLogIndexDoc *doc)
+{
+	doc->dead = TRUE;
+	live_docs--;
+	dead_docs++;
+	live_length -= doc->length;
+	g_hash_table_remove(doc_ids, key);
+	dirty = TRUE;
+
+	if (dead_docs > LOG_INDEX_MAX_DEAD && dead_docs > live_docs)
+		log_index_compact();
+}
+
+/**************************************************************************
+ * Words
+ **************************************************************************/
+
+/* Scripts that are written without spaces between words. Each of their
+ * characters is indexed as a word of its own, and queries for them are
+ * checked against the text of the logs the index comes up with. */
+static gboolean
+log_index_is_unsegmented(gunichar c)
+{
+	switch (g_unichar_get_script(c)) {
+		case G_UNICODE_SCRIPT_HAN:
+		case G_UNICODE_SCRIPT_HIRAGANA:
+		case G_UNICODE_SCRIPT_KATAKANA:
+		case G_UNICODE_SCRIPT_THAI:
+		case G_UNICODE_SCRIPT_LAO:
+		case G_UNICODE_SCRIPT_KHMER:
+		case G_UNICODE_SCRIPT_MYANMAR:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+static void
+log_index_add_word(GHashTable *words, GString *word)
+{
+	gpointer key, count;
+
+	if (word->len > LOG_INDEX_MAX_WORD) {
+		gsize len = LOG_INDEX_MAX_WORD;
+
+		/* don't cut a character in half */
+		while ((word->str[len] & 0xc0) == 0x80)
+			len--;
+		g_string_truncate(word, len);
+	}
+
+	if (word->len >= LOG_INDEX_MIN_WORD) {
+		if (g_hash_table_lookup_extended(words, word->str, &key, &count)) {
+			g_hash_table_steal(words, key);
+			g_hash_table_insert(words, key,
+				GUINT_TO_POINTER(GPOINTER_TO_UINT(count) + 1));
+		} else {
+			g_hash_table_insert(words, g_strdup(word->str),
+				GUINT_TO_POINTER(1));
+		}
+	}
+
+	g_string_truncate(word, 0);
+}
+
+/* Returns a table of lowercase word -> number of occurrences in text. */
+static GHashTable *
+log_index_split(const char *text, gboolean html)
+{
+	GHashTable *words = g_hash_table_new_full(g_str_hash, g_str_equal,
+		g_free, NULL);
+	GString *word = g_string_new(NULL);
+	char *stripped = NULL;
+	const char *p;
+
+	if (html && text != NULL)
+		text = stripped = purple_markup_strip_html(text);
+
+	for (p = text; p != NULL && *p != '\0'; p = g_utf8_next_char(p)) {
+		gunichar c = g_utf8_get_char_validated(p, -1);
+
+		if (c == (gunichar)-1 || c == (gunichar)-2)
+			break;
+
+		if (!g_unichar_isalnum(c)) {
+			if (word->len > 0)
+				log_index_add_word(words, word);
+		} else if (log_index_is_unsegmented(c)) {
+			if (word->len > 0)
+				log_index_add_word(words, word);
+			g_string_append_unichar(word, g_unichar_tolower(c));
+			log_index_add_word(words, word);
+		} else {
+			g_string_append_unichar(word, g_unichar_tolower(c));
+		}
+	}
+	log_index_add_word(words, word);
+
+	g_string_free(word, TRUE);
+	g_free(stripped);
+
+	return words;
+}
+
+static void
+log_index_add_words(guint32 id, GHashTable *words)
+{
+	PurpleLogIndexDoc *doc = g_ptr_array_index(docs, id);
+	GHashTableIter iter;
+	gpointer word, count;
+
+	g_hash_table_iter_init(&iter, words);
+	while (g_hash_table_iter_next(&iter, &word, &count)) {
+		GArray *postings = g_hash_table_lookup(terms, word);
+		PurpleLogIndexPosting *last = NULL;
+
+		if (postings == NULL) {
+			char *copy = g_strdup(word);
+
+			postings = g_array_new(FALSE, FALSE,
+				sizeof(PurpleLogIndexPosting));
+			g_hash_table_insert(terms, copy, postings);
+			g_sequence_insert_sorted(vocabulary, copy,
+				log_index_word_compare, NULL);
+		} else if (postings->len > 0) {
+			last = &g_array_index(postings, PurpleLogIndexPosting,
+				postings->len - 1);
+		}
+
+		/* Conversations logged at the same time take turns here, so a
+		 * document can have more than one posting for a word. */
+		if (last != NULL && last->doc == id) {
+			last->count += GPOINTER_TO_UINT(count);
+		} else {
+			PurpleLogIndexPosting posting = { id, GPOINTER_TO_UINT(count) };
+
+			g_array_append_val(postings, posting);
+		}
+
+		doc->length += GPOINTER_TO_UINT(count);
+		live_length += GPOINTER_TO_UINT(count);
+	}
+
+	dirty = TRUE;
+}
+
+/* Indexes text as everything there is in log, replacing what the index
+ * knew about it. */
+static void
+log_index_store(PurpleLog *log, gint64 size, const char *text)
+{
+	char *key = log_index_log_key(log);
+	PurpleLogIndexDoc *doc;
+	GHashTable *words;
+	guint32 id;
+
+	if (key == NULL)
+		return;
+
+	doc = log_index_doc_lookup(key, NULL);
+	if (doc != NULL)
+		log_index_doc_kill(key, doc);
+	g_free(key);
+
+	words = log_index_split(text, TRUE);
+	doc = log_index_doc_new(log);
+	doc->size = size;
+	id = log_index_doc_add(doc);
+	log_index_add_words(id, words);
+	g_hash_table_destroy(words);
+}
+
+/* (Re)indexes log from disk if it changed since it was indexed. */
+static void
+log_index_update(PurpleLog *log)
+{
+	char *key = log_index_log_key(log);
+	PurpleLogIndexDoc *doc;
+	PurpleLogReadFlags flags;
+	char *text;
+	gint64 size;
+
+	if (key == NULL)
+		return;
+
+	size = purple_log_get_size(log);
+	doc = log_index_doc_lookup(key, NULL);
+	g_free(key);
+	if (doc != NULL && doc->size == size)
+		return;
+
+	text = purple_log_read(log, &flags);
+	log_index_store(log, size, text);
+	g_free(text);
+}
+
+/**************************************************************************
+ * Queries
+ **************************************************************************/
+
+static GPtrArray *
+log_index_query_words(const char *query)
+{
+	GHashTable *words = log_index_split(query, FALSE);
+	GPtrArray *ret = g_ptr_array_new_with_free_func(g_free);
+	GHashTableIter iter;
+	gpointer word;
+
+	g_hash_table_iter_init(&iter, words);
+	while (g_hash_table_iter_next(&iter, &word, NULL)) {
+		g_hash_table_iter_steal(&iter);
+		g_ptr_array_add(ret, word);
+	}
+	g_hash_table_destroy(words);
+
+	return ret;
+}
+
+/* Lowercases text the way it's indexed and turns whatever is between the
+ * words into a single space. */
+static char *
+log_index_fold(const char *text, gboolean html)
+{
+	GString *folded = g_string_new(NULL);
+	char *stripped = NULL;
+	const char *p;
+
+	if (html && text != NULL)
+		text = stripped = purple_markup_strip_html(text);
+
+	for (p = text; p != NULL && *p != '\0'; p = g_utf8_next_char(p)) {
+		gunichar c = g_utf8_get_char_validated(p, -1);
+
+		if (c == (gunichar)-1 || c == (gunichar)-2)
+			break;
+
+		if (g_unichar_isalnum(c))
+			g_string_append_unichar(folded, g_unichar_tolower(c));
+		else if (folded->len > 0 && folded->str[folded->len - 1] != ' ')
+			g_string_append_c(folded, ' ');
+	}
+	if (folded->len > 0 && folded->str[folded->len - 1] == ' ')
+		g_string_truncate(folded, folded->len - 1);
+
+	g_free(stripped);
+
+	return g_string_free(folded, FALSE);
+}
+
+/* Whether each of the folded query words begins a word in the folded text.
+ * Words of scripts written without spaces may appear anywhere. */
+static gboolean
+log_index_text_matches(const char *text, char **query)
+{
+	for (; *query != NULL; query++) {
+		gboolean anywhere =
+			log_index_is_unsegmented(g_utf8_get_char(*query));
+		const char *p = text;
+
+		while ((p = strstr(p, *query)) != NULL) {
+			gunichar prev;
+
+			if (p == text || anywhere)
+				break;
+
+			prev = g_utf8_get_char(g_utf8_prev_char(p));
+			if (prev == ' ' || log_index_is_unsegmented(prev))
+				break;
+
+			p = g_utf8_next_char(p);
+		}
+
+		if (p == NULL)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Whether the index alone answers the folded query words: every one of them
+ * is a word it has, or the beginning of one, with nothing cut off. */
+static gboolean
+log_index_query_is_exact(char **query)
+{
+	for (; *query != NULL; query++) {
+		gsize len = strlen(*query);
+		const char *p;
+
+		if (len < LOG_INDEX_MIN_WORD || len > LOG_INDEX_MAX_WORD)
+			return FALSE;
+
+		for (p = *query; *p != '\0'; p = g_utf8_next_char(p)) {
+			if (log_index_is_unsegmented(g_utf8_get_char(p)))
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* Reads log and checks it against the folded query words. */
+static gboolean
+log_index_log_matches(PurpleLog *log, char **query)
+{
+	PurpleLogReadFlags flags;
+	char *text = purple_log_read(log, &flags);
+	char *folded = log_index_fold(text, TRUE);
+	gboolean ret = log_index_text_matches(folded, query);
+
+	g_free(folded);
+	g_free(text);
+
+	return ret;
+}
+
+/* Returns a table of doc id -> occurrences of words starting with prefix. */
+static GHashTable *
+log_index_match_prefix(const char *prefix)
+{
+	GHashTable *matches = g_hash_table_new(g_direct_hash, g_direct_equal);
+	GSequenceIter *iter;
+
+	/* That's past the word equal to prefix, if there's one */
+	iter = g_sequence_search(vocabulary, (gpointer)prefix,
+		log_index_word_compare, NULL);
+	if (!g_sequence_iter_is_begin(iter)) {
+		GSequenceIter *prev = g_sequence_iter_prev(iter);
+
+		if (strcmp(g_sequence_get(prev), prefix) == 0)
+			iter = prev;
+	}
+
+	for (; !g_sequence_iter_is_end(iter); iter = g_sequence_iter_next(iter)) {
+		const char *word = g_sequence_get(iter);
+		GArray *postings;
+		guint i;
+
+		if (!g_str_has_prefix(word, prefix))
+			break;
+
+		postings = g_hash_table_lookup(terms, word);
+
+		for (i = 0; i < postings->len; i++) {
+			PurpleLogIndexPosting *posting =
+				&g_array_index(postings, PurpleLogIndexPosting, i);
+			PurpleLogIndexDoc *doc = g_ptr_array_index(docs, posting->doc);
+			gpointer key = GUINT_TO_POINTER(posting->doc + 1);
+
+			if (doc->dead)
+				continue;
+
+			g_hash_table_insert(matches, key, GUINT_TO_POINTER(
+				GPOINTER_TO_UINT(g_hash_table_lookup(matches, key)) +
+				posting->count));
+		}
+	}
+
+	return matches;
+}
+
+/* Returns a table of doc id + 1 for the documents with a word containing
+ * part, or with a word that was cut off and might have. */
+static GHashTable *
+log_index_match_infix(const char *part)
+{
+	GHashTable *matches = g_hash_table_new(g_direct_hash, g_direct_equal);
+	GHashTableIter iter;
+	gpointer word, value;
+
+	g_hash_table_iter_init(&iter, terms);
+	while (g_hash_table_iter_next(&iter, &word, &value)) {
+		GArray *postings = value;
+		guint i;
+
+		/* cutting off a word may have backed off up to three bytes */
+		if (strlen(word) <= LOG_INDEX_MAX_WORD - 4 && !strstr(word, part))
+			continue;
+
+		for (i = 0; i < postings->len; i++) {
+			PurpleLogIndexPosting *posting =
+				&g_array_index(postings, PurpleLogIndexPosting, i);
+			PurpleLogIndexDoc *doc = g_ptr_array_index(docs, posting->doc);
+
+			if (!doc->dead)
+				g_hash_table_add(matches,
+					GUINT_TO_POINTER(posting->doc + 1));
+		}
+	}
+
+	return matches;
+}
+
+/* Returns a table of doc id + 1 -> score (as a gdouble *) for the documents
+ * containing all words, restricted to the ones in only if that's given. */
+static GHashTable *
+log_index_query(GPtrArray *words, GHashTable *only)
+{
+	GHashTable *scores = NULL;
+	gdouble avg_length = live_docs ? (gdouble)live_length / live_docs : 1;
+	guint i;
+
+	for (i = 0; i < words->len; i++) {
+		GHashTable *matches = log_index_match_prefix(g_ptr_array_index(words, i));
+		GHashTable *next = g_hash_table_new_full(g_direct_hash,
+			g_direct_equal, NULL, g_free);
+		gdouble df = g_hash_table_size(matches);
+		gdouble idf = log(1 + (live_docs - df + 0.5) / (df + 0.5));
+		GHashTableIter iter;
+		gpointer key, value;
+
+		g_hash_table_iter_init(&iter, matches);
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			PurpleLogIndexDoc *doc = g_ptr_array_index(docs,
+				GPOINTER_TO_UINT(key) - 1);
+			gdouble tf = GPOINTER_TO_UINT(value);
+			gdouble *score;
+
+			if (only != NULL && !g_hash_table_contains(only, key))
+				continue;
+
+			if (scores == NULL) {
+				score = g_new0(gdouble, 1);
+			} else {
+				/* every word has to be in there */
+				if (!g_hash_table_lookup_extended(scores, key, NULL,
+						(gpointer *)&score))
+					continue;
+				g_hash_table_steal(scores, key);
+			}
+
+			*score += idf * tf * (LOG_INDEX_K1 + 1) /
+				(tf + LOG_INDEX_K1 * (1 - LOG_INDEX_B +
+					LOG_INDEX_B * doc->length / avg_length));
+			g_hash_table_insert(next, key, score);
+		}
+
+		g_hash_table_destroy(matches);
+		if (scores != NULL)
+			g_hash_table_destroy(scores);
+		scores = next;
+	}
+
+	if (scores == NULL) {
+		scores = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+			NULL, g_free);
+	}
+
+	return scores;
+}
+
+typedef struct {
+	gpointer data;
+	gdouble score;
+	gint64 time;
+} PurpleLogIndexHit;
+
+static gint
+log_index_hit_compare(gconstpointer a, gconstpointer b)
+{
+	const PurpleLogIndexHit *x = a, *y = b;
+
+	if (x->score != y->score)
+		return x->score < y->score ? 1 : -1;
+
+	/* newer logs first */
+	return (x->time < y->time) - (x->time > y->time);
+}
+
+/**************************************************************************
+ * Storage
+ **************************************************************************/
+
+static void
+log_index_save(void)
+{
+	GByteArray *out;
+	guint32 i;
+	GHashTableIter iter;
+	gpointer word, value;
+
+	if (!dirty || docs == NULL)
+		return;
+
+	log_index_compact();
+
+	out = g_byte_array_new();
+	g_byte_array_append(out, (const guint8 *)LOG_INDEX_MAGIC,
+		strlen(LOG_INDEX_MAGIC));
+	_purple_binary_put_uint32(out, LOG_INDEX_VERSION);
+
+	_purple_binary_put_uint32(out, docs->len);
+	for (i = 0; i < docs->len; i++) {
+		PurpleLogIndexDoc *doc = g_ptr_array_index(docs, i);
+
+		_purple_binary_put_string(out, doc->logger);
+		_purple_binary_put_uint32(out, doc->type);
+		_purple_binary_put_string(out, doc->protocol);
+		_purple_binary_put_string(out, doc->username);
+		_purple_binary_put_string(out, doc->name);
+		_purple_binary_put_int64(out, doc->time);
+		_purple_binary_put_int64(out, doc->size);
+		_purple_binary_put_uint32(out, doc->length);
+	}
+
+	g_hash_table_iter_init(&iter, terms);
+	while (g_hash_table_iter_next(&iter, &word, &value)) {
+		GArray *postings = value;
+		guint j;
+
+		_purple_binary_put_string(out, word);
+		_purple_binary_put_uint32(out, postings->len);
+		for (j = 0; j < postings->len; j++) {
+			PurpleLogIndexPosting *posting =
+				&g_array_index(postings, PurpleLogIndexPosting, j);
+
+			_purple_binary_put_uint32(out, posting->doc);
+			_purple_binary_put_uint32(out, posting->count);
+		}
+	}
+
+	_purple_binary_put_uint32(out, _purple_fnv1a(out->data, out->len));
+
+	if (purple_util_write_data_to_cache_file(LOG_INDEX_FILENAME,
+			(const char *)out->data, out->len))
+		dirty = FALSE;
+
+	g_byte_array_free(out, TRUE);
+}
+
+static gboolean
+log_index_load_data(const guchar *data, gsize len)
+{
+	PurpleBinaryReader reader;
+	guint32 version, ndocs, checksum, i;
+
+	if (len < strlen(LOG_INDEX_MAGIC) + 2 * sizeof(guint32) ||
+			memcmp(data, LOG_INDEX_MAGIC, strlen(LOG_INDEX_MAGIC)) != 0)
+		return FALSE;
+
+	memcpy(&checksum, data + len - sizeof(checksum), sizeof(checksum));
+	if (GUINT32_FROM_LE(checksum) !=
+			_purple_fnv1a(data, len - sizeof(checksum)))
+		return FALSE;
+
+	reader.cur = data + strlen(LOG_INDEX_MAGIC);
+	reader.end = data + len - sizeof(checksum);
+
+	if (!_purple_binary_get_uint32(&reader, &version) ||
+			version != LOG_INDEX_VERSION)
+		return FALSE;
+
+	if (!_purple_binary_get_uint32(&reader, &ndocs))
+		return FALSE;
+
+	for (i = 0; i < ndocs; i++) {
+		const char *logger, *protocol, *username, *name;
+		guint32 type, length;
+		gint64 time, size;
+		PurpleLogIndexDoc *doc;
+
+		if (!_purple_binary_get_string(&reader, &logger) || logger == NULL ||
+				!_purple_binary_get_uint32(&reader, &type) ||
+				!_purple_binary_get_string(&reader, &protocol) ||
+				protocol == NULL ||
+				!_purple_binary_get_string(&reader, &username) ||
+				username == NULL ||
+				!_purple_binary_get_string(&reader, &name) || name == NULL ||
+				!_purple_binary_get_int64(&reader, &time) ||
+				!_purple_binary_get_int64(&reader, &size) ||
+				!_purple_binary_get_uint32(&reader, &length))
+			return FALSE;
+
+		doc = g_new0(PurpleLogIndexDoc, 1);
+		doc->logger = g_strdup(logger);
+		doc->type = type;
+		doc->protocol = g_strdup(protocol);
+		doc->username = g_strdup(username);
+		doc->name = g_strdup(name);
+		doc->time = time;
+		doc->size = size;
+		doc->length = length;
+		log_index_doc_add(doc);
+	}
+
+	while (reader.cur < reader.end) {
+		const char *word;
+		char *copy;
+		guint32 count;
+		GArray *postings;
+
+		if (!_purple_binary_get_string(&reader, &word) || word == NULL ||
+				g_hash_table_contains(terms, word) ||
+				!_purple_binary_get_uint32(&reader, &count) ||
+				(gsize)(reader.end - reader.cur) / (2 * sizeof(guint32)) < count)
+			return FALSE;
+
+		copy = g_strdup(word);
+		postings = g_array_sized_new(FALSE, FALSE,
+			sizeof(PurpleLogIndexPosting), count);
+		g_hash_table_insert(terms, copy, postings);
+		g_sequence_append(vocabulary, copy);
+
+		for (i = 0; i < count; i++) {
+			PurpleLogIndexPosting posting;
+
+			_purple_binary_get_uint32(&reader, &posting.doc);
+			_purple_binary_get_uint32(&reader, &posting.count);
+			if (posting.doc >= ndocs)
+				return FALSE;
+			g_array_append_val(postings, posting);
+		}
+	}
+
+	g_sequence_sort(vocabulary, log_index_word_compare, NULL);
+
+	return TRUE;
+}
+
+static void
+log_index_clear(void)
+{
+	if (docs != NULL)
+		g_ptr_array_set_size(docs, 0);
+	if (doc_ids != NULL)
+		g_hash_table_remove_all(doc_ids);
+	if (vocabulary != NULL) {
+		g_sequence_remove_range(g_sequence_get_begin_iter(vocabulary),
+			g_sequence_get_end_iter(vocabulary));
+	}
+	if (terms != NULL)
+		g_hash_table_remove_all(terms);
+	live_docs = 0;
+	dead_docs = 0;
+	live_length = 0;
+}
+
+static void
+log_index_load(void)
+{
+	char *filename = g_build_filename(purple_cache_dir(), LOG_INDEX_FILENAME,
+		NULL);
+	gchar *data = NULL;
+	gsize len;
+
+	if (g_file_get_contents(filename, &data, &len, NULL)) {
+		if (!log_index_load_data((const guchar *)data, len)) {
+			purple_debug_warning("log",
+				"Log index is damaged, it'll be rebuilt\n");
+			log_index_clear();
+		} else {
+			purple_debug_info("log", "Loaded log index of %u logs\n",
+				live_docs);
+		}
+	}
+	/* Nothing's changed from what's on disk */
+	dirty = FALSE;
+
+	g_free(data);
+	g_free(filename);
+}
+
+/**************************************************************************
+ * Backfill
+ **************************************************************************/
+
+static void
+log_index_set_free(PurpleLogIndexSet *set)
+{
+	g_free(set->name);
+	g_free(set->username);
+	g_free(set->protocol);
+	g_free(set);
+}
+
+static void
+log_index_queue_set(PurpleLogType type, const char *name,
+                    PurpleAccount *account)
+{
+	PurpleLogIndexSet *set = g_new(PurpleLogIndexSet, 1);
+
+	set->type = type;
+	set->name = g_strdup(name);
+	set->username = g_strdup(purple_account_get_username(account));
+	set->protocol = g_strdup(purple_account_get_protocol_id(account));
+
+	g_queue_push_tail(&backfill_sets, set);
+}
+
+static gboolean
+log_index_backfill_cb(gpointer data)
+{
+	gint64 deadline = g_get_monotonic_time() + LOG_INDEX_BACKFILL_SLICE;
+
+	while (g_get_monotonic_time() < deadline) {
+		PurpleLog *log;
+
+		if (backfill_logs == NULL) {
+			PurpleLogIndexSet *set = g_queue_pop_head(&backfill_sets);
+			PurpleAccount *account;
+
+			if (set == NULL) {
+				backfill_source = 0;
+				ready = TRUE;
+				log_index_save();
+				purple_debug_info("log", "Log index is up to date, "
+					"%u logs\n", live_docs);
+				return G_SOURCE_REMOVE;
+			}
+
+			/* The account may be gone by now */
+			account = purple_accounts_find(set->username, set->protocol);
+			if (account != NULL && set->type == PURPLE_LOG_SYSTEM)
+				backfill_logs = purple_log_get_system_logs(account);
+			else if (account != NULL)
+				backfill_logs = purple_log_get_logs(set->type, set->name,
+					account);
+
+			log_index_set_free(set);
+			continue;
+		}
+
+		log = backfill_logs->data;
+		backfill_logs = g_list_delete_link(backfill_logs, backfill_logs);
+
+		log_index_update(log);
+		purple_log_free(log);
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+log_index_backfill_start_cb(gpointer data)
+{
+	GHashTable *sets = purple_log_get_log_sets();
+	GHashTableIter iter;
+	gpointer key;
+	GList *accounts;
+
+	g_hash_table_iter_init(&iter, sets);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		PurpleLogSet *set = key;
+
+		/* can't list the logs of accounts that no longer exist */
+		if (set->account != NULL)
+			log_index_queue_set(set->type, set->name, set->account);
+	}
+	g_hash_table_destroy(sets);
+
+	for (accounts = purple_accounts_get_all(); accounts != NULL;
+			accounts = accounts->next) {
+		log_index_queue_set(PURPLE_LOG_SYSTEM, NULL, accounts->data);
+	}
+
+	backfill_source = g_idle_add(log_index_backfill_cb, NULL);
+
+	return G_SOURCE_REMOVE;
+}
+
+/**************************************************************************
+ * Log Index API
+ **************************************************************************/
+
+void
+purple_log_index_add(PurpleLog *log, const char *text)
+{
+	PurpleLogIndexDoc *doc;
+	GHashTable *words;
+	char *key;
+	guint32 id;
+
+	g_return_if_fail(log != NULL);
+	g_return_if_fail(docs != NULL);
+
+	if (text == NULL)
+		return;
+
+	key = log_index_log_key(log);
+	if (key == NULL)
+		return;
+
+	doc = log_index_doc_lookup(key, &id);
+	if (doc == NULL)
+		id = log_index_doc_add(log_index_doc_new(log));
+	g_free(key);
+
+	/* The log on disk will have changed by then, so it's indexed from
+	 * scratch next session. That also catches whatever was still on its
+	 * way to the disk. */
+	doc = g_ptr_array_index(docs, id);
+	doc->size = -1;
+
+	words = log_index_split(text, TRUE);
+	log_index_add_words(id, words);
+	g_hash_table_destroy(words);
+}
+
+void
+purple_log_index_remove(PurpleLog *log)
+{
+	PurpleLogIndexDoc *doc;
+	char *key;
+
+	g_return_if_fail(log != NULL);
+
+	if (docs == NULL)
+		return;
+
+	key = log_index_log_key(log);
+	doc = log_index_doc_lookup(key, NULL);
+	if (doc != NULL)
+		log_index_doc_kill(key, doc);
+	g_free(key);
+}
+
+GList *
+purple_log_index_filter(GList *logs, const char *query)
+{
+	GPtrArray *words;
+	GHashTable *only, *scores;
+	GArray *hits;
+	GList *l, *ret = NULL, *unindexed = NULL, *found = NULL;
+	char *folded, **query_words = NULL;
+	gboolean exact;
+	guint i;
+
+	g_return_val_if_fail(query != NULL, NULL);
+	g_return_val_if_fail(docs != NULL, NULL);
+
+	folded = log_index_fold(query, FALSE);
+	if (*folded != '\0')
+		query_words = g_strsplit(folded, " ", -1);
+	g_free(folded);
+
+	words = log_index_query_words(query);
+	exact = (query_words != NULL && log_index_query_is_exact(query_words));
+
+	/* doc id + 1 -> the log */
+	only = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (l = logs; l != NULL; l = l->next) {
+		PurpleLog *log = l->data;
+		char *key = log_index_log_key(log);
+		guint32 id;
+
+		if (key != NULL && log_index_doc_lookup(key, &id) != NULL) {
+			if (query_words != NULL)
+				g_hash_table_insert(only, GUINT_TO_POINTER(id + 1), log);
+			else
+				unindexed = g_list_prepend(unindexed, log);
+		} else {
+			/* indexed below, NULL marks that */
+			unindexed = g_list_prepend(unindexed, NULL);
+			unindexed = g_list_prepend(unindexed, log);
+		}
+		g_free(key);
+	}
+
+	if (query_words != NULL) {
+		GHashTableIter iter;
+		gpointer key, value;
+
+		if (words->len > 0) {
+			scores = log_index_query(words, only);
+		} else {
+			/* nothing the index knows about, so they all have to be read */
+			scores = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+				NULL, g_free);
+			g_hash_table_iter_init(&iter, only);
+			while (g_hash_table_iter_next(&iter, &key, NULL))
+				g_hash_table_insert(scores, key, g_new0(gdouble, 1));
+		}
+
+		hits = g_array_sized_new(FALSE, FALSE, sizeof(PurpleLogIndexHit),
+			g_hash_table_size(scores));
+
+		g_hash_table_iter_init(&iter, scores);
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			PurpleLogIndexHit hit;
+			PurpleLog *log = g_hash_table_lookup(only, key);
+
+			hit.data = log;
+			hit.score = *(gdouble *)value;
+			hit.time = g_date_time_to_unix(log->time);
+			g_array_append_val(hits, hit);
+		}
+		g_array_sort(hits, log_index_hit_compare);
+
+		for (i = hits->len; i > 0; i--) {
+			PurpleLog *log = g_array_index(hits, PurpleLogIndexHit, i - 1).data;
+
+			/* The index only narrowed it down, check the real thing */
+			if (!exact && !log_index_log_matches(log, query_words))
+				continue;
+
+			ret = g_list_prepend(ret, log);
+		}
+
+		g_array_free(hits, TRUE);
+		g_hash_table_destroy(scores);
+	}
+	g_hash_table_destroy(only);
+	g_ptr_array_free(words, TRUE);
+
+	/* These are in reverse, so prepending them puts them back in order */
+	for (l = unindexed; l != NULL; l = l->next) {
+		PurpleLog *log = l->data;
+		PurpleLogReadFlags flags;
+		gint64 size = 0;
+		gboolean index = FALSE, match;
+		char *text;
+
+		if (l->next != NULL && l->next->data == NULL) {
+			index = TRUE;
+			l = l->next;
+			size = purple_log_get_size(log);
+		}
+
+		text = purple_log_read(log, &flags);
+		if (query_words != NULL) {
+			char *folded_text = log_index_fold(text, TRUE);
+
+			match = log_index_text_matches(folded_text, query_words);
+			g_free(folded_text);
+		} else {
+			/* nothing but punctuation, look for it as it is */
+			match = (text != NULL && *text != '\0' &&
+				purple_strcasestr(text, query));
+		}
+		if (match)
+			found = g_list_prepend(found, log);
+		if (index)
+			log_index_store(log, size, text);
+		g_free(text);
+	}
+	g_list_free(unindexed);
+	g_strfreev(query_words);
+
+	return g_list_concat(ret, found);
+}
+
+GList *
+purple_log_index_search(const char *query, PurpleAccount *account,
+                        const char *name, guint limit)
+{
+	GPtrArray *words;
+	GHashTable *scores, *listed;
+	GHashTableIter iter;
+	gpointer key, value;
+	GArray *hits;
+	GList *ret = NULL;
+	char *folded, **query_words;
+	gboolean exact;
+	guint i, count = 0;
+
+	g_return_val_if_fail(query != NULL, NULL);
+	g_return_val_if_fail(docs != NULL, NULL);
+
+	words = log_index_query_words(query);
+	if (words->len == 0) {
+		g_ptr_array_free(words, TRUE);
+		return NULL;
+	}
+
+	folded = log_index_fold(query, FALSE);
+	query_words = g_strsplit(folded, " ", -1);
+	exact = log_index_query_is_exact(query_words);
+	g_free(folded);
+
+	scores = log_index_query(words, NULL);
+	g_ptr_array_free(words, TRUE);
+
+	hits = g_array_new(FALSE, FALSE, sizeof(PurpleLogIndexHit));
+	g_hash_table_iter_init(&iter, scores);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		PurpleLogIndexDoc *doc = g_ptr_array_index(docs,
+			GPOINTER_TO_UINT(key) - 1);
+		PurpleLogIndexHit hit;
+
+		if (account != NULL && (!purple_strequal(doc->username,
+				purple_account_get_username(account)) ||
+				!purple_strequal(doc->protocol,
+				purple_account_get_protocol_id(account))))
+			continue;
+
+		if (name != NULL && account != NULL &&
+				!purple_strequal(doc->name, purple_normalize(account, name)))
+			continue;
+		else if (name != NULL && account == NULL &&
+				g_ascii_strcasecmp(doc->name, name) != 0)
+			continue;
+
+		hit.data = doc;
+		hit.score = *(gdouble *)value;
+		hit.time = doc->time;
+		g_array_append_val(hits, hit);
+	}
+	g_array_sort(hits, log_index_hit_compare);
+	g_hash_table_destroy(scores);
+
+	/* The index only knows where logs are, the loggers have to load them.
+	 * listed maps "type\nname\nusername\nprotocol" -> the logs of that
+	 * conversation, by key. */
+	listed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+		(GDestroyNotify)g_hash_table_destroy);
+
+	for (i = 0; i < hits->len && (limit == 0 || count < limit); i++) {
+		PurpleLogIndexDoc *doc = g_array_index(hits, PurpleLogIndexHit, i).data;
+		char *set_key = g_strdup_printf("%d\n%s\n%s\n%s", doc->type,
+			doc->name, doc->username, doc->protocol);
+		GHashTable *logs = g_hash_table_lookup(listed, set_key);
+		PurpleLog *log;
+		char *doc_key;
+
+		if (logs == NULL) {
+			PurpleAccount *acct = purple_accounts_find(doc->username,
+				doc->protocol);
+			GList *list = NULL;
+
+			logs = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, (GDestroyNotify)purple_log_free);
+
+			if (acct != NULL && doc->type == PURPLE_LOG_SYSTEM)
+				list = purple_log_get_system_logs(acct);
+			else if (acct != NULL)
+				list = purple_log_get_logs(doc->type, doc->name, acct);
+
+			for (; list != NULL; list = g_list_delete_link(list, list)) {
+				char *k = log_index_log_key(list->data);
+
+				if (k != NULL)
+					g_hash_table_replace(logs, k, list->data);
+				else
+					purple_log_free(list->data);
+			}
+
+			g_hash_table_insert(listed, set_key, logs);
+		} else {
+			g_free(set_key);
+		}
+
+		doc_key = log_index_doc_get_key(doc);
+		if (g_hash_table_lookup_extended(logs, doc_key, NULL, (gpointer *)&log) &&
+				(exact || log_index_log_matches(log, query_words))) {
+			g_hash_table_steal(logs, doc_key);
+			ret = g_list_prepend(ret, log);
+			count++;
+		}
+		g_free(doc_key);
+	}
+
+	g_hash_table_destroy(listed);
+	g_array_free(hits, TRUE);
+	g_strfreev(query_words);
+
+	return g_list_reverse(ret);
+}
+
+GList *
+purple_log_index_narrow(GList *logs, const char *query)
+{
+	GPtrArray *words;
+	GHashTable *matches = NULL;
+	GList *l, *ret = NULL;
+	guint i;
+
+	g_return_val_if_fail(query != NULL, NULL);
+	g_return_val_if_fail(docs != NULL, NULL);
+
+	/* Every word of the text the query is found in has to contain the
+	 * words of the query, as far as the index keeps them. */
+	words = log_index_query_words(query);
+	for (i = 0; i < words->len; i++) {
+		GHashTable *part = log_index_match_infix(g_ptr_array_index(words, i));
+
+		if (matches != NULL) {
+			GHashTableIter iter;
+			gpointer key;
+
+			g_hash_table_iter_init(&iter, matches);
+			while (g_hash_table_iter_next(&iter, &key, NULL)) {
+				if (!g_hash_table_contains(part, key))
+					g_hash_table_iter_remove(&iter);
+			}
+			g_hash_table_destroy(part);
+		} else {
+			matches = part;
+		}
+	}
+	g_ptr_array_free(words, TRUE);
+
+	for (l = logs; l != NULL; l = l->next) {
+		PurpleLog *log = l->data;
+		char *key = log_index_log_key(log);
+		guint32 id;
+
+		/* the index knows nothing about the others, so they all stay */
+		if (matches == NULL || key == NULL ||
+				log_index_doc_lookup(key, &id) == NULL ||
+				g_hash_table_contains(matches, GUINT_TO_POINTER(id + 1)))
+			ret = g_list_prepend(ret, log);
+		g_free(key);
+	}
+
+	if (matches != NULL)
+		g_hash_table_destroy(matches);
+
+	return g_list_reverse(ret);
+}
+
+gboolean
+purple_log_index_is_ready(void)
+{
+	return ready;
+}
+
+/**************************************************************************
+ * Log Index Subsystem
+ **************************************************************************/
+
+void
+_purple_log_index_init(void)
+{
+	docs = g_ptr_array_new_with_free_func((GDestroyNotify)log_index_doc_free);
+	doc_ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	terms = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+		(GDestroyNotify)g_array_unref);
+	vocabulary = g_sequence_new(NULL);
+
+	log_index_load();
+
+	backfill_source = g_timeout_add_seconds(LOG_INDEX_BACKFILL_DELAY,
+		log_index_backfill_start_cb, NULL);
+}
+
+void
+_purple_log_index_uninit(void)
+{
+	if (backfill_source != 0) {
+		g_source_remove(backfill_source);
+		backfill_source = 0;
+	}
+	g_queue_foreach(&backfill_sets, (GFunc)log_index_set_free, NULL);
+	g_queue_clear(&backfill_sets);
+	g_list_free_full(backfill_logs, (GDestroyNotify)purple_log_free);
+	backfill_logs = NULL;
+
+	log_index_save();
+
+	g_sequence_free(vocabulary);
+	vocabulary = NULL;
+	g_hash_table_destroy(terms);
+	terms = NULL;
+	g_hash_table_destroy(doc_ids);
+	doc_ids = NULL;
+	g_ptr_array_free(docs, TRUE);
+	docs = NULL;
+
+	live_docs = 0;
+	dead_docs = 0;
+	live_length = 0;
+	ready = FALSE;
+}
@@ -0,0 +1,123 @@
+/* purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#ifndef PURPLE_LOG_INDEX_H
+#define PURPLE_LOG_INDEX_H
+/**
+ * SECTION:logindex
+ * @include:logindex.h
+ * @section_id: libpurple-logindex
+ * @short_description: full-text search over logs
+ * @title: Log Index
+ *
+ * The log index maps the words in every log to the logs containing them, so
+ * searching doesn't have to read any log. It's updated by purple_log_write()
+ * and filled with the logs already on disk in the background, a bit at a time
+ * from the main loop. It's kept in the cache directory between sessions.
+ *
+ * A query is a list of words. A log matches if every one of them begins a
+ * word in it, regardless of case. In scripts that are written without spaces,
+ * such as Chinese or Japanese, they may appear anywhere. Logs the index can't
+ * settle a query for on its own, e.g. because of such words or very long
+ * ones, are read to check. Matches are ranked by how often the words appear
+ * in the log (BM25).
+ */
+
+#include "log.h"
+
+G_BEGIN_DECLS
+
+/**
+ * purple_log_index_add:
+ * @log:  The log
+ * @text: The text that was written to @log, possibly HTML
+ *
+ * Adds @text to the index for @log. purple_log_write() already does this,
+ * so it's only needed for logs written some other way.
+ */
+void purple_log_index_add(PurpleLog *log, const char *text);
+
+/**
+ * purple_log_index_remove:
+ * @log: The log
+ *
+ * Drops @log from the index, e.g. when it's deleted.
+ */
+void purple_log_index_remove(PurpleLog *log);
+
+/**
+ * purple_log_index_filter:
+ * @logs:  (element-type PurpleLog): The logs to search
+ * @query: The words to search for
+ *
+ * Finds the logs in @logs matching @query. Logs that aren't indexed yet are
+ * read, matched the same way and indexed while at it; they come after the
+ * ranked matches.
+ *
+ * Returns: (element-type PurpleLog) (transfer container): The matching logs,
+ *          best match first. The logs themselves still belong to @logs.
+ */
+GList *purple_log_index_filter(GList *logs, const char *query);
+
+/**
+ * purple_log_index_narrow:
+ * @logs:  (element-type PurpleLog): The logs to search
+ * @query: The text to search for
+ *
+ * Narrows @logs down to the ones that may contain @query, the way
+ * purple_strcasestr() finds it in their text. Every log that does is kept,
+ * as long as it isn't found in the markup alone, but some that don't may
+ * be kept too, so the caller still has to check them. Logs that aren't
+ * indexed yet are always kept.
+ *
+ * Returns: (element-type PurpleLog) (transfer container): The logs that may
+ *          match, in the order of @logs. The logs themselves still belong
+ *          to @logs.
+ */
+GList *purple_log_index_narrow(GList *logs, const char *query);
+
+/**
+ * purple_log_index_search:
+ * @query:   The words to search for
+ * @account: (nullable): Only search the logs of this account
+ * @name:    (nullable): Only search the logs of conversations with this name
+ * @limit:   The maximum number of results, or 0 for all of them
+ *
+ * Searches all indexed logs. A query needs at least one word the index
+ * keeps, that is one of two bytes or more.
+ *
+ * Returns: (element-type PurpleLog) (transfer full): The matching logs, best
+ *          match first. Free them with purple_log_free().
+ */
+GList *purple_log_index_search(const char *query, PurpleAccount *account,
+		const char *name, guint limit);
+
+/**
+ * purple_log_index_is_ready:
+ *
+ * Returns: %TRUE once the logs that were already on disk have been indexed,
+ *          %FALSE while that's still going on.
+ */
+gboolean purple_log_index_is_ready(void);
+
+G_END_DECLS
+
+#endif /* PURPLE_LOG_INDEX_H */
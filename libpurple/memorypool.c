@@ -161,21 +161,44 @@ purple_memory_pool_alloc_impl(PurpleMemoryPool *pool, gsize size, guint alignmen
 	return mem;
 }
 
+static void
+purple_memory_pool_free_blocks(PurpleMemoryPoolBlock *blk)
+{
+	while (blk) {
+		PurpleMemoryPoolBlock *next = blk->next;
+		g_free(blk);
+		blk = next;
+	}
+}
+
 static void
 purple_memory_pool_cleanup_impl(PurpleMemoryPool *pool)
 {
 	PurpleMemoryPoolPrivate *priv =
 			purple_memory_pool_get_instance_private(pool);
 	PurpleMemoryPoolBlock *blk;
+	gsize capacity;
 
 	blk = priv->first_block;
-	priv->first_block = NULL;
-	priv->last_block = NULL;
-	while (blk) {
-		PurpleMemoryPoolBlock *next = blk->next;
-		g_free(blk);
-		blk = next;
+	if (blk == NULL)
+		return;
+
+	/* The first block is kept for reuse, unless it was oversized, so pools
+	 * cleaned up frequently (i.e. once per parsed item) don't hit the
+	 * allocator every time. */
+	capacity = (guintptr)blk->end_ptr - (guintptr)blk;
+	if (capacity > sizeof(PurpleMemoryPoolBlock) + 2 * priv->block_size) {
+		priv->first_block = NULL;
+		priv->last_block = NULL;
+		purple_memory_pool_free_blocks(blk);
+		return;
 	}
+
+	purple_memory_pool_free_blocks(blk->next);
+	blk->next = NULL;
+	blk->available_ptr = PURPLE_MEMORY_POINTER_SHIFT(blk,
+		sizeof(PurpleMemoryPoolBlock));
+	priv->last_block = blk;
 }
 
 
@@ -281,8 +304,16 @@ purple_memory_pool_init(PurpleMemoryPool *pool)
 static void
 purple_memory_pool_finalize(GObject *obj)
 {
+	PurpleMemoryPoolPrivate *priv = purple_memory_pool_get_instance_private(
+		PURPLE_MEMORY_POOL(obj));
+
 	purple_memory_pool_cleanup(PURPLE_MEMORY_POOL(obj));
 
+	/* cleanup may keep a block for reuse */
+	purple_memory_pool_free_blocks(priv->first_block);
+	priv->first_block = NULL;
+	priv->last_block = NULL;
+
 	G_OBJECT_CLASS(purple_memory_pool_parent_class)->finalize(obj);
 }
 
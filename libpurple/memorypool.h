@@ -40,7 +40,8 @@
  * it checks if there is enough space in current block. If there is not enough
  * room here, it creates another block of memory. On pool destruction or calling
  * #purple_memory_pool_cleanup, the whole block chain will be freed, using only
- * one #g_free call for every block.
+ * one #g_free call for every block. The cleanup keeps the first block (unless
+ * it's oversized) to be reused for subsequent allocations.
  */
 
 #include <glib-object.h>
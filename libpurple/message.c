@@ -60,6 +60,7 @@ enum
 
 static GParamSpec *properties[PROP_LAST];
 
+/* Maps ids to messages, without holding a reference. */
 static GHashTable *messages = NULL;
 
 G_DEFINE_TYPE_WITH_PRIVATE(PurpleMessage, purple_message, G_TYPE_OBJECT)
@@ -142,6 +143,22 @@ purple_message_find_by_id(guint id)
 	return g_hash_table_lookup(messages, GINT_TO_POINTER(id));
 }
 
+void
+_purple_message_set_id(PurpleMessage *msg, guint id)
+{
+	PurpleMessagePrivate *priv = NULL;
+
+	g_return_if_fail(PURPLE_IS_MESSAGE(msg));
+	g_return_if_fail(id > 0);
+	g_return_if_fail(purple_message_find_by_id(id) == NULL);
+
+	priv = purple_message_get_instance_private(msg);
+
+	g_hash_table_remove(messages, GINT_TO_POINTER(priv->id));
+	priv->id = id;
+	g_hash_table_insert(messages, GINT_TO_POINTER(id), msg);
+}
+
 const gchar *
 purple_message_get_author(PurpleMessage *msg)
 {
@@ -264,6 +281,10 @@ purple_message_finalize(GObject *obj)
 	PurpleMessage *message = PURPLE_MESSAGE(obj);
 	PurpleMessagePrivate *priv = purple_message_get_instance_private(message);
 
+	if (messages != NULL &&
+			g_hash_table_lookup(messages, GINT_TO_POINTER(priv->id)) == message)
+		g_hash_table_remove(messages, GINT_TO_POINTER(priv->id));
+
 	g_free(priv->author);
 	g_free(priv->author_alias);
 	g_free(priv->recipient);
@@ -382,8 +403,7 @@ purple_message_class_init(PurpleMessageClass *klass)
 void
 _purple_message_init(void)
 {
-	messages = g_hash_table_new_full(g_direct_hash, g_direct_equal,
-		NULL, g_object_unref);
+	messages = g_hash_table_new(g_direct_hash, g_direct_equal);
 }
 
 void
@@ -109,7 +109,8 @@ purple_message_get_id(PurpleMessage *msg);
  * purple_message_find_by_id:
  * @id: The message identifier.
  *
- * Finds the message with a given @id.
+ * Finds the message with a given @id. Messages are only found for as long as
+ * something holds a reference to them.
  *
  * Returns: (transfer none): The #PurpleMessage, or %NULL if not found.
  */
@@ -242,7 +242,8 @@ sync_prefs(void)
 
 	node = prefs_to_xmlnode();
 	data = purple_xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_config_file("prefs.xml", data, -1);
+	if (purple_util_write_data_to_config_file("prefs.xml", data, -1))
+		_purple_xmlnode_write_snapshot(purple_config_dir(), "prefs.xml", node);
 	g_free(data);
 	purple_xmlnode_free(node);
 }
@@ -408,6 +409,38 @@ static GMarkupParser prefs_parser = {
 	NULL
 };
 
+/* Feeds a tree read from the prefs.xml snapshot to the same handlers the
+ * GMarkup parser calls. */
+static void
+prefs_load_xmlnode(PurpleXmlNode *node)
+{
+	PurpleXmlNode *child;
+	const gchar **attribute_names, **attribute_values;
+	guint i;
+
+	attribute_names = g_new(const gchar *, node->n_attribs + 1);
+	attribute_values = g_new(const gchar *, node->n_attribs + 1);
+	for (i = 0; i < node->n_attribs; i++) {
+		attribute_names[i] = node->attribs[i].name;
+		attribute_values[i] = node->attribs[i].value;
+	}
+	attribute_names[i] = NULL;
+	attribute_values[i] = NULL;
+
+	prefs_start_element_handler(NULL, node->name, attribute_names,
+			attribute_values, NULL, NULL);
+
+	g_free(attribute_names);
+	g_free(attribute_values);
+
+	for (child = node->child; child != NULL; child = child->next) {
+		if (child->type == PURPLE_XMLNODE_TYPE_TAG)
+			prefs_load_xmlnode(child);
+	}
+
+	prefs_end_element_handler(NULL, node->name, NULL, NULL);
+}
+
 gboolean
 purple_prefs_load()
 {
@@ -416,6 +449,7 @@ purple_prefs_load()
 	gsize length;
 	GMarkupParseContext *context;
 	GError *error = NULL;
+	PurpleXmlNode *node;
 
 	PurplePrefsUiOps *uiop = purple_prefs_get_ui_ops();
 
@@ -424,6 +458,15 @@ purple_prefs_load()
 		return uiop->load();
 	}
 
+	node = _purple_xmlnode_from_snapshot(purple_config_dir(), "prefs.xml");
+	if (node != NULL) {
+		prefs_load_xmlnode(node);
+		purple_xmlnode_free(node);
+		prefs_loaded = TRUE;
+
+		return TRUE;
+	}
+
 	filename = g_build_filename(purple_config_dir(), "prefs.xml", NULL);
 
 	if (!filename) {
@@ -35,6 +35,9 @@ struct _FbJsonValue
 	FbJsonType type;
 	gboolean required;
 	GValue value;
+
+	gchar **members;
+	JsonPath *path;
 };
 
 typedef struct
@@ -76,6 +79,11 @@ fb_json_values_dispose(GObject *obj)
 			g_value_unset(&value->value);
 		}
 
+		if (value->path != NULL) {
+			g_object_unref(value->path);
+		}
+
+		g_strfreev(value->members);
 		g_free(value);
 	}
 
@@ -445,6 +453,107 @@ fb_json_node_get_str(JsonNode *root, const gchar *expr, GError **error)
 	return ret;
 }
 
+static gchar **
+fb_json_expr_members(const gchar *expr)
+{
+	const gchar *s;
+
+	/* Only plain member chains ($, $.a, $.a.b, ...) can be walked
+	 * directly, anything else is left to a compiled #JsonPath. */
+	if (expr[0] != '$') {
+		return NULL;
+	}
+
+	if (expr[1] == '\0') {
+		return g_new0(gchar *, 1);
+	}
+
+	if (expr[1] != '.') {
+		return NULL;
+	}
+
+	for (s = expr + 1; *s != '\0'; s++) {
+		if ((*s == '.') && ((s[1] == '.') || (s[1] == '\0'))) {
+			return NULL;
+		}
+
+		if (strchr("[]*@?()'\" ", *s) != NULL) {
+			return NULL;
+		}
+	}
+
+	return g_strsplit(expr + 2, ".", -1);
+}
+
+static JsonNode *
+fb_json_value_get(FbJsonValue *value, JsonNode *root, JsonNode **match,
+                  GError **error)
+{
+	guint size;
+	gchar **member;
+	JsonArray *rslt;
+	JsonNode *node;
+	JsonObject *obj;
+
+	*match = NULL;
+
+	if (value->members != NULL) {
+		node = root;
+
+		for (member = value->members; *member != NULL; member++) {
+			if (!JSON_NODE_HOLDS_OBJECT(node)) {
+				node = NULL;
+				break;
+			}
+
+			obj = json_node_get_object(node);
+			node = json_object_get_member(obj, *member);
+
+			if (node == NULL) {
+				break;
+			}
+		}
+
+		if (node == NULL) {
+			g_set_error(error, FB_JSON_ERROR, FB_JSON_ERROR_NOMATCH,
+			            _("No matches for %s"), value->expr);
+			return NULL;
+		}
+
+		if (JSON_NODE_HOLDS_NULL(node)) {
+			g_set_error(error, FB_JSON_ERROR, FB_JSON_ERROR_NULL,
+			            _("Null value for %s"), value->expr);
+			return NULL;
+		}
+
+		return node;
+	}
+
+	*match = json_path_match(value->path, root);
+	rslt = json_node_get_array(*match);
+	size = json_array_get_length(rslt);
+
+	if (size < 1) {
+		g_set_error(error, FB_JSON_ERROR, FB_JSON_ERROR_NOMATCH,
+		            _("No matches for %s"), value->expr);
+		return NULL;
+	}
+
+	if (size > 1) {
+		g_set_error(error, FB_JSON_ERROR, FB_JSON_ERROR_AMBIGUOUS,
+		            _("Ambiguous matches for %s"), value->expr);
+		return NULL;
+	}
+
+	if (json_array_get_null_element(rslt, 0)) {
+		g_set_error(error, FB_JSON_ERROR, FB_JSON_ERROR_NULL,
+		            _("Null value for %s"), value->expr);
+		return NULL;
+	}
+
+	return json_array_get_element(rslt, 0);
+}
+
 FbJsonValues *
 fb_json_values_new(JsonNode *root)
 {
@@ -466,6 +575,7 @@ fb_json_values_add(FbJsonValues *values, FbJsonType type, gboolean required,
 {
 	FbJsonValue *value;
 	FbJsonValuesPrivate *priv;
+	GError *err = NULL;
 
 	g_return_if_fail(values != NULL);
 	g_return_if_fail(expr != NULL);
@@ -475,6 +585,27 @@ fb_json_values_add(FbJsonValues *values, FbJsonType type, gboolean required,
 	value->expr = expr;
 	value->type = type;
 	value->required = required;
+	value->members = fb_json_expr_members(expr);
+
+	if (value->members == NULL) {
+		value->path = json_path_new();
+
+		if (!json_path_compile(value->path, expr, &err)) {
+			/* Leaving the value out would shift every value after
+			 * it, so fail the update instead */
+			if (priv->error == NULL) {
+				g_set_error(&priv->error, FB_JSON_ERROR,
+				            FB_JSON_ERROR_GENERAL,
+				            _("Failed to compile %s: %s"),
+				            expr, err->message);
+			}
+
+			g_error_free(err);
+			g_object_unref(value->path);
+			g_free(value);
+			return;
+		}
+	}
 
 	g_queue_push_tail(priv->queue, value);
 }
@@ -527,6 +658,7 @@ fb_json_values_update(FbJsonValues *values, GError **error)
 	GError *err = NULL;
 	GList *l;
 	GType type;
+	JsonNode *match;
 	JsonNode *root;
 	JsonNode *node;
 
@@ -555,14 +687,16 @@ fb_json_values_update(FbJsonValues *values, GError **error)
 
 	for (l = priv->queue->head; l != NULL; l = l->next) {
 		value = l->data;
-		node = fb_json_node_get(root, value->expr, &err);
+		node = fb_json_value_get(value, root, &match, &err);
 
 		if (G_IS_VALUE(&value->value)) {
 			g_value_unset(&value->value);
 		}
 
 		if (err != NULL) {
-			json_node_free(node);
+			if (match != NULL) {
+				json_node_free(match);
+			}
 
 			if (value->required) {
 				g_propagate_error(error, err);
@@ -581,12 +715,19 @@ fb_json_values_update(FbJsonValues *values, GError **error)
 			            g_type_name(value->type),
 			            g_type_name(type),
 				    value->expr);
-			json_node_free(node);
+
+			if (match != NULL) {
+				json_node_free(match);
+			}
+
 			return FALSE;
 		}
 
 		json_node_get_value(node, &value->value);
-		json_node_free(node);
+
+		if (match != NULL) {
+			json_node_free(match);
+		}
 	}
 
 	priv->next = priv->queue->head;
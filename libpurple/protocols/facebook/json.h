@@ -361,7 +361,11 @@ fb_json_values_new(JsonNode *root);
  * @required: #TRUE if the node is required, otherwise #FALSE.
  * @expr: The #JsonPath expression.
  *
- * Adds a new #FbJsonValue to the #FbJsonValues.
+ * Adds a new #FbJsonValue to the #FbJsonValues. The expression is
+ * compiled once here, plain member chains such as `$.a.b` are walked
+ * directly without a #JsonPath. The expression is not copied, and must
+ * outlive the #FbJsonValues. If the expression fails to compile, the
+ * next #fb_json_values_update() fails with #FB_JSON_ERROR_GENERAL.
  */
 void
 fb_json_values_add(FbJsonValues *values, FbJsonType type, gboolean required,
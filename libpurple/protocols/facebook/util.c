@@ -457,6 +457,7 @@ fb_util_serv_got_im(PurpleConnection *gc, const gchar *who, const gchar *text,
 	msg = purple_message_new_outgoing(name, text, flags);
 	purple_message_set_time(msg, timestamp);
 	purple_conversation_write_message(PURPLE_CONVERSATION(conv), msg);
+	g_object_unref(msg);
 }
 
 void
@@ -481,6 +482,7 @@ fb_util_serv_got_chat_in(PurpleConnection *gc, gint id, const gchar *who,
 	msg = purple_message_new_outgoing(name, text, flags);
 	purple_message_set_time(msg, timestamp);
 	purple_conversation_write_message(PURPLE_CONVERSATION(conv), msg);
+	g_object_unref(msg);
 }
 
 gboolean
@@ -530,6 +530,7 @@ void ggp_chat_got_message(PurpleConnection *gc, uint64_t chat_id,
 
 		purple_conversation_write_message(
 			PURPLE_CONVERSATION(chat->conv), pmsg);
+		g_object_unref(pmsg);
 	} else {
 		purple_serv_got_chat_in(gc, chat->local_id, ggp_uin_to_str(who),
 			PURPLE_MESSAGE_RECV, message, time);
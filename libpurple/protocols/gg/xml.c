@@ -126,8 +126,7 @@ void ggp_xmlnode_remove_children(PurpleXmlNode *xml)
 	PurpleXmlNode *child = xml->child;
 	while (child) {
 		PurpleXmlNode *next = child->next;
-		if (child->type != PURPLE_XMLNODE_TYPE_ATTRIB)
-			purple_xmlnode_free(child);
+		purple_xmlnode_free(child);
 		child = next;
 	}
 }
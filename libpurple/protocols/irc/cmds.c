@@ -116,8 +116,10 @@ int irc_cmd_ctcp_action(struct irc_conn *irc, const char *cmd, const char *targe
 	}
 
 	g_free(msg);
-	if (purple_message_is_empty(pmsg))
+	if (purple_message_is_empty(pmsg)) {
+		g_object_unref(pmsg);
 		return 0;
+	}
 	msg = g_strdup(purple_message_get_contents(pmsg)); /* XXX: is it really necessary? */
 
 	if (strncmp(msg, "/me ", 4) != 0) {
@@ -170,6 +172,7 @@ int irc_cmd_ctcp_action(struct irc_conn *irc, const char *cmd, const char *targe
 			purple_chat_conversation_get_id(PURPLE_CHAT_CONVERSATION(convo)));
 	}
 
+	g_object_unref(pmsg);
 	g_free(msg);
 
 	if (convo) {
@@ -178,13 +181,16 @@ int irc_cmd_ctcp_action(struct irc_conn *irc, const char *cmd, const char *targe
 		g_free(escaped);
 		if (action[strlen(action) - 1] == '\n')
 			action[strlen(action) - 1] = '\0';
-		if (PURPLE_IS_CHAT_CONVERSATION(convo))
+		if (PURPLE_IS_CHAT_CONVERSATION(convo)) {
 			purple_serv_got_chat_in(gc, purple_chat_conversation_get_id(PURPLE_CHAT_CONVERSATION(convo)),
 			                 purple_connection_get_display_name(gc),
 			                 PURPLE_MESSAGE_SEND, action, time(NULL));
-		else
-			purple_conversation_write_message(convo, purple_message_new_outgoing(
-				purple_connection_get_display_name(gc), action, 0));
+		} else {
+			pmsg = purple_message_new_outgoing(
+				purple_connection_get_display_name(gc), action, 0);
+			purple_conversation_write_message(convo, pmsg);
+			g_object_unref(pmsg);
+		}
 		g_free(action);
 	}
 
@@ -511,11 +517,14 @@ int irc_cmd_query(struct irc_conn *irc, const char *cmd, const char *target, con
 	purple_conversation_present(PURPLE_CONVERSATION(im));
 
 	if (args[1]) {
+		PurpleMessage *pmsg;
+
 		gc = purple_account_get_connection(irc->account);
 		irc_cmd_privmsg(irc, cmd, target, args);
-		purple_conversation_write_message(PURPLE_CONVERSATION(im),
-			purple_message_new_outgoing(
-				purple_connection_get_display_name(gc), args[1], 0));
+		pmsg = purple_message_new_outgoing(
+			purple_connection_get_display_name(gc), args[1], 0);
+		purple_conversation_write_message(PURPLE_CONVERSATION(im), pmsg);
+		g_object_unref(pmsg);
 	}
 
 	return 0;
@@ -40,7 +40,7 @@ static void irc_close(PurpleConnection *gc);
 static int irc_im_send(PurpleConnection *gc, PurpleMessage *msg);
 static int irc_chat_send(PurpleConnection *gc, int id, PurpleMessage *msg);
 static void irc_chat_join (PurpleConnection *gc, GHashTable *data);
-static void irc_read_input_cb(GObject *source, GAsyncResult *res, gpointer data);
+static void irc_read_input(PurpleConnection *gc);
 
 static guint irc_nick_hash(const char *nick);
 static gboolean irc_nick_equal(const char *nick1, const char *nick2);
@@ -567,12 +567,11 @@ irc_login_cb(GObject *source, GAsyncResult *res, gpointer user_data)
 			g_io_stream_get_output_stream(G_IO_STREAM(irc->conn)));
 
 	if (do_login(gc)) {
-		irc->input = g_data_input_stream_new(
+		irc->input = G_BUFFERED_INPUT_STREAM(g_buffered_input_stream_new(
 				g_io_stream_get_input_stream(
-						G_IO_STREAM(irc->conn)));
-		g_data_input_stream_read_line_async(irc->input,
-				G_PRIORITY_DEFAULT, irc->cancellable,
-				irc_read_input_cb, gc);
+						G_IO_STREAM(irc->conn))));
+		irc->line = g_string_sized_new(IRC_MAX_MSG_SIZE);
+		irc_read_input(gc);
 	}
 }
 
@@ -597,9 +596,14 @@ static void irc_close(PurpleConnection *gc)
 				G_OUTPUT_STREAM(irc->output));
 	}
 
+	if (irc->input_idle)
+		g_source_remove(irc->input_idle);
+
 	g_clear_object(&irc->input);
 	g_clear_object(&irc->output);
 	g_clear_object(&irc->conn);
+	if (irc->line)
+		g_string_free(irc->line, TRUE);
 
 	if (irc->timer)
 		g_source_remove(irc->timer);
@@ -714,24 +718,108 @@ static void irc_remove_buddy(PurpleConnection *gc, PurpleBuddy *buddy, PurpleGro
 	}
 }
 
+static void irc_read_input_cb(GObject *source, GAsyncResult *res, gpointer data);
+
+/* Parses all complete lines within the input buffer. Returns FALSE, if it
+ * ran out of time before processing all of them. */
+static gboolean
+irc_process_input(PurpleConnection *gc)
+{
+	struct irc_conn *irc = purple_connection_get_protocol_data(gc);
+	gint64 deadline = g_get_monotonic_time() + IRC_INPUT_TIME_BUDGET;
+
+	while (TRUE) {
+		const gchar *buf, *eol;
+		gsize available, len, skip;
+		gsize start = 0;
+
+		buf = g_buffered_input_stream_peek_buffer(irc->input, &available);
+		eol = memchr(buf, '\n', available);
+
+		if (eol != NULL) {
+			len = eol - buf;
+			skip = len + 1;
+		} else if (available < g_buffered_input_stream_get_buffer_size(
+				irc->input)) {
+			/* wait for the rest of the line */
+			return TRUE;
+		} else if (available < IRC_MAX_BUFSIZE) {
+			g_buffered_input_stream_set_buffer_size(irc->input,
+				MIN(available * 2, IRC_MAX_BUFSIZE));
+			return TRUE;
+		} else {
+			/* the line is too long, take what we have */
+			len = skip = available;
+		}
+
+		g_string_truncate(irc->line, 0);
+		g_string_append_len(irc->line, buf, len);
+		g_input_stream_skip(G_INPUT_STREAM(irc->input), skip, NULL, NULL);
+
+		if (len > 0 && irc->line->str[len - 1] == '\r')
+			g_string_truncate(irc->line, len - 1);
+
+		/* This is a hack to work around the fact that marv gets messages
+		 * with null bytes in them while using some weird irc server at
+		 * work
+		 */
+		while (start < irc->line->len && irc->line->str[start] == '\0')
+			++start;
+
+		if (start < irc->line->len) {
+			irc_parse_msg(irc, irc->line->str + start);
+		}
+
+		if (g_get_monotonic_time() >= deadline) {
+			g_buffered_input_stream_peek_buffer(irc->input, &available);
+			return (available == 0);
+		}
+	}
+}
+
+static gboolean
+irc_process_input_idle(gpointer data)
+{
+	PurpleConnection *gc = data;
+	struct irc_conn *irc = purple_connection_get_protocol_data(gc);
+
+	irc->input_idle = 0;
+	irc_read_input(gc);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+irc_read_input(PurpleConnection *gc)
+{
+	struct irc_conn *irc = purple_connection_get_protocol_data(gc);
+
+	if (!irc_process_input(gc)) {
+		/* let the main loop breathe, then continue with the rest */
+		irc->input_idle = g_idle_add(irc_process_input_idle, gc);
+		return;
+	}
+
+	g_buffered_input_stream_fill_async(irc->input, -1,
+			G_PRIORITY_DEFAULT, irc->cancellable,
+			irc_read_input_cb, gc);
+}
+
 static void
 irc_read_input_cb(GObject *source, GAsyncResult *res, gpointer data)
 {
 	PurpleConnection *gc = data;
-	struct irc_conn *irc;
-	gchar *line;
-	gsize len;
-	gsize start = 0;
+	gssize len;
 	GError *error = NULL;
 
-	line = g_data_input_stream_read_line_finish(
-			G_DATA_INPUT_STREAM(source), res, &len, &error);
+	len = g_buffered_input_stream_fill_finish(
+			G_BUFFERED_INPUT_STREAM(source), res, &error);
 
-	if (line == NULL && error != NULL) {
+	if (len < 0) {
 		g_prefix_error(&error, "%s", _("Lost connection with server: "));
 		purple_connection_take_error(gc, error);
 		return;
-	} else if (line == NULL) {
+	} else if (len == 0) {
 		purple_connection_take_error(gc, g_error_new_literal(
 			PURPLE_CONNECTION_ERROR,
 			PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
@@ -739,28 +827,9 @@ irc_read_input_cb(GObject *source, GAsyncResult *res, gpointer data)
 		return;
 	}
 
-	irc = purple_connection_get_protocol_data(gc);
-
 	purple_connection_update_last_received(gc);
 
-	if (len > 0 && line[len - 1] == '\r')
-		line[len - 1] = '\0';
-
-	/* This is a hack to work around the fact that marv gets messages
-	 * with null bytes in them while using some weird irc server at work
- 	 */
-	while (start < len && line[start] == '\0')
-		++start;
-
-	if (start < len) {
-		irc_parse_msg(irc, line + start);
-	}
-
-	g_free(line);
-
-	g_data_input_stream_read_line_async(irc->input,
-			G_PRIORITY_DEFAULT, irc->cancellable,
-			irc_read_input_cb, gc);
+	irc_read_input(gc);
 }
 
 static void irc_chat_join (PurpleConnection *gc, GHashTable *data)
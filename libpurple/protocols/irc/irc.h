@@ -52,6 +52,10 @@
 
 #define IRC_MAX_MSG_SIZE 512
 
+/* Buffered lines are parsed at once, but for no longer than this time, so a
+ * large NAMES list or a message flood don't block the UI. */
+#define IRC_INPUT_TIME_BUDGET (20 * G_TIME_SPAN_MILLISECOND)
+
 #define IRC_NAMES_FLAG "irc-namelist"
 
 enum { IRC_USEROPT_SERVER, IRC_USEROPT_PORT, IRC_USEROPT_CHARSET };
@@ -80,8 +84,11 @@ struct irc_conn {
 	gboolean ison_outstanding;
 	GList *buddies_outstanding;
 
-	GDataInputStream *input;
+	GBufferedInputStream *input;
 	PurpleQueuedOutputStream *output;
+	/* the line currently being parsed */
+	GString *line;
+	guint input_idle;
 
 	GString *motd;
 	GString *names;
@@ -32,6 +32,11 @@ static GSList *cmds = NULL;
 static char *irc_send_convert(struct irc_conn *irc, const char *string);
 static char *irc_recv_convert(struct irc_conn *irc, const char *string);
 
+/* The maximum number of arguments of a message, see _irc_msgs formats */
+#define IRC_MSG_ARGS_MAX 10
+/* The maximum length of a message name */
+#define IRC_MSG_NAME_MAX 32
+
 static void irc_parse_error_cb(struct irc_conn *irc, char *input);
 
 static char *irc_mirc_colors[16] = {
@@ -128,6 +133,9 @@ static struct _irc_msg {
 	{ NULL, NULL, 0, NULL }
 };
 
+/* Numeric replies are looked up directly by their value */
+static struct _irc_msg *_irc_numeric_msgs[1000];
+
 static struct _irc_user_cmd {
 	char *name;
 	char *format;
@@ -269,6 +277,49 @@ static char *irc_send_convert(struct irc_conn *irc, const char *string)
 	return utf8;
 }
 
+/* Checks, if a valid UTF-8 string would be accepted by irc_recv_convert as
+ * is. */
+static gboolean irc_recv_accepts_utf8(struct irc_conn *irc)
+{
+	const gchar *enclist;
+
+	if (purple_account_get_bool(irc->account, "autodetect_utf8", IRC_DEFAULT_AUTODETECT))
+		return TRUE;
+
+	enclist = purple_account_get_string(irc->account, "encoding", IRC_DEFAULT_CHARSET);
+	if (enclist == NULL)
+		return FALSE;
+	while (*enclist == ' ')
+		enclist++;
+
+	return (g_ascii_strncasecmp(enclist, "UTF-8", 5) == 0 &&
+		(enclist[5] == '\0' || enclist[5] == ',' || enclist[5] == ' '));
+}
+
+/* Like irc_recv_convert, but doesn't copy the string, if it's valid UTF-8
+ * already. The converted string (if any) is returned in tofree. */
+static char *irc_recv_convert_fast(struct irc_conn *irc, gboolean accepts_utf8,
+	char *string, char **tofree)
+{
+	if (accepts_utf8 && g_utf8_validate(string, -1, NULL)) {
+		*tofree = NULL;
+		return string;
+	}
+
+	return (*tofree = irc_recv_convert(irc, string));
+}
+
+/* Like purple_utf8_salvage, but doesn't copy a valid UTF-8 string */
+static char *irc_recv_salvage_fast(char *string, char **tofree)
+{
+	if (g_utf8_validate(string, -1, NULL)) {
+		*tofree = NULL;
+		return string;
+	}
+
+	return (*tofree = purple_utf8_salvage(string));
+}
+
 static char *irc_recv_convert(struct irc_conn *irc, const char *string)
 {
 	char *utf8 = NULL;
@@ -613,10 +664,48 @@ void irc_msg_table_build(struct irc_conn *irc)
 	}
 
 	for (i = 0; _irc_msgs[i].name; i++) {
-		g_hash_table_insert(irc->msgs, (gpointer)_irc_msgs[i].name, (gpointer)&_irc_msgs[i]);
+		const char *name = _irc_msgs[i].name;
+
+		if (strlen(_irc_msgs[i].format) > IRC_MSG_ARGS_MAX) {
+			purple_debug_error("irc", "Too many arguments for '%s'\n", name);
+			continue;
+		}
+
+		g_hash_table_insert(irc->msgs, (gpointer)name, (gpointer)&_irc_msgs[i]);
+
+		if (g_ascii_isdigit(name[0]) && g_ascii_isdigit(name[1]) &&
+			g_ascii_isdigit(name[2]) && name[3] == '\0')
+		{
+			_irc_numeric_msgs[g_ascii_digit_value(name[0]) * 100 +
+				g_ascii_digit_value(name[1]) * 10 +
+				g_ascii_digit_value(name[2])] = &_irc_msgs[i];
+		}
 	}
 }
 
+/* Finds the message handler for a (not NUL-terminated) name. */
+static struct _irc_msg *irc_msg_lookup(struct irc_conn *irc, const char *name, gsize len)
+{
+	char lower[IRC_MSG_NAME_MAX];
+	gsize i;
+
+	if (len == 3 && g_ascii_isdigit(name[0]) && g_ascii_isdigit(name[1]) &&
+		g_ascii_isdigit(name[2]))
+	{
+		return _irc_numeric_msgs[g_ascii_digit_value(name[0]) * 100 +
+			g_ascii_digit_value(name[1]) * 10 +
+			g_ascii_digit_value(name[2])];
+	}
+
+	if (len >= sizeof(lower))
+		return NULL;
+	for (i = 0; i < len; i++)
+		lower[i] = g_ascii_tolower(name[i]);
+	lower[len] = '\0';
+
+	return g_hash_table_lookup(irc->msgs, lower);
+}
+
 void irc_cmd_table_build(struct irc_conn *irc)
 {
 	int i;
@@ -671,10 +760,13 @@ char *irc_format(struct irc_conn *irc, const char *format, ...)
 void irc_parse_msg(struct irc_conn *irc, char *input)
 {
 	struct _irc_msg *msgent;
-	char *cur, *end, *tmp, *from, *msgname, *fmt, **args, *msg;
+	char *cur, *end, *from, *fmt, *msg;
+	char *args[IRC_MSG_ARGS_MAX] = { NULL };
+	char *args_owned[IRC_MSG_ARGS_MAX] = { NULL };
+	char *from_owned;
 	guint i;
 	PurpleConnection *gc = purple_account_get_connection(irc->account);
-	gboolean fmt_valid;
+	gboolean fmt_valid, more, accepts_utf8;
 	int args_cnt;
 
 	irc->recv_time = time(NULL);
@@ -684,7 +776,8 @@ void irc_parse_msg(struct irc_conn *irc, char *input)
 	 * TODO: It should be passed as an array of bytes and a length
 	 * instead of a null terminated string.
 	 */
-	purple_signal_emit(_irc_protocol, "irc-receiving-text", gc, &input);
+	if (purple_signal_has_handlers(_irc_protocol, "irc-receiving-text"))
+		purple_signal_emit(_irc_protocol, "irc-receiving-text", gc, &input);
 
 	if (purple_debug_is_verbose()) {
 		char *clean = purple_utf8_salvage(input);
@@ -722,64 +815,68 @@ void irc_parse_msg(struct irc_conn *irc, char *input)
 		return;
 	}
 
-	from = g_strndup(&input[1], cur - &input[1]);
-	cur++;
-	end = strchr(cur, ' ');
+	end = strchr(cur + 1, ' ');
 	if (!end)
-		end = cur + strlen(cur);
-
-	tmp = g_strndup(cur, end - cur);
-	msgname = g_ascii_strdown(tmp, -1);
-	g_free(tmp);
+		end = cur + 1 + strlen(cur + 1);
 
-	if ((msgent = g_hash_table_lookup(irc->msgs, msgname)) == NULL) {
+	if ((msgent = irc_msg_lookup(irc, cur + 1, end - (cur + 1))) == NULL) {
+		from = g_strndup(&input[1], cur - &input[1]);
 		irc_msg_default(irc, "", from, &input);
-		g_free(msgname);
 		g_free(from);
 		return;
 	}
-	g_free(msgname);
+
+	/* The arguments are tokenized in place: separators are replaced with
+	 * NULs and the arguments point into the input, unless they have to be
+	 * converted. */
+	from = &input[1];
+	*cur = '\0';
+	accepts_utf8 = irc_recv_accepts_utf8(irc);
 
 	fmt_valid = TRUE;
-	args = g_new0(char *, strlen(msgent->format));
 	args_cnt = 0;
-	for (cur = end, fmt = msgent->format, i = 0; fmt[i] && *cur++; i++) {
+	more = (*end == ' ');
+	for (fmt = msgent->format, i = 0; fmt[i] && more; i++) {
+		cur = end + 1;
 		switch (fmt[i]) {
 		case 'v':
-			if (!(end = strchr(cur, ' '))) end = cur + strlen(cur);
-			/* This is a string of unknown encoding which we do not
-			 * want to transcode, but it may or may not be valid
-			 * UTF-8, so we'll salvage it.  If a nick/channel/target
-			 * field has inadvertently been marked verbatim, this
-			 * could cause weirdness. */
-			tmp = g_strndup(cur, end - cur);
-			args[i] = purple_utf8_salvage(tmp);
-			g_free(tmp);
-			cur += end - cur;
-			break;
 		case 't':
 		case 'n':
 		case 'c':
-			if (!(end = strchr(cur, ' '))) end = cur + strlen(cur);
-			tmp = g_strndup(cur, end - cur);
-			args[i] = irc_recv_convert(irc, tmp);
-			g_free(tmp);
-			cur += end - cur;
+			if ((end = strchr(cur, ' ')) != NULL) {
+				*end = '\0';
+			} else {
+				end = cur + strlen(cur);
+				more = FALSE;
+			}
+			if (fmt[i] == 'v') {
+				/* This is a string of unknown encoding which we do
+				 * not want to transcode, but it may or may not be
+				 * valid UTF-8, so we'll salvage it.  If a
+				 * nick/channel/target field has inadvertently been
+				 * marked verbatim, this could cause weirdness. */
+				args[i] = irc_recv_salvage_fast(cur, &args_owned[i]);
+			} else {
+				args[i] = irc_recv_convert_fast(irc, accepts_utf8,
+					cur, &args_owned[i]);
+			}
 			break;
 		case ':':
 			if (*cur == ':') cur++;
-			args[i] = irc_recv_convert(irc, cur);
-			cur = cur + strlen(cur);
+			args[i] = irc_recv_convert_fast(irc, accepts_utf8, cur,
+				&args_owned[i]);
+			more = FALSE;
 			break;
 		case '*':
 			/* Ditto 'v' above; we're going to salvage this in case
 			 * it leaks past the IRC protocol */
-			args[i] = purple_utf8_salvage(cur);
-			cur = cur + strlen(cur);
+			args[i] = irc_recv_salvage_fast(cur, &args_owned[i]);
+			more = FALSE;
 			break;
 		default:
 			purple_debug(PURPLE_DEBUG_ERROR, "irc", "invalid message format character '%c'\n", fmt[i]);
 			fmt_valid = FALSE;
+			more = FALSE;
 			break;
 		}
 		if (fmt_valid)
@@ -788,19 +885,17 @@ void irc_parse_msg(struct irc_conn *irc, char *input)
 	if (G_UNLIKELY(!fmt_valid)) {
 		purple_debug_error("irc", "message format was invalid");
 	} else if (G_LIKELY(args_cnt >= msgent->req_cnt)) {
-		tmp = irc_recv_convert(irc, from);
-		(msgent->cb)(irc, msgent->name, tmp, args);
-		g_free(tmp);
+		from = irc_recv_convert_fast(irc, accepts_utf8, from, &from_owned);
+		(msgent->cb)(irc, msgent->name, from, args);
+		g_free(from_owned);
 	} else {
 		purple_debug_error("irc", "args count (%d) doesn't reach "
 			"expected value of %d for the '%s' command",
 			args_cnt, msgent->req_cnt, msgent->name);
 	}
-	for (i = 0; i < strlen(msgent->format); i++) {
-		g_free(args[i]);
+	for (i = 0; i < IRC_MSG_ARGS_MAX; i++) {
+		g_free(args_owned[i]);
 	}
-	g_free(args);
-	g_free(from);
 }
 
 static void irc_parse_error_cb(struct irc_conn *irc, char *input)
@@ -333,6 +333,20 @@ void jabber_auth_start_old(JabberStream *js)
 
 	account = purple_connection_get_account(js->gc);
 
+	/*
+	 * A stream can only be resumed after SASL, and everything we send
+	 * while resuming is held until the server says it's back.  So there's
+	 * no point in trying, let the usual reconnect take over.
+	 */
+	if (js->sm != NULL && js->sm->resuming) {
+		purple_debug_info("jabber", "Unable to resume the stream with "
+			"legacy authentication\n");
+		purple_connection_error(js->gc,
+			PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+			_("Lost connection with server"));
+		return;
+	}
+
 	/*
 	 * We can end up here without encryption if the server doesn't support
 	 * <stream:features/> and we're not using old-style SSL.  If the user
@@ -2267,8 +2267,9 @@ jabber_resource_know_capabilities(const JabberBuddyResource *jbr)
 gboolean
 jabber_resource_has_capability(const JabberBuddyResource *jbr, const gchar *cap)
 {
-	const GList *node = NULL;
 	const JabberCapsNodeExts *exts;
+	gboolean found;
+	gint id;
 
 	if (!jbr->caps.info) {
 		purple_debug_info("jabber",
@@ -2276,20 +2277,24 @@ jabber_resource_has_capability(const JabberBuddyResource *jbr, const gchar *cap)
 		return FALSE;
 	}
 
-	node = g_list_find_custom(jbr->caps.info->features, cap, (GCompareFunc)strcmp);
-	if (!node && jbr->caps.exts && jbr->caps.info->exts) {
+	/* No client we know of has it */
+	id = jabber_caps_feature_lookup(cap);
+	if (id < 0)
+		return FALSE;
+
+	found = jabber_caps_features_has(jbr->caps.info->feature_set, id);
+	if (!found && jbr->caps.exts && jbr->caps.info->exts) {
 		const GList *ext;
 		exts = jbr->caps.info->exts;
-		/* Walk through all the enabled caps, checking each list for the cap.
+		/* Walk through all the enabled caps, checking each set for the cap.
 		 * Don't check it twice, though. */
-		for (ext = jbr->caps.exts; ext && !node; ext = ext->next) {
-			GList *features = g_hash_table_lookup(exts->exts, ext->data);
-			if (features)
-				node = g_list_find_custom(features, cap, (GCompareFunc)strcmp);
+		for (ext = jbr->caps.exts; ext && !found; ext = ext->next) {
+			JabberCapsFeatures *features = g_hash_table_lookup(exts->exts, ext->data);
+			found = jabber_caps_features_has(features, id);
 		}
 	}
 
-	return (node != NULL);
+	return found;
 }
 
 gboolean
@@ -23,6 +23,7 @@
 
 #include "internal.h"
 
+#include "binaryio.h"
 #include "debug.h"
 #include "caps.h"
 #include "iq.h"
@@ -30,16 +31,23 @@
 #include "util.h"
 #include "xdata.h"
 
-#define JABBER_CAPS_FILENAME "xmpp-caps.xml"
+/* Where older versions kept the cache */
+#define JABBER_CAPS_XML_FILENAME "xmpp-caps.xml"
 
 typedef struct {
 	gchar *var;
 	GList *values;
 } JabberDataFormField;
 
+struct _JabberCapsFeatures {
+	guint n_words;
+	guint32 words[];
+};
+
 static GHashTable *capstable = NULL; /* JabberCapsTuple -> JabberCapsClientInfo */
 static GHashTable *nodetable = NULL; /* char *node -> JabberCapsNodeExts */
-static guint       save_timer = 0;
+static GHashTable *feature_ids = NULL; /* char *feature -> id + 1 */
+static GPtrArray  *feature_names = NULL; /* id -> char *feature */
 
 /* Free a GList of allocated char* */
 static void
@@ -48,6 +56,128 @@ free_string_glist(GList *list)
 	g_list_free_full(list, g_free);
 }
 
+/* Returns the shared copy of feature, and its id in *id */
+static const char *
+jabber_caps_intern_feature(const char *feature, guint *id)
+{
+	gpointer value;
+	char *name;
+
+	if (feature_ids == NULL) {
+		feature_ids = g_hash_table_new(g_str_hash, g_str_equal);
+		feature_names = g_ptr_array_new_with_free_func(g_free);
+	}
+
+	if (g_hash_table_lookup_extended(feature_ids, feature,
+			(gpointer *)&name, &value)) {
+		*id = GPOINTER_TO_UINT(value) - 1;
+		return name;
+	}
+
+	name = g_strdup(feature);
+	*id = feature_names->len;
+	g_ptr_array_add(feature_names, name);
+	g_hash_table_insert(feature_ids, name, GUINT_TO_POINTER(*id + 1));
+
+	return name;
+}
+
+gint
+jabber_caps_feature_lookup(const char *feature)
+{
+	gpointer value;
+
+	if (feature_ids == NULL || feature == NULL)
+		return -1;
+
+	value = g_hash_table_lookup(feature_ids, feature);
+
+	return value ? (gint)GPOINTER_TO_UINT(value) - 1 : -1;
+}
+
+JabberCapsFeatures *
+jabber_caps_features_add(JabberCapsFeatures *set, const char *feature)
+{
+	guint id, word;
+
+	g_return_val_if_fail(feature != NULL, set);
+
+	jabber_caps_intern_feature(feature, &id);
+	word = id / 32;
+
+	if (set == NULL || word >= set->n_words) {
+		guint old = set ? set->n_words : 0;
+		/* ids are handed out in order, so leave room for a few more */
+		guint n_words = word + 2;
+
+		set = g_realloc(set, sizeof(JabberCapsFeatures) +
+			n_words * sizeof(guint32));
+		memset(set->words + old, 0, (n_words - old) * sizeof(guint32));
+		set->n_words = n_words;
+	}
+
+	set->words[word] |= 1u << (id % 32);
+
+	return set;
+}
+
+gboolean
+jabber_caps_features_has(const JabberCapsFeatures *set, gint id)
+{
+	if (set == NULL || id < 0 || (guint)id / 32 >= set->n_words)
+		return FALSE;
+
+	return (set->words[id / 32] & (1u << (id % 32))) != 0;
+}
+
+GList *
+jabber_caps_features_get_names(const JabberCapsFeatures *set)
+{
+	GList *names = NULL;
+	guint i;
+
+	if (set == NULL)
+		return NULL;
+
+	for (i = 0; i < set->n_words * 32; i++) {
+		if (set->words[i / 32] & (1u << (i % 32)))
+			names = g_list_prepend(names,
+				g_ptr_array_index(feature_names, i));
+	}
+
+	return g_list_sort(names, (GCompareFunc)strcmp);
+}
+
+void
+jabber_caps_features_free(JabberCapsFeatures *set)
+{
+	g_free(set);
+}
+
+/* Adds feature to the info's feature list, which is reversed once the
+ * parsing is done. Nothing is interned yet, a remote client's features
+ * only are once its hash was checked. */
+static void
+jabber_caps_client_info_add_feature(JabberCapsClientInfo *info,
+                                    const char *feature)
+{
+	info->features = g_list_prepend(info->features, g_strdup(feature));
+}
+
+/* Builds the info's feature set from its feature list */
+static void
+jabber_caps_client_info_intern_features(JabberCapsClientInfo *info)
+{
+	GList *l;
+
+	if (info->feature_set != NULL)
+		return;
+
+	for (l = info->features; l; l = l->next)
+		info->feature_set = jabber_caps_features_add(info->feature_set,
+			l->data);
+}
+
 static JabberCapsNodeExts*
 jabber_caps_node_exts_ref(JabberCapsNodeExts *exts)
 {
@@ -94,7 +224,7 @@ static gboolean jabber_caps_compare(gconstpointer v1, gconstpointer v2) {
 	       purple_strequal(name1->hash, name2->hash);
 }
 
-static void
+void
 jabber_caps_client_info_destroy(JabberCapsClientInfo *info)
 {
 	if (info == NULL)
@@ -103,6 +233,7 @@ jabber_caps_client_info_destroy(JabberCapsClientInfo *info)
 	g_list_free_full(info->identities, (GDestroyNotify)jabber_identity_free);
 
 	free_string_glist(info->features);
+	jabber_caps_features_free(info->feature_set);
 
 	g_list_free_full(info->forms, (GDestroyNotify)purple_xmlnode_free);
 
@@ -124,7 +255,7 @@ jabber_caps_find_exts_by_node(const char *node)
 	if (NULL == (exts = g_hash_table_lookup(nodetable, node))) {
 		exts = g_new0(JabberCapsNodeExts, 1);
 		exts->exts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
-		                                   (GDestroyNotify)free_string_glist);
+		                                   (GDestroyNotify)jabber_caps_features_free);
 		g_hash_table_insert(nodetable, g_strdup(node), jabber_caps_node_exts_ref(exts));
 	}
 
@@ -132,88 +263,9 @@ jabber_caps_find_exts_by_node(const char *node)
 }
 
 static void
-exts_to_xmlnode(gconstpointer key, gconstpointer value, gpointer user_data)
-{
-	const char *identifier = key;
-	const GList *features = value, *node;
-	PurpleXmlNode *client = user_data, *ext, *feature;
-
-	ext = purple_xmlnode_new_child(client, "ext");
-	purple_xmlnode_set_attrib(ext, "identifier", identifier);
-
-	for (node = features; node; node = node->next) {
-		feature = purple_xmlnode_new_child(ext, "feature");
-		purple_xmlnode_set_attrib(feature, "var", (const gchar *)node->data);
-	}
-}
-
-static void jabber_caps_store_client(gpointer key, gpointer value, gpointer user_data) {
-	const JabberCapsTuple *tuple = key;
-	const JabberCapsClientInfo *props = value;
-	PurpleXmlNode *root = user_data;
-	PurpleXmlNode *client = purple_xmlnode_new_child(root, "client");
-	GList *iter;
-
-	purple_xmlnode_set_attrib(client, "node", tuple->node);
-	purple_xmlnode_set_attrib(client, "ver", tuple->ver);
-	if (tuple->hash)
-		purple_xmlnode_set_attrib(client, "hash", tuple->hash);
-	for(iter = props->identities; iter; iter = g_list_next(iter)) {
-		JabberIdentity *id = iter->data;
-		PurpleXmlNode *identity = purple_xmlnode_new_child(client, "identity");
-		purple_xmlnode_set_attrib(identity, "category", id->category);
-		purple_xmlnode_set_attrib(identity, "type", id->type);
-		if (id->name)
-			purple_xmlnode_set_attrib(identity, "name", id->name);
-		if (id->lang)
-			purple_xmlnode_set_attrib(identity, "lang", id->lang);
-	}
-
-	for(iter = props->features; iter; iter = g_list_next(iter)) {
-		const char *feat = iter->data;
-		PurpleXmlNode *feature = purple_xmlnode_new_child(client, "feature");
-		purple_xmlnode_set_attrib(feature, "var", feat);
-	}
-
-	for(iter = props->forms; iter; iter = g_list_next(iter)) {
-		/* FIXME: See #7814 */
-		PurpleXmlNode *xdata = iter->data;
-		purple_xmlnode_insert_child(client, purple_xmlnode_copy(xdata));
-	}
-
-	/* TODO: Ideally, only save this once-per-node... */
-	if (props->exts)
-		g_hash_table_foreach(props->exts->exts, (GHFunc)exts_to_xmlnode, client);
-}
-
-static gboolean
-do_jabber_caps_store(gpointer data)
-{
-	char *str;
-	int length = 0;
-	PurpleXmlNode *root = purple_xmlnode_new("capabilities");
-
-	g_hash_table_foreach(capstable, jabber_caps_store_client, root);
-	str = purple_xmlnode_to_formatted_str(root, &length);
-	purple_xmlnode_free(root);
-	purple_util_write_data_to_cache_file(JABBER_CAPS_FILENAME, str, length);
-	g_free(str);
-
-	save_timer = 0;
-	return FALSE;
-}
-
-static void
-schedule_caps_save(void)
-{
-	if (save_timer == 0)
-		save_timer = g_timeout_add_seconds(5, do_jabber_caps_store, NULL);
-}
-
-static void
-jabber_caps_load(void)
+jabber_caps_load_xml(void)
 {
-	PurpleXmlNode *capsdata = purple_util_read_xml_from_cache_file(JABBER_CAPS_FILENAME, "XMPP capabilities cache");
+	PurpleXmlNode *capsdata = purple_util_read_xml_from_cache_file(JABBER_CAPS_XML_FILENAME, "XMPP capabilities cache");
 	PurpleXmlNode *client;
 
 	if(!capsdata)
@@ -247,7 +299,7 @@ jabber_caps_load(void)
 					const char *var = purple_xmlnode_get_attrib(child, "var");
 					if(!var)
 						continue;
-					value->features = g_list_append(value->features,g_strdup(var));
+					jabber_caps_client_info_add_feature(value, var);
 				} else if (purple_strequal(child->name, "identity")) {
 					const char *category = purple_xmlnode_get_attrib(child, "category");
 					const char *type = purple_xmlnode_get_attrib(child, "type");
@@ -273,7 +325,7 @@ jabber_caps_load(void)
 						/* TODO: Do we care about reading in the identities listed here? */
 						const char *identifier = purple_xmlnode_get_attrib(child, "identifier");
 						PurpleXmlNode *node;
-						GList *features = NULL;
+						JabberCapsFeatures *features = NULL;
 
 						if (!identifier)
 							continue;
@@ -285,7 +337,7 @@ jabber_caps_load(void)
 								const char *var = purple_xmlnode_get_attrib(node, "var");
 								if (!var)
 									continue;
-								features = g_list_prepend(features, g_strdup(var));
+								features = jabber_caps_features_add(features, var);
 							}
 						}
 
@@ -299,6 +351,8 @@ jabber_caps_load(void)
 				}
 			}
 
+			value->features = g_list_reverse(value->features);
+			jabber_caps_client_info_intern_features(value);
 			value->exts = exts;
 			g_hash_table_replace(capstable, key, value);
 
@@ -307,23 +361,683 @@ jabber_caps_load(void)
 	purple_xmlnode_free(capsdata);
 }
 
+/**************************************************************************
+ * Binary store
+ **************************************************************************/
+
+/* The caps cache is an append-only file, so learning about a new client
+ * costs one small write instead of rewriting the whole cache. Opening it
+ * only indexes the client records by node, ver and hash; a client is
+ * decoded from the mapped file the first time it's looked up.
+ *
+ * The file starts with the magic and a version number, followed by
+ * records: the type (one byte), the payload size, when the entry was last
+ * seen, an FNV-1a checksum of the payload and the payload. All numbers are
+ * little-endian. Strings are stored with their length and a terminating
+ * NUL, a length of G_MAXUINT32 stands for NULL.
+ *
+ * A client record holds node, ver, hash, the identities, features and
+ * forms. An ext record holds node, ext name and the features. A touch
+ * record holds node, ver and hash and only updates when that client was
+ * last seen. Later records win over earlier ones.
+ *
+ * Clients that weren't seen for JABBER_CAPS_STORE_MAX_AGE are dropped,
+ * and so are the oldest ones past JABBER_CAPS_STORE_MAX_ENTRIES. When
+ * opened, the file is rewritten if it's mostly made of dropped or
+ * outdated records.
+ */
+#define JABBER_CAPS_STORE_FILENAME    "xmpp-caps.bin"
+#define JABBER_CAPS_STORE_MAGIC       "PURPLECS"
+#define JABBER_CAPS_STORE_VERSION     1
+#define JABBER_CAPS_STORE_HEADER_SIZE 12
+#define JABBER_CAPS_STORE_RECORD_SIZE 17
+#define JABBER_CAPS_STORE_MAX_AGE     (30 * 24 * 60 * 60)
+#define JABBER_CAPS_STORE_MAX_ENTRIES 10000
+/* last seen times are only written out when they moved this much */
+#define JABBER_CAPS_STORE_TOUCH_DELAY (24 * 60 * 60)
+/* smaller files aren't worth rewriting */
+#define JABBER_CAPS_STORE_MIN_DEAD    (64 * 1024)
+
+typedef enum {
+	JABBER_CAPS_RECORD_CLIENT = 1,
+	JABBER_CAPS_RECORD_EXT,
+	JABBER_CAPS_RECORD_TOUCH
+} JabberCapsRecordType;
+
+typedef struct {
+	JabberCapsTuple tuple;
+	gsize offset; /* of the payload in capsmap, 0 if it isn't in there */
+	guint32 size;
+	gint64 last_seen;
+	gint64 written_seen; /* last_seen as far as the file knows */
+} JabberCapsStoreEntry;
+
+static GHashTable    *capsindex = NULL; /* JabberCapsTuple -> JabberCapsStoreEntry */
+static GMappedFile   *capsmap = NULL;
+static GOutputStream *capsout = NULL;
+
+static gboolean
+caps_store_get_tuple(PurpleBinaryReader *reader, JabberCapsTuple *tuple)
+{
+	return _purple_binary_get_string(reader, &tuple->node) && tuple->node &&
+	       _purple_binary_get_string(reader, &tuple->ver) && tuple->ver &&
+	       _purple_binary_get_string(reader, &tuple->hash);
+}
+
+static void
+caps_store_put_tuple(GByteArray *out, const JabberCapsTuple *tuple)
+{
+	_purple_binary_put_string(out, tuple->node);
+	_purple_binary_put_string(out, tuple->ver);
+	_purple_binary_put_string(out, tuple->hash);
+}
+
+void
+jabber_caps_client_info_serialize(const JabberCapsClientInfo *info,
+                                  GByteArray *out)
+{
+	GList *l;
+
+	g_return_if_fail(info != NULL);
+	g_return_if_fail(out != NULL);
+
+	caps_store_put_tuple(out, &info->tuple);
+
+	_purple_binary_put_uint32(out, g_list_length(info->identities));
+	for (l = info->identities; l; l = l->next) {
+		JabberIdentity *id = l->data;
+
+		_purple_binary_put_string(out, id->category);
+		_purple_binary_put_string(out, id->type);
+		_purple_binary_put_string(out, id->lang);
+		_purple_binary_put_string(out, id->name);
+	}
+
+	_purple_binary_put_uint32(out, g_list_length(info->features));
+	for (l = info->features; l; l = l->next)
+		_purple_binary_put_string(out, l->data);
+
+	_purple_binary_put_uint32(out, g_list_length(info->forms));
+	for (l = info->forms; l; l = l->next) {
+		char *form = purple_xmlnode_to_str(l->data, NULL);
+		_purple_binary_put_string(out, form);
+		g_free(form);
+	}
+}
+
+JabberCapsClientInfo *
+jabber_caps_client_info_deserialize(const guchar *data, gsize len)
+{
+	PurpleBinaryReader reader = { data, data + len };
+	JabberCapsClientInfo *info;
+	JabberCapsTuple tuple, *key;
+	guint32 count, i;
+
+	g_return_val_if_fail(data != NULL, NULL);
+
+	if (!caps_store_get_tuple(&reader, &tuple))
+		return NULL;
+
+	info = g_new0(JabberCapsClientInfo, 1);
+	key = (JabberCapsTuple *)&info->tuple;
+	key->node = g_strdup(tuple.node);
+	key->ver = g_strdup(tuple.ver);
+	key->hash = g_strdup(tuple.hash);
+
+	if (!_purple_binary_get_uint32(&reader, &count))
+		goto error;
+	for (i = 0; i < count; i++) {
+		const char *category, *type, *lang, *name;
+
+		if (!_purple_binary_get_string(&reader, &category) || !category ||
+				!_purple_binary_get_string(&reader, &type) || !type ||
+				!_purple_binary_get_string(&reader, &lang) ||
+				!_purple_binary_get_string(&reader, &name))
+			goto error;
+
+		info->identities = g_list_prepend(info->identities,
+			jabber_identity_new(category, type, lang, name));
+	}
+	info->identities = g_list_reverse(info->identities);
+
+	if (!_purple_binary_get_uint32(&reader, &count))
+		goto error;
+	for (i = 0; i < count; i++) {
+		const char *var;
+
+		if (!_purple_binary_get_string(&reader, &var) || !var)
+			goto error;
+
+		jabber_caps_client_info_add_feature(info, var);
+	}
+	info->features = g_list_reverse(info->features);
+	jabber_caps_client_info_intern_features(info);
+
+	if (!_purple_binary_get_uint32(&reader, &count))
+		goto error;
+	for (i = 0; i < count; i++) {
+		const char *str;
+		PurpleXmlNode *form;
+
+		if (!_purple_binary_get_string(&reader, &str) || !str ||
+				!(form = purple_xmlnode_from_str(str, -1)))
+			goto error;
+
+		info->forms = g_list_prepend(info->forms, form);
+	}
+	info->forms = g_list_reverse(info->forms);
+
+	return info;
+
+error:
+	jabber_caps_client_info_destroy(info);
+	return NULL;
+}
+
+static void
+caps_store_put_record(GByteArray *out, JabberCapsRecordType type,
+                      gint64 last_seen, const guint8 *payload, guint32 size)
+{
+	guint8 type_byte = type;
+
+	g_byte_array_append(out, &type_byte, 1);
+	_purple_binary_put_uint32(out, size);
+	_purple_binary_put_int64(out, last_seen);
+	_purple_binary_put_uint32(out, _purple_fnv1a(payload, size));
+	g_byte_array_append(out, payload, size);
+}
+
+static void
+caps_store_append(JabberCapsRecordType type, gint64 last_seen,
+                  GByteArray *payload)
+{
+	GByteArray *record;
+	GError *error = NULL;
+
+	if (capsout == NULL)
+		return;
+
+	record = g_byte_array_sized_new(JABBER_CAPS_STORE_RECORD_SIZE +
+		payload->len);
+	caps_store_put_record(record, type, last_seen, payload->data,
+		payload->len);
+
+	if (!g_output_stream_write_all(capsout, record->data, record->len,
+			NULL, NULL, &error)) {
+		purple_debug_warning("jabber",
+			"Unable to write to the caps cache, giving up on it: %s\n",
+			error->message);
+		g_error_free(error);
+		g_clear_object(&capsout);
+	}
+
+	g_byte_array_unref(record);
+}
+
+static void
+caps_store_put_ext(GByteArray *out, const char *node, const char *name,
+                   const JabberCapsFeatures *features)
+{
+	GList *names, *l;
+
+	_purple_binary_put_string(out, node);
+	_purple_binary_put_string(out, name);
+
+	names = jabber_caps_features_get_names(features);
+	_purple_binary_put_uint32(out, g_list_length(names));
+	for (l = names; l; l = l->next)
+		_purple_binary_put_string(out, l->data);
+	g_list_free(names);
+}
+
+static JabberCapsStoreEntry *
+caps_store_entry_new(const JabberCapsTuple *tuple, gint64 last_seen)
+{
+	JabberCapsStoreEntry *entry = g_new0(JabberCapsStoreEntry, 1);
+
+	entry->tuple.node = g_strdup(tuple->node);
+	entry->tuple.ver = g_strdup(tuple->ver);
+	entry->tuple.hash = g_strdup(tuple->hash);
+	entry->last_seen = last_seen;
+	entry->written_seen = last_seen;
+
+	return entry;
+}
+
+static void
+caps_store_entry_free(JabberCapsStoreEntry *entry)
+{
+	g_free((char *)entry->tuple.node);
+	g_free((char *)entry->tuple.ver);
+	g_free((char *)entry->tuple.hash);
+	g_free(entry);
+}
+
+static void
+caps_store_entry_insert(JabberCapsStoreEntry *entry)
+{
+	g_hash_table_replace(capsindex, &entry->tuple, entry);
+}
+
+static gint
+caps_store_entry_compare_seen(gconstpointer a, gconstpointer b)
+{
+	const JabberCapsStoreEntry *entry_a = a;
+	const JabberCapsStoreEntry *entry_b = b;
+
+	if (entry_a->last_seen < entry_b->last_seen)
+		return -1;
+	return entry_a->last_seen > entry_b->last_seen;
+}
+
+/* Drops the entries seen least recently until there are max left */
+static void
+caps_store_evict(guint max)
+{
+	GList *entries, *l;
+	guint count = g_hash_table_size(capsindex);
+
+	if (count <= max)
+		return;
+
+	entries = g_hash_table_get_values(capsindex);
+	entries = g_list_sort(entries, caps_store_entry_compare_seen);
+	for (l = entries; l && count > max; l = l->next, count--) {
+		JabberCapsStoreEntry *entry = l->data;
+		g_hash_table_remove(capsindex, &entry->tuple);
+	}
+	g_list_free(entries);
+}
+
+static gboolean
+caps_store_entry_expired(gpointer key, gpointer value, gpointer data)
+{
+	const JabberCapsStoreEntry *entry = value;
+	const gint64 *cutoff = data;
+
+	return entry->last_seen < *cutoff;
+}
+
+/* Indexes the client records in capsmap and loads the exts. Returns FALSE
+ * if the file is damaged, after indexing whatever comes before the damage.
+ * *live is set to the size of the records still in use. */
+static gboolean
+caps_store_scan(gsize *live)
+{
+	const guchar *data = (const guchar *)g_mapped_file_get_contents(capsmap);
+	gsize len = g_mapped_file_get_length(capsmap);
+	gsize pos = JABBER_CAPS_STORE_HEADER_SIZE;
+	PurpleBinaryReader reader;
+	GHashTableIter iter;
+	gpointer value;
+	guint32 version;
+
+	*live = 0;
+
+	if (data == NULL || len < JABBER_CAPS_STORE_HEADER_SIZE ||
+			memcmp(data, JABBER_CAPS_STORE_MAGIC, 8) != 0)
+		return FALSE;
+
+	reader.cur = data + 8;
+	reader.end = data + len;
+	if (!_purple_binary_get_uint32(&reader, &version) ||
+			version != JABBER_CAPS_STORE_VERSION)
+		return FALSE;
+
+	while (pos < len) {
+		JabberCapsTuple tuple;
+		JabberCapsStoreEntry *entry;
+		const guchar *payload;
+		guint8 type;
+		guint32 size, checksum;
+		gint64 last_seen;
+
+		if (len - pos < JABBER_CAPS_STORE_RECORD_SIZE)
+			return FALSE;
+
+		reader.cur = data + pos;
+		reader.end = data + len;
+		type = *reader.cur++;
+		_purple_binary_get_uint32(&reader, &size);
+		_purple_binary_get_int64(&reader, &last_seen);
+		_purple_binary_get_uint32(&reader, &checksum);
+
+		payload = reader.cur;
+		if ((gsize)(reader.end - payload) < size ||
+				_purple_fnv1a(payload, size) != checksum)
+			return FALSE;
+
+		pos += JABBER_CAPS_STORE_RECORD_SIZE + size;
+		reader.end = payload + size;
+
+		switch (type) {
+			case JABBER_CAPS_RECORD_CLIENT:
+				if (!caps_store_get_tuple(&reader, &tuple))
+					return FALSE;
+
+				entry = caps_store_entry_new(&tuple, last_seen);
+				entry->offset = payload - data;
+				entry->size = size;
+				caps_store_entry_insert(entry);
+				break;
+
+			case JABBER_CAPS_RECORD_TOUCH:
+				if (!caps_store_get_tuple(&reader, &tuple))
+					return FALSE;
+
+				entry = g_hash_table_lookup(capsindex, &tuple);
+				if (entry && entry->last_seen < last_seen)
+					entry->last_seen = entry->written_seen = last_seen;
+				break;
+
+			case JABBER_CAPS_RECORD_EXT: {
+				JabberCapsNodeExts *exts;
+				JabberCapsFeatures *features = NULL;
+				const char *node, *name, *var;
+				guint32 count, i;
+
+				if (!_purple_binary_get_string(&reader, &node) || !node ||
+						!_purple_binary_get_string(&reader, &name) || !name ||
+						!_purple_binary_get_uint32(&reader, &count))
+					return FALSE;
+
+				for (i = 0; i < count; i++) {
+					if (!_purple_binary_get_string(&reader, &var) || !var) {
+						jabber_caps_features_free(features);
+						return FALSE;
+					}
+					features = jabber_caps_features_add(features, var);
+				}
+
+				exts = jabber_caps_find_exts_by_node(node);
+				g_hash_table_replace(exts->exts, g_strdup(name), features);
+				jabber_caps_node_exts_unref(exts);
+
+				*live += JABBER_CAPS_STORE_RECORD_SIZE + size;
+				break;
+			}
+
+			default:
+				purple_debug_warning("jabber",
+					"Skipping unknown record %u in the caps cache\n", type);
+				break;
+		}
+	}
+
+	g_hash_table_iter_init(&iter, capsindex);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		JabberCapsStoreEntry *entry = value;
+		*live += JABBER_CAPS_STORE_RECORD_SIZE + entry->size;
+	}
+
+	return TRUE;
+}
+
+static void
+caps_store_close(void)
+{
+	g_clear_object(&capsout);
+	if (capsmap != NULL) {
+		g_mapped_file_unref(capsmap);
+		capsmap = NULL;
+	}
+	g_hash_table_remove_all(capsindex);
+}
+
+/* Rewrites the file with only the entries in the index and the known exts,
+ * and closes it. */
+static void
+caps_store_compact(void)
+{
+	GByteArray *out = g_byte_array_new();
+	GByteArray *payload = g_byte_array_new();
+	GHashTableIter iter, ext_iter;
+	gpointer key, value;
+	gint64 now = time(NULL);
+
+	g_byte_array_append(out, (const guint8 *)JABBER_CAPS_STORE_MAGIC, 8);
+	_purple_binary_put_uint32(out, JABBER_CAPS_STORE_VERSION);
+
+	g_hash_table_iter_init(&iter, capsindex);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		JabberCapsStoreEntry *entry = value;
+		JabberCapsClientInfo *info;
+
+		g_byte_array_set_size(payload, 0);
+		info = g_hash_table_lookup(capstable, &entry->tuple);
+		if (info != NULL) {
+			jabber_caps_client_info_serialize(info, payload);
+		} else if (entry->offset != 0) {
+			g_byte_array_append(payload,
+				(const guint8 *)g_mapped_file_get_contents(capsmap) +
+					entry->offset, entry->size);
+		} else {
+			continue;
+		}
+
+		caps_store_put_record(out, JABBER_CAPS_RECORD_CLIENT,
+			entry->last_seen, payload->data, payload->len);
+	}
+
+	g_hash_table_iter_init(&iter, nodetable);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		JabberCapsNodeExts *exts = value;
+		gpointer name, features;
+
+		g_hash_table_iter_init(&ext_iter, exts->exts);
+		while (g_hash_table_iter_next(&ext_iter, &name, &features)) {
+			g_byte_array_set_size(payload, 0);
+			caps_store_put_ext(payload, key, name, features);
+			caps_store_put_record(out, JABBER_CAPS_RECORD_EXT, now,
+				payload->data, payload->len);
+		}
+	}
+
+	/* the old file has to be closed before it can be replaced */
+	caps_store_close();
+	purple_util_write_data_to_cache_file(JABBER_CAPS_STORE_FILENAME,
+		(const char *)out->data, out->len);
+
+	g_byte_array_unref(payload);
+	g_byte_array_unref(out);
+}
+
+static void
+caps_store_open(gboolean allow_compact)
+{
+	char *filename = g_build_filename(purple_cache_dir(),
+		JABBER_CAPS_STORE_FILENAME, NULL);
+	GError *error = NULL;
+	GFileOutputStream *stream;
+	GFile *file;
+	gboolean intact = FALSE;
+	gsize len = 0, live = 0;
+
+	capsmap = g_mapped_file_new(filename, FALSE, &error);
+	if (capsmap != NULL) {
+		gint64 cutoff = time(NULL) - JABBER_CAPS_STORE_MAX_AGE;
+		GHashTableIter iter;
+		gpointer value;
+
+		intact = caps_store_scan(&live);
+		len = g_mapped_file_get_length(capsmap);
+
+		g_hash_table_iter_init(&iter, capsindex);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			JabberCapsStoreEntry *entry = value;
+
+			if (caps_store_entry_expired(NULL, entry, &cutoff)) {
+				live -= JABBER_CAPS_STORE_RECORD_SIZE + entry->size;
+				g_hash_table_iter_remove(&iter);
+			}
+		}
+		caps_store_evict(JABBER_CAPS_STORE_MAX_ENTRIES);
+	} else if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+		purple_debug_warning("jabber", "Unable to open the caps cache: %s\n",
+			error->message);
+		g_clear_error(&error);
+	} else {
+		g_clear_error(&error);
+	}
+
+	/* live is an estimate after eviction, which only ever lowers it */
+	if (allow_compact && (!intact || (len - live > JABBER_CAPS_STORE_MIN_DEAD &&
+			len - live > live))) {
+		if (capsmap != NULL)
+			purple_debug_info("jabber", "Compacting the caps cache\n");
+		caps_store_compact();
+		g_free(filename);
+		caps_store_open(FALSE);
+		return;
+	}
+
+	file = g_file_new_for_path(filename);
+	stream = g_file_append_to(file, G_FILE_CREATE_PRIVATE, NULL, &error);
+	if (stream == NULL) {
+		purple_debug_warning("jabber",
+			"Unable to write to the caps cache: %s\n", error->message);
+		g_error_free(error);
+	}
+	capsout = G_OUTPUT_STREAM(stream);
+
+	g_object_unref(file);
+	g_free(filename);
+}
+
+/* Decodes a client from the store into the capstable */
+static JabberCapsClientInfo *
+caps_store_lookup(const JabberCapsTuple *key)
+{
+	JabberCapsStoreEntry *entry;
+	JabberCapsClientInfo *info;
+	const guchar *data;
+
+	if (capsmap == NULL)
+		return NULL;
+
+	entry = g_hash_table_lookup(capsindex, key);
+	if (entry == NULL || entry->offset == 0)
+		return NULL;
+
+	data = (const guchar *)g_mapped_file_get_contents(capsmap);
+	info = jabber_caps_client_info_deserialize(data + entry->offset,
+		entry->size);
+	if (info == NULL || !jabber_caps_compare(&info->tuple, key)) {
+		purple_debug_warning("jabber",
+			"Dropping damaged caps cache entry for %s#%s\n",
+			key->node, key->ver);
+		jabber_caps_client_info_destroy(info);
+		g_hash_table_remove(capsindex, key);
+		return NULL;
+	}
+
+	/* v1.3 capabilities */
+	if (info->tuple.hash == NULL)
+		info->exts = jabber_caps_find_exts_by_node(info->tuple.node);
+
+	g_hash_table_insert(capstable, (gpointer)&info->tuple, info);
+
+	return info;
+}
+
+static void
+caps_store_touch(const JabberCapsTuple *key)
+{
+	JabberCapsStoreEntry *entry = g_hash_table_lookup(capsindex, key);
+	GByteArray *payload;
+	gint64 now;
+
+	if (entry == NULL)
+		return;
+
+	now = time(NULL);
+	entry->last_seen = now;
+	if (now - entry->written_seen < JABBER_CAPS_STORE_TOUCH_DELAY)
+		return;
+
+	payload = g_byte_array_new();
+	caps_store_put_tuple(payload, key);
+	caps_store_append(JABBER_CAPS_RECORD_TOUCH, now, payload);
+	g_byte_array_unref(payload);
+
+	entry->written_seen = now;
+}
+
+static void
+caps_store_add_client(const JabberCapsClientInfo *info)
+{
+	GByteArray *payload = g_byte_array_new();
+	gint64 now = time(NULL);
+
+	jabber_caps_client_info_serialize(info, payload);
+	caps_store_append(JABBER_CAPS_RECORD_CLIENT, now, payload);
+	g_byte_array_unref(payload);
+
+	/* it's in the capstable now, which is where compacting looks first */
+	caps_store_entry_insert(caps_store_entry_new(&info->tuple, now));
+
+	if (g_hash_table_size(capsindex) >
+			JABBER_CAPS_STORE_MAX_ENTRIES + JABBER_CAPS_STORE_MAX_ENTRIES / 10)
+		caps_store_evict(JABBER_CAPS_STORE_MAX_ENTRIES);
+}
+
+static void
+caps_store_add_ext(const char *node, const char *name,
+                   const JabberCapsFeatures *features)
+{
+	GByteArray *payload = g_byte_array_new();
+
+	caps_store_put_ext(payload, node, name, features);
+	caps_store_append(JABBER_CAPS_RECORD_EXT, time(NULL), payload);
+	g_byte_array_unref(payload);
+}
+
 void jabber_caps_init(void)
 {
+	char *xml_filename;
+
 	nodetable = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)jabber_caps_node_exts_unref);
 	capstable = g_hash_table_new_full(jabber_caps_hash, jabber_caps_compare, NULL, (GDestroyNotify)jabber_caps_client_info_destroy);
-	jabber_caps_load();
+	capsindex = g_hash_table_new_full(jabber_caps_hash, jabber_caps_compare, NULL, (GDestroyNotify)caps_store_entry_free);
+
+	/* Move the XML cache older versions wrote over to the store */
+	xml_filename = g_build_filename(purple_cache_dir(), JABBER_CAPS_XML_FILENAME, NULL);
+	if (g_file_test(xml_filename, G_FILE_TEST_EXISTS)) {
+		GHashTableIter iter;
+		gpointer key;
+		gint64 now = time(NULL);
+
+		jabber_caps_load_xml();
+
+		g_hash_table_iter_init(&iter, capstable);
+		while (g_hash_table_iter_next(&iter, &key, NULL))
+			caps_store_entry_insert(caps_store_entry_new(key, now));
+
+		caps_store_compact();
+		g_unlink(xml_filename);
+	}
+	g_free(xml_filename);
+
+	caps_store_open(TRUE);
 }
 
 void jabber_caps_uninit(void)
 {
-	if (save_timer != 0) {
-		g_source_remove(save_timer);
-		save_timer = 0;
-		do_jabber_caps_store(NULL);
-	}
+	caps_store_close();
+	g_hash_table_destroy(capsindex);
+	capsindex = NULL;
+
 	g_hash_table_destroy(capstable);
 	g_hash_table_destroy(nodetable);
 	capstable = nodetable = NULL;
+
+	/* nothing refers to the interned features without the tables */
+	if (feature_ids != NULL) {
+		g_hash_table_destroy(feature_ids);
+		g_ptr_array_free(feature_names, TRUE);
+		feature_ids = NULL;
+		feature_names = NULL;
+	}
 }
 
 gboolean jabber_caps_exts_known(const JabberCapsClientInfo *info,
@@ -498,8 +1212,7 @@ jabber_caps_client_iqcb(JabberStream *js, const char *from, JabberIqType type,
 		userdata->node = userdata->ver = userdata->hash = NULL;
 
 		/* The capstable gets a reference */
-		g_hash_table_insert(capstable, n_key, info);
-		schedule_caps_save();
+		jabber_caps_add_client_info(info);
 	}
 
 	userdata->info = info;
@@ -523,7 +1236,7 @@ jabber_caps_ext_iqcb(JabberStream *js, const char *from, JabberIqType type,
 		NS_DISCO_INFO);
 	PurpleXmlNode *child;
 	ext_iq_data *userdata = data;
-	GList *features = NULL;
+	JabberCapsFeatures *features = NULL;
 	JabberCapsNodeExts *node_exts;
 
 	if (!query || type == JABBER_IQ_ERROR) {
@@ -567,11 +1280,14 @@ jabber_caps_ext_iqcb(JabberStream *js, const char *from, JabberIqType type,
 	        child = purple_xmlnode_get_next_twin(child)) {
 		const char *var = purple_xmlnode_get_attrib(child, "var");
 		if (var)
-			features = g_list_prepend(features, g_strdup(var));
+			features = jabber_caps_features_add(features, var);
 	}
 
 	g_hash_table_insert(node_exts->exts, g_strdup(userdata->name), features);
-	schedule_caps_save();
+	/* the node moves to the info once that arrived */
+	caps_store_add_ext(userdata->data->info ? userdata->data->info->tuple.node :
+	                                          userdata->data->node,
+	                   userdata->name, features);
 
 	/* Are we done? */
 	if (userdata->data->info && userdata->data->extOutstanding == 0)
@@ -581,6 +1297,35 @@ jabber_caps_ext_iqcb(JabberStream *js, const char *from, JabberIqType type,
 	g_free(userdata);
 }
 
+JabberCapsClientInfo *
+jabber_caps_find_client_info(const char *node, const char *ver,
+                             const char *hash)
+{
+	JabberCapsClientInfo *info;
+	JabberCapsTuple key;
+
+	/* Using this in a read-only fashion, so the cast is OK */
+	key.node = (char *)node;
+	key.ver = (char *)ver;
+	key.hash = (char *)hash;
+
+	info = g_hash_table_lookup(capstable, &key);
+	if (info == NULL)
+		info = caps_store_lookup(&key);
+	if (info != NULL)
+		caps_store_touch(&key);
+
+	return info;
+}
+
+void
+jabber_caps_add_client_info(JabberCapsClientInfo *info)
+{
+	jabber_caps_client_info_intern_features(info);
+	g_hash_table_insert(capstable, (gpointer)&info->tuple, info);
+	caps_store_add_client(info);
+}
+
 void jabber_caps_get_info(JabberStream *js, const char *who, const char *node,
         const char *ver, const char *hash, char **exts,
         jabber_caps_get_info_cb cb, gpointer user_data)
@@ -596,12 +1341,8 @@ void jabber_caps_get_info(JabberStream *js, const char *who, const char *node,
 		exts = NULL;
 	}
 
-	/* Using this in a read-only fashion, so the cast is OK */
-	key.node = (char *)node;
-	key.ver = (char *)ver;
-	key.hash = (char *)hash;
+	info = jabber_caps_find_client_info(node, ver, hash);
 
-	info = g_hash_table_lookup(capstable, &key);
 	if (info && hash) {
 		/* v1.5 - We already have all the information we care about */
 		if (cb)
@@ -746,7 +1487,7 @@ JabberCapsClientInfo *jabber_caps_parse_client_info(PurpleXmlNode *query)
 			/* parse feature */
 			const char *var = purple_xmlnode_get_attrib(child, "var");
 			if (var)
-				info->features = g_list_prepend(info->features, g_strdup(var));
+				jabber_caps_client_info_add_feature(info, var);
 		} else if (purple_strequal(child->name, "x")) {
 			if (purple_strequal(child->xmlns, "jabber:x:data")) {
 				/* x-data form */
@@ -755,6 +1496,9 @@ JabberCapsClientInfo *jabber_caps_parse_client_info(PurpleXmlNode *query)
 			}
 		}
 	}
+
+	info->features = g_list_reverse(info->features);
+
 	return info;
 }
 
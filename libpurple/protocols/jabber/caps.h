@@ -32,6 +32,13 @@ typedef struct _JabberCapsClientInfo JabberCapsClientInfo;
 
 typedef struct _JabberCapsNodeExts JabberCapsNodeExts;
 
+/*
+ * Feature namespaces are interned to small integer ids, shared by every
+ * client in the caps table, so a set of features is a bitset and checking
+ * for one doesn't compare any strings.
+ */
+typedef struct _JabberCapsFeatures JabberCapsFeatures;
+
 typedef struct {
 	const char *node;
 	const char *ver;
@@ -40,7 +47,8 @@ typedef struct {
 
 struct _JabberCapsClientInfo {
 	GList *identities; /* JabberIdentity */
-	GList *features; /* char * */
+	GList *features; /* char *, in the order received */
+	JabberCapsFeatures *feature_set; /* set once it's in the capstable */
 	GList *forms; /* PurpleXmlNode * */
 	JabberCapsNodeExts *exts;
 
@@ -62,7 +70,7 @@ struct _JabberCapsClientInfo {
  */
 struct _JabberCapsNodeExts {
 	guint ref;
-	GHashTable *exts; /* char *ext_name -> GList *features */
+	GHashTable *exts; /* char *ext_name -> JabberCapsFeatures * */
 };
 
 typedef void (*jabber_caps_get_info_cb)(JabberCapsClientInfo *info, GList *exts, gpointer user_data);
@@ -70,6 +78,38 @@ typedef void (*jabber_caps_get_info_cb)(JabberCapsClientInfo *info, GList *exts,
 void jabber_caps_init(void);
 void jabber_caps_uninit(void);
 
+/**
+ * Look up the id a feature namespace was interned to.
+ *
+ * @return The id, or -1 if no client with this feature has been seen, in
+ *         which case no feature set contains it.
+ */
+gint jabber_caps_feature_lookup(const char *feature);
+
+/**
+ * Add a feature to a set, interning it if needed.
+ *
+ * @param set The set, or NULL to start a new one.
+ * @return The set, which may have moved; free it with
+ *         jabber_caps_features_free().
+ */
+JabberCapsFeatures *jabber_caps_features_add(JabberCapsFeatures *set,
+                                             const char *feature);
+
+/**
+ * Check whether a set contains the feature with the given id.
+ */
+gboolean jabber_caps_features_has(const JabberCapsFeatures *set, gint id);
+
+/**
+ * Get the features in a set, sorted.
+ *
+ * @return A list of interned, const strings; free it with g_list_free().
+ */
+GList *jabber_caps_features_get_names(const JabberCapsFeatures *set);
+
+void jabber_caps_features_free(JabberCapsFeatures *set);
+
 /**
  * Check whether all of the exts in a char* array are known to the given info.
  */
@@ -118,7 +158,8 @@ void jabber_caps_broadcast_change(void);
 
 /**
  * Parse the <query/> element from an IQ stanza into a JabberCapsClientInfo
- * struct.
+ * struct. The features aren't interned until the client is added with
+ * jabber_caps_add_client_info().
  *
  * Exposed for tests
  *
@@ -127,4 +168,42 @@ void jabber_caps_broadcast_change(void);
  */
 JabberCapsClientInfo *jabber_caps_parse_client_info(PurpleXmlNode *query);
 
+/**
+ * Append the binary form the caps cache stores a client in to out.
+ *
+ * Exposed for tests
+ */
+void jabber_caps_client_info_serialize(const JabberCapsClientInfo *info,
+                                       GByteArray *out);
+
+/**
+ * Read a client back from the caps cache's binary form.
+ *
+ * Exposed for tests
+ *
+ * @returns A JabberCapsClientInfo struct, or NULL if the data is damaged
+ */
+JabberCapsClientInfo *jabber_caps_client_info_deserialize(const guchar *data,
+                                                          gsize len);
+
+void jabber_caps_client_info_destroy(JabberCapsClientInfo *info);
+
+/**
+ * Look a client up in the capstable, or else in the caps cache.
+ *
+ * Exposed for tests
+ *
+ * @returns The client, owned by the capstable, or NULL if it isn't known
+ */
+JabberCapsClientInfo *jabber_caps_find_client_info(const char *node,
+                                                   const char *ver,
+                                                   const char *hash);
+
+/**
+ * Add a client to the capstable, which takes it, and to the caps cache.
+ *
+ * Exposed for tests
+ */
+void jabber_caps_add_client_info(JabberCapsClientInfo *info);
+
 #endif /* PURPLE_JABBER_CAPS_H */
@@ -502,6 +502,28 @@ void jabber_iq_register_handler(const char *node, const char *xmlns, JabberIqHan
 	g_hash_table_replace(iq_handlers, key, handlerfunc);
 }
 
+gboolean jabber_iq_has_handler(const char *node, const char *xmlns)
+{
+	gchar buf[128];
+	gchar *key = buf;
+	gboolean found;
+
+	if (node == NULL || xmlns == NULL)
+		return FALSE;
+
+	/* this is called by the parser for every incoming get/set iq */
+	if (g_snprintf(buf, sizeof(buf), "%s %s", node, xmlns) >= (gint)sizeof(buf))
+		key = g_strdup_printf("%s %s", node, xmlns);
+
+	found = g_hash_table_contains(iq_handlers, key) ||
+		g_hash_table_contains(signal_iq_handlers, key);
+
+	if (key != buf)
+		g_free(key);
+
+	return found;
+}
+
 void jabber_iq_signal_register(const gchar *node, const gchar *xmlns)
 {
 	gchar *key;
@@ -112,6 +112,17 @@ void jabber_iq_uninit(void);
 void jabber_iq_register_handler(const char *node, const char *xmlns,
                                 JabberIqHandler *func);
 
+/**
+ * Checks, if the payload of an incoming get or set iq may be handled by
+ * a registered handler or a watching plugin.
+ *
+ * @param node  The name of the child element of the <iq/> stanza.
+ * @param xmlns The namespace of that element.
+ *
+ * @return TRUE, if there is anyone interested in the payload.
+ */
+gboolean jabber_iq_has_handler(const char *node, const char *xmlns);
+
 /* Connected to namespace-handler registration signals */
 void jabber_iq_signal_register(const gchar *node, const gchar *xmlns);
 void jabber_iq_signal_unregister(const gchar *node, const gchar *xmlns);
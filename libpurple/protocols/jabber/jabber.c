@@ -83,6 +83,18 @@
  */
 #define DEFAULT_INACTIVITY_TIME 120
 
+/* The receive buffer starts small (most of the time we get a single short
+ * stanza at once) and grows up to the configured maximum, when reads keep
+ * filling it up. */
+#define JABBER_RECV_BUFFER_MIN 4096
+#define JABBER_RECV_BUFFER_DEFAULT_MAX 65536
+/* the buffer is shrunk after so many consecutive reads using less than a
+ * quarter of it */
+#define JABBER_RECV_SHRINK_AFTER 32
+/* no more data is read within a single main loop wakeup, to let the other
+ * sources run on a flood */
+#define JABBER_RECV_BUDGET_FACTOR 4
+
 GList *jabber_features = NULL;
 GList *jabber_identities = NULL;
 
@@ -94,6 +106,7 @@ static GHashTable *jabber_cmds = NULL; /* PurpleProtocol * => GSList of ids */
 static gint plugin_ref = 0;
 
 static void jabber_unregister_account_cb(JabberStream *js);
+static gboolean jabber_stream_resume(JabberStream *js);
 
 static void jabber_stream_init(JabberStream *js)
 {
@@ -181,6 +194,7 @@ static void jabber_bind_result_cb(JabberStream *js, const char *from,
 		return;
 	}
 
+	jabber_sm_enable(js);
 	jabber_session_init(js);
 }
 
@@ -285,6 +299,14 @@ void jabber_stream_features_parse(JabberStream *js, PurpleXmlNode *packet)
 		return;
 	}
 
+	/* Roster versioning is usually offered alongside bind, so look for it
+	 * before deciding what to do next. */
+	if (purple_xmlnode_get_child_with_namespace(packet, "ver", NS_ROSTER_VERSIONING))
+		js->server_caps |= JABBER_CAP_ROSTER_VERSIONING;
+
+	if (jabber_sm_features_parse(js, packet))
+		return;
+
 	if(js->registration) {
 		jabber_register_start(js);
 	} else if(purple_xmlnode_get_child(packet, "mechanisms")) {
@@ -308,7 +330,7 @@ void jabber_stream_features_parse(JabberStream *js, PurpleXmlNode *packet)
 
 		jabber_iq_send(iq);
 	} else if (purple_xmlnode_get_child_with_namespace(packet, "ver", NS_ROSTER_VERSIONING)) {
-		js->server_caps |= JABBER_CAP_ROSTER_VERSIONING;
+		/* Nothing else to do with these features. */
 	} else /* if(purple_xmlnode_get_child_with_namespace(packet, "auth")) */ {
 		/* If we get an empty stream:features packet, or we explicitly get
 		 * an auth feature with namespace http://jabber.org/features/iq-auth
@@ -345,6 +367,10 @@ void jabber_process_packet(JabberStream *js, PurpleXmlNode **packet)
 	name = (*packet)->name;
 	xmlns = purple_xmlnode_get_namespace(*packet);
 
+	if (purple_strequal(name, "iq") || purple_strequal(name, "presence") ||
+			purple_strequal(name, "message"))
+		jabber_sm_inbound(js);
+
 	if (purple_strequal(name, "iq")) {
 		jabber_iq_parse(js, *packet);
 	} else if (purple_strequal(name, "presence")) {
@@ -367,6 +393,8 @@ void jabber_process_packet(JabberStream *js, PurpleXmlNode **packet)
 			else if (purple_strequal(name, "failure"))
 				jabber_auth_handle_failure(js, *packet);
 		}
+	} else if (purple_strequal(xmlns, NS_STREAM_MANAGEMENT)) {
+		jabber_sm_parse(js, *packet);
 	} else if (purple_strequal(xmlns, NS_XMPP_TLS)) {
 		if (js->state != JABBER_STREAM_INITIALIZING_ENCRYPTION ||
 		    G_IS_TLS_CONNECTION(js->stream)) {
@@ -392,8 +420,19 @@ jabber_push_bytes_cb(GObject *source, GAsyncResult *res, gpointer data)
 	result = purple_queued_output_stream_push_bytes_finish(stream, res, &error);
 
 	if (!result) {
+		/* the stream was closed on purpose, js may be gone already */
+		if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_error_free(error);
+			return;
+		}
+
 		purple_queued_output_stream_clear_queue(stream);
 
+		if (jabber_stream_resume(js)) {
+			g_error_free(error);
+			return;
+		}
+
 		g_prefix_error(&error, "%s", _("Lost connection with server: "));
 		purple_connection_take_error(js->gc, error);
 	}
@@ -406,6 +445,10 @@ static gboolean do_jabber_send_raw(JabberStream *js, const char *data, int len)
 
 	g_return_val_if_fail(len > 0, FALSE);
 
+	/* nothing to write to while a lost stream is being resumed */
+	if (js->output == NULL)
+		return FALSE;
+
 	if (js->state == JABBER_STREAM_CONNECTED)
 		jabber_stream_restart_inactivity_timer(js);
 
@@ -475,6 +518,9 @@ void jabber_send_raw(JabberStream *js, const char *data, int len)
 	if (len == -1)
 		len = strlen(data);
 
+	if (jabber_sm_outbound(js, data, len))
+		return;
+
 	/* If we've got a security layer, we need to encode the data,
 	 * splitting it on the maximum buffer length negotiated */
 #ifdef HAVE_CYRUS_SASL
@@ -573,9 +619,10 @@ void jabber_send(JabberStream *js, PurpleXmlNode *packet)
 static gboolean jabber_keepalive_timeout(PurpleConnection *gc)
 {
 	JabberStream *js = purple_connection_get_protocol_data(gc);
-	purple_connection_error(gc, PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
-					_("Ping timed out"));
 	js->keepalive_timeout = 0;
+	if (!jabber_stream_resume(js))
+		purple_connection_error(gc, PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+						_("Ping timed out"));
 	return FALSE;
 }
 
@@ -595,19 +642,51 @@ static int jabber_get_keepalive_interval(void)
 	return PING_TIMEOUT;
 }
 
+static void
+jabber_recv_buffer_adapt(JabberStream *js, gsize len)
+{
+	gsize size = js->recv_buf_size;
+
+	if (len == js->recv_buf_size && size < js->recv_buf_max) {
+		size = MIN(size * 2, js->recv_buf_max);
+		js->recv_small_reads = 0;
+	} else if (len < js->recv_buf_size / 4 && size > JABBER_RECV_BUFFER_MIN) {
+		if (++js->recv_small_reads < JABBER_RECV_SHRINK_AFTER)
+			return;
+		size = MAX(size / 2, JABBER_RECV_BUFFER_MIN);
+		js->recv_small_reads = 0;
+	} else {
+		js->recv_small_reads = 0;
+		return;
+	}
+
+	if (size == js->recv_buf_size)
+		return;
+
+	g_free(js->recv_buf);
+	js->recv_buf = g_malloc(size);
+	js->recv_buf_size = size;
+}
+
 static gboolean
 jabber_recv_cb(GObject *stream, gpointer data)
 {
 	PurpleConnection *gc = data;
 	JabberStream *js = purple_connection_get_protocol_data(gc);
 	gssize len;
-	gchar buf[4096];
+	gsize budget;
 	GError *error = NULL;
 
 	PURPLE_ASSERT_CONNECTION_IS_VALID(gc);
 
+	if (js->recv_buf == NULL) {
+		js->recv_buf_size = JABBER_RECV_BUFFER_MIN;
+		js->recv_buf = g_malloc(js->recv_buf_size);
+	}
+	budget = js->recv_buf_max * JABBER_RECV_BUDGET_FACTOR;
+
 	len = g_pollable_input_stream_read_nonblocking(
-	        G_POLLABLE_INPUT_STREAM(stream), buf, sizeof(buf) - 1,
+	        G_POLLABLE_INPUT_STREAM(stream), js->recv_buf, js->recv_buf_size,
 	        js->cancellable, &error);
 
 	while (len > 0) {
@@ -618,7 +697,7 @@ jabber_recv_cb(GObject *stream, gpointer data)
 			unsigned int olen;
 			int rc;
 
-			rc = sasl_decode(js->sasl, buf, len, &out, &olen);
+			rc = sasl_decode(js->sasl, js->recv_buf, len, &out, &olen);
 			if (rc != SASL_OK) {
 				gchar *error =
 					g_strdup_printf(_("SASL error: %s"),
@@ -630,7 +709,10 @@ jabber_recv_cb(GObject *stream, gpointer data)
 					PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
 					error);
 			} else if (olen > 0) {
-				purple_debug_info("jabber", "RecvSASL (%u): %s\n", olen, out);
+				if (purple_debug_is_active(PURPLE_DEBUG_INFO, "jabber")) {
+					purple_debug_info("jabber", "RecvSASL (%u): %.*s\n",
+						olen, (int)olen, out);
+				}
 				jabber_parser_process(js, out, olen);
 				if (js->reinit)
 					jabber_stream_init(js);
@@ -638,18 +720,42 @@ jabber_recv_cb(GObject *stream, gpointer data)
 			return G_SOURCE_CONTINUE;
 		}
 #endif
-		buf[len] = '\0';
-		purple_debug_misc("jabber", "Recv (%" G_GSSIZE_FORMAT "): %s", len,
-		                  buf);
-		jabber_parser_process(js, buf, len);
+		if (purple_debug_is_active(PURPLE_DEBUG_MISC, "jabber")) {
+			purple_debug_misc("jabber", "Recv (%" G_GSSIZE_FORMAT "): %.*s",
+				len, (int)len, js->recv_buf);
+		}
+		jabber_parser_process(js, js->recv_buf, len);
 		if(js->reinit)
 			jabber_stream_init(js);
+
+		jabber_recv_buffer_adapt(js, len);
+		if ((gsize)len >= budget) {
+			/* there may be more data, but we'll get back here on the
+			 * next main loop iteration */
+			return G_SOURCE_CONTINUE;
+		}
+		budget -= len;
+
 		len = g_pollable_input_stream_read_nonblocking(
-			G_POLLABLE_INPUT_STREAM(stream), buf, sizeof(buf) - 1,
-			js->cancellable, &error);
+			G_POLLABLE_INPUT_STREAM(stream), js->recv_buf,
+			js->recv_buf_size, js->cancellable, &error);
+	}
+	if (len == 0) {
+		/* end of stream, there is no error to look at */
+		if (!jabber_stream_resume(js)) {
+			js->inpa = 0;
+			purple_connection_error(js->gc,
+				PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+				_("Server closed the connection"));
+		}
+		return G_SOURCE_REMOVE;
 	}
 	if (error->code != G_IO_ERROR_WOULD_BLOCK &&
 	    error->code != G_IO_ERROR_CANCELLED) {
+		if (jabber_stream_resume(js)) {
+			g_clear_error(&error);
+			return G_SOURCE_REMOVE;
+		}
 		g_prefix_error(&error, "%s", _("Lost connection with server: "));
 		purple_connection_g_error(js->gc, error);
 	}
@@ -930,6 +1036,11 @@ jabber_stream_new(PurpleAccount *account)
 	/* we might want to expose this at some point */
 	js->cancellable = g_cancellable_new();
 
+	/* not exposed in the UI, it's here for tuning */
+	js->recv_buf_max = MAX(JABBER_RECV_BUFFER_MIN,
+		purple_account_get_int(account, "recv_buffer_max",
+			JABBER_RECV_BUFFER_DEFAULT_MAX));
+
 	user = g_strdup(purple_account_get_username(account));
 	/* jabber_id_new doesn't accept "user@domain/" as valid */
 	slash = strchr(user, '/');
@@ -1001,6 +1112,7 @@ jabber_stream_new(PurpleAccount *account)
 	js->stun_port = 0;
 	js->google_relay_token = NULL;
 	js->google_relay_host = NULL;
+	js->sm = jabber_sm_new();
 
 	/* if we are idle, set idle-ness on the stream (this could happen if we get
 		disconnected and the reconnects while being idle. I don't think it makes
@@ -1071,6 +1183,77 @@ jabber_stream_connect(JabberStream *js)
 	}
 }
 
+/* Tears down a lost connection and starts a new one that picks up the
+ * XEP-0198 session where it was, leaving the PurpleConnection connected.
+ * Returns FALSE if the session can't be resumed, in which case the caller
+ * reports the connection error as usual. */
+static gboolean
+jabber_stream_resume(JabberStream *js)
+{
+	if (!jabber_sm_can_resume(js))
+		return FALSE;
+
+	purple_debug_info("jabber", "Connection lost, trying to resume the stream\n");
+
+	if (js->inpa) {
+		g_source_remove(js->inpa);
+		js->inpa = 0;
+	}
+
+	/* anything still in flight belongs to the old connection */
+	g_cancellable_cancel(js->cancellable);
+	g_object_unref(js->cancellable);
+	js->cancellable = g_cancellable_new();
+
+	if (js->output != NULL) {
+		purple_queued_output_stream_clear_queue(js->output);
+		purple_gio_graceful_close(js->stream, js->input,
+		                          G_OUTPUT_STREAM(js->output));
+	}
+	g_clear_object(&js->output);
+	/* owned by the stream */
+	js->input = NULL;
+	g_clear_object(&js->stream);
+	g_clear_object(&js->client);
+
+	jabber_parser_free(js);
+	js->reinit = FALSE;
+
+	if (js->keepalive_timeout != 0) {
+		g_source_remove(js->keepalive_timeout);
+		js->keepalive_timeout = 0;
+	}
+	if (js->inactivity_timer != 0) {
+		g_source_remove(js->inactivity_timer);
+		js->inactivity_timer = 0;
+	}
+
+	if (js->auth_mech && js->auth_mech->dispose)
+		js->auth_mech->dispose(js);
+	js->auth_mech = NULL;
+#ifdef HAVE_CYRUS_SASL
+	if (js->sasl)
+		sasl_dispose(&js->sasl);
+	if (js->sasl_mechs) {
+		g_string_free(js->sasl_mechs, TRUE);
+		js->sasl_mechs = NULL;
+	}
+	js->sasl_maxbuf = 0;
+#endif
+
+	g_free(js->certificate_CN);
+	js->certificate_CN = NULL;
+	g_free(js->stream_id);
+	js->stream_id = NULL;
+
+	js->sm->available = FALSE;
+	js->sm->resuming = TRUE;
+
+	jabber_stream_connect(js);
+
+	return TRUE;
+}
+
 void
 jabber_login(PurpleAccount *account)
 {
@@ -1690,12 +1873,16 @@ void jabber_close(PurpleConnection *gc)
 	g_cancellable_cancel(js->cancellable);
 	g_object_unref(G_OBJECT(js->cancellable));
 
+	g_free(js->recv_buf);
+
 	g_free(js->stun_ip);
 
 	/* remove Google relay-related stuff */
 	g_free(js->google_relay_token);
 	g_free(js->google_relay_host);
 
+	jabber_sm_free(js->sm);
+
 	g_free(js);
 
 	purple_connection_set_protocol_data(gc, NULL);
@@ -1709,6 +1896,15 @@ void jabber_stream_set_state(JabberStream *js, JabberStreamState state)
 	         ? 9 \
 	         : 5)
 
+	/* A resumed session stays connected as far as the core is concerned,
+	 * only the new stream has to be set up. */
+	if (js->sm != NULL && js->sm->resuming) {
+		js->state = state;
+		if (state == JABBER_STREAM_INITIALIZING)
+			jabber_stream_init(js);
+		return;
+	}
+
 	js->state = state;
 	switch(state) {
 		case JABBER_STREAM_OFFLINE:
@@ -3059,6 +3255,7 @@ static PurpleCmdRet jabber_cmd_chat_msg(PurpleConversation *conv,
 		const char *cmd, char **args, char **error, void *data)
 {
 	JabberChat *chat = jabber_chat_find_by_conv(PURPLE_CHAT_CONVERSATION(conv));
+	PurpleMessage *msg;
 	char *who;
 
 	if (!chat)
@@ -3066,8 +3263,9 @@ static PurpleCmdRet jabber_cmd_chat_msg(PurpleConversation *conv,
 
 	who = g_strdup_printf("%s@%s/%s", chat->room, chat->server, args[0]);
 
-	jabber_message_send_im(purple_conversation_get_connection(conv),
-		purple_message_new_outgoing(who, args[1], 0));
+	msg = purple_message_new_outgoing(who, args[1], 0);
+	jabber_message_send_im(purple_conversation_get_connection(conv), msg);
+	g_object_unref(msg);
 
 	g_free(who);
 	return PURPLE_CMD_RET_OK;
@@ -79,6 +79,7 @@ typedef struct _JabberStream JabberStream;
 #include "xmlnode.h"
 #include "buddy.h"
 #include "bosh.h"
+#include "sm.h"
 
 #ifdef HAVE_CYRUS_SASL
 #include <sasl/sasl.h>
@@ -124,8 +125,19 @@ struct _JabberStream
 
 	GCancellable *cancellable;
 
+	/* the receive buffer, see jabber_recv_cb */
+	gchar *recv_buf;
+	gsize recv_buf_size;
+	gsize recv_buf_max;
+	guint recv_small_reads;
+
 	xmlParserCtxt *context;
 	PurpleXmlNode *current;
+	PurpleMemoryPool *stanza_pool;
+	/* the depth of currently skipped subtree, see parser.c */
+	guint skip_depth;
+	/* a node of the current stanza, whose content is being skipped */
+	PurpleXmlNode *hollow_node;
 
 	struct {
 		guint8 major;
@@ -278,6 +290,9 @@ struct _JabberStream
 
 	PurpleJabberBOSHConnection *bosh;
 
+	/* XEP-0198 state, kept across a resumed session */
+	JabberStreamManagement *sm;
+
 	SoupSession *http_conns;
 
 	/* keep a hash table of JingleSessions */
@@ -26,11 +26,124 @@
 
 #include "connection.h"
 #include "debug.h"
+#include "iq.h"
 #include "jabber.h"
 #include "parser.h"
+#include "pep.h"
 #include "util.h"
 #include "xmlnode.h"
 
+/* Stanzas are allocated within a pool, which is cleaned up after processing
+ * each of them, so the block should fit most of them. */
+#define JABBER_STANZA_POOL_BLOCK_SIZE 16384
+
+/* Attribute values up to this length (and not containing any entities) are
+ * copied to the stack before adding them to the node. */
+#define JABBER_ATTRIB_BUFFER_SIZE 256
+
+typedef enum {
+	JABBER_PARSER_KEEP,
+	JABBER_PARSER_SKIP_CONTENT,
+	JABBER_PARSER_SKIP_ELEMENT
+} JabberParserSkip;
+
+static const char *
+jabber_parser_find_attrib(const char *name, int nb_attributes,
+	const xmlChar **attributes, int *len)
+{
+	int i;
+
+	for (i = 0; i < nb_attributes * 5; i += 5) {
+		if (attributes[i+2] == NULL &&
+			!xmlStrcmp(attributes[i], (xmlChar *)name))
+		{
+			*len = attributes[i+4] - attributes[i+3];
+			return (const char *)attributes[i+3];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Decides, if an element of the currently parsed stanza is needed at all,
+ * before it's built. Payloads nobody is interested in are dropped here, so
+ * they don't cost any allocations:
+ *  - the content of get/set iq payloads without a handler (the element itself
+ *    is kept, so the error reply may be sent),
+ *  - PEP events without a handler.
+ * Nothing is skipped while anyone is watching the raw stanzas.
+ */
+static JabberParserSkip
+jabber_parser_check_skip(JabberStream *js, const char *element_name,
+	const char *namespace, int nb_attributes, const xmlChar **attributes)
+{
+	PurpleXmlNode *parent = js->current;
+	PurpleXmlNode *root = parent->parent ? parent->parent : parent;
+	PurpleXmlNode *child;
+	PurpleProtocol *protocol;
+	const char *value;
+	int len;
+
+	if (root->parent != NULL)
+		return JABBER_PARSER_KEEP;
+
+	if (parent == root && purple_strequal(root->name, "iq")) {
+		/* only the first child is the payload */
+		for (child = root->child; child; child = child->next) {
+			if (child->type == PURPLE_XMLNODE_TYPE_TAG)
+				return JABBER_PARSER_KEEP;
+		}
+		value = purple_xmlnode_get_attrib(root, "type");
+		if (!purple_strequal(value, "get") && !purple_strequal(value, "set"))
+			return JABBER_PARSER_KEEP;
+		if (jabber_iq_has_handler(element_name, namespace))
+			return JABBER_PARSER_KEEP;
+
+		protocol = purple_connection_get_protocol(js->gc);
+		if (purple_signal_has_handlers(protocol, "jabber-receiving-xmlnode") ||
+			purple_signal_has_handlers(protocol, "jabber-receiving-iq"))
+		{
+			return JABBER_PARSER_KEEP;
+		}
+
+		return JABBER_PARSER_SKIP_CONTENT;
+	}
+
+	if (parent != root && purple_strequal(root->name, "message") &&
+		purple_strequal(parent->name, "event") &&
+		purple_strequal(element_name, "items") &&
+		purple_strequal(purple_xmlnode_get_namespace(parent),
+			"http://jabber.org/protocol/pubsub#event"))
+	{
+		gchar node[128];
+
+		value = jabber_parser_find_attrib("node", nb_attributes, attributes,
+			&len);
+		/* PEP nodes are namespaces, they are rather short */
+		if (value == NULL || len >= (int)sizeof(node) ||
+			memchr(value, '&', len) != NULL)
+		{
+			return JABBER_PARSER_KEEP;
+		}
+		memcpy(node, value, len);
+		node[len] = '\0';
+		if (jabber_pep_has_handler(node))
+			return JABBER_PARSER_KEEP;
+
+		protocol = purple_connection_get_protocol(js->gc);
+		if (purple_signal_has_handlers(protocol, "jabber-receiving-xmlnode") ||
+			purple_signal_has_handlers(protocol, "jabber-receiving-message"))
+		{
+			return JABBER_PARSER_KEEP;
+		}
+
+		return JABBER_PARSER_SKIP_ELEMENT;
+	}
+
+	return JABBER_PARSER_KEEP;
+}
+
 static void
 jabber_parser_element_start_libxml(void *user_data,
 				   const xmlChar *element_name, const xmlChar *prefix, const xmlChar *namespace,
@@ -39,10 +152,17 @@ jabber_parser_element_start_libxml(void *user_data,
 {
 	JabberStream *js = user_data;
 	PurpleXmlNode *node;
+	JabberParserSkip skip = JABBER_PARSER_KEEP;
 	int i, j;
 
 	if(!element_name) {
 		return;
+	} else if (js->skip_depth > 0) {
+		js->skip_depth++;
+		return;
+	} else if (js->current != NULL && js->current == js->hollow_node) {
+		js->skip_depth = 1;
+		return;
 	} else if (js->stream_id == NULL) {
 		/* Sanity checking! */
 		if (0 != xmlStrcmp(element_name, (xmlChar *) "stream") ||
@@ -104,11 +224,26 @@ jabber_parser_element_start_libxml(void *user_data,
 			                  "to be a MUST; digest legacy auth may fail.\n");
 		}
 	} else {
+		if (js->current) {
+			skip = jabber_parser_check_skip(js, (const char *)element_name,
+				(const char *)namespace, nb_attributes, attributes);
+			if (skip == JABBER_PARSER_SKIP_ELEMENT) {
+				js->skip_depth = 1;
+				return;
+			}
+		}
 
 		if(js->current)
 			node = purple_xmlnode_new_child(js->current, (const char*) element_name);
-		else
-			node = purple_xmlnode_new((const char*) element_name);
+		else {
+			if (js->stanza_pool == NULL) {
+				js->stanza_pool = purple_memory_pool_new();
+				purple_memory_pool_set_block_size(js->stanza_pool,
+					JABBER_STANZA_POOL_BLOCK_SIZE);
+			}
+			node = purple_xmlnode_new_in_pool(js->stanza_pool,
+				(const char*) element_name);
+		}
 		purple_xmlnode_set_namespace(node, (const char*) namespace);
 		purple_xmlnode_set_prefix(node, (const char *)prefix);
 
@@ -127,10 +262,23 @@ jabber_parser_element_start_libxml(void *user_data,
 			const char *name = (const char *)attributes[i];
 			const char *prefix = (const char *)attributes[i+1];
 			const char *attrib_ns = (const char *)attributes[i+2];
-			char *txt;
+			const char *value = (const char *)attributes[i+3];
 			int attrib_len = attributes[i+4] - attributes[i+3];
-			char *attrib = g_strndup((gchar *)attributes[i+3], attrib_len);
+			char buffer[JABBER_ATTRIB_BUFFER_SIZE];
+			char *attrib, *txt;
+
+			if (attrib_len < JABBER_ATTRIB_BUFFER_SIZE &&
+				memchr(value, '&', attrib_len) == NULL)
+			{
+				/* nothing to unescape */
+				memcpy(buffer, value, attrib_len);
+				buffer[attrib_len] = '\0';
+				purple_xmlnode_set_attrib_full(node, name, attrib_ns,
+					prefix, buffer);
+				continue;
+			}
 
+			attrib = g_strndup(value, attrib_len);
 			txt = attrib;
 			attrib = purple_unescape_text(txt);
 			g_free(txt);
@@ -139,6 +287,8 @@ jabber_parser_element_start_libxml(void *user_data,
 		}
 
 		js->current = node;
+		if (skip == JABBER_PARSER_SKIP_CONTENT)
+			js->hollow_node = node;
 	}
 }
 
@@ -148,9 +298,17 @@ jabber_parser_element_end_libxml(void *user_data, const xmlChar *element_name,
 {
 	JabberStream *js = user_data;
 
+	if (js->skip_depth > 0) {
+		js->skip_depth--;
+		return;
+	}
+
 	if(!js->current)
 		return;
 
+	if (js->current == js->hollow_node)
+		js->hollow_node = NULL;
+
 	if(js->current->parent) {
 		if(!xmlStrcmp((xmlChar*) js->current->name, element_name))
 			js->current = js->current->parent;
@@ -158,8 +316,16 @@ jabber_parser_element_end_libxml(void *user_data, const xmlChar *element_name,
 		PurpleXmlNode *packet = js->current;
 		js->current = NULL;
 		jabber_process_packet(js, &packet);
-		if (packet != NULL)
+		if (packet != NULL) {
 			purple_xmlnode_free(packet);
+			/* the parser might have been reset during processing */
+			if (js->stanza_pool != NULL)
+				purple_memory_pool_cleanup(js->stanza_pool);
+		} else {
+			/* Someone took the ownership of the whole stanza, so its
+			 * memory can't be reused. It keeps the pool alive. */
+			g_clear_object(&js->stanza_pool);
+		}
 	}
 }
 
@@ -171,6 +337,9 @@ jabber_parser_element_text_libxml(void *user_data, const xmlChar *text, int text
 	if(!js->current)
 		return;
 
+	if (js->skip_depth > 0 || js->current == js->hollow_node)
+		return;
+
 	if(!text || !text_len)
 		return;
 
@@ -256,6 +425,19 @@ void jabber_parser_free(JabberStream *js) {
 		xmlFreeParserCtxt(js->context);
 		js->context = NULL;
 	}
+
+	if (js->current) {
+		/* drop the partially parsed stanza */
+		PurpleXmlNode *root = js->current;
+		while (root->parent)
+			root = root->parent;
+		js->current = NULL;
+		purple_xmlnode_free(root);
+	}
+	js->hollow_node = NULL;
+	js->skip_depth = 0;
+
+	g_clear_object(&js->stanza_pool);
 }
 
 void jabber_parser_process(JabberStream *js, const char *buf, int len)
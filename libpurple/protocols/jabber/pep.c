@@ -59,6 +59,11 @@ void jabber_pep_init_actions(GList **m) {
 	jabber_nick_init_action(m);
 }
 
+gboolean jabber_pep_has_handler(const char *xmlns) {
+	return xmlns != NULL && pep_handlers != NULL &&
+		g_hash_table_contains(pep_handlers, xmlns);
+}
+
 void jabber_pep_register_handler(const char *xmlns, JabberPEPHandler handlerfunc) {
 	gchar *notifyns = g_strdup_printf("%s+notify", xmlns);
 	jabber_add_feature(notifyns, NULL); /* receiving PEPs is always supported */
@@ -50,6 +50,13 @@ typedef void (JabberPEPHandler)(JabberStream *js, const char *from, PurpleXmlNod
  */
 void jabber_pep_register_handler(const char *xmlns, JabberPEPHandler handlerfunc);
 
+/*
+ * Checks, if there is a callback registered for PEP events of this type.
+ *
+ * @parameter xmlns			The namespace of the event (the node of &lt;items/>)
+ */
+gboolean jabber_pep_has_handler(const char *xmlns);
+
 /*
  * Request a specific item from another PEP node.
  *
@@ -48,6 +48,105 @@ static gchar *roster_groups_join(GSList *list)
 	return g_string_free(out, FALSE);
 }
 
+static int roster_subscription_parse(const char *subscription)
+{
+	if (purple_strequal(subscription, "to"))
+		return JABBER_SUB_TO;
+	else if (purple_strequal(subscription, "from"))
+		return JABBER_SUB_FROM;
+	else if (purple_strequal(subscription, "both"))
+		return JABBER_SUB_BOTH;
+
+	return JABBER_SUB_NONE;
+}
+
+static const char *roster_subscription_to_string(int subscription)
+{
+	switch (subscription & JABBER_SUB_BOTH) {
+		case JABBER_SUB_TO:
+			return "to";
+		case JABBER_SUB_FROM:
+			return "from";
+		case JABBER_SUB_BOTH:
+			return "both";
+		default:
+			return "none";
+	}
+}
+
+/*
+ * Remember a roster item's subscription on its buddies.  Together with the
+ * groups and aliases already on the buddy list, this is the local copy of
+ * the roster that XEP-0237 lets us keep between sessions.
+ */
+static void roster_store_subscription(JabberStream *js, const char *jid,
+                                      int subscription)
+{
+	const char *sub = roster_subscription_to_string(subscription);
+	gboolean pending = (subscription & JABBER_SUB_PENDING) != 0;
+	GSList *buddies;
+
+	buddies = purple_blist_find_buddies(purple_connection_get_account(js->gc), jid);
+
+	while (buddies) {
+		PurpleBlistNode *node = buddies->data;
+
+		/* Setting these saves the buddy list, so only do it on changes. */
+		if (!purple_strequal(purple_blist_node_get_string(node, "subscription"), sub))
+			purple_blist_node_set_string(node, "subscription", sub);
+		if (purple_blist_node_get_bool(node, "subscription_pending") != pending)
+			purple_blist_node_set_bool(node, "subscription_pending", pending);
+
+		buddies = g_slist_delete_link(buddies, buddies);
+	}
+}
+
+/*
+ * The server said the roster hasn't changed since the version we sent, so
+ * the buddy list is already up to date.  Only the subscriptions, which
+ * aren't shown on the buddy list, need to be restored.
+ */
+static void roster_restore_cached(JabberStream *js)
+{
+	PurpleAccount *account = purple_connection_get_account(js->gc);
+	gboolean self = FALSE;
+	GSList *buddies;
+
+	purple_debug_info("jabber", "Roster version %s is current; "
+	                  "using the local roster\n",
+	                  purple_account_get_string(account, "roster_ver", ""));
+
+	buddies = purple_blist_find_buddies(account, NULL);
+
+	while (buddies) {
+		PurpleBlistNode *node = buddies->data;
+		const char *sub = purple_blist_node_get_string(node, "subscription");
+		JabberBuddy *jb;
+
+		buddies = g_slist_delete_link(buddies, buddies);
+
+		if (sub == NULL)
+			continue;
+
+		jb = jabber_buddy_find(js, purple_buddy_get_name(PURPLE_BUDDY(node)), TRUE);
+		if (jb == NULL)
+			continue;
+
+		if (jb == js->user_jb) {
+			jb->subscription = JABBER_SUB_BOTH;
+			self = TRUE;
+			continue;
+		}
+
+		jb->subscription = roster_subscription_parse(sub);
+		if (purple_blist_node_get_bool(node, "subscription_pending"))
+			jb->subscription |= JABBER_SUB_PENDING;
+	}
+
+	if (self)
+		jabber_presence_fake_to_self(js, NULL);
+}
+
 static void roster_request_cb(JabberStream *js, const char *from,
                               JabberIqType type, const char *id,
                               PurpleXmlNode *packet, gpointer data)
@@ -67,6 +166,10 @@ static void roster_request_cb(JabberStream *js, const char *from,
 
 	query = purple_xmlnode_get_child(packet, "query");
 	if (query == NULL) {
+		/* With XEP-0237, an empty result means that our copy is current
+		 * and any changes will follow as roster pushes. */
+		if (GPOINTER_TO_INT(data))
+			roster_restore_cached(js);
 		jabber_stream_set_state(js, JABBER_STREAM_CONNECTED);
 		return;
 	}
@@ -79,6 +182,7 @@ void jabber_roster_request(JabberStream *js)
 {
 	JabberIq *iq;
 	PurpleXmlNode *query;
+	gboolean versioned = FALSE;
 
 	iq = jabber_iq_new_query(js, JABBER_IQ_GET, "jabber:iq:roster");
 	query = purple_xmlnode_get_child(iq->node, "query");
@@ -88,7 +192,24 @@ void jabber_roster_request(JabberStream *js)
 		purple_xmlnode_set_attrib(query, "gr:ext", "2");
 	}
 
-	jabber_iq_set_callback(iq, roster_request_cb, NULL);
+	if (js->server_caps & JABBER_CAP_ROSTER_VERSIONING) {
+		PurpleAccount *account = purple_connection_get_account(js->gc);
+		const char *ver = purple_account_get_string(account, "roster_ver", NULL);
+		GSList *buddies = NULL;
+
+		/* Our version is only good if the buddy list still holds the
+		 * roster it describes, which it won't if it was lost or reset. */
+		if (ver != NULL && *ver != '\0')
+			buddies = purple_blist_find_buddies(account, NULL);
+		versioned = (buddies != NULL);
+		g_slist_free(buddies);
+
+		/* An empty version asks for the whole roster, and for the server
+		 * to start versioning it. */
+		purple_xmlnode_set_attrib(query, "ver", versioned ? ver : "");
+	}
+
+	jabber_iq_set_callback(iq, roster_request_cb, GINT_TO_POINTER(versioned));
 	jabber_iq_send(iq);
 }
 
@@ -228,14 +349,8 @@ void jabber_roster_parse(JabberStream *js, const char *from,
 				jb->subscription = JABBER_SUB_REMOVE;
 			else if (jb == js->user_jb)
 				jb->subscription = JABBER_SUB_BOTH;
-			else if (purple_strequal(subscription, "none"))
-				jb->subscription = JABBER_SUB_NONE;
-			else if (purple_strequal(subscription, "to"))
-				jb->subscription = JABBER_SUB_TO;
-			else if (purple_strequal(subscription, "from"))
-				jb->subscription = JABBER_SUB_FROM;
-			else if (purple_strequal(subscription, "both"))
-				jb->subscription = JABBER_SUB_BOTH;
+			else
+				jb->subscription = roster_subscription_parse(subscription);
 		}
 
 		if(purple_strequal(ask, "subscribe"))
@@ -272,11 +387,23 @@ void jabber_roster_parse(JabberStream *js, const char *from,
 			}
 
 			add_purple_buddy_to_groups(js, jid, name, groups);
+			if (js->server_caps & JABBER_CAP_ROSTER_VERSIONING)
+				roster_store_subscription(js, jid, jb->subscription);
 			if (jb == js->user_jb)
 				jabber_presence_fake_to_self(js, NULL);
 		}
 	}
 
+	/* Both the full roster and each push carry the version they bring us
+	 * up to.  Only record it once the items above have been applied. */
+	if (js->server_caps & JABBER_CAP_ROSTER_VERSIONING) {
+		const char *ver = purple_xmlnode_get_attrib(query, "ver");
+
+		if (ver != NULL)
+			purple_account_set_string(purple_connection_get_account(js->gc),
+			                          "roster_ver", ver);
+	}
+
 	if (type == JABBER_IQ_SET) {
 		JabberIq *ack = jabber_iq_new(js, JABBER_IQ_RESULT);
 		jabber_iq_set_id(ack, id);
@@ -0,0 +1,476 @@
+/*
+ * purple - Jabber Protocol Plugin
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ *
+ */
+
+#include "internal.h"
+
+#include "debug.h"
+
+#include "jabber.h"
+#include "namespaces.h"
+#include "sm.h"
+
+/* how long to wait after sending a stanza before asking the server to
+ * acknowledge it */
+#define JABBER_SM_ACK_DELAY 5
+
+JabberStreamManagement *
+jabber_sm_new(void)
+{
+	JabberStreamManagement *sm = g_new0(JabberStreamManagement, 1);
+
+	g_queue_init(&sm->unacked);
+
+	return sm;
+}
+
+static void
+jabber_sm_clear_unacked(JabberStreamManagement *sm)
+{
+	g_queue_foreach(&sm->unacked, (GFunc)g_free, NULL);
+	g_queue_clear(&sm->unacked);
+	sm->dropped = 0;
+}
+
+void
+jabber_sm_free(JabberStreamManagement *sm)
+{
+	if (sm == NULL)
+		return;
+
+	if (sm->ack_timer != 0)
+		g_source_remove(sm->ack_timer);
+
+	jabber_sm_clear_unacked(sm);
+	g_free(sm->id);
+	g_free(sm);
+}
+
+gboolean
+jabber_sm_is_stanza(const char *data, gsize len)
+{
+	static const char *names[] = { "message", "presence", "iq" };
+	gsize i;
+
+	g_return_val_if_fail(data != NULL, FALSE);
+
+	while (len > 0 && g_ascii_isspace(*data)) {
+		data++;
+		len--;
+	}
+
+	if (len < 2 || *data != '<')
+		return FALSE;
+	data++;
+	len--;
+
+	for (i = 0; i < G_N_ELEMENTS(names); i++) {
+		gsize n = strlen(names[i]);
+
+		if (len > n && strncmp(data, names[i], n) == 0 &&
+				(g_ascii_isspace(data[n]) || data[n] == '>' ||
+				 data[n] == '/'))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+void
+jabber_sm_queue_stanza(JabberStreamManagement *sm, const char *data,
+                       gsize len)
+{
+	g_return_if_fail(sm != NULL);
+	g_return_if_fail(data != NULL);
+
+	/* A server that doesn't acknowledge anything would have us keep
+	 * every stanza forever.  Drop the oldest instead, which costs us the
+	 * ability to resume until the server catches up. */
+	if (g_queue_get_length(&sm->unacked) >= JABBER_SM_MAX_UNACKED) {
+		if (sm->dropped == 0)
+			purple_debug_warning("jabber", "Too many unacknowledged "
+				"stanzas, the stream can't be resumed for now\n");
+		g_free(g_queue_pop_head(&sm->unacked));
+		sm->dropped++;
+	}
+
+	g_queue_push_tail(&sm->unacked, g_strndup(data, len));
+}
+
+/* Returns FALSE, and changes nothing, if the server acknowledged more
+ * stanzas than it was sent.  Otherwise the number newly acknowledged goes
+ * into acked, if that isn't NULL. */
+gboolean
+jabber_sm_handle_ack(JabberStreamManagement *sm, guint32 h, guint *acked)
+{
+	guint32 count, sent, from_queue;
+	guint i;
+
+	g_return_val_if_fail(sm != NULL, FALSE);
+
+	/* h counts modulo 2^32, so the unsigned difference is right even
+	 * after it wrapped around */
+	count = h - sm->acked;
+	sent = sm->dropped + g_queue_get_length(&sm->unacked);
+	if (count > sent) {
+		purple_debug_error("jabber",
+			"Server acknowledged %u stanzas, but only %u were sent\n",
+			count, sent);
+		return FALSE;
+	}
+
+	from_queue = count - MIN(count, sm->dropped);
+	sm->dropped -= count - from_queue;
+	for (i = 0; i < from_queue; i++)
+		g_free(g_queue_pop_head(&sm->unacked));
+
+	sm->acked = h;
+
+	if (acked != NULL)
+		*acked = count;
+
+	return TRUE;
+}
+
+/* Takes the acknowledgement from <resumed/> and moves the stanzas to send
+ * again into replay.  Returns FALSE on a bogus acknowledgement. */
+gboolean
+jabber_sm_handle_resumed(JabberStreamManagement *sm, guint32 h,
+                         GQueue *replay)
+{
+	g_return_val_if_fail(sm != NULL, FALSE);
+	g_return_val_if_fail(replay != NULL, FALSE);
+
+	if (!jabber_sm_handle_ack(sm, h, NULL))
+		return FALSE;
+
+	/* what the server didn't get of those is gone for good, and won't
+	 * be counted by it either */
+	if (sm->dropped > 0) {
+		purple_debug_warning("jabber",
+			"%u stanzas were lost with the connection\n", sm->dropped);
+		sm->dropped = 0;
+	}
+
+	sm->resuming = FALSE;
+
+	/* Sending queues the stanzas again, take them out first. */
+	*replay = sm->unacked;
+	g_queue_init(&sm->unacked);
+
+	return TRUE;
+}
+
+static gboolean
+jabber_sm_parse_h(PurpleXmlNode *packet, guint32 *h)
+{
+	const char *value = purple_xmlnode_get_attrib(packet, "h");
+	char *end = NULL;
+	guint64 parsed;
+
+	if (value == NULL || *value == '\0')
+		return FALSE;
+
+	parsed = g_ascii_strtoull(value, &end, 10);
+	if (*end != '\0' || parsed > G_MAXUINT32)
+		return FALSE;
+
+	*h = (guint32)parsed;
+	return TRUE;
+}
+
+static void
+jabber_sm_disable(JabberStreamManagement *sm)
+{
+	sm->state = JABBER_SM_DISABLED;
+	g_free(sm->id);
+	sm->id = NULL;
+	jabber_sm_clear_unacked(sm);
+	if (sm->ack_timer != 0) {
+		g_source_remove(sm->ack_timer);
+		sm->ack_timer = 0;
+	}
+}
+
+static void
+jabber_sm_send_element(JabberStream *js, const char *name)
+{
+	PurpleXmlNode *node = purple_xmlnode_new(name);
+
+	purple_xmlnode_set_namespace(node, NS_STREAM_MANAGEMENT);
+	jabber_send(js, node);
+	purple_xmlnode_free(node);
+}
+
+/* XEP-0198 makes acknowledging stanzas that were never sent a stream
+ * error, we can't know what the server really got. */
+static void
+jabber_sm_over_ack(JabberStream *js, guint32 h)
+{
+	JabberStreamManagement *sm = js->sm;
+	char *error;
+
+	error = g_strdup_printf("<stream:error>"
+		"<undefined-condition xmlns='urn:ietf:params:xml:ns:xmpp-streams'/>"
+		"<handled-count-too-high xmlns='" NS_STREAM_MANAGEMENT "'"
+		" h='%u' send-count='%u'/>"
+		"</stream:error>", h,
+		sm->acked + sm->dropped + g_queue_get_length(&sm->unacked));
+	jabber_send_raw(js, error, -1);
+	g_free(error);
+
+	/* replaying anything now could duplicate or lose stanzas */
+	jabber_sm_disable(sm);
+
+	purple_connection_error(js->gc, PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+		_("Server acknowledged more stanzas than were sent"));
+}
+
+static gboolean
+jabber_sm_ack_timeout(gpointer data)
+{
+	JabberStream *js = data;
+	JabberStreamManagement *sm = js->sm;
+
+	sm->ack_timer = 0;
+
+	if (sm->state == JABBER_SM_ENABLED && !sm->resuming &&
+			!g_queue_is_empty(&sm->unacked))
+		jabber_sm_send_element(js, "r");
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+jabber_sm_schedule_ack(JabberStream *js)
+{
+	if (js->sm->ack_timer == 0)
+		js->sm->ack_timer = g_timeout_add_seconds(JABBER_SM_ACK_DELAY,
+				jabber_sm_ack_timeout, js);
+}
+
+gboolean
+jabber_sm_features_parse(JabberStream *js, PurpleXmlNode *features)
+{
+	JabberStreamManagement *sm = js->sm;
+	PurpleXmlNode *resume;
+	char *h;
+
+	sm->available = (js->bosh == NULL &&
+		purple_xmlnode_get_child_with_namespace(features, "sm",
+			NS_STREAM_MANAGEMENT) != NULL);
+
+	/* Resumption replaces resource binding, everything before that
+	 * (TLS and authentication) happens as usual. */
+	if (!sm->resuming || !purple_xmlnode_get_child(features, "bind"))
+		return FALSE;
+
+	if (!sm->available) {
+		purple_debug_info("jabber",
+			"Server no longer offers stream management, "
+			"unable to resume\n");
+		purple_connection_error(js->gc,
+			PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+			_("Lost connection with server"));
+		return TRUE;
+	}
+
+	purple_debug_info("jabber", "Resuming stream %s at h=%u\n",
+		sm->id, sm->inbound);
+
+	h = g_strdup_printf("%u", sm->inbound);
+	resume = purple_xmlnode_new("resume");
+	purple_xmlnode_set_namespace(resume, NS_STREAM_MANAGEMENT);
+	purple_xmlnode_set_attrib(resume, "h", h);
+	purple_xmlnode_set_attrib(resume, "previd", sm->id);
+	jabber_send(js, resume);
+	purple_xmlnode_free(resume);
+	g_free(h);
+
+	return TRUE;
+}
+
+void
+jabber_sm_enable(JabberStream *js)
+{
+	JabberStreamManagement *sm = js->sm;
+	PurpleXmlNode *enable;
+
+	if (!sm->available || sm->state != JABBER_SM_DISABLED)
+		return;
+
+	sm->state = JABBER_SM_ENABLING;
+	sm->inbound = 0;
+	sm->acked = 0;
+	g_free(sm->id);
+	sm->id = NULL;
+	jabber_sm_clear_unacked(sm);
+
+	enable = purple_xmlnode_new("enable");
+	purple_xmlnode_set_namespace(enable, NS_STREAM_MANAGEMENT);
+	purple_xmlnode_set_attrib(enable, "resume", "true");
+	jabber_send(js, enable);
+	purple_xmlnode_free(enable);
+}
+
+static void
+jabber_sm_resumed(JabberStream *js, PurpleXmlNode *packet)
+{
+	JabberStreamManagement *sm = js->sm;
+	GQueue pending;
+	guint32 h;
+	char *stanza;
+
+	if (!jabber_sm_parse_h(packet, &h)) {
+		purple_debug_error("jabber", "<resumed/> without a valid h\n");
+		purple_connection_error(js->gc,
+			PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+			_("Lost connection with server"));
+		return;
+	}
+
+	if (!jabber_sm_handle_resumed(sm, h, &pending)) {
+		jabber_sm_over_ack(js, h);
+		return;
+	}
+
+	purple_debug_info("jabber", "Stream resumed at h=%u, %u to resend\n",
+		h, g_queue_get_length(&pending));
+
+	/* The session is back as it was, so skip the initial presence and
+	 * everything else jabber_stream_set_state() does for a new one. */
+	js->state = JABBER_STREAM_CONNECTED;
+	jabber_stream_restart_inactivity_timer(js);
+
+	while ((stanza = g_queue_pop_head(&pending)) != NULL) {
+		jabber_send_raw(js, stanza, -1);
+		g_free(stanza);
+	}
+}
+
+void
+jabber_sm_parse(JabberStream *js, PurpleXmlNode *packet)
+{
+	JabberStreamManagement *sm = js->sm;
+	const char *name = packet->name;
+	guint32 h;
+
+	if (purple_strequal(name, "r")) {
+		char *value;
+		PurpleXmlNode *a;
+
+		if (sm->state != JABBER_SM_ENABLED)
+			return;
+
+		value = g_strdup_printf("%u", sm->inbound);
+		a = purple_xmlnode_new("a");
+		purple_xmlnode_set_namespace(a, NS_STREAM_MANAGEMENT);
+		purple_xmlnode_set_attrib(a, "h", value);
+		jabber_send(js, a);
+		purple_xmlnode_free(a);
+		g_free(value);
+	} else if (purple_strequal(name, "a")) {
+		if (sm->state == JABBER_SM_ENABLED && jabber_sm_parse_h(packet, &h) &&
+				!jabber_sm_handle_ack(sm, h, NULL))
+			jabber_sm_over_ack(js, h);
+	} else if (purple_strequal(name, "enabled")) {
+		const char *resume = purple_xmlnode_get_attrib(packet, "resume");
+
+		if (sm->state != JABBER_SM_ENABLING) {
+			purple_debug_warning("jabber", "Ignoring spurious <enabled/>\n");
+			return;
+		}
+
+		sm->state = JABBER_SM_ENABLED;
+		sm->inbound = 0;
+		g_free(sm->id);
+		sm->id = NULL;
+		if (purple_strequal(resume, "true") || purple_strequal(resume, "1"))
+			sm->id = g_strdup(purple_xmlnode_get_attrib(packet, "id"));
+
+		purple_debug_info("jabber", "Stream management enabled%s\n",
+			sm->id ? ", session can be resumed" : "");
+
+		if (!g_queue_is_empty(&sm->unacked))
+			jabber_sm_schedule_ack(js);
+	} else if (purple_strequal(name, "resumed")) {
+		if (!sm->resuming) {
+			purple_debug_warning("jabber", "Ignoring spurious <resumed/>\n");
+			return;
+		}
+
+		jabber_sm_resumed(js, packet);
+	} else if (purple_strequal(name, "failed")) {
+		if (sm->resuming) {
+			purple_debug_info("jabber", "Server refused to resume the stream\n");
+			purple_connection_error(js->gc,
+				PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+				_("Lost connection with server"));
+			return;
+		}
+
+		purple_debug_info("jabber", "Server refused to enable stream management\n");
+		jabber_sm_disable(sm);
+	} else {
+		purple_debug_warning("jabber", "Unknown stream management packet: %s\n",
+			name);
+	}
+}
+
+void
+jabber_sm_inbound(JabberStream *js)
+{
+	if (js->sm->state == JABBER_SM_ENABLED)
+		js->sm->inbound++;
+}
+
+gboolean
+jabber_sm_outbound(JabberStream *js, const char *data, gsize len)
+{
+	JabberStreamManagement *sm = js->sm;
+
+	if (sm == NULL || sm->state == JABBER_SM_DISABLED ||
+			!jabber_sm_is_stanza(data, len))
+		return FALSE;
+
+	jabber_sm_queue_stanza(sm, data, len);
+
+	/* Hold stanzas until the session is back, they go out in order
+	 * once the server tells us what it already has. */
+	if (sm->resuming)
+		return TRUE;
+
+	if (sm->state == JABBER_SM_ENABLED)
+		jabber_sm_schedule_ack(js);
+
+	return FALSE;
+}
+
+gboolean
+jabber_sm_can_resume(JabberStream *js)
+{
+	JabberStreamManagement *sm = js->sm;
+
+	return sm != NULL && sm->state == JABBER_SM_ENABLED && sm->id != NULL &&
+		!sm->resuming && sm->dropped == 0 && js->bosh == NULL &&
+		js->state == JABBER_STREAM_CONNECTED;
+}
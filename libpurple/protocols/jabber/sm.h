@@ -0,0 +1,94 @@
+/**
+ * @file sm.h Stream Management (XEP-0198)
+ *
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#ifndef PURPLE_JABBER_SM_H
+#define PURPLE_JABBER_SM_H
+
+typedef struct _JabberStreamManagement JabberStreamManagement;
+
+/* The most unacknowledged stanzas kept for replaying */
+#define JABBER_SM_MAX_UNACKED 1000
+
+#include "jabber.h"
+#include "xmlnode.h"
+
+typedef enum {
+	JABBER_SM_DISABLED,
+	JABBER_SM_ENABLING,
+	JABBER_SM_ENABLED
+} JabberSmState;
+
+struct _JabberStreamManagement
+{
+	JabberSmState state;
+
+	/* Whether the server offered stream management on this stream. */
+	gboolean available;
+
+	/* Whether we are reconnecting to resume the session. */
+	gboolean resuming;
+
+	/* The id of the session to resume, or NULL if it can't be resumed. */
+	char *id;
+
+	/* The number of stanzas we have handled from the server. */
+	guint32 inbound;
+
+	/* The number of our stanzas the server has acknowledged. */
+	guint32 acked;
+
+	/* Our stanzas the server hasn't acknowledged yet, serialized and
+	 * oldest first.  These are sent again when the session is resumed.
+	 * At most JABBER_SM_MAX_UNACKED are kept. */
+	GQueue unacked;
+
+	/* How many unacknowledged stanzas were dropped from the front of
+	 * unacked to keep it short.  The session can't be resumed until
+	 * the server acknowledged them. */
+	guint32 dropped;
+
+	guint ack_timer;
+};
+
+JabberStreamManagement *jabber_sm_new(void);
+void jabber_sm_free(JabberStreamManagement *sm);
+
+/* Bookkeeping, independent of any stream. */
+gboolean jabber_sm_is_stanza(const char *data, gsize len);
+void jabber_sm_queue_stanza(JabberStreamManagement *sm, const char *data,
+                            gsize len);
+gboolean jabber_sm_handle_ack(JabberStreamManagement *sm, guint32 h,
+                              guint *acked);
+gboolean jabber_sm_handle_resumed(JabberStreamManagement *sm, guint32 h,
+                                  GQueue *replay);
+
+/* Hooks for jabber.c */
+gboolean jabber_sm_features_parse(JabberStream *js, PurpleXmlNode *features);
+void jabber_sm_enable(JabberStream *js);
+void jabber_sm_parse(JabberStream *js, PurpleXmlNode *packet);
+void jabber_sm_inbound(JabberStream *js);
+gboolean jabber_sm_outbound(JabberStream *js, const char *data, gsize len);
+gboolean jabber_sm_can_resume(JabberStream *js);
+
+#endif /* PURPLE_JABBER_SM_H */
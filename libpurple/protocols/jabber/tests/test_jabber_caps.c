@@ -1,8 +1,18 @@
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
 
+#include "util.h"
 #include "xmlnode.h"
 #include "protocols/jabber/caps.h"
 
+/* The caps cache, as written by caps.c */
+#define TEST_CAPS_STORE_FILENAME "xmpp-caps.bin"
+#define TEST_CAPS_RECORD_CLIENT  1
+#define TEST_CAPS_RECORD_EXT     2
+#define TEST_CAPS_RECORD_TOUCH   3
+#define TEST_CAPS_DAY            (24 * 60 * 60)
+
 static void
 test_jabber_caps_parse_invalid_nodes(void) {
 	PurpleXmlNode *query;
@@ -43,15 +53,531 @@ test_jabber_caps_calculate_from_xmlnode(void) {
 	);
 }
 
+static void
+test_jabber_caps_features_interned(void) {
+	PurpleXmlNode *query;
+	JabberCapsClientInfo *info, *copy;
+	JabberCapsFeatures *set;
+	GByteArray *data;
+	GList *names;
+	gint ping, receipts;
+
+	g_assert_cmpint(jabber_caps_feature_lookup("test:caps:never-seen"), ==, -1);
+
+	query = purple_xmlnode_from_str(
+		"<query xmlns='http://jabber.org/protocol/disco#info'>"
+		"<feature var='urn:xmpp:receipts'/>"
+		"<feature var='urn:xmpp:ping'/>"
+		"<feature var='urn:xmpp:ping'/>"
+		"</query>", -1);
+	info = jabber_caps_parse_client_info(query);
+	purple_xmlnode_free(query);
+
+	/* nothing is interned before the client's hash was checked */
+	g_assert_null(info->feature_set);
+	g_assert_cmpint(jabber_caps_feature_lookup("urn:xmpp:receipts"), ==, -1);
+
+	/* the list keeps the order and the duplicate for hashing */
+	g_assert_cmpuint(g_list_length(info->features), ==, 3);
+	g_assert_cmpstr(info->features->data, ==, "urn:xmpp:receipts");
+	g_assert_cmpstr(info->features->next->data, ==, "urn:xmpp:ping");
+
+	/* a client read back from the caps cache is interned */
+	data = g_byte_array_new();
+	jabber_caps_client_info_serialize(info, data);
+	copy = jabber_caps_client_info_deserialize(data->data, data->len);
+	g_byte_array_unref(data);
+	g_assert_nonnull(copy);
+
+	ping = jabber_caps_feature_lookup("urn:xmpp:ping");
+	receipts = jabber_caps_feature_lookup("urn:xmpp:receipts");
+	g_assert_cmpint(ping, >=, 0);
+	g_assert_cmpint(receipts, >=, 0);
+	g_assert_cmpint(ping, !=, receipts);
+
+	g_assert_true(jabber_caps_features_has(copy->feature_set, ping));
+	g_assert_true(jabber_caps_features_has(copy->feature_set, receipts));
+	g_assert_false(jabber_caps_features_has(copy->feature_set, -1));
+	g_assert_false(jabber_caps_features_has(NULL, ping));
+
+	/* the set doesn't keep the duplicate */
+	names = jabber_caps_features_get_names(copy->feature_set);
+	g_assert_cmpuint(g_list_length(names), ==, 2);
+	g_assert_cmpstr(names->data, ==, "urn:xmpp:ping");
+	g_assert_cmpstr(names->next->data, ==, "urn:xmpp:receipts");
+	g_list_free(names);
+
+	/* another client gets the same ids */
+	set = jabber_caps_features_add(NULL, "urn:xmpp:ping");
+	g_assert_true(jabber_caps_features_has(set, ping));
+	g_assert_false(jabber_caps_features_has(set, receipts));
+	jabber_caps_features_free(set);
+
+	jabber_caps_client_info_destroy(info);
+	jabber_caps_client_info_destroy(copy);
+}
+
+static void
+test_jabber_caps_features_grow(void) {
+	JabberCapsFeatures *set = NULL;
+	gchar *feature;
+	gint i;
+
+	/* enough features to need several words */
+	for (i = 0; i < 200; i += 2) {
+		feature = g_strdup_printf("test:caps:grow:%d", i);
+		set = jabber_caps_features_add(set, feature);
+		g_free(feature);
+	}
+
+	for (i = 0; i < 200; i++) {
+		gint id;
+
+		feature = g_strdup_printf("test:caps:grow:%d", i);
+		id = jabber_caps_feature_lookup(feature);
+		if (i % 2 == 0)
+			g_assert_true(jabber_caps_features_has(set, id));
+		else
+			g_assert_cmpint(id, ==, -1);
+		g_free(feature);
+	}
+
+	jabber_caps_features_free(set);
+}
+
+static void
+test_jabber_caps_serialize_roundtrip(void) {
+	PurpleXmlNode *query;
+	JabberCapsClientInfo *info, *copy;
+	JabberCapsTuple *tuple;
+	GByteArray *data;
+	gchar *expected, *got;
+	gsize i;
+
+	query = purple_xmlnode_from_str(
+		"<query xmlns='http://jabber.org/protocol/disco#info'>"
+		"<identity category='client' type='pc' name='Psi' xml:lang='en'/>"
+		"<feature var='urn:xmpp:ping'/>"
+		"<feature var='jabber:iq:version'/>"
+		"<x xmlns='jabber:x:data' type='result'>"
+		"<field var='FORM_TYPE' type='hidden'>"
+		"<value>urn:xmpp:dataforms:softwareinfo</value></field>"
+		"<field var='os'><value>Mac</value></field>"
+		"</x></query>", -1);
+	info = jabber_caps_parse_client_info(query);
+	purple_xmlnode_free(query);
+
+	tuple = (JabberCapsTuple *)&info->tuple;
+	tuple->node = g_strdup("http://psi-im.org");
+	tuple->ver = g_strdup("q07IKJEyjvHSyhy//CH0CxmKi8w=");
+	tuple->hash = g_strdup("sha-1");
+
+	data = g_byte_array_new();
+	jabber_caps_client_info_serialize(info, data);
+	copy = jabber_caps_client_info_deserialize(data->data, data->len);
+	g_assert_nonnull(copy);
+
+	g_assert_cmpstr(copy->tuple.node, ==, info->tuple.node);
+	g_assert_cmpstr(copy->tuple.ver, ==, info->tuple.ver);
+	g_assert_cmpstr(copy->tuple.hash, ==, info->tuple.hash);
+	g_assert_cmpuint(g_list_length(copy->identities), ==, 1);
+	g_assert_cmpuint(g_list_length(copy->features), ==, 2);
+	g_assert_cmpuint(g_list_length(copy->forms), ==, 1);
+	g_assert_true(jabber_caps_features_has(copy->feature_set,
+		jabber_caps_feature_lookup("urn:xmpp:ping")));
+
+	/* a copy hashes the same as what it was made from */
+	expected = jabber_caps_calculate_hash(info, G_CHECKSUM_SHA1);
+	got = jabber_caps_calculate_hash(copy, G_CHECKSUM_SHA1);
+	g_assert_cmpstr(expected, ==, got);
+	g_free(expected);
+	g_free(got);
+
+	/* anything cut short is rejected */
+	for (i = 0; i < data->len; i++)
+		g_assert_null(jabber_caps_client_info_deserialize(data->data, i));
+
+	g_byte_array_unref(data);
+	jabber_caps_client_info_destroy(info);
+	jabber_caps_client_info_destroy(copy);
+}
+
+/******************************************************************************
+ * The caps cache
+ *****************************************************************************/
+static JabberCapsClientInfo *
+test_jabber_caps_client_new(const char *node, const char *ver,
+                            const char *hash)
+{
+	PurpleXmlNode *query;
+	JabberCapsClientInfo *info;
+	JabberCapsTuple *tuple;
+
+	query = purple_xmlnode_from_str(
+		"<query xmlns='http://jabber.org/protocol/disco#info'>"
+		"<identity category='client' type='pc' name='Test'/>"
+		"<feature var='urn:xmpp:ping'/>"
+		"</query>", -1);
+	info = jabber_caps_parse_client_info(query);
+	purple_xmlnode_free(query);
+
+	tuple = (JabberCapsTuple *)&info->tuple;
+	tuple->node = g_strdup(node);
+	tuple->ver = g_strdup(ver);
+	tuple->hash = g_strdup(hash);
+
+	return info;
+}
+
+static gchar *
+test_jabber_caps_store_filename(void)
+{
+	return g_build_filename(purple_cache_dir(), TEST_CAPS_STORE_FILENAME,
+		NULL);
+}
+
+static void
+test_jabber_caps_put_uint32(GByteArray *out, guint32 value)
+{
+	value = GUINT32_TO_LE(value);
+	g_byte_array_append(out, (const guint8 *)&value, sizeof(value));
+}
+
+static void
+test_jabber_caps_put_string(GByteArray *out, const char *str)
+{
+	if (str == NULL) {
+		test_jabber_caps_put_uint32(out, G_MAXUINT32);
+		return;
+	}
+
+	test_jabber_caps_put_uint32(out, strlen(str));
+	g_byte_array_append(out, (const guint8 *)str, strlen(str) + 1);
+}
+
+static GByteArray *
+test_jabber_caps_store_new(void)
+{
+	GByteArray *out = g_byte_array_new();
+
+	g_byte_array_append(out, (const guint8 *)"PURPLECS", 8);
+	test_jabber_caps_put_uint32(out, 1);
+
+	return out;
+}
+
+/* Appends a record holding payload, and frees payload */
+static void
+test_jabber_caps_store_add_record(GByteArray *out, guint8 type,
+                                  gint64 last_seen, GByteArray *payload)
+{
+	guint32 checksum = 2166136261u;
+	gint64 seen = GINT64_TO_LE(last_seen);
+	guint i;
+
+	for (i = 0; i < payload->len; i++) {
+		checksum ^= payload->data[i];
+		checksum *= 16777619u;
+	}
+
+	g_byte_array_append(out, &type, 1);
+	test_jabber_caps_put_uint32(out, payload->len);
+	g_byte_array_append(out, (const guint8 *)&seen, sizeof(seen));
+	test_jabber_caps_put_uint32(out, checksum);
+	g_byte_array_append(out, payload->data, payload->len);
+
+	g_byte_array_unref(payload);
+}
+
+static void
+test_jabber_caps_store_add_client(GByteArray *out, const char *node,
+                                  const char *ver, const char *hash,
+                                  gint64 last_seen)
+{
+	JabberCapsClientInfo *info = test_jabber_caps_client_new(node, ver, hash);
+	GByteArray *payload = g_byte_array_new();
+
+	jabber_caps_client_info_serialize(info, payload);
+	jabber_caps_client_info_destroy(info);
+
+	test_jabber_caps_store_add_record(out, TEST_CAPS_RECORD_CLIENT,
+		last_seen, payload);
+}
+
+static void
+test_jabber_caps_store_add_touch(GByteArray *out, const char *node,
+                                 const char *ver, const char *hash,
+                                 gint64 last_seen)
+{
+	GByteArray *payload = g_byte_array_new();
+
+	test_jabber_caps_put_string(payload, node);
+	test_jabber_caps_put_string(payload, ver);
+	test_jabber_caps_put_string(payload, hash);
+
+	test_jabber_caps_store_add_record(out, TEST_CAPS_RECORD_TOUCH,
+		last_seen, payload);
+}
+
+static void
+test_jabber_caps_store_add_ext(GByteArray *out, const char *node,
+                               const char *name, const char *feature)
+{
+	GByteArray *payload = g_byte_array_new();
+
+	test_jabber_caps_put_string(payload, node);
+	test_jabber_caps_put_string(payload, name);
+	test_jabber_caps_put_uint32(payload, 1);
+	test_jabber_caps_put_string(payload, feature);
+
+	test_jabber_caps_store_add_record(out, TEST_CAPS_RECORD_EXT,
+		time(NULL), payload);
+}
+
+/* Writes out the cache and frees it, returns its size */
+static gsize
+test_jabber_caps_store_write(GByteArray *out)
+{
+	gchar *filename = test_jabber_caps_store_filename();
+	gsize len = out->len;
+
+	g_assert_cmpint(g_mkdir_with_parents(purple_cache_dir(), 0700), ==, 0);
+	g_assert_true(g_file_set_contents(filename, (const gchar *)out->data,
+		out->len, NULL));
+
+	g_byte_array_unref(out);
+	g_free(filename);
+
+	return len;
+}
+
+static gsize
+test_jabber_caps_store_size(void)
+{
+	gchar *filename = test_jabber_caps_store_filename();
+	GStatBuf st;
+
+	g_assert_cmpint(g_stat(filename, &st), ==, 0);
+	g_free(filename);
+
+	return st.st_size;
+}
+
+static void
+test_jabber_caps_store_remove(void)
+{
+	gchar *filename = test_jabber_caps_store_filename();
+
+	g_unlink(filename);
+	g_free(filename);
+}
+
+static void
+test_jabber_caps_store_scan(void) {
+	GByteArray *out = test_jabber_caps_store_new();
+	GByteArray *unknown = g_byte_array_new();
+	JabberCapsClientInfo *info;
+	gint64 now = time(NULL);
+	char *ext1[] = { (char *)"ext1", NULL };
+	char *ext2[] = { (char *)"ext2", NULL };
+
+	test_jabber_caps_store_add_client(out, "http://test/a", "a=", "sha-1",
+		now);
+	/* a v1.3 client and the exts of its node */
+	test_jabber_caps_store_add_client(out, "http://test/b", "1.0", NULL, now);
+	test_jabber_caps_store_add_ext(out, "http://test/b", "ext1",
+		"urn:test:ext1");
+	/* records from a later version are skipped over */
+	g_byte_array_append(unknown, (const guint8 *)"later", 5);
+	test_jabber_caps_store_add_record(out, 99, now, unknown);
+	test_jabber_caps_store_add_client(out, "http://test/c", "c=", "sha-1",
+		now);
+	test_jabber_caps_store_write(out);
+
+	jabber_caps_init();
+
+	info = jabber_caps_find_client_info("http://test/a", "a=", "sha-1");
+	g_assert_nonnull(info);
+	g_assert_cmpstr(info->tuple.node, ==, "http://test/a");
+	g_assert_cmpuint(g_list_length(info->identities), ==, 1);
+	g_assert_true(jabber_caps_features_has(info->feature_set,
+		jabber_caps_feature_lookup("urn:xmpp:ping")));
+
+	info = jabber_caps_find_client_info("http://test/b", "1.0", NULL);
+	g_assert_nonnull(info);
+	g_assert_true(jabber_caps_exts_known(info, ext1));
+	g_assert_false(jabber_caps_exts_known(info, ext2));
+
+	g_assert_nonnull(jabber_caps_find_client_info("http://test/c", "c=",
+		"sha-1"));
+	g_assert_null(jabber_caps_find_client_info("http://test/a", "a=",
+		"sha-256"));
+	g_assert_null(jabber_caps_find_client_info("http://test/d", "d=",
+		"sha-1"));
+
+	jabber_caps_uninit();
+	test_jabber_caps_store_remove();
+}
+
+static void
+test_jabber_caps_store_add(void) {
+	jabber_caps_init();
+	g_assert_null(jabber_caps_find_client_info("http://test/a", "a=",
+		"sha-1"));
+	jabber_caps_add_client_info(test_jabber_caps_client_new("http://test/a",
+		"a=", "sha-1"));
+	jabber_caps_uninit();
+
+	/* it's read back from the file the next time around */
+	jabber_caps_init();
+	g_assert_nonnull(jabber_caps_find_client_info("http://test/a", "a=",
+		"sha-1"));
+	jabber_caps_uninit();
+
+	test_jabber_caps_store_remove();
+}
+
+static void
+test_jabber_caps_store_expiry(void) {
+	GByteArray *out = test_jabber_caps_store_new();
+	gint64 now = time(NULL);
+
+	test_jabber_caps_store_add_client(out, "http://test/old", "1", "sha-1",
+		now - 31 * TEST_CAPS_DAY);
+	test_jabber_caps_store_add_client(out, "http://test/touched", "1",
+		"sha-1", now - 31 * TEST_CAPS_DAY);
+	test_jabber_caps_store_add_touch(out, "http://test/touched", "1",
+		"sha-1", now - 2 * TEST_CAPS_DAY);
+	test_jabber_caps_store_add_client(out, "http://test/new", "1", "sha-1",
+		now);
+	test_jabber_caps_store_write(out);
+
+	jabber_caps_init();
+
+	g_assert_null(jabber_caps_find_client_info("http://test/old", "1",
+		"sha-1"));
+	g_assert_nonnull(jabber_caps_find_client_info("http://test/touched", "1",
+		"sha-1"));
+	g_assert_nonnull(jabber_caps_find_client_info("http://test/new", "1",
+		"sha-1"));
+
+	jabber_caps_uninit();
+	test_jabber_caps_store_remove();
+}
+
+static void
+test_jabber_caps_store_eviction(void) {
+	GByteArray *out = test_jabber_caps_store_new();
+	gint64 now = time(NULL);
+	gchar ver[16];
+	guint i;
+
+	/* one more client than the cache keeps, the first seen least recently */
+	for (i = 0; i <= 10000; i++) {
+		g_snprintf(ver, sizeof(ver), "%u", i);
+		test_jabber_caps_store_add_client(out, "http://test/evict", ver,
+			"sha-1", now - 10000 + i);
+	}
+	test_jabber_caps_store_write(out);
+
+	jabber_caps_init();
+
+	g_assert_null(jabber_caps_find_client_info("http://test/evict", "0",
+		"sha-1"));
+	g_assert_nonnull(jabber_caps_find_client_info("http://test/evict", "1",
+		"sha-1"));
+	g_assert_nonnull(jabber_caps_find_client_info("http://test/evict",
+		"10000", "sha-1"));
+
+	jabber_caps_uninit();
+	test_jabber_caps_store_remove();
+}
+
+static void
+test_jabber_caps_store_compaction(void) {
+	GByteArray *out = test_jabber_caps_store_new();
+	gint64 now = time(NULL);
+	gsize len, written;
+	guint i;
+
+	/* the same client over and over, so most of the file is outdated */
+	for (i = 0; i < 1000; i++)
+		test_jabber_caps_store_add_client(out, "http://test/a", "a=", "sha-1",
+			now);
+	written = test_jabber_caps_store_write(out);
+
+	jabber_caps_init();
+	len = test_jabber_caps_store_size();
+	g_assert_cmpuint(len, <, written / 100);
+	g_assert_nonnull(jabber_caps_find_client_info("http://test/a", "a=",
+		"sha-1"));
+	jabber_caps_uninit();
+
+	/* a file that was cut short keeps the records before the damage */
+	out = test_jabber_caps_store_new();
+	test_jabber_caps_store_add_client(out, "http://test/a", "a=", "sha-1",
+		now);
+	len = out->len;
+	g_byte_array_append(out, (const guint8 *)"\001\377", 2);
+	test_jabber_caps_store_write(out);
+
+	jabber_caps_init();
+	g_assert_cmpuint(test_jabber_caps_store_size(), ==, len);
+	g_assert_nonnull(jabber_caps_find_client_info("http://test/a", "a=",
+		"sha-1"));
+	jabber_caps_uninit();
+
+	test_jabber_caps_store_remove();
+}
+
 gint
 main(gint argc, gchar **argv) {
+	gchar *dir, *cache;
+	gint ret;
+
 	g_test_init(&argc, &argv, NULL);
 
+	dir = g_dir_make_tmp("purple-caps-XXXXXX", NULL);
+	g_assert_nonnull(dir);
+	purple_util_set_user_dir(dir);
+
 	g_test_add_func("/jabber/caps/parse invalid nodes",
 	                test_jabber_caps_parse_invalid_nodes);
 
 	g_test_add_func("/jabber/caps/calulate from xmlnode",
 	                test_jabber_caps_calculate_from_xmlnode);
 
-	return g_test_run();
+	g_test_add_func("/jabber/caps/features interned",
+	                test_jabber_caps_features_interned);
+
+	g_test_add_func("/jabber/caps/features grow",
+	                test_jabber_caps_features_grow);
+
+	g_test_add_func("/jabber/caps/serialize roundtrip",
+	                test_jabber_caps_serialize_roundtrip);
+
+	g_test_add_func("/jabber/caps/store scan",
+	                test_jabber_caps_store_scan);
+
+	g_test_add_func("/jabber/caps/store add",
+	                test_jabber_caps_store_add);
+
+	g_test_add_func("/jabber/caps/store expiry",
+	                test_jabber_caps_store_expiry);
+
+	g_test_add_func("/jabber/caps/store eviction",
+	                test_jabber_caps_store_eviction);
+
+	g_test_add_func("/jabber/caps/store compaction",
+	                test_jabber_caps_store_compaction);
+
+	ret = g_test_run();
+
+	cache = g_build_filename(dir, "cache", NULL);
+	g_rmdir(cache);
+	g_rmdir(dir);
+	g_free(cache);
+	g_free(dir);
+
+	return ret;
 }
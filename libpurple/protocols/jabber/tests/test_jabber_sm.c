@@ -0,0 +1,725 @@
+#include <glib.h>
+#include <gio/gio.h>
+#include <string.h>
+
+#include <purple.h>
+
+#include "tests/test_ui.h"
+#include "protocols/jabber/jabber.h"
+#include "protocols/jabber/parser.h"
+#include "protocols/jabber/sm.h"
+
+static void
+test_jabber_sm_is_stanza(void) {
+	g_assert_true(jabber_sm_is_stanza("<message to='a@b'/>", 19));
+	g_assert_true(jabber_sm_is_stanza("<presence/>", 11));
+	g_assert_true(jabber_sm_is_stanza("<iq>", 4));
+	g_assert_true(jabber_sm_is_stanza("\n  <iq type='get'/>", 19));
+
+	g_assert_false(jabber_sm_is_stanza("", 0));
+	g_assert_false(jabber_sm_is_stanza("\t", 1));
+	g_assert_false(jabber_sm_is_stanza("<r xmlns='urn:xmpp:sm:3'/>", 26));
+	g_assert_false(jabber_sm_is_stanza("<stream:stream to='b'>", 22));
+	g_assert_false(jabber_sm_is_stanza("<iqq/>", 6));
+	g_assert_false(jabber_sm_is_stanza("<messages/>", 11));
+	/* the name has to be complete within len */
+	g_assert_false(jabber_sm_is_stanza("<iq/>", 3));
+}
+
+static void
+test_jabber_sm_resume_replays_unacked(void) {
+	JabberStreamManagement *sm = jabber_sm_new();
+	gchar *stanza;
+	guint acked;
+	gint i;
+
+	/* the client sends five stanzas, the connection drops after the
+	 * server handled three of them */
+	for (i = 0; i < 5; i++) {
+		stanza = g_strdup_printf("<message id='m%d'/>", i);
+		jabber_sm_queue_stanza(sm, stanza, strlen(stanza));
+		g_free(stanza);
+	}
+
+	/* <resumed h='3'/> */
+	g_assert_true(jabber_sm_handle_ack(sm, 3, &acked));
+	g_assert_cmpuint(acked, ==, 3);
+	g_assert_cmpuint(sm->acked, ==, 3);
+
+	/* only the two the server never got are left to replay, in order */
+	g_assert_cmpuint(g_queue_get_length(&sm->unacked), ==, 2);
+	g_assert_cmpstr(g_queue_peek_nth(&sm->unacked, 0), ==, "<message id='m3'/>");
+	g_assert_cmpstr(g_queue_peek_nth(&sm->unacked, 1), ==, "<message id='m4'/>");
+
+	/* acking the same count again drops nothing */
+	g_assert_true(jabber_sm_handle_ack(sm, 3, &acked));
+	g_assert_cmpuint(acked, ==, 0);
+	g_assert_cmpuint(g_queue_get_length(&sm->unacked), ==, 2);
+
+	jabber_sm_free(sm);
+}
+
+static void
+test_jabber_sm_ack_wraparound(void) {
+	JabberStreamManagement *sm = jabber_sm_new();
+	guint acked;
+	gint i;
+
+	sm->acked = G_MAXUINT32 - 1;
+	for (i = 0; i < 4; i++)
+		jabber_sm_queue_stanza(sm, "<iq/>", 5);
+
+	/* G_MAXUINT32 - 1 + 3 wraps around to 1 */
+	g_assert_true(jabber_sm_handle_ack(sm, 1, &acked));
+	g_assert_cmpuint(acked, ==, 3);
+	g_assert_cmpuint(sm->acked, ==, 1);
+	g_assert_cmpuint(g_queue_get_length(&sm->unacked), ==, 1);
+
+	jabber_sm_free(sm);
+}
+
+static void
+test_jabber_sm_over_ack(void) {
+	JabberStreamManagement *sm = jabber_sm_new();
+
+	guint acked;
+
+	jabber_sm_queue_stanza(sm, "<presence id='p1'/>", 19);
+	jabber_sm_queue_stanza(sm, "<presence id='p2'/>", 19);
+
+	/* a broken server acking more than we sent is an error, and changes
+	 * nothing */
+	g_assert_false(jabber_sm_handle_ack(sm, 10, &acked));
+	g_assert_cmpuint(sm->acked, ==, 0);
+	g_assert_cmpuint(g_queue_get_length(&sm->unacked), ==, 2);
+
+	/* so a real ack afterwards still only drops what it acknowledges */
+	g_assert_true(jabber_sm_handle_ack(sm, 1, &acked));
+	g_assert_cmpuint(acked, ==, 1);
+	g_assert_cmpuint(g_queue_get_length(&sm->unacked), ==, 1);
+	g_assert_cmpstr(g_queue_peek_head(&sm->unacked), ==, "<presence id='p2'/>");
+
+	jabber_sm_free(sm);
+}
+
+static void
+test_jabber_sm_unacked_limit(void) {
+	JabberStreamManagement *sm = jabber_sm_new();
+	guint acked;
+	gint i;
+
+	for (i = 0; i < JABBER_SM_MAX_UNACKED + 5; i++)
+		jabber_sm_queue_stanza(sm, "<iq/>", 5);
+
+	/* the oldest went, but they still count as sent */
+	g_assert_cmpuint(g_queue_get_length(&sm->unacked), ==,
+		JABBER_SM_MAX_UNACKED);
+	g_assert_cmpuint(sm->dropped, ==, 5);
+	g_assert_false(jabber_sm_handle_ack(sm, JABBER_SM_MAX_UNACKED + 6,
+		&acked));
+
+	/* acknowledging the dropped ones first leaves the queue alone */
+	g_assert_true(jabber_sm_handle_ack(sm, 3, &acked));
+	g_assert_cmpuint(sm->dropped, ==, 2);
+	g_assert_cmpuint(g_queue_get_length(&sm->unacked), ==,
+		JABBER_SM_MAX_UNACKED);
+
+	g_assert_true(jabber_sm_handle_ack(sm, 10, &acked));
+	g_assert_cmpuint(acked, ==, 7);
+	g_assert_cmpuint(sm->dropped, ==, 0);
+	g_assert_cmpuint(g_queue_get_length(&sm->unacked), ==,
+		JABBER_SM_MAX_UNACKED - 5);
+
+	jabber_sm_free(sm);
+}
+
+/* Sends a stanza the way jabber_send_raw() does, returns whether it was
+ * held back instead of going out */
+static gboolean
+test_jabber_sm_send(JabberStream *js, gint id, GQueue *wire)
+{
+	gchar *stanza = g_strdup_printf("<message id='m%d'/>", id);
+
+	if (jabber_sm_outbound(js, stanza, strlen(stanza))) {
+		g_free(stanza);
+		return TRUE;
+	}
+
+	g_queue_push_tail(wire, stanza);
+	return FALSE;
+}
+
+static void
+test_jabber_sm_drop_and_resume(void) {
+	JabberStream *js = g_new0(JabberStream, 1);
+	JabberStreamManagement *sm = jabber_sm_new();
+	GQueue wire = G_QUEUE_INIT, replay = G_QUEUE_INIT;
+	gchar *stanza;
+	gint i;
+
+	js->sm = sm;
+	sm->state = JABBER_SM_ENABLED;
+	sm->id = g_strdup("session");
+
+	/* five stanzas go out, the server acknowledges two of them */
+	for (i = 0; i < 5; i++)
+		g_assert_false(test_jabber_sm_send(js, i, &wire));
+	g_assert_cmpuint(wire.length, ==, 5);
+	g_assert_true(jabber_sm_handle_ack(sm, 2, NULL));
+
+	/* the connection drops, what's sent until the stream is back is
+	 * held */
+	sm->resuming = TRUE;
+	g_queue_foreach(&wire, (GFunc)g_free, NULL);
+	g_queue_clear(&wire);
+	for (i = 5; i < 7; i++)
+		g_assert_true(test_jabber_sm_send(js, i, &wire));
+	g_assert_cmpuint(wire.length, ==, 0);
+
+	/* stream management elements aren't stanzas, they aren't held */
+	g_assert_false(jabber_sm_outbound(js, "<resume h='0'/>", 15));
+
+	/* the server got one more before the drop: <resumed h='3'/> */
+	g_assert_false(jabber_sm_handle_resumed(sm, 10, &replay));
+	g_assert_true(sm->resuming);
+	g_assert_true(jabber_sm_handle_resumed(sm, 3, &replay));
+	g_assert_false(sm->resuming);
+	g_assert_true(g_queue_is_empty(&sm->unacked));
+
+	/* everything the server didn't get goes out again, in order */
+	g_assert_cmpuint(replay.length, ==, 4);
+	for (i = 3; (stanza = g_queue_pop_head(&replay)) != NULL; i++) {
+		gchar *expected = g_strdup_printf("<message id='m%d'/>", i);
+
+		g_assert_cmpstr(stanza, ==, expected);
+		g_free(expected);
+
+		/* and is kept again until it's acknowledged */
+		g_assert_false(jabber_sm_outbound(js, stanza, strlen(stanza)));
+		g_free(stanza);
+	}
+	g_assert_cmpuint(g_queue_get_length(&sm->unacked), ==, 4);
+	g_assert_true(jabber_sm_handle_ack(sm, 7, NULL));
+	g_assert_true(g_queue_is_empty(&sm->unacked));
+
+	jabber_sm_free(sm);
+	g_free(js);
+}
+
+/******************************************************************************
+ * A server that speaks just enough XMPP to get the jabber protocol logged in
+ * with stream management, and then drops the connection on it.
+ *****************************************************************************/
+typedef struct {
+	GSocketService *service;
+	guint16 port;
+
+	GSocketConnection *conn;
+	GMarkupParseContext *parser;
+	gboolean reading;
+	gchar buf[4096];
+
+	/* the child of <stream:stream> being parsed */
+	gint depth;
+	gchar *name, *id, *type, *to, *h, *previd;
+	gboolean bind;
+
+	/* stanzas received since <enable/>, as "name id" */
+	GPtrArray *received;
+	/* stanzas sent since <enabled/> */
+	guint sent;
+	gboolean enabled;
+
+	/* set when the stanza to drop the connection on came in */
+	gboolean drop;
+	/* what it handled, sent and never got when it dropped */
+	guint handled;
+	guint sent_at_drop;
+	GPtrArray *lost;
+
+	/* the <resume/> the client sent */
+	gchar *resume_h, *resume_previd;
+} TestJabberServer;
+
+static void test_jabber_server_read(TestJabberServer *server);
+
+static void
+test_jabber_server_send(TestJabberServer *server, const gchar *data,
+                        gboolean stanza)
+{
+	GOutputStream *output;
+
+	output = g_io_stream_get_output_stream(G_IO_STREAM(server->conn));
+	g_assert_true(g_output_stream_write_all(output, data, strlen(data),
+		NULL, NULL, NULL));
+
+	if (stanza && server->enabled)
+		server->sent++;
+}
+
+static void
+test_jabber_server_handle(TestJabberServer *server)
+{
+	const gchar *name = server->name;
+	gchar *reply;
+
+	if (purple_strequal(name, "enable")) {
+		server->enabled = TRUE;
+		server->sent = 0;
+		g_ptr_array_set_size(server->received, 0);
+		test_jabber_server_send(server, "<enabled xmlns='urn:xmpp:sm:3' "
+			"id='test-session' resume='true'/>", FALSE);
+		return;
+	}
+
+	if (purple_strequal(name, "resume")) {
+		server->resume_h = g_strdup(server->h);
+		server->resume_previd = g_strdup(server->previd);
+		reply = g_strdup_printf("<resumed xmlns='urn:xmpp:sm:3' h='%u' "
+			"previd='test-session'/>", server->handled);
+		test_jabber_server_send(server, reply, FALSE);
+		g_free(reply);
+		return;
+	}
+
+	/* <r/> and <a/> aren't counted */
+	if (!purple_strequal(name, "message") &&
+			!purple_strequal(name, "presence") &&
+			!purple_strequal(name, "iq"))
+		return;
+
+	g_ptr_array_add(server->received,
+		g_strdup_printf("%s %s", name, server->id ? server->id : ""));
+
+	/* whatever comes after it is lost with the connection */
+	if (server->drop)
+		return;
+	if (purple_strequal(name, "message") &&
+			purple_strequal(server->id, "m4")) {
+		server->drop = TRUE;
+		return;
+	}
+
+	if (!purple_strequal(name, "iq") || (!purple_strequal(server->type, "get")
+			&& !purple_strequal(server->type, "set")))
+		return;
+
+	if (server->bind)
+		reply = g_markup_printf_escaped("<iq type='result' id='%s'>"
+			"<bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'>"
+			"<jid>test@localhost/resume</jid></bind></iq>", server->id);
+	else if (server->to != NULL)
+		reply = g_markup_printf_escaped(
+			"<iq type='result' id='%s' from='%s'/>", server->id, server->to);
+	else
+		reply = g_markup_printf_escaped("<iq type='result' id='%s'/>",
+			server->id);
+	test_jabber_server_send(server, reply, TRUE);
+	g_free(reply);
+}
+
+static void
+test_jabber_server_start_element(GMarkupParseContext *context,
+                                 const gchar *element_name,
+                                 const gchar **attribute_names,
+                                 const gchar **attribute_values,
+                                 gpointer data, GError **error)
+{
+	TestJabberServer *server = data;
+	gint i;
+
+	server->depth++;
+
+	if (server->depth == 1) {
+		test_jabber_server_send(server, "<?xml version='1.0'?>"
+			"<stream:stream xmlns='jabber:client' "
+			"xmlns:stream='http://etherx.jabber.org/streams' "
+			"from='localhost' id='test-stream' version='1.0'>"
+			"<stream:features>"
+			"<bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'/>"
+			"<sm xmlns='urn:xmpp:sm:3'/>"
+			"</stream:features>", FALSE);
+	} else if (server->depth == 2) {
+		g_free(server->name);
+		g_clear_pointer(&server->id, g_free);
+		g_clear_pointer(&server->type, g_free);
+		g_clear_pointer(&server->to, g_free);
+		g_clear_pointer(&server->h, g_free);
+		g_clear_pointer(&server->previd, g_free);
+		server->bind = FALSE;
+
+		server->name = g_strdup(element_name);
+		for (i = 0; attribute_names[i] != NULL; i++) {
+			const gchar *value = attribute_values[i];
+
+			if (purple_strequal(attribute_names[i], "id"))
+				server->id = g_strdup(value);
+			else if (purple_strequal(attribute_names[i], "type"))
+				server->type = g_strdup(value);
+			else if (purple_strequal(attribute_names[i], "to"))
+				server->to = g_strdup(value);
+			else if (purple_strequal(attribute_names[i], "h"))
+				server->h = g_strdup(value);
+			else if (purple_strequal(attribute_names[i], "previd"))
+				server->previd = g_strdup(value);
+		}
+	} else if (server->depth == 3 && purple_strequal(element_name, "bind")) {
+		server->bind = TRUE;
+	}
+}
+
+static void
+test_jabber_server_end_element(GMarkupParseContext *context,
+                               const gchar *element_name, gpointer data,
+                               GError **error)
+{
+	TestJabberServer *server = data;
+
+	if (server->depth == 2)
+		test_jabber_server_handle(server);
+
+	server->depth--;
+}
+
+static const GMarkupParser test_jabber_server_parser = {
+	.start_element = test_jabber_server_start_element,
+	.end_element = test_jabber_server_end_element,
+};
+
+/* The server handled everything up to m2 when the connection went away */
+static void
+test_jabber_server_drop(TestJabberServer *server)
+{
+	guint i;
+
+	for (i = 0; i < server->received->len; i++) {
+		if (purple_strequal(g_ptr_array_index(server->received, i),
+				"message m2"))
+			break;
+	}
+	g_assert_cmpuint(i, <, server->received->len);
+
+	server->handled = i + 1;
+	server->sent_at_drop = server->sent;
+	server->lost = g_ptr_array_new_with_free_func(g_free);
+	for (i = server->handled; i < server->received->len; i++)
+		g_ptr_array_add(server->lost,
+			g_strdup(g_ptr_array_index(server->received, i)));
+	g_ptr_array_set_size(server->received, 0);
+
+	g_io_stream_close(G_IO_STREAM(server->conn), NULL, NULL);
+	g_clear_object(&server->conn);
+	server->drop = FALSE;
+}
+
+static void
+test_jabber_server_read_cb(GObject *source, GAsyncResult *res, gpointer data)
+{
+	TestJabberServer *server = data;
+	gssize len;
+
+	server->reading = FALSE;
+
+	/* the client closed the connection */
+	len = g_input_stream_read_finish(G_INPUT_STREAM(source), res, NULL);
+	if (len <= 0) {
+		g_clear_object(&server->conn);
+		return;
+	}
+
+	g_assert_true(g_markup_parse_context_parse(server->parser, server->buf,
+		len, NULL));
+
+	if (server->drop) {
+		test_jabber_server_drop(server);
+		return;
+	}
+
+	test_jabber_server_read(server);
+}
+
+static void
+test_jabber_server_read(TestJabberServer *server)
+{
+	GInputStream *input;
+
+	input = g_io_stream_get_input_stream(G_IO_STREAM(server->conn));
+	g_input_stream_read_async(input, server->buf, sizeof(server->buf),
+		G_PRIORITY_DEFAULT, NULL, test_jabber_server_read_cb, server);
+	server->reading = TRUE;
+}
+
+static gboolean
+test_jabber_server_incoming_cb(GSocketService *service,
+                               GSocketConnection *conn, GObject *source,
+                               gpointer data)
+{
+	TestJabberServer *server = data;
+
+	/* the old connection has to be gone before the client reconnects */
+	g_assert_null(server->conn);
+
+	server->conn = g_object_ref(conn);
+	server->depth = 0;
+	g_clear_pointer(&server->parser, g_markup_parse_context_free);
+	server->parser = g_markup_parse_context_new(&test_jabber_server_parser,
+		0, server, NULL);
+	test_jabber_server_read(server);
+
+	return TRUE;
+}
+
+static TestJabberServer *
+test_jabber_server_new(void)
+{
+	TestJabberServer *server = g_new0(TestJabberServer, 1);
+	GError *error = NULL;
+
+	server->received = g_ptr_array_new_with_free_func(g_free);
+
+	server->service = g_socket_service_new();
+	server->port = g_socket_listener_add_any_inet_port(
+		G_SOCKET_LISTENER(server->service), NULL, &error);
+	g_assert_no_error(error);
+	g_signal_connect(server->service, "incoming",
+		G_CALLBACK(test_jabber_server_incoming_cb), server);
+	g_socket_service_start(server->service);
+
+	return server;
+}
+
+static void
+test_jabber_server_free(TestJabberServer *server)
+{
+	g_socket_service_stop(server->service);
+	g_socket_listener_close(G_SOCKET_LISTENER(server->service));
+	g_object_unref(server->service);
+
+	g_clear_object(&server->conn);
+	g_clear_pointer(&server->parser, g_markup_parse_context_free);
+	g_free(server->name);
+	g_free(server->id);
+	g_free(server->type);
+	g_free(server->to);
+	g_free(server->h);
+	g_free(server->previd);
+	g_free(server->resume_h);
+	g_free(server->resume_previd);
+	g_ptr_array_free(server->received, TRUE);
+	if (server->lost != NULL)
+		g_ptr_array_free(server->lost, TRUE);
+	g_free(server);
+}
+
+static gboolean
+test_jabber_sm_tick(gpointer data)
+{
+	return G_SOURCE_CONTINUE;
+}
+
+/* Runs the main loop until cond holds, failing after ten seconds */
+#define TEST_JABBER_SM_WAIT(cond) G_STMT_START { \
+	gint64 deadline = g_get_monotonic_time() + 10 * G_USEC_PER_SEC; \
+	while (!(cond)) { \
+		g_assert_cmpint(g_get_monotonic_time(), <, deadline); \
+		g_main_context_iteration(NULL, TRUE); \
+	} \
+} G_STMT_END
+
+static void
+test_jabber_sm_send_message(JabberStream *js, gint id)
+{
+	gchar *stanza = g_strdup_printf("<message to='peer@localhost' id='m%d'>"
+		"<body>%d</body></message>", id, id);
+
+	jabber_send_raw(js, stanza, -1);
+	g_free(stanza);
+}
+
+/* Logs an account in to the server, the caller runs the main loop until it
+ * is connected */
+static PurpleAccount *
+test_jabber_sm_account_new(TestJabberServer *server)
+{
+	PurpleAccount *account;
+
+	account = purple_account_new("test@localhost/resume", "prpl-jabber");
+	purple_account_set_string(account, "connect_server", "127.0.0.1");
+	purple_account_set_int(account, "port", server->port);
+	purple_account_set_string(account, "connection_security",
+		"opportunistic_tls");
+	purple_account_set_remember_password(account, FALSE);
+	purple_account_set_password(account, "password", NULL, NULL);
+	purple_account_set_enabled(account, purple_core_get_ui(), TRUE);
+	if (purple_account_get_connection(account) == NULL)
+		purple_account_connect(account);
+
+	return account;
+}
+
+static void
+test_jabber_sm_resume_over_socket(void) {
+	TestJabberServer *server = test_jabber_server_new();
+	PurpleAccount *account;
+	PurpleConnection *gc;
+	JabberStream *js;
+	gchar *h;
+	guint tick, i;
+
+	tick = g_timeout_add(100, test_jabber_sm_tick, NULL);
+
+	account = test_jabber_sm_account_new(server);
+	TEST_JABBER_SM_WAIT(purple_account_is_connected(account));
+	gc = purple_account_get_connection(account);
+	js = purple_connection_get_protocol_data(gc);
+	g_assert_cmpint(js->sm->state, ==, JABBER_SM_ENABLED);
+	g_assert_cmpstr(js->sm->id, ==, "test-session");
+
+	/* the server takes three of these, and drops the connection when the
+	 * last one comes in */
+	for (i = 0; i < 5; i++)
+		test_jabber_sm_send_message(js, i);
+	TEST_JABBER_SM_WAIT(js->sm->resuming);
+
+	/* held until the stream is back */
+	test_jabber_sm_send_message(js, 5);
+
+	TEST_JABBER_SM_WAIT(server->lost != NULL &&
+		server->received->len >= server->lost->len + 1);
+	g_assert_false(js->sm->resuming);
+
+	/* the client told the server how much of its output it got */
+	g_assert_cmpstr(server->resume_previd, ==, "test-session");
+	h = g_strdup_printf("%u", server->sent_at_drop);
+	g_assert_cmpstr(server->resume_h, ==, h);
+	g_free(h);
+
+	/* and sent what it didn't get again, in order, before anything new */
+	g_assert_cmpuint(server->lost->len, >=, 2);
+	g_assert_cmpstr(g_ptr_array_index(server->lost, 0), ==, "message m3");
+	g_assert_cmpstr(g_ptr_array_index(server->lost, 1), ==, "message m4");
+	for (i = 0; i < server->lost->len; i++)
+		g_assert_cmpstr(g_ptr_array_index(server->received, i), ==,
+			g_ptr_array_index(server->lost, i));
+	g_assert_cmpstr(g_ptr_array_index(server->received, i), ==,
+		"message m5");
+
+	/* nothing of this reached the core */
+	g_assert_true(purple_account_get_connection(account) == gc);
+	g_assert_true(purple_account_is_connected(account));
+
+	purple_account_set_enabled(account, purple_core_get_ui(), FALSE);
+	TEST_JABBER_SM_WAIT(!server->reading);
+
+	g_source_remove(tick);
+	test_jabber_server_free(server);
+	g_object_unref(account);
+}
+
+/* what jabber_recv_cb() reads at a time until the buffer grows */
+#define TEST_JABBER_SM_READ_SIZE 4096
+
+/* Feeds a canned stream of the stanzas a busy account gets through the
+ * parser of a logged in connection */
+static void
+test_jabber_sm_parser_replay(void) {
+	TestJabberServer *server = test_jabber_server_new();
+	PurpleAccount *account;
+	JabberStream *js;
+	GString *canned;
+	GTimer *timer;
+	gdouble elapsed;
+	guint count = g_test_perf() ? 20000 : 200;
+	guint iterations = g_test_perf() ? 10 : 1;
+	guint tick, i, inbound;
+	gsize offset;
+
+	tick = g_timeout_add(100, test_jabber_sm_tick, NULL);
+
+	account = test_jabber_sm_account_new(server);
+	TEST_JABBER_SM_WAIT(purple_account_is_connected(account));
+	js = purple_connection_get_protocol_data(
+		purple_account_get_connection(account));
+
+	canned = g_string_new(NULL);
+	for (i = 0; i < count; i++) {
+		switch (i % 3) {
+			case 0:
+				g_string_append_printf(canned,
+					"<presence from='contact%u@localhost/home' "
+					"to='test@localhost/resume'><show>away</show>"
+					"<status>Away since %u</status><priority>5</priority>"
+					"</presence>", i % 100, i);
+				break;
+			case 1:
+				g_string_append_printf(canned,
+					"<message from='contact%u@localhost/home' "
+					"to='test@localhost/resume' type='chat'>"
+					"<composing xmlns='http://jabber.org/protocol/chatstates'/>"
+					"</message>", i % 100);
+				break;
+			default:
+				g_string_append_printf(canned,
+					"<iq type='result' id='replay%u' "
+					"from='test@localhost'/>", i);
+				break;
+		}
+	}
+
+	inbound = js->sm->inbound;
+	timer = g_timer_new();
+	for (i = 0; i < iterations; i++) {
+		for (offset = 0; offset < canned->len;
+				offset += TEST_JABBER_SM_READ_SIZE) {
+			jabber_parser_process(js, canned->str + offset,
+				MIN(canned->len - offset, TEST_JABBER_SM_READ_SIZE));
+		}
+	}
+	elapsed = g_timer_elapsed(timer, NULL);
+
+	/* every stanza made it through the parser, and the stream is fine */
+	g_assert_cmpuint(js->sm->inbound - inbound, ==, count * iterations);
+	g_assert_true(purple_account_is_connected(account));
+
+	g_test_message("%u stanzas (%" G_GSIZE_FORMAT " bytes) parsed %u times "
+		"in %f s", count, canned->len, iterations, elapsed);
+	if (g_test_perf())
+		g_test_minimized_result(elapsed, "stanza stream parse time");
+
+	purple_account_set_enabled(account, purple_core_get_ui(), FALSE);
+	TEST_JABBER_SM_WAIT(!server->reading);
+
+	g_timer_destroy(timer);
+	g_string_free(canned, TRUE);
+	g_source_remove(tick);
+	test_jabber_server_free(server);
+	g_object_unref(account);
+}
+
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+	purple_plugins_add_search_path(TEST_JABBER_PLUGIN_DIR);
+	purple_plugins_refresh();
+
+	g_test_add_func("/jabber/sm/is stanza",
+	                test_jabber_sm_is_stanza);
+	g_test_add_func("/jabber/sm/resume replays unacked",
+	                test_jabber_sm_resume_replays_unacked);
+	g_test_add_func("/jabber/sm/ack wraparound",
+	                test_jabber_sm_ack_wraparound);
+	g_test_add_func("/jabber/sm/over ack",
+	                test_jabber_sm_over_ack);
+	g_test_add_func("/jabber/sm/unacked limit",
+	                test_jabber_sm_unacked_limit);
+	g_test_add_func("/jabber/sm/drop and resume",
+	                test_jabber_sm_drop_and_resume);
+	g_test_add_func("/jabber/sm/resume over a socket",
+	                test_jabber_sm_resume_over_socket);
+	g_test_add_func("/jabber/sm/parser replay",
+	                test_jabber_sm_parser_replay);
+
+	return g_test_run();
+}
@@ -1382,6 +1382,7 @@ silcpurple_send_im_resolved(SilcClient client,
 	SilcPurple sg = purple_connection_get_protocol_data(gc);
 	SilcPurpleIM im = context;
 	PurpleIMConversation *convo;
+	PurpleMessage *pmsg;
 	char tmp[256];
 	SilcClientEntry client_entry;
 	SilcDList list;
@@ -1424,9 +1425,11 @@ silcpurple_send_im_resolved(SilcClient client,
 								 buf->data,
 								 silc_buffer_len(buf));
 			silc_mime_partial_free(list);
+			pmsg = purple_message_new_outgoing(
+				conn->local_entry->nickname, im->message, 0);
 			purple_conversation_write_message(PURPLE_CONVERSATION(convo),
-				purple_message_new_outgoing(
-					conn->local_entry->nickname, im->message, 0));
+				pmsg);
+			g_object_unref(pmsg);
 			goto out;
 		}
 	}
@@ -1434,8 +1437,10 @@ silcpurple_send_im_resolved(SilcClient client,
 	/* Send the message */
 	silc_client_send_private_message(client, conn, client_entry, im->flags,
 					 sg->sha1hash, (unsigned char *)im->message, im->message_len);
-	purple_conversation_write_message(PURPLE_CONVERSATION(convo),
-		purple_message_new_outgoing(conn->local_entry->nickname, im->message, 0));
+	pmsg = purple_message_new_outgoing(conn->local_entry->nickname,
+		im->message, 0);
+	purple_conversation_write_message(PURPLE_CONVERSATION(convo), pmsg);
+	g_object_unref(pmsg);
 	goto out;
 
  err:
@@ -1684,14 +1689,16 @@ static PurpleCmdRet silcpurple_cmd_msg(PurpleConversation *conv,
 {
 	int ret;
 	PurpleConnection *gc;
+	PurpleMessage *msg;
 
 	gc = purple_conversation_get_connection(conv);
 
 	if (gc == NULL)
 		return PURPLE_CMD_RET_FAILED;
 
-	ret = silcpurple_send_im(gc,
-		purple_message_new_outgoing(args[0], args[1], 0));
+	msg = purple_message_new_outgoing(args[0], args[1], 0);
+	ret = silcpurple_send_im(gc, msg);
+	g_object_unref(msg);
 
 	if (ret)
 		return PURPLE_CMD_RET_OK;
@@ -1727,6 +1734,7 @@ static PurpleCmdRet silcpurple_cmd_query(PurpleConversation *conv,
 
 		ret = silcpurple_send_im(gc, msg);
 		purple_conversation_write_message(PURPLE_CONVERSATION(im), msg);
+		g_object_unref(msg);
 	}
 
 	if (ret)
@@ -35,6 +35,8 @@
  * To create a queued output stream, use #purple_queued_output_stream_new().
  *
  * To queue data, use #purple_queued_output_stream_push_bytes_async().
+ * Data queued while another write is in progress is merged into larger
+ * writes, see #purple_queued_output_stream_set_coalesce_size().
  *
  * If there's a fatal stream error, it's suggested to clear the remaining
  * bytes queued with #purple_queued_output_stream_clear_queue() to avoid
@@ -50,8 +52,21 @@ typedef struct
 {
 	GAsyncQueue *queue;
 	gboolean pending_queued;
+
+	/* tasks being written, in order */
+	GQueue batch;
+	/* the data of the batch, which is being written */
+	GBytes *batch_bytes;
+	gsize coalesce_size;
+
+	guint64 bytes_written;
+	guint64 writes_count;
 } PurpleQueuedOutputStreamPrivate;
 
+/* Queued buffers are merged into writes up to this size. It's the maximum
+ * TLS record size, so a burst of small stanzas ends up as a single record. */
+#define PURPLE_QUEUED_OUTPUT_STREAM_DEFAULT_COALESCE_SIZE 16384
+
 G_DEFINE_TYPE_WITH_PRIVATE(PurpleQueuedOutputStream,
 		purple_queued_output_stream, G_TYPE_FILTER_OUTPUT_STREAM)
 
@@ -59,76 +74,178 @@ G_DEFINE_TYPE_WITH_PRIVATE(PurpleQueuedOutputStream,
  * Helpers
  *****************************************************************************/
 
-static void purple_queued_output_stream_start_push_bytes_async(GTask *task);
+static void purple_queued_output_stream_start_push_bytes_async(
+		PurpleQueuedOutputStream *stream);
 
 static void
 purple_queued_output_stream_push_bytes_async_cb(GObject *source,
 		GAsyncResult *res, gpointer user_data)
 {
-	GTask *task = G_TASK(user_data);
-	PurpleQueuedOutputStream *stream = g_task_get_source_object(task);
+	PurpleQueuedOutputStream *stream = PURPLE_QUEUED_OUTPUT_STREAM(user_data);
 	PurpleQueuedOutputStreamPrivate *priv = purple_queued_output_stream_get_instance_private(stream);
+	GQueue finished = G_QUEUE_INIT;
+	GTask *task;
 	gssize written;
-	GBytes *bytes;
-	gsize size;
 	GError *error = NULL;
 
 	written = g_output_stream_write_bytes_finish(G_OUTPUT_STREAM(source),
 			res, &error);
 
-	bytes = g_task_get_task_data(task);
-	size = g_bytes_get_size(bytes);
-
 	if (written < 0) {
-		/* Error occurred, return error */
-		g_task_return_error(task, error);
-		g_clear_object(&task);
-	} else if (size > written) {
-		/* Partial write, prepare to send remaining data */
-		bytes = g_bytes_new_from_bytes(bytes, written, size - written);
-		g_task_set_task_data(task, bytes,
-				(GDestroyNotify)g_bytes_unref);
+		/* Error occurred, every task of the batch failed */
+		finished = priv->batch;
+		g_queue_init(&priv->batch);
+		g_clear_pointer(&priv->batch_bytes, g_bytes_unref);
 	} else {
-		/* Full write, this task is finished */
-		g_task_return_boolean(task, TRUE);
-		g_clear_object(&task);
+		gsize batch_size = g_bytes_get_size(priv->batch_bytes);
+
+		if ((gsize)written < batch_size) {
+			/* Partial write, the rest of the batch goes next */
+			GBytes *rest = g_bytes_new_from_bytes(priv->batch_bytes,
+					written, batch_size - written);
+			g_bytes_unref(priv->batch_bytes);
+			priv->batch_bytes = rest;
+		} else {
+			g_clear_pointer(&priv->batch_bytes, g_bytes_unref);
+		}
+
+		priv->bytes_written += written;
+		priv->writes_count++;
+
+		while ((task = g_queue_peek_head(&priv->batch)) != NULL) {
+			GBytes *bytes = g_task_get_task_data(task);
+			gsize size = g_bytes_get_size(bytes);
+
+			if ((gsize)written < size) {
+				/* Partially written task, keep track of the rest */
+				if (written > 0) {
+					bytes = g_bytes_new_from_bytes(bytes,
+							written, size - written);
+					g_task_set_task_data(task, bytes,
+							(GDestroyNotify)g_bytes_unref);
+				}
+				break;
+			}
+
+			/* Full write, this task is finished */
+			written -= size;
+			g_queue_push_tail(&finished, g_queue_pop_head(&priv->batch));
+		}
 	}
 
-	/* If g_task_return_* was called in this function, the callback
-	 * may have cleared the stream. If so, there will be no remaining
-	 * tasks to process here.
+	/* Keep the stream alive, the callbacks might drop the last reference
+	 * held outside of the tasks. */
+	g_object_ref(stream);
+
+	/* If g_task_return_* is called here, the callback may have cleared the
+	 * queue. If so, there will be no remaining tasks to process here.
 	 */
+	while ((task = g_queue_pop_head(&finished)) != NULL) {
+		if (error == NULL) {
+			g_task_return_boolean(task, TRUE);
+		} else if (g_queue_is_empty(&finished)) {
+			g_task_return_error(task, error);
+			error = NULL;
+		} else {
+			g_task_return_error(task, g_error_copy(error));
+		}
+		g_object_unref(task);
+	}
+
+	purple_queued_output_stream_start_push_bytes_async(stream);
+
+	g_object_unref(stream);
+}
 
-	if (task == NULL) {
-		/* Any queued data left? */
-		task = g_async_queue_try_pop(priv->queue);
+/* Takes the tasks to be written next (unless there is a partially written
+ * batch already), merging consecutive buffers up to the coalesce size. The
+ * tasks have to share the cancellable and priority, because they are written
+ * as a single request. */
+static GBytes *
+purple_queued_output_stream_fill_batch(PurpleQueuedOutputStream *stream)
+{
+	PurpleQueuedOutputStreamPrivate *priv = purple_queued_output_stream_get_instance_private(stream);
+	GTask *first, *task;
+	GByteArray *buffer;
+	GList *it;
+	gsize total;
+
+	if (priv->batch_bytes != NULL) {
+		/* finish the partially written batch first */
+		return g_bytes_ref(priv->batch_bytes);
 	}
 
-	if (task != NULL) {
-		/* More to process */
-		purple_queued_output_stream_start_push_bytes_async(task);
-	} else {
-		/* All done */
-		priv->pending_queued = FALSE;
-		g_output_stream_clear_pending(G_OUTPUT_STREAM(stream));
+	task = g_async_queue_try_pop(priv->queue);
+	if (task == NULL)
+		return NULL;
+	g_queue_push_tail(&priv->batch, task);
+	first = task;
+	total = g_bytes_get_size(g_task_get_task_data(first));
+
+	while (total < priv->coalesce_size &&
+			(task = g_async_queue_try_pop(priv->queue)) != NULL) {
+		gsize size = g_bytes_get_size(g_task_get_task_data(task));
+
+		if (total + size > priv->coalesce_size ||
+				g_task_get_cancellable(task) !=
+				g_task_get_cancellable(first) ||
+				g_task_get_priority(task) !=
+				g_task_get_priority(first)) {
+			g_async_queue_push_front(priv->queue, task);
+			break;
+		}
+
+		g_queue_push_tail(&priv->batch, task);
+		total += size;
+	}
+
+	if (priv->batch.length == 1) {
+		priv->batch_bytes = g_bytes_ref(g_task_get_task_data(first));
+		return g_bytes_ref(priv->batch_bytes);
 	}
+
+	buffer = g_byte_array_sized_new(total);
+	for (it = priv->batch.head; it != NULL; it = it->next) {
+		gconstpointer data;
+		gsize size;
+
+		data = g_bytes_get_data(g_task_get_task_data(it->data), &size);
+		g_byte_array_append(buffer, data, size);
+	}
+
+	priv->batch_bytes = g_byte_array_free_to_bytes(buffer);
+	return g_bytes_ref(priv->batch_bytes);
 }
 
 static void
-purple_queued_output_stream_start_push_bytes_async(GTask *task)
+purple_queued_output_stream_start_push_bytes_async(
+		PurpleQueuedOutputStream *stream)
 {
-	PurpleQueuedOutputStream *stream = g_task_get_source_object(task);
+	PurpleQueuedOutputStreamPrivate *priv = purple_queued_output_stream_get_instance_private(stream);
 	GOutputStream *base_stream;
+	GTask *first;
+	GBytes *bytes;
+
+	bytes = purple_queued_output_stream_fill_batch(stream);
+	if (bytes == NULL) {
+		/* All done */
+		priv->pending_queued = FALSE;
+		g_output_stream_clear_pending(G_OUTPUT_STREAM(stream));
+		return;
+	}
 
 	base_stream = g_filter_output_stream_get_base_stream(
 			G_FILTER_OUTPUT_STREAM(stream));
+	first = g_queue_peek_head(&priv->batch);
 
 	g_output_stream_write_bytes_async(base_stream,
-			g_task_get_task_data(task),
-			g_task_get_priority(task),
-			g_task_get_cancellable(task),
+			bytes,
+			g_task_get_priority(first),
+			g_task_get_cancellable(first),
 			purple_queued_output_stream_push_bytes_async_cb,
-			task);
+			stream);
+
+	g_bytes_unref(bytes);
 }
 
 /******************************************************************************
@@ -142,6 +259,7 @@ purple_queued_output_stream_dispose(GObject *object)
 	PurpleQueuedOutputStreamPrivate *priv = purple_queued_output_stream_get_instance_private(stream);
 
 	g_clear_pointer(&priv->queue, g_async_queue_unref);
+	g_clear_pointer(&priv->batch_bytes, g_bytes_unref);
 
 	G_OBJECT_CLASS(purple_queued_output_stream_parent_class)->dispose(object);
 }
@@ -158,8 +276,10 @@ static void
 purple_queued_output_stream_init(PurpleQueuedOutputStream *stream)
 {
 	PurpleQueuedOutputStreamPrivate *priv = purple_queued_output_stream_get_instance_private(stream);
-	priv->queue = g_async_queue_new_full((GDestroyNotify)g_bytes_unref);
+	priv->queue = g_async_queue_new_full((GDestroyNotify)g_object_unref);
 	priv->pending_queued = FALSE;
+	g_queue_init(&priv->batch);
+	priv->coalesce_size = PURPLE_QUEUED_OUTPUT_STREAM_DEFAULT_COALESCE_SIZE;
 }
 
 /******************************************************************************
@@ -219,13 +339,12 @@ purple_queued_output_stream_push_bytes_async(PurpleQueuedOutputStream *stream,
 	g_clear_error (&error);
 	priv->pending_queued = TRUE;
 
-	if (set_pending) {
-		/* Start processing if there were no pending operations */
-		purple_queued_output_stream_start_push_bytes_async(task);
-	} else {
-		/* Otherwise queue the data */
-		g_async_queue_push(priv->queue, task);
-	}
+	/* Queue the data and start processing if there were no pending
+	 * operations. Otherwise, it will be picked up when the current
+	 * write finishes. */
+	g_async_queue_push(priv->queue, task);
+	if (set_pending)
+		purple_queued_output_stream_start_push_bytes_async(stream);
 }
 
 gboolean
@@ -256,3 +375,48 @@ purple_queued_output_stream_clear_queue(PurpleQueuedOutputStream *stream)
 		g_object_unref(task);
 	}
 }
+
+void
+purple_queued_output_stream_set_coalesce_size(PurpleQueuedOutputStream *stream,
+		gsize size)
+{
+	PurpleQueuedOutputStreamPrivate *priv = NULL;
+
+	g_return_if_fail(PURPLE_IS_QUEUED_OUTPUT_STREAM(stream));
+
+	priv = purple_queued_output_stream_get_instance_private(stream);
+	priv->coalesce_size = size;
+}
+
+gsize
+purple_queued_output_stream_get_coalesce_size(PurpleQueuedOutputStream *stream)
+{
+	PurpleQueuedOutputStreamPrivate *priv = NULL;
+
+	g_return_val_if_fail(PURPLE_IS_QUEUED_OUTPUT_STREAM(stream), 0);
+
+	priv = purple_queued_output_stream_get_instance_private(stream);
+	return priv->coalesce_size;
+}
+
+guint64
+purple_queued_output_stream_get_bytes_written(PurpleQueuedOutputStream *stream)
+{
+	PurpleQueuedOutputStreamPrivate *priv = NULL;
+
+	g_return_val_if_fail(PURPLE_IS_QUEUED_OUTPUT_STREAM(stream), 0);
+
+	priv = purple_queued_output_stream_get_instance_private(stream);
+	return priv->bytes_written;
+}
+
+guint64
+purple_queued_output_stream_get_writes_count(PurpleQueuedOutputStream *stream)
+{
+	PurpleQueuedOutputStreamPrivate *priv = NULL;
+
+	g_return_val_if_fail(PURPLE_IS_QUEUED_OUTPUT_STREAM(stream), 0);
+
+	priv = purple_queued_output_stream_get_instance_private(stream);
+	return priv->writes_count;
+}
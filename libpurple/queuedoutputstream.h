@@ -104,6 +104,48 @@ gboolean purple_queued_output_stream_push_bytes_finish(
  */
 void purple_queued_output_stream_clear_queue(PurpleQueuedOutputStream *stream);
 
+/*
+ * purple_queued_output_stream_set_coalesce_size
+ * @stream: #PurpleQueuedOutputStream to configure
+ * @size: The maximum size of a single write
+ *
+ * Sets the size, up to which the queued buffers are merged into a single
+ * write to the base stream. Buffers are merged only if they were pushed
+ * with the same priority and #GCancellable. A buffer larger than @size is
+ * still written at once. Set it to 0 to write every buffer separately.
+ *
+ * The default is 16384 bytes (the maximum TLS record size).
+ */
+void purple_queued_output_stream_set_coalesce_size(
+		PurpleQueuedOutputStream *stream, gsize size);
+
+/*
+ * purple_queued_output_stream_get_coalesce_size
+ * @stream: #PurpleQueuedOutputStream to query
+ *
+ * Returns: The maximum size of merged writes.
+ */
+gsize purple_queued_output_stream_get_coalesce_size(
+		PurpleQueuedOutputStream *stream);
+
+/*
+ * purple_queued_output_stream_get_bytes_written
+ * @stream: #PurpleQueuedOutputStream to query
+ *
+ * Returns: The number of bytes written to the base stream so far.
+ */
+guint64 purple_queued_output_stream_get_bytes_written(
+		PurpleQueuedOutputStream *stream);
+
+/*
+ * purple_queued_output_stream_get_writes_count
+ * @stream: #PurpleQueuedOutputStream to query
+ *
+ * Returns: The number of successful writes issued to the base stream so far.
+ */
+guint64 purple_queued_output_stream_get_writes_count(
+		PurpleQueuedOutputStream *stream);
+
 G_END_DECLS
 
 #endif /* PURPLE_QUEUED_OUTPUT_STREAM_H */
@@ -544,6 +544,7 @@ void purple_serv_got_im(PurpleConnection *gc, const char *who, const char *msg,
 
 	pmsg = purple_message_new_incoming(name, message, flags, mtime);
 	purple_conversation_write_message(PURPLE_CONVERSATION(im), pmsg);
+	g_object_unref(pmsg);
 	g_free(message);
 
 	/*
@@ -617,6 +618,7 @@ void purple_serv_got_im(PurpleConnection *gc, const char *who, const char *msg,
 
 					purple_serv_send_im(gc, msg);
 					purple_conversation_write_message(PURPLE_CONVERSATION(im), msg);
+					g_object_unref(msg);
 				}
 			}
 		}
@@ -886,6 +888,7 @@ void purple_serv_got_chat_in(PurpleConnection *g, int id, const char *who,
 		purple_message_set_time(pmsg, mtime);
 	}
 	purple_conversation_write_message(PURPLE_CONVERSATION(chat), pmsg);
+	g_object_unref(pmsg);
 
 	g_free(angel);
 	g_free(buffy);
@@ -400,6 +400,28 @@ purple_signals_disconnect_by_handle(void *handle)
 						 (GHFunc)disconnect_handle_from_instance, handle);
 }
 
+gboolean
+purple_signal_has_handlers(void *instance, const char *signal)
+{
+	PurpleInstanceData *instance_data;
+	PurpleSignalData *signal_data;
+
+	g_return_val_if_fail(instance != NULL, FALSE);
+	g_return_val_if_fail(signal   != NULL, FALSE);
+
+	instance_data =
+		(PurpleInstanceData *)g_hash_table_lookup(instance_table, instance);
+
+	g_return_val_if_fail(instance_data != NULL, FALSE);
+
+	signal_data =
+		(PurpleSignalData *)g_hash_table_lookup(instance_data->signals, signal);
+
+	g_return_val_if_fail(signal_data != NULL, FALSE);
+
+	return (signal_data->handler_count > 0);
+}
+
 void
 purple_signal_emit(void *instance, const char *signal, ...)
 {
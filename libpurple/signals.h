@@ -243,6 +243,18 @@ void purple_signal_disconnect(void *instance, const char *signal,
  */
 void purple_signals_disconnect_by_handle(void *handle);
 
+/**
+ * purple_signal_has_handlers:
+ * @instance: The instance emitting the signal.
+ * @signal:   The name of the signal.
+ *
+ * Checks, if there are any callbacks connected to a signal. It may be used
+ * to avoid preparing data, which is only passed to the callbacks.
+ *
+ * Returns: %TRUE, if the signal has any handlers connected.
+ */
+gboolean purple_signal_has_handlers(void *instance, const char *signal);
+
 /**
  * purple_signal_emit:
  * @instance: The instance emitting the signal.
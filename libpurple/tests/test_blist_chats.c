@@ -0,0 +1,415 @@
+/*
+ * Purple
+ *
+ * Purple is the legal property of its developers, whose names are too
+ * numerous to list here. Please refer to the COPYRIGHT file distributed
+ * with this source distribution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#include <glib.h>
+
+#include <purple.h>
+
+#include "test_ui.h"
+
+/******************************************************************************
+ * A protocol that joins chats by a "room" component
+ *****************************************************************************/
+static GType test_blist_chats_protocol_get_type(void);
+
+typedef struct {
+	PurpleProtocol parent;
+} TestBlistChatsProtocol;
+
+typedef struct {
+	PurpleProtocolClass parent;
+} TestBlistChatsProtocolClass;
+
+static GList *
+test_blist_chats_protocol_info(PurpleConnection *gc)
+{
+	PurpleProtocolChatEntry *pce = g_new0(PurpleProtocolChatEntry, 1);
+
+	pce->label = "_Room:";
+	pce->identifier = "room";
+	pce->required = TRUE;
+
+	return g_list_append(NULL, pce);
+}
+
+static void
+test_blist_chats_protocol_chat_iface_init(PurpleProtocolChatInterface *iface) {
+	iface->info = test_blist_chats_protocol_info;
+}
+
+G_DEFINE_TYPE_WITH_CODE(
+	TestBlistChatsProtocol,
+	test_blist_chats_protocol,
+	PURPLE_TYPE_PROTOCOL,
+	G_IMPLEMENT_INTERFACE(
+		PURPLE_TYPE_PROTOCOL_CHAT,
+		test_blist_chats_protocol_chat_iface_init
+	)
+);
+
+static void
+test_blist_chats_protocol_login(PurpleAccount *account) {
+	purple_connection_set_state(purple_account_get_connection(account),
+		PURPLE_CONNECTION_CONNECTED);
+}
+
+static void
+test_blist_chats_protocol_close(PurpleConnection *gc) {
+}
+
+static GList *
+test_blist_chats_protocol_status_types(PurpleAccount *account) {
+	return NULL;
+}
+
+static const char *
+test_blist_chats_protocol_list_icon(PurpleAccount *account,
+                                    PurpleBuddy *buddy)
+{
+	return "chats";
+}
+
+static void
+test_blist_chats_protocol_init(TestBlistChatsProtocol *protocol) {
+	PurpleProtocol *prpl = PURPLE_PROTOCOL(protocol);
+
+	prpl->id = "prpl-blist-chats";
+	prpl->name = "Buddy List Chats";
+}
+
+static void
+test_blist_chats_protocol_class_init(TestBlistChatsProtocolClass *klass) {
+	PurpleProtocolClass *protocol_class = PURPLE_PROTOCOL_CLASS(klass);
+
+	protocol_class->login = test_blist_chats_protocol_login;
+	protocol_class->close = test_blist_chats_protocol_close;
+	protocol_class->status_types = test_blist_chats_protocol_status_types;
+	protocol_class->list_icon = test_blist_chats_protocol_list_icon;
+}
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static PurpleAccount *
+test_blist_chats_account_new(const gchar *username)
+{
+	PurpleAccount *account = purple_account_new(username, "prpl-blist-chats");
+
+	/* not remembered, so connecting doesn't wait on a keyring */
+	purple_account_set_password(account, "secret", NULL, NULL);
+	purple_account_set_enabled(account, purple_core_get_ui(), TRUE);
+	purple_account_connect(account);
+	g_assert_true(purple_account_is_connected(account));
+
+	return account;
+}
+
+static void
+test_blist_chats_account_free(PurpleAccount *account)
+{
+	purple_account_disconnect(account);
+	g_object_unref(account);
+}
+
+static PurpleChat *
+test_blist_chats_add(PurpleAccount *account, const gchar *room)
+{
+	GHashTable *components;
+	PurpleChat *chat;
+
+	components = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+		g_free);
+	g_hash_table_insert(components, g_strdup("room"), g_strdup(room));
+
+	chat = purple_chat_new(account, room, components);
+	purple_blist_add_chat(chat, NULL, NULL);
+
+	return chat;
+}
+
+static gchar *
+test_blist_chats_room(guint i)
+{
+	return g_strdup_printf("room%u", i);
+}
+
+/******************************************************************************
+ * Buddy list tests
+ *****************************************************************************/
+static void
+test_blist_chats_find(void) {
+	PurpleAccount *account = test_blist_chats_account_new("find");
+	PurpleChat *chats[16];
+	PurpleChat *first, *second;
+	gchar *room;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(chats); i++) {
+		room = test_blist_chats_room(i);
+		chats[i] = test_blist_chats_add(account, room);
+		g_free(room);
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(chats); i++) {
+		room = test_blist_chats_room(i);
+		g_assert_true(purple_blist_find_chat(account, room) == chats[i]);
+		g_free(room);
+	}
+	g_assert_null(purple_blist_find_chat(account, "nowhere"));
+
+	/* chats are added at the front, so the last one added comes first */
+	first = test_blist_chats_add(account, "twice");
+	second = test_blist_chats_add(account, "twice");
+	g_assert_true(purple_blist_find_chat(account, "twice") == second);
+	purple_blist_remove_chat(second);
+	g_assert_true(purple_blist_find_chat(account, "twice") == first);
+	purple_blist_remove_chat(first);
+
+	for (i = 0; i < G_N_ELEMENTS(chats); i++)
+		purple_blist_remove_chat(chats[i]);
+
+	test_blist_chats_account_free(account);
+}
+
+static void
+test_blist_chats_accounts(void) {
+	PurpleAccount *alice = test_blist_chats_account_new("alice");
+	PurpleAccount *bob = test_blist_chats_account_new("bob");
+	PurpleChat *chat;
+
+	chat = test_blist_chats_add(alice, "lobby");
+	g_assert_true(purple_blist_find_chat(alice, "lobby") == chat);
+	g_assert_null(purple_blist_find_chat(bob, "lobby"));
+
+	/* nor after bob's index was built before alice's add */
+	g_assert_null(purple_blist_find_chat(bob, "kitchen"));
+	test_blist_chats_add(alice, "kitchen");
+	g_assert_null(purple_blist_find_chat(bob, "kitchen"));
+
+	purple_blist_remove_chat(purple_blist_find_chat(alice, "kitchen"));
+	purple_blist_remove_chat(chat);
+
+	/* a disconnected account never finds anything */
+	chat = test_blist_chats_add(bob, "lobby");
+	g_assert_true(purple_blist_find_chat(bob, "lobby") == chat);
+	purple_account_disconnect(bob);
+	g_assert_null(purple_blist_find_chat(bob, "lobby"));
+	purple_account_connect(bob);
+	g_assert_true(purple_blist_find_chat(bob, "lobby") == chat);
+	purple_blist_remove_chat(chat);
+
+	test_blist_chats_account_free(alice);
+	test_blist_chats_account_free(bob);
+}
+
+static void
+test_blist_chats_invalidate(void) {
+	PurpleAccount *account = test_blist_chats_account_new("invalidate");
+	PurpleBlistNode *node;
+	PurpleChat *chat;
+
+	/* a lookup builds the index, the add has to throw it away */
+	g_assert_null(purple_blist_find_chat(account, "lobby"));
+	chat = test_blist_chats_add(account, "lobby");
+	g_assert_true(purple_blist_find_chat(account, "lobby") == chat);
+
+	/* so does changing the components of a chat */
+	node = PURPLE_BLIST_NODE(chat);
+	g_hash_table_replace(purple_chat_get_components(chat), g_strdup("room"),
+		g_strdup("hall"));
+	purple_blist_save_node(purple_blist_get_default(), node);
+	g_assert_null(purple_blist_find_chat(account, "lobby"));
+	g_assert_true(purple_blist_find_chat(account, "hall") == chat);
+
+	/* and removing it */
+	purple_blist_remove_chat(chat);
+	g_assert_null(purple_blist_find_chat(account, "hall"));
+
+	/* the index is rebuilt for the new connection */
+	chat = test_blist_chats_add(account, "lobby");
+	g_assert_true(purple_blist_find_chat(account, "lobby") == chat);
+	purple_account_disconnect(account);
+	purple_account_connect(account);
+	g_assert_true(purple_blist_find_chat(account, "lobby") == chat);
+	purple_blist_remove_chat(chat);
+
+	test_blist_chats_account_free(account);
+}
+
+/******************************************************************************
+ * Conversation tests
+ *****************************************************************************/
+static void
+test_blist_chats_conversation_id(void) {
+	PurpleAccount *account = test_blist_chats_account_new("conversation-id");
+	PurpleConnection *gc = purple_account_get_connection(account);
+	PurpleChatConversation *lobby, *hall;
+
+	lobby = purple_serv_got_joined_chat(gc, 1, "lobby");
+	hall = purple_serv_got_joined_chat(gc, 2, "hall");
+	g_assert_nonnull(lobby);
+	g_assert_nonnull(hall);
+
+	g_assert_true(purple_conversations_find_chat(gc, 1) == lobby);
+	g_assert_true(purple_conversations_find_chat(gc, 2) == hall);
+	g_assert_null(purple_conversations_find_chat(gc, 3));
+
+	/* the index follows a change of the id */
+	purple_chat_conversation_set_id(lobby, 3);
+	g_assert_null(purple_conversations_find_chat(gc, 1));
+	g_assert_true(purple_conversations_find_chat(gc, 3) == lobby);
+
+	/* two chats may share an id for a moment */
+	purple_chat_conversation_set_id(hall, 3);
+	g_assert_null(purple_conversations_find_chat(gc, 2));
+	g_assert_nonnull(purple_conversations_find_chat(gc, 3));
+
+	g_object_unref(lobby);
+	g_assert_true(purple_conversations_find_chat(gc, 3) == hall);
+
+	g_object_unref(hall);
+	g_assert_null(purple_conversations_find_chat(gc, 3));
+
+	test_blist_chats_account_free(account);
+}
+
+static void
+test_blist_chats_conversation_connections(void) {
+	PurpleAccount *alice = test_blist_chats_account_new("alice");
+	PurpleAccount *bob = test_blist_chats_account_new("bob");
+	PurpleConnection *alice_gc = purple_account_get_connection(alice);
+	PurpleConnection *bob_gc = purple_account_get_connection(bob);
+	PurpleChatConversation *alice_chat, *bob_chat;
+
+	/* ids are only unique per connection */
+	alice_chat = purple_serv_got_joined_chat(alice_gc, 7, "lobby");
+	bob_chat = purple_serv_got_joined_chat(bob_gc, 7, "lobby");
+
+	g_assert_true(purple_conversations_find_chat(alice_gc, 7) == alice_chat);
+	g_assert_true(purple_conversations_find_chat(bob_gc, 7) == bob_chat);
+
+	g_object_unref(alice_chat);
+	g_assert_null(purple_conversations_find_chat(alice_gc, 7));
+	g_assert_true(purple_conversations_find_chat(bob_gc, 7) == bob_chat);
+
+	g_object_unref(bob_chat);
+	g_assert_null(purple_conversations_find_chat(bob_gc, 7));
+
+	test_blist_chats_account_free(alice);
+	test_blist_chats_account_free(bob);
+}
+
+/******************************************************************************
+ * Benchmark
+ *****************************************************************************/
+static void
+test_blist_chats_perf(void) {
+	PurpleAccount *account = test_blist_chats_account_new("perf");
+	PurpleConnection *gc = purple_account_get_connection(account);
+	PurpleChat **chats;
+	PurpleChatConversation **convs;
+	GTimer *timer;
+	gchar **rooms;
+	gdouble build, warm, ids;
+	guint count = g_test_perf() ? 5000 : 200;
+	guint iterations = g_test_perf() ? 20 : 2;
+	guint i, j;
+
+	rooms = g_new0(gchar *, count + 1);
+	chats = g_new0(PurpleChat *, count);
+	convs = g_new0(PurpleChatConversation *, count);
+	for (i = 0; i < count; i++) {
+		rooms[i] = test_blist_chats_room(i);
+		chats[i] = test_blist_chats_add(account, rooms[i]);
+	}
+
+	/* the first lookup after a change pays for the index */
+	timer = g_timer_new();
+	g_assert_true(purple_blist_find_chat(account, rooms[0]) == chats[0]);
+	build = g_timer_elapsed(timer, NULL);
+
+	g_timer_start(timer);
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < count; j++)
+			g_assert_true(purple_blist_find_chat(account, rooms[j]) ==
+				chats[j]);
+	}
+	warm = g_timer_elapsed(timer, NULL);
+
+	for (i = 0; i < count; i++)
+		convs[i] = purple_serv_got_joined_chat(gc, i, rooms[i]);
+
+	g_timer_start(timer);
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < count; j++)
+			g_assert_true(purple_conversations_find_chat(gc, j) ==
+				convs[j]);
+	}
+	ids = g_timer_elapsed(timer, NULL);
+
+	g_test_message("%u chats: %f s to index, %u lookups in %f s by name "
+		"and %f s by id", count, build, count * iterations, warm, ids);
+	if (g_test_perf()) {
+		g_test_minimized_result(build, "chat index build time");
+		g_test_minimized_result(warm, "chat lookup time by name");
+		g_test_minimized_result(ids, "chat lookup time by id");
+	}
+
+	for (i = 0; i < count; i++) {
+		g_object_unref(convs[i]);
+		purple_blist_remove_chat(chats[i]);
+	}
+
+	g_timer_destroy(timer);
+	g_free(convs);
+	g_free(chats);
+	g_strfreev(rooms);
+	test_blist_chats_account_free(account);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	gint res = 0;
+
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	g_assert_nonnull(purple_protocols_add(
+		test_blist_chats_protocol_get_type(), NULL));
+
+	g_test_add_func("/blist-chats/find", test_blist_chats_find);
+	g_test_add_func("/blist-chats/accounts", test_blist_chats_accounts);
+	g_test_add_func("/blist-chats/invalidate", test_blist_chats_invalidate);
+	g_test_add_func("/blist-chats/conversation-id",
+		test_blist_chats_conversation_id);
+	g_test_add_func("/blist-chats/conversation-connections",
+		test_blist_chats_conversation_connections);
+	g_test_add_func("/blist-chats/perf", test_blist_chats_perf);
+
+	res = g_test_run();
+
+	return res;
+}
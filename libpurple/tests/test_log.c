@@ -0,0 +1,510 @@
+/*
+ * Purple
+ *
+ * Purple is the legal property of its developers, whose names are too
+ * numerous to list here. Please refer to the COPYRIGHT file distributed
+ * with this source distribution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <utime.h>
+
+#include <purple.h>
+
+#include "test_ui.h"
+
+#define TEST_LOG_FOOTER "</body></html>\n"
+
+/******************************************************************************
+ * A protocol, so that logs have a directory to go to
+ *****************************************************************************/
+static GType test_log_protocol_get_type(void);
+
+typedef struct {
+	PurpleProtocol parent;
+} TestLogProtocol;
+
+typedef struct {
+	PurpleProtocolClass parent;
+} TestLogProtocolClass;
+
+G_DEFINE_TYPE(TestLogProtocol, test_log_protocol, PURPLE_TYPE_PROTOCOL);
+
+static void
+test_log_protocol_login(PurpleAccount *account) {
+}
+
+static void
+test_log_protocol_close(PurpleConnection *gc) {
+}
+
+static GList *
+test_log_protocol_status_types(PurpleAccount *account) {
+	return NULL;
+}
+
+static const char *
+test_log_protocol_list_icon(PurpleAccount *account, PurpleBuddy *buddy) {
+	return "logmeta";
+}
+
+static void
+test_log_protocol_init(TestLogProtocol *protocol) {
+	PurpleProtocol *prpl = PURPLE_PROTOCOL(protocol);
+
+	prpl->id = "prpl-log-meta";
+	prpl->name = "Log Metadata";
+}
+
+static void
+test_log_protocol_class_init(TestLogProtocolClass *klass) {
+	PurpleProtocolClass *protocol_class = PURPLE_PROTOCOL_CLASS(klass);
+
+	protocol_class->login = test_log_protocol_login;
+	protocol_class->close = test_log_protocol_close;
+	protocol_class->status_types = test_log_protocol_status_types;
+	protocol_class->list_icon = test_log_protocol_list_icon;
+}
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+/* An html log that writes to path, without going through the log directory */
+static PurpleLog *
+test_log_new_html(PurpleAccount *account, const gchar *path)
+{
+	PurpleLogCommonLoggerData *data;
+	GDateTime *start = g_date_time_new_now_local();
+	PurpleLog *log;
+
+	purple_prefs_set_string("/purple/logging/format", "html");
+
+	log = purple_log_new(PURPLE_LOG_IM, "bob", account, NULL, start);
+	log->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
+	data->path = g_strdup(path);
+	data->file = g_fopen(path, "a");
+	g_assert_nonnull(data->file);
+
+	g_date_time_unref(start);
+
+	return log;
+}
+
+static void
+test_log_write(PurpleLog *log, const gchar *message)
+{
+	GDateTime *now = g_date_time_new_now_local();
+
+	purple_log_write(log, PURPLE_MESSAGE_SEND, "me", now, message);
+
+	g_date_time_unref(now);
+}
+
+/* Waits for the writer thread to get the whole footer out */
+static gchar *
+test_log_wait_for_footer(const gchar *path)
+{
+	gint64 deadline = g_get_monotonic_time() + 10 * G_TIME_SPAN_SECOND;
+	gchar *contents = NULL;
+
+	for (;;) {
+		g_assert_true(g_file_get_contents(path, &contents, NULL, NULL));
+		if (g_str_has_suffix(contents, TEST_LOG_FOOTER))
+			return contents;
+
+		g_assert_cmpint(g_get_monotonic_time(), <, deadline);
+		g_free(contents);
+		g_usleep(10 * 1000);
+	}
+}
+
+static void
+test_log_assert_order(const gchar *contents)
+{
+	const gchar *first = strstr(contents, "first</");
+	const gchar *second = strstr(contents, "second</");
+
+	g_assert_nonnull(first);
+	g_assert_nonnull(second);
+	g_assert_true(first < second);
+}
+
+static void
+test_log_remove_tree(const gchar *path)
+{
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const gchar *name;
+
+	while (dir != NULL && (name = g_dir_read_name(dir)) != NULL) {
+		gchar *child = g_build_filename(path, name, NULL);
+
+		if (g_file_test(child, G_FILE_TEST_IS_DIR))
+			test_log_remove_tree(child);
+		else
+			g_unlink(child);
+		g_free(child);
+	}
+
+	if (dir != NULL)
+		g_dir_close(dir);
+	g_rmdir(path);
+}
+
+/* Removes the logs and the cached metadata of an account */
+static void
+test_log_meta_cleanup(PurpleAccount *account)
+{
+	gchar *path, *filename;
+
+	path = g_build_filename(purple_data_dir(), "logs", "logmeta",
+		purple_account_get_username(account), NULL);
+	test_log_remove_tree(path);
+	g_free(path);
+
+	filename = g_strconcat(purple_account_get_username(account), ".bin",
+		NULL);
+	path = g_build_filename(purple_cache_dir(), "log-metadata", "logmeta",
+		filename, NULL);
+	g_unlink(path);
+	g_free(path);
+	g_free(filename);
+
+	g_object_unref(account);
+}
+
+static gchar *
+test_log_meta_add(const gchar *dir, const gchar *filename,
+                  const gchar *contents)
+{
+	gchar *path = g_build_filename(dir, filename, NULL);
+
+	g_assert_cmpint(g_mkdir_with_parents(dir, 0700), ==, 0);
+	g_assert_true(g_file_set_contents(path, contents, -1, NULL));
+
+	return path;
+}
+
+static void
+test_log_meta_set_mtime(const gchar *path, time_t mtime)
+{
+	struct utimbuf times;
+
+	times.actime = mtime;
+	times.modtime = mtime;
+	g_assert_cmpint(g_utime(path, &times), ==, 0);
+}
+
+static guint
+test_log_meta_count(PurpleAccount *account, const gchar *name)
+{
+	GList *logs;
+	guint count;
+
+	logs = purple_log_common_lister(PURPLE_LOG_IM, name, account, ".html",
+		purple_log_logger_get());
+	count = g_list_length(logs);
+	g_list_free_full(logs, (GDestroyNotify)purple_log_free);
+
+	return count;
+}
+
+static gint
+test_log_meta_size(PurpleAccount *account, const gchar *name)
+{
+	return purple_log_common_total_sizer(PURPLE_LOG_IM, name, account,
+		".html");
+}
+
+/******************************************************************************
+ * Writer tests
+ *****************************************************************************/
+static void
+test_log_writer_order(void) {
+	PurpleAccount *account = purple_account_new("me", "prpl-log-test");
+	PurpleLog *log;
+	gchar *dir, *path, *contents;
+
+	dir = g_dir_make_tmp("purple-log-XXXXXX", NULL);
+	g_assert_nonnull(dir);
+	path = g_build_filename(dir, "log.html", NULL);
+
+	log = test_log_new_html(account, path);
+	test_log_write(log, "first");
+	test_log_write(log, "second");
+	purple_log_free(log);
+
+	/* the footer is queued with the close, so it comes out last */
+	contents = test_log_wait_for_footer(path);
+	test_log_assert_order(contents);
+	g_assert_true(strstr(contents, TEST_LOG_FOOTER) >
+		strstr(contents, "second</"));
+
+	g_free(contents);
+	g_unlink(path);
+	g_rmdir(dir);
+	g_free(path);
+	g_free(dir);
+	g_object_unref(account);
+}
+
+static void
+test_log_writer_stop_drains(void) {
+	PurpleAccount *account = purple_account_new("me", "prpl-log-test");
+	PurpleLogCommonLoggerData *data;
+	PurpleLog *log;
+	gchar *dir, *path, *contents;
+
+	dir = g_dir_make_tmp("purple-log-XXXXXX", NULL);
+	g_assert_nonnull(dir);
+	path = g_build_filename(dir, "log.html", NULL);
+
+	/* nothing would be flushed for an hour */
+	purple_prefs_set_int("/purple/logging/flush_interval", 3600 * 1000);
+	purple_prefs_set_int("/purple/logging/flush_size", G_MAXINT);
+
+	log = test_log_new_html(account, path);
+	test_log_write(log, "first");
+	test_log_write(log, "second");
+
+	/* stopping the writer has to get everything queued onto the disk */
+	purple_log_uninit();
+
+	g_assert_true(g_file_get_contents(path, &contents, NULL, NULL));
+	test_log_assert_order(contents);
+	g_free(contents);
+
+	/* the logger went away with purple_log_uninit() */
+	data = log->logger_data;
+	fclose(data->file);
+	g_free(data->path);
+	g_slice_free(PurpleLogCommonLoggerData, data);
+	log->logger = NULL;
+	purple_log_free(log);
+
+	purple_log_init();
+	purple_prefs_set_int("/purple/logging/flush_interval", 1000);
+	purple_prefs_set_int("/purple/logging/flush_size", 65536);
+
+	g_unlink(path);
+	g_rmdir(dir);
+	g_free(path);
+	g_free(dir);
+	g_object_unref(account);
+}
+
+/******************************************************************************
+ * Metadata tests
+ *****************************************************************************/
+#define TEST_LOG_META_FIRST  "2020-01-01.120000+0000UTC.html"
+#define TEST_LOG_META_SECOND "2020-01-02.120000+0000UTC.html"
+
+static void
+test_log_meta_mtime(void) {
+	PurpleAccount *account = purple_account_new("mtime", "prpl-log-meta");
+	gchar *dir, *first, *second;
+	time_t old = time(NULL) - 3600;
+
+	purple_prefs_set_string("/purple/logging/format", "html");
+	dir = purple_log_get_log_dir(PURPLE_LOG_IM, "bob", account);
+
+	first = test_log_meta_add(dir, TEST_LOG_META_FIRST, "0123456789");
+	test_log_meta_set_mtime(dir, old);
+	g_assert_cmpuint(test_log_meta_count(account, "bob"), ==, 1);
+	g_assert_cmpint(test_log_meta_size(account, "bob"), ==, 10);
+
+	/* a file added behind our back goes unnoticed while the mtime stays */
+	second = test_log_meta_add(dir, TEST_LOG_META_SECOND, "01234");
+	test_log_meta_set_mtime(dir, old);
+	g_assert_cmpuint(test_log_meta_count(account, "bob"), ==, 1);
+	g_assert_cmpint(test_log_meta_size(account, "bob"), ==, 10);
+
+	/* a new mtime has the directory read again */
+	test_log_meta_set_mtime(dir, old + 60);
+	g_assert_cmpuint(test_log_meta_count(account, "bob"), ==, 2);
+	g_assert_cmpint(test_log_meta_size(account, "bob"), ==, 15);
+
+	g_free(first);
+	g_free(second);
+	g_free(dir);
+	test_log_meta_cleanup(account);
+}
+
+static void
+test_log_meta_recent(void) {
+	PurpleAccount *account = purple_account_new("recent", "prpl-log-meta");
+	gchar *dir, *first, *second;
+	time_t now;
+
+	purple_prefs_set_string("/purple/logging/format", "html");
+	dir = purple_log_get_log_dir(PURPLE_LOG_IM, "bob", account);
+
+	first = test_log_meta_add(dir, TEST_LOG_META_FIRST, "0123456789");
+	now = time(NULL);
+	test_log_meta_set_mtime(dir, now);
+	g_assert_cmpuint(test_log_meta_count(account, "bob"), ==, 1);
+
+	/* another change within the same second doesn't change the mtime, so
+	 * a directory that changed just now is never trusted */
+	second = test_log_meta_add(dir, TEST_LOG_META_SECOND, "01234");
+	test_log_meta_set_mtime(dir, now);
+	g_assert_cmpuint(test_log_meta_count(account, "bob"), ==, 2);
+	g_assert_cmpint(test_log_meta_size(account, "bob"), ==, 15);
+
+	g_free(first);
+	g_free(second);
+	g_free(dir);
+	test_log_meta_cleanup(account);
+}
+
+static void
+test_log_meta_write(void) {
+	PurpleAccount *account = purple_account_new("write", "prpl-log-meta");
+	PurpleLogCommonLoggerData *data;
+	PurpleLog *log;
+	GDateTime *start;
+	GList *logs;
+	gchar *path, *contents;
+	gsize length;
+
+	purple_prefs_set_string("/purple/logging/format", "html");
+	g_assert_cmpuint(test_log_meta_count(account, "carol"), ==, 0);
+
+	/* the log's directory doesn't exist until the first write */
+	start = g_date_time_new_now_local();
+	log = purple_log_new(PURPLE_LOG_IM, "carol", account, NULL, start);
+	g_date_time_unref(start);
+
+	test_log_write(log, "first");
+	test_log_write(log, "second");
+	g_assert_cmpint(purple_log_get_message_count(log), ==, 2);
+
+	data = log->logger_data;
+	path = g_strdup(data->path);
+	purple_log_free(log);
+
+	/* the sizes written agree with the disk once it's all there */
+	contents = test_log_wait_for_footer(path);
+	length = strlen(contents);
+	g_free(contents);
+
+	logs = purple_log_common_lister(PURPLE_LOG_IM, "carol", account, ".html",
+		purple_log_logger_get());
+	g_assert_cmpuint(g_list_length(logs), ==, 1);
+	g_assert_cmpint(purple_log_get_message_count(logs->data), ==, 2);
+	g_assert_cmpint(test_log_meta_size(account, "carol"), ==, length);
+
+	/* deleting it takes it out of the metadata */
+	g_assert_true(purple_log_delete(logs->data));
+	g_list_free_full(logs, (GDestroyNotify)purple_log_free);
+	g_assert_false(g_file_test(path, G_FILE_TEST_EXISTS));
+	g_assert_cmpuint(test_log_meta_count(account, "carol"), ==, 0);
+	g_assert_cmpint(test_log_meta_size(account, "carol"), ==, 0);
+
+	g_free(path);
+	test_log_meta_cleanup(account);
+}
+
+static void
+test_log_meta_unknown_count(void) {
+	PurpleAccount *account = purple_account_new("unknown", "prpl-log-meta");
+	GList *logs;
+	gchar *dir, *first;
+
+	purple_prefs_set_string("/purple/logging/format", "html");
+	dir = purple_log_get_log_dir(PURPLE_LOG_IM, "bob", account);
+
+	/* counting the messages of a log we didn't write means reading it */
+	first = test_log_meta_add(dir, TEST_LOG_META_FIRST, "0123456789");
+	logs = purple_log_common_lister(PURPLE_LOG_IM, "bob", account, ".html",
+		purple_log_logger_get());
+	g_assert_cmpuint(g_list_length(logs), ==, 1);
+	g_assert_cmpint(purple_log_get_message_count(logs->data), ==, -1);
+	g_list_free_full(logs, (GDestroyNotify)purple_log_free);
+
+	g_free(first);
+	g_free(dir);
+	test_log_meta_cleanup(account);
+}
+
+static void
+test_log_meta_damaged(void) {
+	PurpleAccount *account = purple_account_new("damaged", "prpl-log-meta");
+	gchar *dir, *first, *second, *cache;
+	time_t old = time(NULL) - 3600;
+
+	purple_prefs_set_string("/purple/logging/format", "html");
+	dir = purple_log_get_log_dir(PURPLE_LOG_IM, "bob", account);
+	cache = g_build_filename(purple_cache_dir(), "log-metadata", "logmeta",
+		"damaged.bin", NULL);
+
+	first = test_log_meta_add(dir, TEST_LOG_META_FIRST, "0123456789");
+	test_log_meta_set_mtime(dir, old);
+	g_assert_cmpuint(test_log_meta_count(account, "bob"), ==, 1);
+
+	/* the metadata is kept between sessions */
+	purple_log_uninit();
+	g_assert_true(g_file_test(cache, G_FILE_TEST_EXISTS));
+	purple_log_init();
+
+	second = test_log_meta_add(dir, TEST_LOG_META_SECOND, "01234");
+	test_log_meta_set_mtime(dir, old);
+	g_assert_cmpuint(test_log_meta_count(account, "bob"), ==, 1);
+
+	/* a damaged cache is thrown away and the directory read again */
+	purple_log_uninit();
+	g_assert_true(g_file_set_contents(cache, "PURPLELM\1\0", 10, NULL));
+	purple_log_init();
+
+	g_assert_cmpuint(test_log_meta_count(account, "bob"), ==, 2);
+	g_assert_cmpint(test_log_meta_size(account, "bob"), ==, 15);
+
+	g_free(first);
+	g_free(second);
+	g_free(cache);
+	g_free(dir);
+	test_log_meta_cleanup(account);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	gint res = 0;
+
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	g_assert_nonnull(purple_protocols_add(test_log_protocol_get_type(),
+		NULL));
+
+	g_test_add_func("/log/writer/order", test_log_writer_order);
+	g_test_add_func("/log/writer/stop-drains", test_log_writer_stop_drains);
+
+	g_test_add_func("/log/meta/mtime", test_log_meta_mtime);
+	g_test_add_func("/log/meta/recent", test_log_meta_recent);
+	g_test_add_func("/log/meta/write", test_log_meta_write);
+	g_test_add_func("/log/meta/unknown-count", test_log_meta_unknown_count);
+	g_test_add_func("/log/meta/damaged", test_log_meta_damaged);
+
+	res = g_test_run();
+
+	return res;
+}
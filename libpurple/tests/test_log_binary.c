@@ -0,0 +1,733 @@
+/*
+ * Purple
+ *
+ * Purple is the legal property of its developers, whose names are too
+ * numerous to list here. Please refer to the COPYRIGHT file distributed
+ * with this source distribution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include <purple.h>
+
+#include "test_ui.h"
+
+#define TEST_LOG_BINARY_TRAILER_SIZE 16
+/* the largest block log.c compresses */
+#define TEST_LOG_BINARY_MAX_RAW      (16 * 1024 * 1024)
+
+/******************************************************************************
+ * A protocol, so binary logs can be written where they belong
+ *****************************************************************************/
+static GType test_log_binary_protocol_get_type(void);
+
+typedef struct {
+	PurpleProtocol parent;
+} TestLogBinaryProtocol;
+
+typedef struct {
+	PurpleProtocolClass parent;
+} TestLogBinaryProtocolClass;
+
+G_DEFINE_TYPE(TestLogBinaryProtocol, test_log_binary_protocol,
+              PURPLE_TYPE_PROTOCOL);
+
+static void
+test_log_binary_protocol_login(PurpleAccount *account) {
+}
+
+static void
+test_log_binary_protocol_close(PurpleConnection *gc) {
+}
+
+static GList *
+test_log_binary_protocol_status_types(PurpleAccount *account) {
+	return NULL;
+}
+
+static const char *
+test_log_binary_protocol_list_icon(PurpleAccount *account, PurpleBuddy *buddy) {
+	return "logbinary";
+}
+
+static void
+test_log_binary_protocol_init(TestLogBinaryProtocol *protocol) {
+	PurpleProtocol *prpl = PURPLE_PROTOCOL(protocol);
+
+	prpl->id = "prpl-log-binary";
+	prpl->name = "Log Binary";
+}
+
+static void
+test_log_binary_protocol_class_init(TestLogBinaryProtocolClass *klass) {
+	PurpleProtocolClass *protocol_class = PURPLE_PROTOCOL_CLASS(klass);
+
+	protocol_class->login = test_log_binary_protocol_login;
+	protocol_class->close = test_log_binary_protocol_close;
+	protocol_class->status_types = test_log_binary_protocol_status_types;
+	protocol_class->list_icon = test_log_binary_protocol_list_icon;
+}
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static PurpleLog *
+test_log_binary_new_log(PurpleAccount *account, const gchar *format,
+                        const gchar *path, GDateTime *start)
+{
+	PurpleLogCommonLoggerData *data;
+	PurpleLog *log;
+
+	purple_prefs_set_string("/purple/logging/format", format);
+
+	log = purple_log_new(PURPLE_LOG_IM, "bob", account, NULL, start);
+	log->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
+	data->path = g_strdup(path);
+
+	return log;
+}
+
+/* Converts the html or txt log text and removes both files again */
+static PurpleLog *
+test_log_binary_convert(PurpleAccount *account, const gchar *format,
+                        const gchar *text, GDateTime *start, gchar **dir)
+{
+	PurpleLog *log, *converted;
+	gchar *filename, *path;
+
+	*dir = g_dir_make_tmp("purple-log-binary-XXXXXX", NULL);
+	g_assert_nonnull(*dir);
+
+	filename = g_strconcat("log.", format, NULL);
+	path = g_build_filename(*dir, filename, NULL);
+	g_assert_true(g_file_set_contents(path, text, -1, NULL));
+
+	log = test_log_binary_new_log(account, format, path, start);
+	converted = purple_log_binary_convert(log);
+	g_assert_nonnull(converted);
+
+	/* the original stays, and isn't converted twice */
+	g_assert_true(g_file_test(path, G_FILE_TEST_EXISTS));
+	g_assert_null(purple_log_binary_convert(log));
+
+	purple_log_free(log);
+	g_unlink(path);
+	g_free(path);
+	g_free(filename);
+
+	return converted;
+}
+
+static void
+test_log_binary_remove(PurpleLog *log, gchar *dir)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+
+	g_unlink(data->path);
+	g_rmdir(dir);
+	g_free(dir);
+	purple_log_free(log);
+}
+
+static gint64
+test_log_binary_time(gint day, gint hour, gint minute, gint second)
+{
+	GDateTime *dt = g_date_time_new_local(2020, 1, day, hour, minute, second);
+	gint64 ret = g_date_time_to_unix(dt);
+
+	g_date_time_unref(dt);
+
+	return ret;
+}
+
+/* Writes messages to a new binary log through the logger, returns its path */
+static gchar *
+test_log_binary_write(PurpleAccount *account, GDateTime *start,
+                      const gchar **messages)
+{
+	PurpleLogCommonLoggerData *data;
+	PurpleLog *log;
+	gchar *path;
+	gint i;
+
+	purple_prefs_set_string("/purple/logging/format", "binary");
+
+	log = purple_log_new(PURPLE_LOG_IM, "bob", account, NULL, start);
+	for (i = 0; messages[i] != NULL; i++) {
+		GDateTime *when = g_date_time_add_seconds(start, i);
+
+		purple_log_write(log, PURPLE_MESSAGE_SEND, "me", when, messages[i]);
+		g_date_time_unref(when);
+	}
+
+	data = log->logger_data;
+	g_assert_nonnull(data);
+	path = g_strdup(data->path);
+	purple_log_free(log);
+
+	return path;
+}
+
+/* Waits for the log writer to have written a closed log of more than size
+ * bytes, returns its contents */
+static gchar *
+test_log_binary_wait(const gchar *path, gsize size, gsize *length)
+{
+	gint64 deadline = g_get_monotonic_time() + 10 * G_TIME_SPAN_SECOND;
+	gchar *contents;
+
+	for (;;) {
+		g_assert_true(g_file_get_contents(path, &contents, length, NULL));
+		if (*length > size && *length > TEST_LOG_BINARY_TRAILER_SIZE &&
+				memcmp(contents + *length - 8, "PLBINDEX", 8) == 0)
+			return contents;
+
+		g_assert_cmpint(g_get_monotonic_time(), <, deadline);
+		g_free(contents);
+		g_usleep(10 * 1000);
+	}
+}
+
+/* Offset of the index frame of a closed log */
+static gsize
+test_log_binary_index_offset(const gchar *contents, gsize length)
+{
+	const guchar *trailer = (const guchar *)contents + length -
+		TEST_LOG_BINARY_TRAILER_SIZE;
+	gsize offset = 0;
+	gint i;
+
+	for (i = 7; i >= 0; i--)
+		offset = (offset << 8) | trailer[i];
+
+	g_assert_cmpuint(offset, <, length);
+
+	return offset;
+}
+
+/* Removes a log written by test_log_binary_write() and its directories */
+static void
+test_log_binary_unlink(gchar *path)
+{
+	gchar *dir = g_path_get_dirname(path);
+	gint i;
+
+	g_unlink(path);
+	for (i = 0; i < 4; i++) {
+		gchar *parent = g_path_get_dirname(dir);
+
+		g_rmdir(dir);
+		g_free(dir);
+		dir = parent;
+	}
+
+	g_free(dir);
+	g_free(path);
+}
+
+static void
+test_log_binary_assert_contents(GList *messages, const gchar **expected)
+{
+	gint i;
+
+	for (i = 0; expected[i] != NULL; i++) {
+		g_assert_nonnull(messages);
+		g_assert_cmpstr(purple_message_get_contents(messages->data), ==,
+			expected[i]);
+		g_assert_cmpstr(purple_message_get_author(messages->data), ==, "me");
+		messages = messages->next;
+	}
+
+	g_assert_null(messages);
+}
+
+static void
+test_log_binary_free_messages(GList *messages)
+{
+	g_list_free_full(messages, g_object_unref);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_log_binary_convert_html(void) {
+	PurpleAccount *account = purple_account_new("me", "prpl-log-binary");
+	GDateTime *start = g_date_time_new_local(2020, 1, 1, 12, 0, 0);
+	GDateTime *from, *to;
+	PurpleLog *log;
+	PurpleMessage *msg;
+	PurpleLogReadFlags flags;
+	GList *messages;
+	gchar *dir, *read;
+
+	log = test_log_binary_convert(account, "html",
+		"<html><head><title>Conversation with bob</title></head><body><h3>Conversation with bob</h3>\n"
+		"<font color=\"#A82F2F\"><font size=\"2\">(12:00:00)</font> <b>bob:</b></font> hi &amp; hello<br/>\n"
+		"<font color=\"#16569E\"><font size=\"2\">(12:00:30)</font> <b>me:</b></font> <b>bold</b><br/>\n"
+		"<font size=\"2\">(12:01:00)</font><b> bob has signed off.</b><br/>\n"
+		"<font color=\"#062585\"><font size=\"2\">(12:02:00)</font> <b>***bob</b></font> waves<br/>\n"
+		"<font color=\"#A82F2F\"><font size=\"2\">(00:00:10)</font> <b>bob &lt;AUTO-REPLY&gt;:</b></font> away<br/>\n"
+		"</body></html>\n",
+		start, &dir);
+
+	messages = purple_log_binary_read_range(log, NULL, NULL);
+	g_assert_cmpuint(g_list_length(messages), ==, 5);
+
+	msg = g_list_nth_data(messages, 0);
+	g_assert_cmpstr(purple_message_get_author(msg), ==, "bob");
+	g_assert_cmpstr(purple_message_get_contents(msg), ==, "hi &amp; hello");
+	g_assert_cmpuint(purple_message_get_flags(msg), ==, PURPLE_MESSAGE_RECV);
+	g_assert_cmpuint(purple_message_get_time(msg), ==,
+		test_log_binary_time(1, 12, 0, 0));
+
+	msg = g_list_nth_data(messages, 1);
+	g_assert_cmpstr(purple_message_get_author(msg), ==, "me");
+	g_assert_cmpstr(purple_message_get_contents(msg), ==, "<b>bold</b>");
+	g_assert_cmpuint(purple_message_get_flags(msg), ==, PURPLE_MESSAGE_SEND);
+
+	msg = g_list_nth_data(messages, 2);
+	g_assert_null(purple_message_get_author(msg));
+	g_assert_cmpstr(purple_message_get_contents(msg), ==,
+		"bob has signed off.");
+	g_assert_cmpuint(purple_message_get_flags(msg), ==, PURPLE_MESSAGE_SYSTEM);
+
+	msg = g_list_nth_data(messages, 3);
+	g_assert_cmpstr(purple_message_get_author(msg), ==, "bob");
+	g_assert_cmpstr(purple_message_get_contents(msg), ==, "/me waves");
+
+	/* past midnight */
+	msg = g_list_nth_data(messages, 4);
+	g_assert_cmpstr(purple_message_get_contents(msg), ==, "away");
+	g_assert_cmpuint(purple_message_get_flags(msg), ==,
+		PURPLE_MESSAGE_RECV | PURPLE_MESSAGE_AUTO_RESP);
+	g_assert_cmpuint(purple_message_get_time(msg), ==,
+		test_log_binary_time(2, 0, 0, 10));
+	test_log_binary_free_messages(messages);
+
+	messages = purple_log_binary_read_last(log, 2);
+	g_assert_cmpuint(g_list_length(messages), ==, 2);
+	g_assert_cmpstr(purple_message_get_contents(messages->data), ==,
+		"/me waves");
+	test_log_binary_free_messages(messages);
+
+	from = g_date_time_new_local(2020, 1, 1, 12, 0, 30);
+	to = g_date_time_new_local(2020, 1, 1, 12, 1, 0);
+	messages = purple_log_binary_read_range(log, from, to);
+	g_assert_cmpuint(g_list_length(messages), ==, 2);
+	g_assert_cmpstr(purple_message_get_contents(messages->data), ==,
+		"<b>bold</b>");
+	test_log_binary_free_messages(messages);
+	g_date_time_unref(from);
+	g_date_time_unref(to);
+
+	/* and it reads like an html log */
+	read = purple_log_read(log, &flags);
+	g_assert_nonnull(strstr(read,
+		"<font color=\"#A82F2F\"><font size=\"2\">(12:00:00)</font> <b>bob:</b></font> hi &amp; hello<br/>\n"));
+	g_free(read);
+
+	test_log_binary_remove(log, dir);
+	g_date_time_unref(start);
+	g_object_unref(account);
+}
+
+static void
+test_log_binary_convert_txt(void) {
+	PurpleAccount *account = purple_account_new("me", "prpl-log-binary");
+	GDateTime *start = g_date_time_new_local(2020, 1, 1, 12, 0, 0);
+	PurpleLog *log;
+	PurpleMessage *msg;
+	GList *messages;
+	gchar *dir;
+
+	log = test_log_binary_convert(account, "txt",
+		"Conversation with bob at 2020-01-01 on me (test)\n"
+		"(12:00:00) bob: 1 < 2\n"
+		"and a second line\n"
+		"(12:00:30) me: hello\n"
+		"(12:01:00) bob has signed off.\n",
+		start, &dir);
+
+	messages = purple_log_binary_read_range(log, NULL, NULL);
+	g_assert_cmpuint(g_list_length(messages), ==, 3);
+
+	msg = g_list_nth_data(messages, 0);
+	g_assert_cmpstr(purple_message_get_author(msg), ==, "bob");
+	g_assert_cmpstr(purple_message_get_contents(msg), ==,
+		"1 &lt; 2<br/>and a second line");
+	g_assert_cmpuint(purple_message_get_flags(msg), ==, PURPLE_MESSAGE_RECV);
+
+	/* the account's own messages were sent */
+	msg = g_list_nth_data(messages, 1);
+	g_assert_cmpuint(purple_message_get_flags(msg), ==, PURPLE_MESSAGE_SEND);
+
+	msg = g_list_nth_data(messages, 2);
+	g_assert_cmpuint(purple_message_get_flags(msg), ==, PURPLE_MESSAGE_SYSTEM);
+	g_assert_cmpuint(purple_message_get_time(msg), ==,
+		test_log_binary_time(1, 12, 1, 0));
+	test_log_binary_free_messages(messages);
+
+	test_log_binary_remove(log, dir);
+	g_date_time_unref(start);
+	g_object_unref(account);
+}
+
+static void
+test_log_binary_write_read(void) {
+	static const gchar *written[] = { "one", "two", "three", NULL };
+	static const gchar *last[] = { "two", "three", NULL };
+	PurpleAccount *account = purple_account_new("me", "prpl-log-binary");
+	GDateTime *start = g_date_time_new_local(2020, 2, 1, 12, 0, 0);
+	GDateTime *from;
+	PurpleLog *log;
+	GList *messages;
+	gchar *path, *contents;
+	gsize length;
+
+	path = test_log_binary_write(account, start, written);
+	g_assert_true(g_str_has_suffix(path, ".purplelog"));
+
+	/* closing it left the index at the end */
+	contents = test_log_binary_wait(path, 0, &length);
+	g_assert_true(g_str_has_prefix(contents, "PURPLEBL"));
+	g_assert_cmpuint(test_log_binary_index_offset(contents, length), >, 12);
+	g_free(contents);
+
+	log = test_log_binary_new_log(account, "binary", path, start);
+
+	messages = purple_log_binary_read_range(log, NULL, NULL);
+	test_log_binary_assert_contents(messages, written);
+	test_log_binary_free_messages(messages);
+
+	messages = purple_log_binary_read_last(log, 2);
+	test_log_binary_assert_contents(messages, last);
+	test_log_binary_free_messages(messages);
+
+	from = g_date_time_add_seconds(start, 1);
+	messages = purple_log_binary_read_range(log, from, NULL);
+	test_log_binary_assert_contents(messages, last);
+	test_log_binary_free_messages(messages);
+	g_date_time_unref(from);
+
+	purple_log_free(log);
+	test_log_binary_unlink(path);
+	g_date_time_unref(start);
+	g_object_unref(account);
+}
+
+static void
+test_log_binary_append(void) {
+	static const gchar *first[] = { "one", "two", NULL };
+	static const gchar *second[] = { "three", "four", NULL };
+	static const gchar *all[] = { "one", "two", "three", "four", NULL };
+	PurpleAccount *account = purple_account_new("me", "prpl-log-binary");
+	GDateTime *start = g_date_time_new_local(2020, 2, 2, 12, 0, 0);
+	PurpleLog *log;
+	GList *messages;
+	gchar *path, *again, *contents;
+	gsize length, closed;
+
+	path = test_log_binary_write(account, start, first);
+	contents = test_log_binary_wait(path, 0, &closed);
+	g_free(contents);
+
+	/* a log starting at the same second goes into the same file */
+	again = test_log_binary_write(account, start, second);
+	g_assert_cmpstr(again, ==, path);
+	g_free(again);
+
+	contents = test_log_binary_wait(path, closed, &length);
+	g_free(contents);
+
+	log = test_log_binary_new_log(account, "binary", path, start);
+
+	/* the new index covers the blocks written before as well */
+	messages = purple_log_binary_read_range(log, NULL, NULL);
+	test_log_binary_assert_contents(messages, all);
+	test_log_binary_free_messages(messages);
+
+	messages = purple_log_binary_read_last(log, 2);
+	test_log_binary_assert_contents(messages, second);
+	test_log_binary_free_messages(messages);
+
+	purple_log_free(log);
+	test_log_binary_unlink(path);
+	g_date_time_unref(start);
+	g_object_unref(account);
+}
+
+static void
+test_log_binary_crashed(void) {
+	static const gchar *written[] = { "one", "two", "three", NULL };
+	PurpleAccount *account = purple_account_new("me", "prpl-log-binary");
+	GDateTime *start = g_date_time_new_local(2020, 2, 3, 12, 0, 0);
+	PurpleLog *log;
+	GList *messages;
+	gchar *path, *contents;
+	gsize length, offset;
+
+	path = test_log_binary_write(account, start, written);
+	contents = test_log_binary_wait(path, 0, &length);
+
+	/* a crash before the log was closed leaves no index, and maybe a frame
+	 * that was cut short */
+	offset = test_log_binary_index_offset(contents, length);
+	memcpy(contents + offset, contents + 12, 20);
+	g_assert_true(g_file_set_contents(path, contents, offset + 20, NULL));
+	g_free(contents);
+
+	log = test_log_binary_new_log(account, "binary", path, start);
+
+	messages = purple_log_binary_read_range(log, NULL, NULL);
+	test_log_binary_assert_contents(messages, written);
+	test_log_binary_free_messages(messages);
+
+	purple_log_free(log);
+	test_log_binary_unlink(path);
+	g_date_time_unref(start);
+	g_object_unref(account);
+}
+
+static void
+test_log_binary_oversized(void) {
+	const gchar *written[5] = { "before", NULL, NULL, "after", NULL };
+	PurpleAccount *account = purple_account_new("me", "prpl-log-binary");
+	GDateTime *start = g_date_time_new_local(2020, 2, 5, 12, 0, 0);
+	PurpleLog *log;
+	GList *messages;
+	gchar *path, *contents, *fits, *larger;
+	gsize length;
+
+	/* one that only fits a block of its own, and one that fits none */
+	fits = g_strnfill(TEST_LOG_BINARY_MAX_RAW - 40, 'a');
+	larger = g_strnfill(TEST_LOG_BINARY_MAX_RAW + 1024, 'b');
+	written[1] = fits;
+	written[2] = larger;
+
+	path = test_log_binary_write(account, start, written);
+	contents = test_log_binary_wait(path, TEST_LOG_BINARY_MAX_RAW, &length);
+	g_free(contents);
+
+	/* nothing was dropped */
+	log = test_log_binary_new_log(account, "binary", path, start);
+	messages = purple_log_binary_read_range(log, NULL, NULL);
+	test_log_binary_assert_contents(messages, written);
+	test_log_binary_free_messages(messages);
+
+	g_free(fits);
+	g_free(larger);
+	purple_log_free(log);
+	test_log_binary_unlink(path);
+	g_date_time_unref(start);
+	g_object_unref(account);
+}
+
+/* Replaces a u32 of the first block's frame header and writes contents */
+static void
+test_log_binary_patch_frame(const gchar *path, gchar *contents, gsize length,
+                            gsize field, guint32 value)
+{
+	gint i;
+
+	for (i = 0; i < 4; i++)
+		contents[12 + field + i] = (value >> (i * 8)) & 0xff;
+
+	g_assert_true(g_file_set_contents(path, contents, length, NULL));
+}
+
+static void
+test_log_binary_damaged(void) {
+	static const gchar *written[] = { "one", "two", "three", NULL };
+	PurpleAccount *account = purple_account_new("me", "prpl-log-binary");
+	GDateTime *start = g_date_time_new_local(2020, 2, 4, 12, 0, 0);
+	PurpleLog *log;
+	GList *messages;
+	gchar *path, *contents, *intact;
+	gsize length;
+
+	path = test_log_binary_write(account, start, written);
+	intact = test_log_binary_wait(path, 0, &length);
+	contents = g_memdup(intact, length);
+	log = test_log_binary_new_log(account, "binary", path, start);
+
+	/* a raw length that's too large to allocate */
+	test_log_binary_patch_frame(path, contents, length, 8, G_MAXUINT32);
+	g_assert_null(purple_log_binary_read_range(log, NULL, NULL));
+	memcpy(contents, intact, length);
+
+	/* lengths that would do, but run past the end of the file */
+	test_log_binary_patch_frame(path, contents, length, 8, 1024 * 1024);
+	test_log_binary_patch_frame(path, contents, length, 4, 1024 * 1024);
+	g_assert_null(purple_log_binary_read_range(log, NULL, NULL));
+	memcpy(contents, intact, length);
+
+	/* a count that isn't what was checksummed */
+	test_log_binary_patch_frame(path, contents, length, 12, 2);
+	g_assert_null(purple_log_binary_read_range(log, NULL, NULL));
+
+	/* and the block is still there when nothing was touched */
+	g_assert_true(g_file_set_contents(path, intact, length, NULL));
+	messages = purple_log_binary_read_range(log, NULL, NULL);
+	test_log_binary_assert_contents(messages, written);
+	test_log_binary_free_messages(messages);
+
+	g_free(contents);
+	g_free(intact);
+	purple_log_free(log);
+	test_log_binary_unlink(path);
+	g_date_time_unref(start);
+	g_object_unref(account);
+}
+
+static void
+test_log_binary_perf(void) {
+	static const gchar *words[] = {
+		"hey", "are", "you", "coming", "tonight", "sure", "what", "time",
+		"the", "meeting", "moved", "to", "thursday", "<b>really</b>",
+		"lol", "ok", "see", "you", "there", "bring", "snacks"
+	};
+	PurpleAccount *account = purple_account_new("me", "prpl-log-binary");
+	GDateTime *start = g_date_time_new_local(2020, 1, 1, 8, 0, 0);
+	GDateTime *from, *to;
+	PurpleLog *log;
+	PurpleLogReadFlags flags;
+	GString *text;
+	GTimer *timer;
+	GList *messages;
+	GRand *rand = g_rand_new_with_seed(42);
+	gchar *html_dir, *html_path, *bin_dir, *read;
+	gint html_size, bin_size;
+	gdouble html_time, last_time, range_time;
+	guint count = g_test_perf() ? 20000 : 2000;
+	guint iterations = g_test_perf() ? 20 : 1;
+	guint i, j;
+
+	text = g_string_new("<html><head><title>Conversation with bob</title>"
+		"</head><body><h3>Conversation with bob</h3>\n");
+	for (i = 0; i < count; i++) {
+		GDateTime *dt = g_date_time_add_seconds(start, i * 30);
+		gchar *stamp = g_date_time_format(dt, "%X");
+		gboolean sent = g_rand_boolean(rand);
+
+		g_string_append_printf(text, "<font color=\"%s\"><font size=\"2\">"
+			"(%s)</font> <b>%s:</b></font> ", sent ? "#16569E" : "#A82F2F",
+			stamp, sent ? "me" : "bob");
+		for (j = g_rand_int_range(rand, 2, 12); j > 0; j--) {
+			g_string_append(text,
+				words[g_rand_int_range(rand, 0, G_N_ELEMENTS(words))]);
+			g_string_append_c(text, j > 1 ? ' ' : '.');
+		}
+		g_string_append(text, "<br/>\n");
+
+		g_free(stamp);
+		g_date_time_unref(dt);
+	}
+	g_string_append(text, "</body></html>\n");
+
+	/* the html log stays around to compare */
+	html_dir = g_dir_make_tmp("purple-log-binary-XXXXXX", NULL);
+	html_path = g_build_filename(html_dir, "log.html", NULL);
+	g_assert_true(g_file_set_contents(html_path, text->str, text->len, NULL));
+	log = test_log_binary_new_log(account, "html", html_path, start);
+	html_size = purple_log_get_size(log);
+
+	timer = g_timer_new();
+	for (i = 0; i < iterations; i++) {
+		read = purple_log_read(log, &flags);
+		g_free(read);
+	}
+	html_time = g_timer_elapsed(timer, NULL) / iterations;
+	purple_log_free(log);
+
+	log = test_log_binary_convert(account, "html", text->str, start, &bin_dir);
+	bin_size = purple_log_get_size(log);
+
+	g_timer_start(timer);
+	for (i = 0; i < iterations; i++) {
+		messages = purple_log_binary_read_last(log, 50);
+		g_assert_cmpuint(g_list_length(messages), ==, 50);
+		test_log_binary_free_messages(messages);
+	}
+	last_time = g_timer_elapsed(timer, NULL) / iterations;
+
+	/* an hour in the middle */
+	from = g_date_time_add_seconds(start, count * 15);
+	to = g_date_time_add_hours(from, 1);
+	g_timer_start(timer);
+	for (i = 0; i < iterations; i++) {
+		messages = purple_log_binary_read_range(log, from, to);
+		g_assert_cmpuint(g_list_length(messages), ==, 121);
+		test_log_binary_free_messages(messages);
+	}
+	range_time = g_timer_elapsed(timer, NULL) / iterations;
+
+	g_assert_cmpint(bin_size, <, html_size / 2);
+
+	g_test_message("%u messages; html: %d bytes, whole log read in %f s; "
+		"binary: %d bytes, last 50 read in %f s, an hour read in %f s",
+		count, html_size, html_time, bin_size, last_time, range_time);
+	if (g_test_perf()) {
+		g_test_minimized_result((gdouble)bin_size / html_size,
+			"binary to html size");
+		g_test_minimized_result(last_time, "last 50 messages read time");
+		g_test_minimized_result(range_time, "hour of messages read time");
+	}
+
+	test_log_binary_remove(log, bin_dir);
+	g_unlink(html_path);
+	g_rmdir(html_dir);
+	g_free(html_path);
+	g_free(html_dir);
+	g_date_time_unref(from);
+	g_date_time_unref(to);
+	g_timer_destroy(timer);
+	g_rand_free(rand);
+	g_string_free(text, TRUE);
+	g_date_time_unref(start);
+	g_object_unref(account);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	gint res = 0;
+
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	g_assert_nonnull(purple_protocols_add(test_log_binary_protocol_get_type(),
+		NULL));
+
+	g_test_add_func("/log-binary/write-read", test_log_binary_write_read);
+	g_test_add_func("/log-binary/append", test_log_binary_append);
+	g_test_add_func("/log-binary/crashed", test_log_binary_crashed);
+	g_test_add_func("/log-binary/damaged", test_log_binary_damaged);
+	g_test_add_func("/log-binary/oversized", test_log_binary_oversized);
+	g_test_add_func("/log-binary/convert-html", test_log_binary_convert_html);
+	g_test_add_func("/log-binary/convert-txt", test_log_binary_convert_txt);
+	g_test_add_func("/log-binary/perf", test_log_binary_perf);
+
+	res = g_test_run();
+
+	return res;
+}
@@ -0,0 +1,317 @@
+/*
+ * Purple
+ *
+ * Purple is the legal property of its developers, whose names are too
+ * numerous to list here. Please refer to the COPYRIGHT file distributed
+ * with this source distribution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include <purple.h>
+
+#include "test_ui.h"
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static PurpleLog *
+test_log_index_new_log(PurpleAccount *account, const gchar *name,
+                       gint64 when, const gchar *text)
+{
+	GDateTime *dt = g_date_time_new_from_unix_local(when);
+	PurpleLog *log = purple_log_new(PURPLE_LOG_IM, name, account, NULL, dt);
+
+	g_date_time_unref(dt);
+	purple_log_index_add(log, text);
+
+	return log;
+}
+
+/* A logger keeping the text of a log in its logger_data, so logs can be read
+ * back without touching the disk. */
+static void
+test_log_index_logger_finalize(PurpleLog *log) {
+	g_free(log->logger_data);
+}
+
+static gchar *
+test_log_index_logger_read(PurpleLog *log, PurpleLogReadFlags *flags) {
+	*flags = 0;
+
+	return g_strdup(log->logger_data);
+}
+
+static gint
+test_log_index_logger_size(PurpleLog *log) {
+	return log->logger_data ? strlen(log->logger_data) : 0;
+}
+
+static PurpleLog *
+test_log_index_new_unindexed(PurpleAccount *account, gint64 when,
+                             const gchar *text)
+{
+	GDateTime *dt = g_date_time_new_from_unix_local(when);
+	PurpleLog *log = purple_log_new(PURPLE_LOG_IM, "dave", account, NULL, dt);
+
+	g_date_time_unref(dt);
+	log->logger_data = g_strdup(text);
+
+	return log;
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_log_index_filter(void) {
+	PurpleAccount *account = purple_account_new("log-index", "prpl-log-index");
+	PurpleLog *a, *b, *c;
+	GList *logs = NULL, *found = NULL;
+
+	a = test_log_index_new_log(account, "bob", 1000, "<b>Hello</b> world");
+	b = test_log_index_new_log(account, "bob", 2000,
+		"hello hello hello, World");
+	c = test_log_index_new_log(account, "bob", 3000, "goodbye &amp; thanks");
+
+	logs = g_list_append(logs, a);
+	logs = g_list_append(logs, b);
+	logs = g_list_append(logs, c);
+
+	/* words match by their beginning, the log saying it most wins */
+	found = purple_log_index_filter(logs, "HEL");
+	g_assert_cmpuint(g_list_length(found), ==, 2);
+	g_assert(found->data == b);
+	g_assert(found->next->data == a);
+	g_list_free(found);
+
+	/* every word has to be there */
+	found = purple_log_index_filter(logs, "world hello");
+	g_assert_cmpuint(g_list_length(found), ==, 2);
+	g_list_free(found);
+
+	found = purple_log_index_filter(logs, "goodbye hello");
+	g_assert_null(found);
+
+	/* markup isn't indexed, entities are */
+	found = purple_log_index_filter(logs, "amp");
+	g_assert_null(found);
+	found = purple_log_index_filter(logs, "thanks");
+	g_assert_cmpuint(g_list_length(found), ==, 1);
+	g_assert(found->data == c);
+	g_list_free(found);
+
+	/* only the logs asked about are searched */
+	found = purple_log_index_filter(logs->next->next, "hello");
+	g_assert_null(found);
+
+	g_list_free_full(logs, (GDestroyNotify)purple_log_free);
+	g_object_unref(account);
+}
+
+static void
+test_log_index_narrow(void) {
+	PurpleAccount *account = purple_account_new("log-index-narrow",
+		"prpl-log-index");
+	PurpleLog *a, *b, *c, *d;
+	GList *logs = NULL, *found = NULL;
+	GDateTime *dt;
+
+	a = test_log_index_new_log(account, "frank", 1000, "<b>Hello</b> world");
+	b = test_log_index_new_log(account, "frank", 2000, "yellow wording");
+	c = test_log_index_new_log(account, "frank", 3000, "goodbye &amp; thanks");
+
+	dt = g_date_time_new_from_unix_local(4000);
+	d = purple_log_new(PURPLE_LOG_IM, "frank", account, NULL, dt);
+	g_date_time_unref(dt);
+
+	logs = g_list_append(logs, a);
+	logs = g_list_append(logs, b);
+	logs = g_list_append(logs, c);
+	logs = g_list_append(logs, d);
+
+	/* anywhere in a word, every log that has it is kept, in order */
+	found = purple_log_index_narrow(logs, "ELLO wor");
+	g_assert_cmpuint(g_list_length(found), ==, 3);
+	g_assert(found->data == a);
+	g_assert(found->next->data == b);
+	g_assert(found->next->next->data == d);
+	g_list_free(found);
+
+	found = purple_log_index_narrow(logs, "odbye & tha");
+	g_assert_cmpuint(g_list_length(found), ==, 2);
+	g_assert(found->data == c);
+	g_list_free(found);
+
+	/* nothing the index can check, so nothing is ruled out */
+	found = purple_log_index_narrow(logs, "&");
+	g_assert_cmpuint(g_list_length(found), ==, 4);
+	g_list_free(found);
+
+	g_list_free_full(logs, (GDestroyNotify)purple_log_free);
+	g_object_unref(account);
+}
+
+static void
+test_log_index_add_appends(void) {
+	PurpleAccount *account = purple_account_new("log-index-append",
+		"prpl-log-index");
+	PurpleLog *log;
+	GList *logs, *found;
+
+	log = test_log_index_new_log(account, "carol", 1000, "first message");
+	purple_log_index_add(log, "second message");
+	logs = g_list_append(NULL, log);
+
+	found = purple_log_index_filter(logs, "first second");
+	g_assert_cmpuint(g_list_length(found), ==, 1);
+	g_list_free(found);
+
+	g_list_free_full(logs, (GDestroyNotify)purple_log_free);
+	g_object_unref(account);
+}
+
+static void
+test_log_index_same_results(void) {
+	const gchar *text = "我们明天去東京 see http://example.com/"
+		"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaxyz";
+	struct {
+		const gchar *query;
+		gboolean found;
+	} queries[] = {
+		/* runs of CJK aren't split into words, so anywhere will do */
+		{ "東京", TRUE },
+		{ "明天去", TRUE },
+		{ "京去", FALSE },
+		/* everything else has to begin a word */
+		{ "see", TRUE },
+		{ "SEE example", TRUE },
+		{ "ee", FALSE },
+		{ "s", TRUE },
+		{ "z", FALSE },
+		/* words longer than the index keeps */
+		{ "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaxyz", TRUE },
+		{ "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaq", FALSE },
+	};
+	PurpleLogLogger *logger, *old_logger = purple_log_logger_get();
+	PurpleAccount *account = purple_account_new("log-index-same",
+		"prpl-log-index");
+	PurpleLog *indexed;
+	gsize i;
+
+	logger = purple_log_logger_new("test-log-index", "test-log-index", 6,
+		NULL, NULL, test_log_index_logger_finalize, NULL,
+		test_log_index_logger_read, test_log_index_logger_size);
+	purple_log_logger_add(logger);
+	purple_log_logger_set(logger);
+
+	indexed = test_log_index_new_unindexed(account, 1000, text);
+	purple_log_index_add(indexed, text);
+
+	for (i = 0; i < G_N_ELEMENTS(queries); i++) {
+		/* a new one every time, as searching it indexes it */
+		PurpleLog *unindexed = test_log_index_new_unindexed(account,
+			2000 + i, text);
+		GList *logs = NULL, *found;
+
+		logs = g_list_append(logs, indexed);
+		logs = g_list_append(logs, unindexed);
+
+		found = purple_log_index_filter(logs, queries[i].query);
+		if (queries[i].found) {
+			g_assert_cmpuint(g_list_length(found), ==, 2);
+		} else {
+			g_assert_null(found);
+		}
+		g_list_free(found);
+
+		/* and now that it's indexed, it's still the same */
+		found = purple_log_index_filter(logs->next, queries[i].query);
+		g_assert_cmpuint(g_list_length(found), ==, queries[i].found ? 1 : 0);
+		g_list_free(found);
+
+		g_list_free(logs);
+		purple_log_free(unindexed);
+	}
+
+	purple_log_free(indexed);
+
+	purple_log_logger_set(old_logger);
+	purple_log_logger_remove(logger);
+	purple_log_logger_free(logger);
+	g_object_unref(account);
+}
+
+static void
+test_log_index_remove(void) {
+	PurpleAccount *account = purple_account_new("log-index-remove",
+		"prpl-log-index");
+	PurpleLog *keep;
+	GList *logs, *found;
+	gint i;
+
+	keep = test_log_index_new_log(account, "erin", 1000, "zebra crossing");
+
+	/* enough of them to have the dead ones dropped along the way */
+	for (i = 0; i < 200; i++) {
+		PurpleLog *log = test_log_index_new_log(account, "erin", 2000 + i,
+			"zebra stripes");
+
+		purple_log_index_remove(log);
+		purple_log_free(log);
+	}
+
+	logs = g_list_append(NULL, keep);
+
+	found = purple_log_index_filter(logs, "zebra");
+	g_assert_cmpuint(g_list_length(found), ==, 1);
+	g_assert(found->data == keep);
+	g_list_free(found);
+
+	found = purple_log_index_search("stripes", account, NULL, 0);
+	g_assert_null(found);
+
+	found = purple_log_index_filter(logs, "crossing");
+	g_assert_cmpuint(g_list_length(found), ==, 1);
+	g_list_free(found);
+
+	g_list_free_full(logs, (GDestroyNotify)purple_log_free);
+	g_object_unref(account);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	gint res = 0;
+
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	g_test_add_func("/log-index/filter", test_log_index_filter);
+	g_test_add_func("/log-index/narrow", test_log_index_narrow);
+	g_test_add_func("/log-index/add-appends", test_log_index_add_appends);
+	g_test_add_func("/log-index/same-results", test_log_index_same_results);
+	g_test_add_func("/log-index/remove", test_log_index_remove);
+
+	res = g_test_run();
+
+	return res;
+}
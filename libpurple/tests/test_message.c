@@ -0,0 +1,102 @@
+/*
+ * Purple
+ *
+ * Purple is the legal property of its developers, whose names are too
+ * numerous to list here. Please refer to the COPYRIGHT file distributed
+ * with this source distribution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#include <glib.h>
+
+#include <purple.h>
+
+#include "test_ui.h"
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static void
+test_message_weak_notify(gpointer data, GObject *where_the_object_was) {
+	gboolean *finalized = data;
+
+	*finalized = TRUE;
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_message_find_by_id(void) {
+	PurpleMessage *msg = NULL;
+	gboolean finalized = FALSE;
+	guint id;
+
+	msg = purple_message_new_system("hello", 0);
+	g_object_weak_ref(G_OBJECT(msg), test_message_weak_notify, &finalized);
+	id = purple_message_get_id(msg);
+
+	g_assert(purple_message_find_by_id(id) == msg);
+
+	g_object_unref(msg);
+
+	g_assert_true(finalized);
+	g_assert(purple_message_find_by_id(id) == NULL);
+}
+
+static void
+test_message_reference_keeps_it(void) {
+	PurpleMessage *msg = NULL;
+	gboolean finalized = FALSE;
+	guint id;
+
+	msg = purple_message_new_incoming("bob", "hi", 0, 0);
+	g_object_weak_ref(G_OBJECT(msg), test_message_weak_notify, &finalized);
+	id = purple_message_get_id(msg);
+	g_object_ref(msg);
+
+	/* drop the creator's reference */
+	g_object_unref(msg);
+
+	g_assert_false(finalized);
+	g_assert(purple_message_find_by_id(id) == msg);
+	g_assert_cmpstr(purple_message_get_contents(msg), ==, "hi");
+
+	g_object_unref(msg);
+
+	g_assert_true(finalized);
+	g_assert(purple_message_find_by_id(id) == NULL);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	gint res = 0;
+
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	g_test_add_func("/message/find-by-id", test_message_find_by_id);
+	g_test_add_func("/message/reference-keeps-it",
+	                test_message_reference_keeps_it);
+
+	res = g_test_run();
+
+	return res;
+}
@@ -0,0 +1,352 @@
+/*
+ * Purple
+ *
+ * Purple is the legal property of its developers, whose names are too
+ * numerous to list here. Please refer to the COPYRIGHT file distributed
+ * with this source distribution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include <purple.h>
+
+#include "test_ui.h"
+
+/* PURPLE_NORMALIZE_CACHE_SIZE in util.c */
+#define TEST_NORMALIZE_CACHE_SIZE 1024
+
+/******************************************************************************
+ * A protocol that lowercases names and counts how often it had to
+ *****************************************************************************/
+static GType test_normalize_protocol_get_type(void);
+
+typedef struct {
+	PurpleProtocol parent;
+} TestNormalizeProtocol;
+
+typedef struct {
+	PurpleProtocolClass parent;
+} TestNormalizeProtocolClass;
+
+static gint test_normalize_calls = 0;
+static GPrivate test_normalize_buf = G_PRIVATE_INIT(g_free);
+
+static const char *
+test_normalize_protocol_normalize(const PurpleAccount *account,
+                                  const char *who)
+{
+	gchar *down = g_utf8_strdown(who, -1);
+
+	g_atomic_int_inc(&test_normalize_calls);
+
+	/* purple_normalize() calls this without holding any lock, so the
+	 * threads test needs a buffer for every thread */
+	g_private_replace(&test_normalize_buf, down);
+
+	return down;
+}
+
+static void
+test_normalize_protocol_client_iface_init(PurpleProtocolClientInterface *iface) {
+	iface->normalize = test_normalize_protocol_normalize;
+}
+
+G_DEFINE_TYPE_WITH_CODE(
+	TestNormalizeProtocol,
+	test_normalize_protocol,
+	PURPLE_TYPE_PROTOCOL,
+	G_IMPLEMENT_INTERFACE(
+		PURPLE_TYPE_PROTOCOL_CLIENT,
+		test_normalize_protocol_client_iface_init
+	)
+);
+
+static void
+test_normalize_protocol_login(PurpleAccount *account) {
+}
+
+static void
+test_normalize_protocol_close(PurpleConnection *gc) {
+}
+
+static GList *
+test_normalize_protocol_status_types(PurpleAccount *account) {
+	return NULL;
+}
+
+static const char *
+test_normalize_protocol_list_icon(PurpleAccount *account, PurpleBuddy *buddy) {
+	return "normalize";
+}
+
+static void
+test_normalize_protocol_init(TestNormalizeProtocol *protocol) {
+	PurpleProtocol *prpl = PURPLE_PROTOCOL(protocol);
+
+	prpl->id = "prpl-normalize";
+	prpl->name = "Normalize";
+}
+
+static void
+test_normalize_protocol_class_init(TestNormalizeProtocolClass *klass) {
+	PurpleProtocolClass *protocol_class = PURPLE_PROTOCOL_CLASS(klass);
+
+	protocol_class->login = test_normalize_protocol_login;
+	protocol_class->close = test_normalize_protocol_close;
+	protocol_class->status_types = test_normalize_protocol_status_types;
+	protocol_class->list_icon = test_normalize_protocol_list_icon;
+}
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static PurpleAccount *
+test_normalize_account_new(const gchar *username)
+{
+	PurpleAccount *account = purple_account_new(username, "prpl-normalize");
+
+	g_atomic_int_set(&test_normalize_calls, 0);
+
+	return account;
+}
+
+static gchar *
+test_normalize_name(guint i)
+{
+	return g_strdup_printf("Buddy%u@Example.COM", i);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_normalize_cached(void) {
+	PurpleAccount *account = test_normalize_account_new("cached");
+	gchar *first;
+	guint64 hits, misses;
+
+	first = g_strdup(purple_normalize(account, "Bob"));
+	g_assert_cmpstr(first, ==, "bob");
+	g_assert_cmpstr(purple_normalize(account, "Bob"), ==, first);
+	g_free(first);
+
+	g_assert_cmpint(g_atomic_int_get(&test_normalize_calls), ==, 1);
+	purple_normalize_cache_get_stats(account, &hits, &misses);
+	g_assert_cmpuint(hits, ==, 1);
+	g_assert_cmpuint(misses, ==, 1);
+
+	purple_normalize_cache_clear(account);
+	g_assert_cmpstr(purple_normalize(account, "Bob"), ==, "bob");
+	g_assert_cmpint(g_atomic_int_get(&test_normalize_calls), ==, 2);
+
+	g_object_unref(account);
+}
+
+static void
+test_normalize_lru_eviction(void) {
+	PurpleAccount *account = test_normalize_account_new("lru");
+	gchar *name;
+	guint i;
+
+	/* fill the cache, Buddy0 being the least recently used */
+	for (i = 0; i < TEST_NORMALIZE_CACHE_SIZE; i++) {
+		name = test_normalize_name(i);
+		purple_normalize(account, name);
+		g_free(name);
+	}
+	g_assert_cmpint(g_atomic_int_get(&test_normalize_calls), ==,
+		TEST_NORMALIZE_CACHE_SIZE);
+
+	/* using Buddy0 makes Buddy1 the least recently used one */
+	purple_normalize(account, "Buddy0@Example.COM");
+	g_assert_cmpint(g_atomic_int_get(&test_normalize_calls), ==,
+		TEST_NORMALIZE_CACHE_SIZE);
+
+	/* so a new name evicts Buddy1 */
+	purple_normalize(account, "Someone@Else");
+	purple_normalize(account, "Buddy0@Example.COM");
+	g_assert_cmpint(g_atomic_int_get(&test_normalize_calls), ==,
+		TEST_NORMALIZE_CACHE_SIZE + 1);
+	purple_normalize(account, "Buddy1@Example.COM");
+	g_assert_cmpint(g_atomic_int_get(&test_normalize_calls), ==,
+		TEST_NORMALIZE_CACHE_SIZE + 2);
+
+	/* the cache doesn't grow past its size, everything else is evicted */
+	for (i = TEST_NORMALIZE_CACHE_SIZE; i < 3 * TEST_NORMALIZE_CACHE_SIZE;
+			i++) {
+		name = test_normalize_name(i);
+		purple_normalize(account, name);
+		g_free(name);
+	}
+	g_atomic_int_set(&test_normalize_calls, 0);
+	g_assert_cmpstr(purple_normalize(account, "Buddy0@Example.COM"), ==,
+		"buddy0@example.com");
+	g_assert_cmpint(g_atomic_int_get(&test_normalize_calls), ==, 1);
+
+	g_object_unref(account);
+}
+
+static void
+test_normalize_protocol_change(void) {
+	PurpleAccount *account = test_normalize_account_new("change");
+
+	g_assert_cmpstr(purple_normalize(account, "Bob"), ==, "bob");
+
+	/* a protocol without a normalize function leaves the case alone */
+	purple_account_set_protocol_id(account, "prpl-normalize-none");
+	g_assert_cmpstr(purple_normalize(account, "Bob"), ==, "Bob");
+
+	purple_account_set_protocol_id(account, "prpl-normalize");
+	g_assert_cmpstr(purple_normalize(account, "Bob"), ==, "bob");
+
+	g_object_unref(account);
+}
+
+static void
+test_normalize_no_account(void) {
+	gchar *first = g_strdup(purple_normalize(NULL, "Bob"));
+
+	g_assert_cmpstr(first, ==, "Bob");
+	g_assert_cmpstr(purple_normalize(NULL, "Alice"), ==, "Alice");
+
+	g_free(first);
+}
+
+typedef struct {
+	PurpleAccount *account;
+	guint offset;
+} TestNormalizeThread;
+
+static gpointer
+test_normalize_thread(gpointer data)
+{
+	TestNormalizeThread *thread = data;
+	guint i;
+
+	for (i = 0; i < 4 * TEST_NORMALIZE_CACHE_SIZE; i++) {
+		guint n = (i * 7 + thread->offset) % (2 * TEST_NORMALIZE_CACHE_SIZE);
+		gchar *name = test_normalize_name(n);
+		gchar *expected = g_utf8_strdown(name, -1);
+		const char *got = purple_normalize(thread->account, name);
+
+		/* other threads evict entries all the time, but they have buffers
+		 * of their own */
+		if (!purple_strequal(got, expected) ||
+				!purple_strequal(purple_normalize(NULL, name), name)) {
+			g_free(name);
+			g_free(expected);
+			return GINT_TO_POINTER(FALSE);
+		}
+
+		g_free(name);
+		g_free(expected);
+	}
+
+	return GINT_TO_POINTER(TRUE);
+}
+
+static void
+test_normalize_threads(void) {
+	PurpleAccount *account = test_normalize_account_new("threads");
+	TestNormalizeThread data[4];
+	GThread *threads[4];
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(threads); i++) {
+		data[i].account = account;
+		data[i].offset = i * 13;
+		threads[i] = g_thread_new("normalize", test_normalize_thread,
+			&data[i]);
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(threads); i++)
+		g_assert_true(GPOINTER_TO_INT(g_thread_join(threads[i])));
+
+	g_object_unref(account);
+}
+
+static void
+test_normalize_perf(void) {
+	PurpleAccount *account = test_normalize_account_new("perf");
+	GTimer *timer;
+	gchar **names;
+	gdouble cold, warm;
+	guint count = TEST_NORMALIZE_CACHE_SIZE / 2;
+	guint iterations = g_test_perf() ? 200 : 5;
+	guint i, j;
+
+	names = g_new0(gchar *, count + 1);
+	for (i = 0; i < count; i++)
+		names[i] = test_normalize_name(i);
+
+	/* every name normalized by the protocol */
+	timer = g_timer_new();
+	for (i = 0; i < iterations; i++) {
+		purple_normalize_cache_clear(account);
+		for (j = 0; j < count; j++)
+			purple_normalize(account, names[j]);
+	}
+	cold = g_timer_elapsed(timer, NULL);
+
+	/* the same names, all of them in the cache */
+	g_timer_start(timer);
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < count; j++)
+			purple_normalize(account, names[j]);
+	}
+	warm = g_timer_elapsed(timer, NULL);
+
+	g_test_message("%u lookups: %f s without the cache, %f s with it",
+		count * iterations, cold, warm);
+	if (g_test_perf()) {
+		g_test_minimized_result(warm, "cached normalize time");
+		g_test_maximized_result(cold / MAX(warm, 1e-9),
+			"speedup over uncached");
+	}
+
+	g_timer_destroy(timer);
+	g_strfreev(names);
+	g_object_unref(account);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	gint res = 0;
+
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	g_assert_nonnull(purple_protocols_add(test_normalize_protocol_get_type(),
+		NULL));
+
+	g_test_add_func("/normalize/cached", test_normalize_cached);
+	g_test_add_func("/normalize/lru-eviction", test_normalize_lru_eviction);
+	g_test_add_func("/normalize/protocol-change",
+		test_normalize_protocol_change);
+	g_test_add_func("/normalize/no-account", test_normalize_no_account);
+	g_test_add_func("/normalize/threads", test_normalize_threads);
+	g_test_add_func("/normalize/perf", test_normalize_perf);
+
+	res = g_test_run();
+
+	return res;
+}
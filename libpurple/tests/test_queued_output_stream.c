@@ -254,6 +254,184 @@ test_queued_output_stream_push_bytes_async_error(void) {
 	g_clear_object(&output);
 }
 
+static void
+test_queued_output_stream_push_all(PurpleQueuedOutputStream *queued,
+		GAsyncReadyCallback callback, gint *done)
+{
+	const guint8 *data[] = {
+		test_bytes_data, test_bytes_data2, test_bytes_data3,
+		test_bytes_data2, test_bytes_data
+	};
+	const gsize data_len[] = {
+		test_bytes_data_len, test_bytes_data_len2, test_bytes_data_len3,
+		test_bytes_data_len2, test_bytes_data_len
+	};
+	gsize i;
+
+	*done = G_N_ELEMENTS(data);
+
+	for (i = 0; i < G_N_ELEMENTS(data); i++) {
+		GBytes *bytes = g_bytes_new_static(data[i], data_len[i]);
+		purple_queued_output_stream_push_bytes_async(queued, bytes,
+				G_PRIORITY_DEFAULT, NULL, callback, done);
+		g_bytes_unref(bytes);
+	}
+
+	while (*done > 0) {
+		g_main_context_iteration(NULL, TRUE);
+	}
+
+	g_assert_cmpint(*done, ==, 0);
+}
+
+static const gchar test_all_bytes_data[] = "123456789101112131415678912345";
+
+static void
+test_queued_output_stream_coalesce(void) {
+	GMemoryOutputStream *output;
+	PurpleQueuedOutputStream *queued;
+	GError *err = NULL;
+	gint done;
+
+	output = G_MEMORY_OUTPUT_STREAM(g_memory_output_stream_new_resizable());
+	queued = purple_queued_output_stream_new(G_OUTPUT_STREAM(output));
+
+	test_queued_output_stream_push_all(queued,
+			test_queued_output_stream_push_bytes_async_multiple_cb,
+			&done);
+
+	g_assert_cmpmem(g_memory_output_stream_get_data(output),
+			g_memory_output_stream_get_data_size(output),
+			test_all_bytes_data, strlen(test_all_bytes_data));
+
+	/* the first one is written immediately, the rest is merged */
+	g_assert_cmpuint(purple_queued_output_stream_get_writes_count(queued),
+			==, 2);
+	g_assert_cmpuint(purple_queued_output_stream_get_bytes_written(queued),
+			==, strlen(test_all_bytes_data));
+
+	g_assert_true(g_output_stream_close(
+			G_OUTPUT_STREAM(queued), NULL, &err));
+	g_assert_no_error(err);
+
+	g_clear_object(&queued);
+	g_clear_object(&output);
+}
+
+static void
+test_queued_output_stream_coalesce_disabled(void) {
+	GMemoryOutputStream *output;
+	PurpleQueuedOutputStream *queued;
+	GError *err = NULL;
+	gint done;
+
+	output = G_MEMORY_OUTPUT_STREAM(g_memory_output_stream_new_resizable());
+	queued = purple_queued_output_stream_new(G_OUTPUT_STREAM(output));
+	purple_queued_output_stream_set_coalesce_size(queued, 0);
+	g_assert_cmpuint(purple_queued_output_stream_get_coalesce_size(queued),
+			==, 0);
+
+	test_queued_output_stream_push_all(queued,
+			test_queued_output_stream_push_bytes_async_multiple_cb,
+			&done);
+
+	g_assert_cmpmem(g_memory_output_stream_get_data(output),
+			g_memory_output_stream_get_data_size(output),
+			test_all_bytes_data, strlen(test_all_bytes_data));
+
+	g_assert_cmpuint(purple_queued_output_stream_get_writes_count(queued),
+			==, 5);
+
+	g_assert_true(g_output_stream_close(
+			G_OUTPUT_STREAM(queued), NULL, &err));
+	g_assert_no_error(err);
+
+	g_clear_object(&queued);
+	g_clear_object(&output);
+}
+
+/* An output stream, which accepts only few bytes at once */
+typedef struct {
+	GOutputStream parent;
+	GByteArray *data;
+} TestShortOutputStream;
+
+typedef struct {
+	GOutputStreamClass parent_class;
+} TestShortOutputStreamClass;
+
+G_DEFINE_TYPE(TestShortOutputStream, test_short_output_stream,
+		G_TYPE_OUTPUT_STREAM)
+
+#define TEST_SHORT_OUTPUT_STREAM_MAX_WRITE 3
+
+static gssize
+test_short_output_stream_write(GOutputStream *stream, const void *buffer,
+		gsize count, GCancellable *cancellable, GError **error)
+{
+	TestShortOutputStream *short_stream = (TestShortOutputStream *)stream;
+
+	count = MIN(count, TEST_SHORT_OUTPUT_STREAM_MAX_WRITE);
+	g_byte_array_append(short_stream->data, buffer, count);
+
+	return count;
+}
+
+static void
+test_short_output_stream_finalize(GObject *obj)
+{
+	TestShortOutputStream *short_stream = (TestShortOutputStream *)obj;
+
+	g_byte_array_unref(short_stream->data);
+
+	G_OBJECT_CLASS(test_short_output_stream_parent_class)->finalize(obj);
+}
+
+static void
+test_short_output_stream_init(TestShortOutputStream *short_stream)
+{
+	short_stream->data = g_byte_array_new();
+}
+
+static void
+test_short_output_stream_class_init(TestShortOutputStreamClass *klass)
+{
+	G_OBJECT_CLASS(klass)->finalize = test_short_output_stream_finalize;
+	G_OUTPUT_STREAM_CLASS(klass)->write_fn = test_short_output_stream_write;
+}
+
+static void
+test_queued_output_stream_partial_write(void) {
+	TestShortOutputStream *output;
+	PurpleQueuedOutputStream *queued;
+	GError *err = NULL;
+	gint done;
+
+	output = g_object_new(test_short_output_stream_get_type(), NULL);
+	queued = purple_queued_output_stream_new(G_OUTPUT_STREAM(output));
+
+	test_queued_output_stream_push_all(queued,
+			test_queued_output_stream_push_bytes_async_multiple_cb,
+			&done);
+
+	g_assert_cmpmem(output->data->data, output->data->len,
+			test_all_bytes_data, strlen(test_all_bytes_data));
+
+	/* "123" and "45" of the first buffer, then 25 bytes of the rest in
+	 * 3 bytes long chunks */
+	g_assert_cmpuint(purple_queued_output_stream_get_writes_count(queued),
+			==, 11);
+	g_assert_cmpuint(purple_queued_output_stream_get_bytes_written(queued),
+			==, strlen(test_all_bytes_data));
+
+	g_assert_true(g_output_stream_close(
+			G_OUTPUT_STREAM(queued), NULL, &err));
+	g_assert_no_error(err);
+
+	g_clear_object(&queued);
+	g_clear_object(&output);
+}
+
 /******************************************************************************
  * Main
  *****************************************************************************/
@@ -271,6 +449,12 @@ main(gint argc, gchar **argv) {
 			test_queued_output_stream_push_bytes_async_multiple);
 	g_test_add_func("/queued-output-stream/push-bytes-async-error",
 			test_queued_output_stream_push_bytes_async_error);
+	g_test_add_func("/queued-output-stream/coalesce",
+			test_queued_output_stream_coalesce);
+	g_test_add_func("/queued-output-stream/coalesce-disabled",
+			test_queued_output_stream_coalesce_disabled);
+	g_test_add_func("/queued-output-stream/partial-write",
+			test_queued_output_stream_partial_write);
 
 	return g_test_run();
 }
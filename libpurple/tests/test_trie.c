@@ -339,6 +339,301 @@ test_trie_multi_find(void) {
 	g_slist_free_full(tries, g_object_unref);
 }
 
+static void
+test_trie_compact_replace(void) {
+	PurpleTrie *trie;
+	const gchar *in;
+	gchar *out;
+
+	trie = purple_trie_new();
+	purple_trie_set_reset_on_match(trie, FALSE);
+	purple_trie_set_compact(trie, TRUE);
+	g_assert_true(purple_trie_get_compact(trie));
+
+	purple_trie_add(trie, "test", (gpointer)0x1001);
+	purple_trie_add(trie, "testing", (gpointer)0x1002);
+	purple_trie_add(trie, "overtested", (gpointer)0x1003);
+	purple_trie_add(trie, "trie", (gpointer)0x1004);
+	purple_trie_add(trie, "tree", (gpointer)0x1005);
+	purple_trie_add(trie, "implement", (gpointer)0x1006);
+	purple_trie_add(trie, "implementation", (gpointer)0x1007);
+
+	in = "Alice is testing her trie implementation, "
+		"but she's far away from making test tree overtested";
+
+	out = purple_trie_replace(trie, in, test_trie_replace_cb, (gpointer)1);
+
+	g_assert_cmpstr(
+		"Alice is [1:1002] her [1:1004] [1:1006]ation,"
+		" but she's far away from making test [1:1005] [1:1003]",
+		==,
+		out
+	);
+
+	g_object_unref(trie);
+	g_free(out);
+}
+
+static void
+test_trie_compact_find(void) {
+	PurpleTrie *trie;
+	const gchar *in;
+	gint out;
+
+	trie = purple_trie_new();
+	purple_trie_set_reset_on_match(trie, FALSE);
+	purple_trie_set_compact(trie, TRUE);
+
+	purple_trie_add(trie, "alice", (gpointer)0x9001);
+	purple_trie_add(trie, "ali", (gpointer)0x9002);
+	purple_trie_add(trie, "al", (gpointer)0x9003);
+
+	in = "al ali alice";
+
+	find_sum = 0;
+	out = purple_trie_find(trie, in, test_trie_find_cb, (gpointer)9);
+
+	g_assert_cmpint(6, ==, out);
+	g_assert_cmpint(3 * 3 + 2 * 2 + 1, ==, find_sum);
+
+	g_object_unref(trie);
+}
+
+/* Builds a pseudo-random dictionary, wide enough to have some states
+ * converted to the dense table in the compact layout. */
+static gchar **
+test_trie_dictionary_new(guint count)
+{
+	GRand *rand;
+	GHashTable *seen;
+	gchar **words;
+	guint i;
+
+	rand = g_rand_new_with_seed(42);
+	/* words used explicitly by other tests aren't generated */
+	seen = g_hash_table_new(g_str_hash, g_str_equal);
+	g_hash_table_add(seen, (gpointer)"aab");
+	g_hash_table_add(seen, (gpointer)"xaab");
+
+	words = g_new0(gchar *, count + 1);
+	for (i = 0; i < count; i++) {
+		gint len = g_rand_int_range(rand, 3, 12);
+		gint j;
+
+		words[i] = g_new(gchar, len + 1);
+		for (j = 0; j < len; j++)
+			words[i][j] = g_rand_int_range(rand, 'a', 'z' + 1);
+		words[i][len] = '\0';
+
+		/* g_hash_table_add() would replace the key it already has */
+		if (g_hash_table_contains(seen, words[i])) {
+			g_free(words[i]);
+			i--;
+			continue;
+		}
+
+		g_hash_table_add(seen, words[i]);
+	}
+	g_hash_table_destroy(seen);
+	g_rand_free(rand);
+
+	return words;
+}
+
+static gulong
+test_trie_dictionary_run(PurpleTrie *trie, gchar **words, const gchar *text,
+	guint iterations, gdouble *elapsed)
+{
+	GTimer *timer;
+	gulong found = 0;
+	guint i;
+
+	for (i = 0; words[i] != NULL; i++)
+		purple_trie_add(trie, words[i], NULL);
+
+	timer = g_timer_new();
+	for (i = 0; i < iterations; i++)
+		found = purple_trie_find(trie, text, NULL, NULL);
+	*elapsed = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	return found;
+}
+
+static void
+test_trie_compact_dictionary(void) {
+	PurpleTrie *dense, *compact;
+	gchar **words;
+	GString *text;
+	gulong dense_size, compact_size;
+	gulong dense_found, compact_found;
+	gdouble dense_time, compact_time;
+	guint iterations = g_test_perf() ? 100 : 1;
+	guint i;
+
+	words = test_trie_dictionary_new(1000);
+	text = g_string_new(NULL);
+	for (i = 0; words[i] != NULL; i += 7) {
+		g_string_append(text, words[i]);
+		g_string_append_c(text, ' ');
+	}
+
+	dense = purple_trie_new();
+	purple_trie_set_reset_on_match(dense, FALSE);
+	compact = purple_trie_new();
+	purple_trie_set_reset_on_match(compact, FALSE);
+	purple_trie_set_compact(compact, TRUE);
+
+	dense_found = test_trie_dictionary_run(dense, words, text->str,
+		iterations, &dense_time);
+	compact_found = test_trie_dictionary_run(compact, words, text->str,
+		iterations, &compact_time);
+
+	g_object_get(dense, "states-size", &dense_size, NULL);
+	g_object_get(compact, "states-size", &compact_size, NULL);
+
+	g_assert_cmpuint(dense_found, >, 0);
+	g_assert_cmpuint(dense_found, ==, compact_found);
+	g_assert_cmpuint(compact_size, <, dense_size / 10);
+
+	g_test_message("dense layout: %lu bytes, %f s; "
+		"compact layout: %lu bytes, %f s",
+		dense_size, dense_time, compact_size, compact_time);
+	if (g_test_perf())
+		g_test_minimized_result(compact_time, "compact find time");
+
+	g_object_unref(dense);
+	g_object_unref(compact);
+	g_string_free(text, TRUE);
+	g_strfreev(words);
+}
+
+static gboolean
+test_trie_collect_cb(const gchar *word, gpointer word_data,
+	gpointer user_data)
+{
+	GString *found = user_data;
+
+	g_string_append_printf(found, "%s,", word);
+
+	return TRUE;
+}
+
+static gchar *
+test_trie_collect(PurpleTrie *trie, const gchar *text)
+{
+	GString *found = g_string_new(NULL);
+
+	purple_trie_find(trie, text, test_trie_collect_cb, found);
+
+	return g_string_free(found, FALSE);
+}
+
+static void
+test_trie_incremental_check(gboolean compact) {
+	PurpleTrie *updated, *fresh;
+	gchar **words;
+	GString *text;
+	gchar *updated_found, *fresh_found;
+	guint i;
+
+	words = test_trie_dictionary_new(600);
+	text = g_string_new("xaab aab ab b ");
+	for (i = 0; words[i] != NULL; i += 3) {
+		g_string_append(text, words[i]);
+		g_string_append(text, words[(i * 7) % 600] + 1);
+	}
+
+	updated = purple_trie_new();
+	purple_trie_set_reset_on_match(updated, FALSE);
+	purple_trie_set_compact(updated, compact);
+
+	/* build the automaton with a part of words, then update it */
+	purple_trie_add(updated, "xaab", NULL);
+	for (i = 0; i < 300; i++)
+		purple_trie_add(updated, words[i], NULL);
+	g_free(test_trie_collect(updated, text->str));
+
+	purple_trie_add(updated, "aab", NULL);
+	purple_trie_add(updated, "ab", NULL);
+	purple_trie_add(updated, "b", NULL);
+	for (i = 300; i < 600; i++) {
+		purple_trie_add(updated, words[i], NULL);
+		if (i % 50 == 0)
+			g_free(test_trie_collect(updated, text->str));
+	}
+	purple_trie_remove(updated, "aab");
+	for (i = 0; i < 600; i += 2)
+		purple_trie_remove(updated, words[i]);
+
+	fresh = purple_trie_new();
+	purple_trie_set_reset_on_match(fresh, FALSE);
+	purple_trie_add(fresh, "xaab", NULL);
+	purple_trie_add(fresh, "ab", NULL);
+	purple_trie_add(fresh, "b", NULL);
+	for (i = 1; i < 600; i += 2)
+		purple_trie_add(fresh, words[i], NULL);
+
+	g_assert_cmpuint(purple_trie_get_size(updated), ==,
+		purple_trie_get_size(fresh));
+
+	updated_found = test_trie_collect(updated, text->str);
+	fresh_found = test_trie_collect(fresh, text->str);
+	g_assert_cmpstr(updated_found, ==, fresh_found);
+
+	g_free(updated_found);
+	g_free(fresh_found);
+	g_object_unref(updated);
+	g_object_unref(fresh);
+	g_string_free(text, TRUE);
+	g_strfreev(words);
+}
+
+static void
+test_trie_incremental(void) {
+	test_trie_incremental_check(FALSE);
+}
+
+static void
+test_trie_incremental_compact(void) {
+	test_trie_incremental_check(TRUE);
+}
+
+static void
+test_trie_incremental_perf(void) {
+	PurpleTrie *trie;
+	gchar **words;
+	GTimer *timer;
+	guint count = g_test_perf() ? 20000 : 2000;
+	guint i;
+
+	words = test_trie_dictionary_new(count);
+
+	trie = purple_trie_new();
+	purple_trie_set_compact(trie, TRUE);
+	for (i = 0; i < count - 100; i++)
+		purple_trie_add(trie, words[i], NULL);
+	purple_trie_find(trie, "warm up", NULL, NULL);
+
+	/* every addition is followed by a search, like in the custom smileys
+	 * editor */
+	timer = g_timer_new();
+	for (; i < count; i++) {
+		purple_trie_add(trie, words[i], NULL);
+		purple_trie_find(trie, words[i], NULL, NULL);
+	}
+	g_test_message("100 additions to a trie of %u words: %f s",
+		count - 100, g_timer_elapsed(timer, NULL));
+	if (g_test_perf()) {
+		g_test_minimized_result(g_timer_elapsed(timer, NULL),
+			"incremental additions time");
+	}
+
+	g_timer_destroy(timer);
+	g_object_unref(trie);
+	g_strfreev(words);
+}
+
 gint
 main(gint argc, gchar **argv) {
 	g_test_init(&argc, &argv, NULL);
@@ -368,5 +663,19 @@ main(gint argc, gchar **argv) {
 	g_test_add_func("/trie/multi_find",
 	                test_trie_multi_find);
 
+	g_test_add_func("/trie/compact/replace",
+	                test_trie_compact_replace);
+	g_test_add_func("/trie/compact/find",
+	                test_trie_compact_find);
+	g_test_add_func("/trie/compact/dictionary",
+	                test_trie_compact_dictionary);
+
+	g_test_add_func("/trie/incremental/normal",
+	                test_trie_incremental);
+	g_test_add_func("/trie/incremental/compact",
+	                test_trie_incremental_compact);
+	g_test_add_func("/trie/incremental/perf",
+	                test_trie_incremental_perf);
+
 	return g_test_run();
 }
@@ -21,8 +21,13 @@
  *
  */
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
 
-#include "../xmlnode.h"
+#include <purple.h>
+
+#include "../internal.h"
+#include "test_ui.h"
 
 /*
  * If we really wanted to test the billion laughs attack we would
@@ -133,16 +138,353 @@ test_strip_prefixes(void) {
 	purple_xmlnode_free(xml);
 }
 
+static void
+test_xmlnode_attributes(void) {
+	PurpleXmlNode *xml, *copy;
+	char *str;
+
+	xml = purple_xmlnode_new("iq");
+	purple_xmlnode_set_attrib(xml, "type", "get");
+	purple_xmlnode_set_attrib(xml, "id", "purple1");
+	purple_xmlnode_set_attrib_full(xml, "lang", "http://www.w3.org/XML/1998/namespace", "xml", "en");
+	purple_xmlnode_insert_data(xml, "data", -1);
+	purple_xmlnode_set_attrib(xml, "to", "user@example.com");
+	purple_xmlnode_set_attrib(xml, "type", "set");
+
+	g_assert_cmpuint(4, ==, xml->n_attribs);
+	g_assert_cmpstr("set", ==, purple_xmlnode_get_attrib(xml, "type"));
+	g_assert_cmpstr("purple1", ==, purple_xmlnode_get_attrib(xml, "id"));
+	g_assert_cmpstr("en", ==, purple_xmlnode_get_attrib_with_namespace(xml, "lang", "http://www.w3.org/XML/1998/namespace"));
+	g_assert_null(purple_xmlnode_get_attrib_with_namespace(xml, "lang", NULL));
+	g_assert_null(purple_xmlnode_get_attrib(xml, "from"));
+
+	/* attributes aren't children */
+	g_assert_nonnull(xml->child);
+	g_assert_true(xml->child->type == PURPLE_XMLNODE_TYPE_DATA);
+	g_assert_null(xml->child->next);
+
+	purple_xmlnode_remove_attrib(xml, "id");
+	g_assert_null(purple_xmlnode_get_attrib(xml, "id"));
+	g_assert_cmpuint(3, ==, xml->n_attribs);
+
+	copy = purple_xmlnode_copy(xml);
+	purple_xmlnode_free(xml);
+
+	str = purple_xmlnode_to_str(copy, NULL);
+	g_assert_cmpstr("<iq xml:lang='en' to='user@example.com' type='set'>data</iq>", ==, str);
+	g_free(str);
+
+	purple_xmlnode_free(copy);
+}
+
+static void
+test_xmlnode_child_path(void) {
+	const char *xml_doc =
+		"<iq type='result' xmlns='jabber:client'>"
+			"<query xmlns='jabber:iq:roster'>"
+				"<item jid='a@example.com'><group>A</group></item>"
+				"<item jid='b@example.com'><group>B</group></item>"
+			"</query>"
+		"</iq>";
+	PurpleXmlNode *xml, *group;
+	char *data;
+
+	xml = purple_xmlnode_from_str(xml_doc, -1);
+	g_assert_nonnull(xml);
+
+	group = purple_xmlnode_get_child(xml, "query/item/group");
+	g_assert_nonnull(group);
+	data = purple_xmlnode_get_data(group);
+	g_assert_cmpstr("A", ==, data);
+	g_free(data);
+
+	g_assert_nonnull(purple_xmlnode_get_child_with_namespace(xml, "query/item", "jabber:iq:roster"));
+	g_assert_null(purple_xmlnode_get_child_with_namespace(xml, "query/item", "jabber:client"));
+	g_assert_null(purple_xmlnode_get_child(xml, "quer/item"));
+	g_assert_null(purple_xmlnode_get_child(xml, "query/items"));
+
+	purple_xmlnode_free(xml);
+}
+
+static void
+test_xmlnode_pool(void) {
+	PurpleMemoryPool *pool;
+	PurpleXmlNode *xml, *child, *copy;
+	char *str;
+
+	pool = purple_memory_pool_new();
+	g_object_add_weak_pointer(G_OBJECT(pool), (gpointer *)&pool);
+
+	xml = purple_xmlnode_new_in_pool(pool, "message");
+	purple_xmlnode_set_namespace(xml, "jabber:client");
+	purple_xmlnode_set_attrib(xml, "to", "user@example.com");
+	purple_xmlnode_set_attrib(xml, "type", "chat");
+	purple_xmlnode_set_attrib(xml, "id", "purple1");
+	purple_xmlnode_set_attrib(xml, "from", "other@example.com");
+	purple_xmlnode_set_attrib(xml, "xml:lang", "en");
+	child = purple_xmlnode_new_child(xml, "body");
+	purple_xmlnode_insert_data(child, "hello", -1);
+	purple_xmlnode_insert_child(xml, purple_xmlnode_new("active"));
+	g_object_unref(pool);
+
+	/* the tree keeps the pool alive */
+	g_assert_nonnull(pool);
+	g_assert_cmpuint(5, ==, xml->n_attribs);
+	g_assert_cmpstr("chat", ==, purple_xmlnode_get_attrib(xml, "type"));
+
+	copy = purple_xmlnode_copy(xml);
+	purple_xmlnode_free(xml);
+	g_assert_null(pool);
+
+	str = purple_xmlnode_to_str(copy, NULL);
+	g_assert_cmpstr("<message xmlns='jabber:client' to='user@example.com' "
+		"type='chat' id='purple1' from='other@example.com' xml:lang='en'>"
+		"<body>hello</body><active/></message>", ==, str);
+	g_free(str);
+
+	purple_xmlnode_free(copy);
+}
+
+/*
+ * Snapshots
+ */
+/* The header in front of a snapshot's payload, and where in it the payload's
+ * checksum and size are */
+#define TEST_XMLNODE_SNAPSHOT_HEADER   48
+#define TEST_XMLNODE_SNAPSHOT_CHECKSUM 12
+#define TEST_XMLNODE_SNAPSHOT_SIZE     40
+
+static const char *test_xmlnode_snapshot_doc =
+	"<purple version='1.0'>"
+		"<blist localized-default-group='Buddies'>"
+			"<group name='A &amp; B'>"
+				"<setting name='collapsed' type='bool'>1</setting>"
+				"<contact><buddy account='me' proto='prpl-test'>"
+					"<name>alice</name><alias></alias>"
+				"</buddy></contact>"
+			"</group>"
+			"<group/>"
+		"</blist>"
+		"<x:privacy xmlns:x='urn:test'><x:account mode='1'/></x:privacy>"
+	"</purple>";
+
+/* Writes the document to test.xml in a new directory and snapshots it */
+static gchar *
+test_xmlnode_snapshot_new(PurpleXmlNode **node)
+{
+	gchar *dir, *filename;
+
+	dir = g_dir_make_tmp("purple-xmlnode-XXXXXX", NULL);
+	g_assert_nonnull(dir);
+
+	filename = g_build_filename(dir, "test.xml", NULL);
+	g_assert_true(g_file_set_contents(filename, test_xmlnode_snapshot_doc,
+		-1, NULL));
+	g_free(filename);
+
+	*node = purple_xmlnode_from_str(test_xmlnode_snapshot_doc, -1);
+	g_assert_nonnull(*node);
+	_purple_xmlnode_write_snapshot(dir, "test.xml", *node);
+
+	return dir;
+}
+
+static void
+test_xmlnode_snapshot_free(gchar *dir)
+{
+	gchar *filename;
+
+	filename = g_build_filename(dir, "test.xml", NULL);
+	g_unlink(filename);
+	g_free(filename);
+
+	filename = g_build_filename(dir, "test.xml.snapshot", NULL);
+	g_unlink(filename);
+	g_free(filename);
+
+	g_rmdir(dir);
+	g_free(dir);
+}
+
+static void
+test_xmlnode_snapshot_round_trip(void) {
+	PurpleXmlNode *xml, *copy, *privacy;
+	gchar *dir, *expected, *str;
+
+	dir = test_xmlnode_snapshot_new(&xml);
+
+	copy = _purple_xmlnode_from_snapshot(dir, "test.xml");
+	g_assert_nonnull(copy);
+
+	expected = purple_xmlnode_to_str(xml, NULL);
+	str = purple_xmlnode_to_str(copy, NULL);
+	g_assert_cmpstr(expected, ==, str);
+	g_free(expected);
+	g_free(str);
+
+	/* prefixes and the namespaces they stand for come back too */
+	privacy = purple_xmlnode_get_child(copy, "privacy");
+	g_assert_nonnull(privacy);
+	g_assert_cmpstr("x", ==, purple_xmlnode_get_prefix(privacy));
+	g_assert_cmpstr("urn:test", ==, purple_xmlnode_get_namespace(privacy));
+	g_assert_cmpstr("A & B", ==, purple_xmlnode_get_attrib(
+		purple_xmlnode_get_child(copy, "blist/group"), "name"));
+
+	purple_xmlnode_free(xml);
+	purple_xmlnode_free(copy);
+	test_xmlnode_snapshot_free(dir);
+}
+
+static void
+test_xmlnode_snapshot_stale(void) {
+	PurpleXmlNode *xml;
+	gchar *dir, *filename, *contents;
+
+	dir = test_xmlnode_snapshot_new(&xml);
+	purple_xmlnode_free(xml);
+
+	/* the XML file was written again without the snapshot */
+	filename = g_build_filename(dir, "test.xml", NULL);
+	contents = g_strconcat(test_xmlnode_snapshot_doc, "\n", NULL);
+	g_assert_true(g_file_set_contents(filename, contents, -1, NULL));
+	g_assert_null(_purple_xmlnode_from_snapshot(dir, "test.xml"));
+	g_free(contents);
+
+	/* a snapshot is nothing without its XML file */
+	g_unlink(filename);
+	g_assert_null(_purple_xmlnode_from_snapshot(dir, "test.xml"));
+	g_free(filename);
+
+	test_xmlnode_snapshot_free(dir);
+}
+
+static void
+test_xmlnode_snapshot_corrupt(void) {
+	PurpleXmlNode *xml;
+	gchar *dir, *filename, *contents;
+	gsize length, payload;
+	guint32 checksum, value;
+	guint64 size;
+	gsize i;
+
+	dir = test_xmlnode_snapshot_new(&xml);
+	purple_xmlnode_free(xml);
+
+	filename = g_build_filename(dir, "test.xml.snapshot", NULL);
+	g_assert_true(g_file_get_contents(filename, &contents, &length, NULL));
+	g_assert_cmpuint(length, >, TEST_XMLNODE_SNAPSHOT_HEADER);
+
+	/* a damaged payload fails its checksum */
+	contents[length - 1] ^= 0x01;
+	g_assert_true(g_file_set_contents(filename, contents, length, NULL));
+	g_assert_null(_purple_xmlnode_from_snapshot(dir, "test.xml"));
+	contents[length - 1] ^= 0x01;
+
+	/* so does a short one */
+	g_assert_true(g_file_set_contents(filename, contents, length - 1, NULL));
+	g_assert_null(_purple_xmlnode_from_snapshot(dir, "test.xml"));
+
+	/* and one that isn't a snapshot at all */
+	g_assert_true(g_file_set_contents(filename, "<purple/>", -1, NULL));
+	g_assert_null(_purple_xmlnode_from_snapshot(dir, "test.xml"));
+
+	/* a payload cut in half with a header to match still doesn't make a
+	 * tree, and has to be turned down rather than read past its end */
+	payload = (length - TEST_XMLNODE_SNAPSHOT_HEADER) / 2;
+	checksum = 2166136261u;
+	for (i = 0; i < payload; i++) {
+		checksum ^= (guchar)contents[TEST_XMLNODE_SNAPSHOT_HEADER + i];
+		checksum *= 16777619u;
+	}
+	value = GUINT32_TO_LE(checksum);
+	memcpy(contents + TEST_XMLNODE_SNAPSHOT_CHECKSUM, &value, sizeof(value));
+	size = GUINT64_TO_LE(payload);
+	memcpy(contents + TEST_XMLNODE_SNAPSHOT_SIZE, &size, sizeof(size));
+	g_assert_true(g_file_set_contents(filename, contents,
+		TEST_XMLNODE_SNAPSHOT_HEADER + payload, NULL));
+	g_assert_null(_purple_xmlnode_from_snapshot(dir, "test.xml"));
+
+	g_free(contents);
+	g_free(filename);
+	test_xmlnode_snapshot_free(dir);
+}
+
+static void
+test_xmlnode_snapshot_prefs(void) {
+	GList *list = NULL;
+	PurpleXmlNode *node;
+	gchar *filename;
+
+	purple_prefs_add_none("/test_xmlnode");
+	purple_prefs_add_bool("/test_xmlnode/bool", FALSE);
+	purple_prefs_add_int("/test_xmlnode/int", 0);
+	purple_prefs_add_string("/test_xmlnode/string", NULL);
+	purple_prefs_add_string_list("/test_xmlnode/list", NULL);
+
+	purple_prefs_set_bool("/test_xmlnode/bool", TRUE);
+	purple_prefs_set_int("/test_xmlnode/int", 42);
+	purple_prefs_set_string("/test_xmlnode/string", "snap & shot");
+	list = g_list_append(list, "one");
+	list = g_list_append(list, "two");
+	purple_prefs_set_string_list("/test_xmlnode/list", list);
+	g_list_free(list);
+
+	/* saves prefs.xml along with its snapshot */
+	purple_prefs_uninit();
+
+	node = _purple_xmlnode_from_snapshot(purple_config_dir(), "prefs.xml");
+	g_assert_nonnull(node);
+	purple_xmlnode_free(node);
+
+	/* the prefs are read back from the snapshot, through the same handlers
+	 * that parse prefs.xml */
+	purple_prefs_init();
+
+	g_assert_true(purple_prefs_get_bool("/test_xmlnode/bool"));
+	g_assert_cmpint(42, ==, purple_prefs_get_int("/test_xmlnode/int"));
+	g_assert_cmpstr("snap & shot", ==,
+		purple_prefs_get_string("/test_xmlnode/string"));
+	list = purple_prefs_get_string_list("/test_xmlnode/list");
+	g_assert_cmpuint(2, ==, g_list_length(list));
+	g_assert_cmpstr("one", ==, list->data);
+	g_assert_cmpstr("two", ==, list->next->data);
+	g_list_free_full(list, g_free);
+
+	filename = g_build_filename(purple_config_dir(), "prefs.xml", NULL);
+	g_unlink(filename);
+	g_free(filename);
+	filename = g_build_filename(purple_config_dir(), "prefs.xml.snapshot",
+		NULL);
+	g_unlink(filename);
+	g_free(filename);
+}
+
 gint
 main(gint argc, gchar **argv) {
 	g_test_init(&argc, &argv, NULL);
 
+	test_ui_purple_init();
+
 	g_test_add_func("/xmlnode/billion_laughs_attack",
 	                test_xmlnode_billion_laughs_attack);
 	g_test_add_func("/xmlnode/prefixes",
 	                test_xmlnode_prefixes);
 	g_test_add_func("/xmlnode/strip_prefixes",
 	                test_strip_prefixes);
+	g_test_add_func("/xmlnode/attributes",
+	                test_xmlnode_attributes);
+	g_test_add_func("/xmlnode/child_path",
+	                test_xmlnode_child_path);
+	g_test_add_func("/xmlnode/pool",
+	                test_xmlnode_pool);
+	g_test_add_func("/xmlnode/snapshot/round_trip",
+	                test_xmlnode_snapshot_round_trip);
+	g_test_add_func("/xmlnode/snapshot/stale",
+	                test_xmlnode_snapshot_stale);
+	g_test_add_func("/xmlnode/snapshot/corrupt",
+	                test_xmlnode_snapshot_corrupt);
+	g_test_add_func("/xmlnode/snapshot/prefs",
+	                test_xmlnode_snapshot_prefs);
 
 	return g_test_run();
 }
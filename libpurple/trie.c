@@ -28,7 +28,7 @@
 #include "memorypool.h"
 
 /* A single internal (that don't have any children) consists
- * of 256 + 4 pointers. That's 1040 bytes on 32-bit machine or 2080 bytes
+ * of about 256 + 10 pointers. That's 1064 bytes on 32-bit machine or 2128 bytes
  * on 64-bit.
  *
  * Thus, in 10500-byte pool block we can hold about 5-10 internal states.
@@ -39,6 +39,18 @@
 #define PURPLE_TRIE_STATES_SMALL_POOL_BLOCK_SIZE 10880
 #define PURPLE_TRIE_STATES_LARGE_POOL_BLOCK_SIZE 102400
 
+/* In the compact layout, children of a state are kept in a sorted array of
+ * keys and a parallel array of pointers, allocated together. It starts with
+ * room for a couple of children and doubles when it's full. Once a state has
+ * more than PURPLE_TRIE_DENSE_THRESHOLD children, it's converted to a dense
+ * table (the same one, that is used in the default layout), because binary
+ * search over such wide state would be slower and the table wouldn't waste
+ * much memory anyway. The root state is always dense, because it's the one
+ * visited most often (after every mismatch).
+ */
+#define PURPLE_TRIE_SPARSE_INITIAL_SIZE 2
+#define PURPLE_TRIE_DENSE_THRESHOLD 32
+
 typedef struct _PurpleTrieRecord PurpleTrieRecord;
 typedef struct _PurpleTrieState PurpleTrieState;
 typedef struct _PurpleTrieRecordList PurpleTrieRecordList;
@@ -56,6 +68,7 @@ struct _PurpleTrie
 typedef struct
 {
 	gboolean reset_on_match;
+	gboolean compact;
 
 	PurpleMemoryPool *records_str_mempool;
 	PurpleMemoryPool *records_obj_mempool;
@@ -65,6 +78,8 @@ typedef struct
 
 	PurpleMemoryPool *states_mempool;
 	PurpleTrieState *root_state;
+	gulong states_size;
+	gulong states_wasted;
 } PurpleTriePrivate;
 
 struct _PurpleTrieRecord
@@ -86,10 +101,31 @@ struct _PurpleTrieRecordList
 struct _PurpleTrieState
 {
 	PurpleTrieState *parent;
-	PurpleTrieState **children;
 
+	/* If keys is NULL, children is a dense table of 256 pointers (or NULL,
+	 * if there are no children). Otherwise, children and keys are sorted
+	 * arrays of children_alloc elements (children_count of them used). */
+	PurpleTrieState **children;
+	guchar *keys;
+	guint16 children_count;
+	guint16 children_alloc;
+
+	/* the character leading from the parent and the length of prefix */
+	guchar character;
+	guint depth;
+
+	/* Suffix links form a tree (rooted at the root state), which is needed
+	 * to update the automaton without rebuilding it. suffix_children is
+	 * a list of states having this one as their longest_suffix, linked
+	 * with suffix_next and suffix_prev fields. */
 	PurpleTrieState *longest_suffix;
+	PurpleTrieState *suffix_children;
+	PurpleTrieState *suffix_next;
+	PurpleTrieState *suffix_prev;
 
+	/* own_word is the word ending exactly at this state, found_word is
+	 * the longest word being a suffix of this state (possibly own_word) */
+	PurpleTrieRecord *own_word;
 	PurpleTrieRecord *found_word;
 };
 
@@ -110,6 +146,8 @@ enum
 {
 	PROP_ZERO,
 	PROP_RESET_ON_MATCH,
+	PROP_COMPACT,
+	PROP_STATES_SIZE,
 	PROP_LAST
 };
 
@@ -208,7 +246,198 @@ purple_trie_states_cleanup(PurpleTriePrivate *priv)
 	if (priv->root_state != NULL) {
 		purple_memory_pool_cleanup(priv->states_mempool);
 		priv->root_state = NULL;
+		priv->states_size = 0;
+		priv->states_wasted = 0;
+	}
+}
+
+/* Every block of the states pool is aligned to a pointer, so the sizes are
+ * counted with the padding, that follows them. */
+static inline gsize
+purple_trie_states_block_size(gsize size)
+{
+	return (size + sizeof(gpointer) - 1) & ~(sizeof(gpointer) - 1);
+}
+
+static gpointer
+purple_trie_states_alloc0(PurpleTriePrivate *priv, gsize size)
+{
+	gpointer mem;
+
+	mem = purple_memory_pool_alloc0(priv->states_mempool, size,
+		sizeof(gpointer));
+	if (mem != NULL)
+		priv->states_size += purple_trie_states_block_size(size);
+
+	return mem;
+}
+
+static void
+purple_trie_states_free(PurpleTriePrivate *priv, gpointer mem, gsize size)
+{
+	purple_memory_pool_free(priv->states_mempool, mem);
+
+	size = purple_trie_states_block_size(size);
+	priv->states_size -= size;
+	priv->states_wasted += size;
+}
+
+static inline gsize
+purple_trie_children_size(const PurpleTrieState *state)
+{
+	if (state->keys == NULL)
+		return 256 * sizeof(gpointer);
+	return state->children_alloc * (sizeof(gpointer) + sizeof(guchar));
+}
+
+static inline PurpleTrieState *
+purple_trie_state_get_child(const PurpleTrieState *state, guchar character)
+{
+	guint lo, hi;
+
+	if (state->keys == NULL) {
+		if (state->children == NULL)
+			return NULL;
+		return state->children[character];
+	}
+
+	lo = 0;
+	hi = state->children_count;
+	while (lo < hi) {
+		guint mid = (lo + hi) / 2;
+
+		if (state->keys[mid] < character)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+
+	if (lo < state->children_count && state->keys[lo] == character)
+		return state->children[lo];
+	return NULL;
+}
+
+static PurpleTrieState **
+purple_trie_children_dense_new(PurpleTriePrivate *priv)
+{
+	/* PurpleTrieState *children[G_MAXUCHAR + 1] */
+	return purple_trie_states_alloc0(priv, 256 * sizeof(gpointer));
+}
+
+/* Allocates sparse arrays for children and keys within a single block. */
+static gboolean
+purple_trie_children_sparse_resize(PurpleTriePrivate *priv,
+	PurpleTrieState *state, guint16 new_alloc)
+{
+	PurpleTrieState **children;
+	guchar *keys;
+
+	children = purple_trie_states_alloc0(priv,
+		new_alloc * (sizeof(gpointer) + sizeof(guchar)));
+	g_return_val_if_fail(children != NULL, FALSE);
+	keys = (guchar *)(children + new_alloc);
+
+	if (state->children_count > 0) {
+		memcpy(children, state->children,
+			state->children_count * sizeof(gpointer));
+		memcpy(keys, state->keys, state->children_count);
+	}
+	if (state->children != NULL) {
+		purple_trie_states_free(priv, state->children,
+			purple_trie_children_size(state));
+	}
+
+	state->children = children;
+	state->keys = keys;
+	state->children_alloc = new_alloc;
+
+	return TRUE;
+}
+
+static gboolean
+purple_trie_children_make_dense(PurpleTriePrivate *priv,
+	PurpleTrieState *state)
+{
+	PurpleTrieState **children;
+	guint i;
+
+	children = purple_trie_children_dense_new(priv);
+	g_return_val_if_fail(children != NULL, FALSE);
+
+	for (i = 0; i < state->children_count; i++)
+		children[state->keys[i]] = state->children[i];
+
+	purple_trie_states_free(priv, state->children,
+		purple_trie_children_size(state));
+
+	state->children = children;
+	state->keys = NULL;
+	state->children_alloc = 0;
+
+	return TRUE;
+}
+
+static gboolean
+purple_trie_state_set_child(PurpleTriePrivate *priv, PurpleTrieState *state,
+	guchar character, PurpleTrieState *child)
+{
+	guint pos;
+
+	if (state->children == NULL) {
+		/* The root state is hot, so keep it dense. */
+		if (priv->compact && state->parent != NULL) {
+			if (!purple_trie_children_sparse_resize(priv, state,
+				PURPLE_TRIE_SPARSE_INITIAL_SIZE))
+			{
+				return FALSE;
+			}
+		} else {
+			state->children = purple_trie_children_dense_new(priv);
+			if (state->children == NULL)
+				return FALSE;
+		}
+	}
+
+	if (state->keys == NULL) {
+		if (state->children[character] == NULL)
+			state->children_count++;
+		state->children[character] = child;
+		return TRUE;
+	}
+
+	for (pos = 0; pos < state->children_count; pos++) {
+		if (state->keys[pos] >= character)
+			break;
+	}
+	if (pos < state->children_count && state->keys[pos] == character) {
+		state->children[pos] = child;
+		return TRUE;
+	}
+
+	if (state->children_count == state->children_alloc) {
+		if (state->children_count >= PURPLE_TRIE_DENSE_THRESHOLD) {
+			if (!purple_trie_children_make_dense(priv, state))
+				return FALSE;
+			state->children[character] = child;
+			state->children_count++;
+			return TRUE;
+		}
+		if (!purple_trie_children_sparse_resize(priv, state,
+			state->children_alloc * 2))
+		{
+			return FALSE;
+		}
+	}
+
+	memmove(state->children + pos + 1, state->children + pos,
+		(state->children_count - pos) * sizeof(gpointer));
+	memmove(state->keys + pos + 1, state->keys + pos,
+		state->children_count - pos);
+	state->children[pos] = child;
+	state->keys[pos] = character;
+	state->children_count++;
+
+	return TRUE;
 }
 
 /* Allocates a state and binds it to the parent. */
@@ -218,33 +447,115 @@ purple_trie_state_new(PurpleTriePrivate *priv, PurpleTrieState *parent,
 {
 	PurpleTrieState *state;
 
-	state = purple_memory_pool_alloc0(priv->states_mempool,
-		sizeof(PurpleTrieState), sizeof(gpointer));
+	state = purple_trie_states_alloc0(priv, sizeof(PurpleTrieState));
 	g_return_val_if_fail(state != NULL, NULL);
 
 	if (parent == NULL)
 		return state;
 
 	state->parent = parent;
-	if (parent->children == NULL) {
-		parent->children = purple_memory_pool_alloc0(
-			priv->states_mempool,
-			/* PurpleTrieState *children[G_MAXUCHAR + 1] */
-			256 * sizeof(gpointer),
-			sizeof(gpointer));
-	}
-
-	if (parent->children == NULL) {
-		purple_memory_pool_free(priv->states_mempool, state);
+	state->character = character;
+	state->depth = parent->depth + 1;
+	if (!purple_trie_state_set_child(priv, parent, character, state)) {
+		purple_trie_states_free(priv, state, sizeof(PurpleTrieState));
 		g_warn_if_reached();
 		return NULL;
 	}
 
-	parent->children[character] = state;
-
 	return state;
 }
 
+static void
+purple_trie_state_unset_child(PurpleTrieState *state, guchar character)
+{
+	guint pos;
+
+	g_return_if_fail(state->children != NULL);
+
+	if (state->keys == NULL) {
+		g_return_if_fail(state->children[character] != NULL);
+		state->children[character] = NULL;
+		state->children_count--;
+		return;
+	}
+
+	for (pos = 0; pos < state->children_count; pos++) {
+		if (state->keys[pos] == character)
+			break;
+	}
+	g_return_if_fail(pos < state->children_count);
+
+	state->children_count--;
+	memmove(state->children + pos, state->children + pos + 1,
+		(state->children_count - pos) * sizeof(gpointer));
+	memmove(state->keys + pos, state->keys + pos + 1,
+		state->children_count - pos);
+}
+
+/* Frees a state, that is already detached from the automaton. */
+static void
+purple_trie_state_free(PurpleTriePrivate *priv, PurpleTrieState *state)
+{
+	if (state->children != NULL) {
+		purple_trie_states_free(priv, state->children,
+			purple_trie_children_size(state));
+	}
+	purple_trie_states_free(priv, state, sizeof(PurpleTrieState));
+}
+
+/* Moves a state in the tree of suffix links. If suffix is NULL, the state is
+ * just detached from it. */
+static void
+purple_trie_state_set_suffix(PurpleTrieState *state, PurpleTrieState *suffix)
+{
+	if (state->longest_suffix != NULL) {
+		if (state->suffix_prev != NULL)
+			state->suffix_prev->suffix_next = state->suffix_next;
+		else
+			state->longest_suffix->suffix_children = state->suffix_next;
+		if (state->suffix_next != NULL)
+			state->suffix_next->suffix_prev = state->suffix_prev;
+	}
+
+	state->longest_suffix = suffix;
+	state->suffix_prev = NULL;
+	state->suffix_next = NULL;
+	if (suffix == NULL)
+		return;
+
+	state->suffix_next = suffix->suffix_children;
+	if (state->suffix_next != NULL)
+		state->suffix_next->suffix_prev = state;
+	suffix->suffix_children = state;
+}
+
+/* Visits (in pre-order) all states having the start state as their suffix,
+ * without the start state itself. If visit_cb returns FALSE, the subtree of
+ * the visited state is skipped. The callback must not alter the tree
+ * of suffix links. */
+static void
+purple_trie_suffix_subtree_foreach(PurpleTrieState *start,
+	gboolean (*visit_cb)(PurpleTrieState *state, gpointer user_data),
+	gpointer user_data)
+{
+	PurpleTrieState *state = start->suffix_children;
+
+	while (state != NULL) {
+		if (visit_cb(state, user_data) &&
+			state->suffix_children != NULL)
+		{
+			state = state->suffix_children;
+			continue;
+		}
+
+		while (state != start && state->suffix_next == NULL)
+			state = state->longest_suffix;
+		if (state == start)
+			break;
+		state = state->suffix_next;
+	}
+}
+
 static gboolean
 purple_trie_states_build(PurpleTriePrivate *priv)
 {
@@ -287,14 +598,15 @@ purple_trie_states_build(PurpleTriePrivate *priv)
 			PurpleTrieRecord *rec = it->rec;
 			guchar character = rec->word[cur_len];
 			PurpleTrieState *prefix = it->extra_data;
-			PurpleTrieState *lon_suf_parent;
+			PurpleTrieState *lon_suf_parent, *child;
 
 			g_assert(character != '\0');
 
-			if (prefix->children && prefix->children[character]) {
+			child = purple_trie_state_get_child(prefix, character);
+			if (child != NULL) {
 				/* Word's prefix is already in the trie, added
 				 * by the other word. */
-				prefix = prefix->children[character];
+				prefix = child;
 			} else {
 				/* We need to create a new branch of trie. */
 				prefix = purple_trie_state_new(priv, prefix,
@@ -310,9 +622,10 @@ purple_trie_states_build(PurpleTriePrivate *priv)
 
 			/* The whole word is now added to the trie. */
 			if (rec->word[cur_len + 1] == '\0') {
-				if (prefix->found_word == NULL)
+				if (prefix->own_word == NULL) {
+					prefix->own_word = rec;
 					prefix->found_word = rec;
-				else {
+				} else {
 					purple_debug_warning("trie", "found "
 						"a collision of \"%s\" words",
 						rec->word);
@@ -330,18 +643,16 @@ purple_trie_states_build(PurpleTriePrivate *priv)
 			if (prefix->longest_suffix != NULL)
 				continue;
 			lon_suf_parent = prefix->parent->longest_suffix;
+			child = NULL;
 			while (lon_suf_parent) {
-				if (lon_suf_parent->children &&
-					lon_suf_parent->children[character])
-				{
-					prefix->longest_suffix = lon_suf_parent->
-						children[character];
+				child = purple_trie_state_get_child(
+					lon_suf_parent, character);
+				if (child != NULL)
 					break;
-				}
 				lon_suf_parent = lon_suf_parent->longest_suffix;
 			}
-			if (prefix->longest_suffix == NULL)
-				prefix->longest_suffix = root;
+			purple_trie_state_set_suffix(prefix,
+				child != NULL ? child : root);
 			if (prefix->found_word == NULL) {
 				prefix->found_word =
 					prefix->longest_suffix->found_word;
@@ -351,9 +662,164 @@ purple_trie_states_build(PurpleTriePrivate *priv)
 
 	g_object_unref(reclist_mpool);
 
+	/* Only the memory wasted by later updates counts, see
+	 * purple_trie_states_check_wasted. */
+	priv->states_wasted = 0;
+
+	return TRUE;
+}
+
+/*******************************************************************************
+ * Incremental updates
+ ******************************************************************************/
+
+typedef struct
+{
+	guchar character;
+	GSList *affected;
+} PurpleTrieSuffixSearch;
+
+static gboolean
+purple_trie_find_affected_cb(PurpleTrieState *state, gpointer _search)
+{
+	PurpleTrieSuffixSearch *search = _search;
+	PurpleTrieState *child;
+
+	child = purple_trie_state_get_child(state, search->character);
+	if (child == NULL)
+		return TRUE;
+
+	/* The child of this state has the new state as its longest suffix now.
+	 * States below already have a longer suffix (that's this state). */
+	search->affected = g_slist_prepend(search->affected, child);
+	return FALSE;
+}
+
+static gboolean
+purple_trie_update_found_word_cb(PurpleTrieState *state, gpointer unused)
+{
+	/* this state (and its subtree) doesn't depend on the changed one */
+	if (state->own_word != NULL)
+		return FALSE;
+
+	state->found_word = state->longest_suffix->found_word;
+	return TRUE;
+}
+
+/* Adds a record to the already built automaton. It only creates states for
+ * the new suffix of the word and updates suffix links, that should point to
+ * them now. */
+static gboolean
+purple_trie_states_insert(PurpleTriePrivate *priv, PurpleTrieRecord *rec)
+{
+	PurpleTrieState *state = priv->root_state;
+	guint i;
+
+	for (i = 0; i < rec->word_len; i++) {
+		guchar character = rec->word[i];
+		PurpleTrieState *child, *suffix, *lon_suf_parent;
+		PurpleTrieSuffixSearch search;
+		GSList *it;
+
+		child = purple_trie_state_get_child(state, character);
+		if (child != NULL) {
+			state = child;
+			continue;
+		}
+
+		child = purple_trie_state_new(priv, state, character);
+		g_return_val_if_fail(child != NULL, FALSE);
+
+		suffix = NULL;
+		lon_suf_parent = state->longest_suffix;
+		while (lon_suf_parent) {
+			suffix = purple_trie_state_get_child(lon_suf_parent,
+				character);
+			if (suffix != NULL)
+				break;
+			lon_suf_parent = lon_suf_parent->longest_suffix;
+		}
+		if (suffix == NULL)
+			suffix = priv->root_state;
+
+		/* Every state, that has the parent as its suffix and
+		 * a child for the same character, may need to point at
+		 * the new state now. Their former suffix was the same, as
+		 * the suffix of new state, so found_word doesn't change. */
+		search.character = character;
+		search.affected = NULL;
+		purple_trie_suffix_subtree_foreach(state,
+			purple_trie_find_affected_cb, &search);
+
+		purple_trie_state_set_suffix(child, suffix);
+		child->found_word = suffix->found_word;
+
+		for (it = search.affected; it != NULL; it = it->next)
+			purple_trie_state_set_suffix(it->data, child);
+		g_slist_free(search.affected);
+
+		state = child;
+	}
+
+	g_return_val_if_fail(state->own_word == NULL, FALSE);
+	state->own_word = rec;
+	state->found_word = rec;
+	purple_trie_suffix_subtree_foreach(state,
+		purple_trie_update_found_word_cb, NULL);
+
+	return TRUE;
+}
+
+/* Removes a record from the already built automaton, releasing states that
+ * aren't a prefix of any other word. */
+static gboolean
+purple_trie_states_remove(PurpleTriePrivate *priv, PurpleTrieRecord *rec)
+{
+	PurpleTrieState *state = priv->root_state;
+	guint i;
+
+	for (i = 0; i < rec->word_len && state != NULL; i++)
+		state = purple_trie_state_get_child(state, rec->word[i]);
+	g_return_val_if_fail(state != NULL, FALSE);
+	g_return_val_if_fail(state->own_word == rec, FALSE);
+
+	state->own_word = NULL;
+	state->found_word = state->longest_suffix->found_word;
+	purple_trie_suffix_subtree_foreach(state,
+		purple_trie_update_found_word_cb, NULL);
+
+	while (state != priv->root_state && state->own_word == NULL &&
+		state->children_count == 0)
+	{
+		PurpleTrieState *parent = state->parent;
+
+		/* States having the removed one as their longest suffix fall
+		 * back to the next one. It had no own word, so their
+		 * found_word stays the same. */
+		while (state->suffix_children != NULL) {
+			purple_trie_state_set_suffix(state->suffix_children,
+				state->longest_suffix);
+		}
+		purple_trie_state_set_suffix(state, NULL);
+
+		purple_trie_state_unset_child(parent, state->character);
+		purple_trie_state_free(priv, state);
+
+		state = parent;
+	}
+
 	return TRUE;
 }
 
+/* Memory pool doesn't reuse freed memory, so after many updates it's better to
+ * rebuild the automaton from scratch (at the next search). */
+static void
+purple_trie_states_check_wasted(PurpleTriePrivate *priv)
+{
+	if (priv->states_wasted > priv->states_size)
+		purple_trie_states_cleanup(priv);
+}
+
 /*******************************************************************************
  * Searching
  ******************************************************************************/
@@ -363,10 +829,13 @@ purple_trie_advance(PurpleTrieMachine *m, const guchar character)
 {
 	/* change state after processing a character */
 	while (TRUE) {
+		PurpleTrieState *child;
+
 		/* Perfect fit - next character is the same, as the child of the
 		 * prefix we reached so far. */
-		if (m->state->children && m->state->children[character]) {
-			m->state = m->state->children[character];
+		child = purple_trie_state_get_child(m->state, character);
+		if (child != NULL) {
+			m->state = child;
 			break;
 		}
 
@@ -679,11 +1148,6 @@ purple_trie_add(PurpleTrie *trie, const gchar *word, gpointer data)
 		return FALSE;
 	}
 
-	/* Every change in a trie invalidates longest_suffix map.
-	 * These prefixes could be updated instead of cleaning the whole graph.
-	 */
-	purple_trie_states_cleanup(priv);
-
 	rec = purple_memory_pool_alloc(priv->records_obj_mempool,
 		sizeof(PurpleTrieRecord), sizeof(gpointer));
 	rec->word = purple_memory_pool_strdup(priv->records_str_mempool, word);
@@ -696,6 +1160,14 @@ purple_trie_add(PurpleTrie *trie, const gchar *word, gpointer data)
 		priv->records, rec);
 	g_hash_table_insert(priv->records_map, rec->word, priv->records);
 
+	/* If the automaton is already built, update it in place. Otherwise,
+	 * it will be built on the next search. */
+	if (priv->root_state != NULL) {
+		if (!purple_trie_states_insert(priv, rec))
+			purple_trie_states_cleanup(priv);
+		purple_trie_states_check_wasted(priv);
+	}
+
 	return TRUE;
 }
 
@@ -716,7 +1188,11 @@ purple_trie_remove(PurpleTrie *trie, const gchar *word)
 		return;
 
 	/* see purple_trie_add */
-	purple_trie_states_cleanup(priv);
+	if (priv->root_state != NULL) {
+		if (!purple_trie_states_remove(priv, it->rec))
+			purple_trie_states_cleanup(priv);
+		purple_trie_states_check_wasted(priv);
+	}
 
 	priv->records_total_size -= it->rec->word_len;
 	priv->records = purple_record_list_remove(priv->records, it);
@@ -766,6 +1242,34 @@ purple_trie_set_reset_on_match(PurpleTrie *trie, gboolean reset)
 	g_object_notify_by_pspec(G_OBJECT(trie), properties[PROP_RESET_ON_MATCH]);
 }
 
+gboolean
+purple_trie_get_compact(PurpleTrie *trie)
+{
+	PurpleTriePrivate *priv = NULL;
+
+	g_return_val_if_fail(PURPLE_IS_TRIE(trie), FALSE);
+
+	priv = purple_trie_get_instance_private(trie);
+	return priv->compact;
+}
+
+void
+purple_trie_set_compact(PurpleTrie *trie, gboolean compact)
+{
+	PurpleTriePrivate *priv = NULL;
+
+	g_return_if_fail(PURPLE_IS_TRIE(trie));
+
+	priv = purple_trie_get_instance_private(trie);
+	if (priv->compact == compact)
+		return;
+
+	/* states will be rebuilt with the new layout on the next search */
+	purple_trie_states_cleanup(priv);
+	priv->compact = compact;
+	g_object_notify_by_pspec(G_OBJECT(trie), properties[PROP_COMPACT]);
+}
+
 /*******************************************************************************
  * Object stuff
  ******************************************************************************/
@@ -815,6 +1319,12 @@ purple_trie_get_property(GObject *obj, guint param_id, GValue *value,
 		case PROP_RESET_ON_MATCH:
 			g_value_set_boolean(value, priv->reset_on_match);
 			break;
+		case PROP_COMPACT:
+			g_value_set_boolean(value, priv->compact);
+			break;
+		case PROP_STATES_SIZE:
+			g_value_set_ulong(value, priv->states_size);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, param_id, pspec);
 	}
@@ -831,6 +1341,10 @@ purple_trie_set_property(GObject *obj, guint param_id,
 		case PROP_RESET_ON_MATCH:
 			priv->reset_on_match = g_value_get_boolean(value);
 			break;
+		case PROP_COMPACT:
+			purple_trie_set_compact(trie,
+				g_value_get_boolean(value));
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, param_id, pspec);
 	}
@@ -854,5 +1368,21 @@ purple_trie_class_init(PurpleTrieClass *klass)
 		"you perform only find operations.", TRUE,
 		G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
 
+	properties[PROP_COMPACT] = g_param_spec_boolean("compact",
+		"Compact", "Determines, if the internal states should use "
+		"a compact layout, where most of the states keep a sorted array "
+		"of their children instead of a full 256-entry table. It "
+		"greatly reduces memory usage for large tries at a small cost "
+		"of search speed.", FALSE,
+		G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
+
+	properties[PROP_STATES_SIZE] = g_param_spec_ulong("states-size",
+		"States size", "The number of bytes allocated for the "
+		"internal states, that were built for the last search, "
+		"including their children tables and alignment padding. "
+		"The words and their data are not counted.",
+		0, G_MAXULONG, 0,
+		G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
 	g_object_class_install_properties(obj_class, PROP_LAST, properties);
 }
@@ -34,19 +34,20 @@
  * within multiple source texts (or a single, big one).
  *
  * It's preparation time is <literal>O(p)</literal>, where <literal>p</literal>
- * is the total length of searched phrases. In current implementation, the
- * internal structure is invalidated after every modification of the
- * #PurpleTrie's contents, so it's not efficient to do alternating modifications
- * and searches. Search time does not depend on patterns being stored within
- * a trie and is always <literal>O(n)</literal>, where <literal>n</literal> is
- * the size of a text.
+ * is the total length of searched phrases. The internal structure is built on
+ * the first search and later modifications of the #PurpleTrie's contents
+ * update it in place, so alternating modifications and searches is cheap.
+ * Search time does not depend on patterns being stored within a trie and is
+ * always <literal>O(n)</literal>, where <literal>n</literal> is the size
+ * of a text.
  *
  * Its main drawback is a significant memory usage - every internal trie node
  * needs about 1kB of memory on 32-bit machine and 2kB on 64-bit. Fortunately,
  * the trie grows slower when more words (with common prefixes) are added.
- * We could avoid invalidating the whole tree when altering it, but it would
- * require figuring out, how to update <literal>longest_suffix</literal> fields
- * in satisfying time.
+ * For large sets of phrases (like spell-checking dictionaries), you may
+ * enable #PurpleTrie:compact layout, where most nodes keep only a sorted array
+ * of their children. It needs a few dozens of bytes per node at the cost of
+ * a binary search on every step.
  */
 
 #include <glib-object.h>
@@ -139,6 +140,33 @@ purple_trie_get_reset_on_match(PurpleTrie *trie);
 void
 purple_trie_set_reset_on_match(PurpleTrie *trie, gboolean reset);
 
+/**
+ * purple_trie_get_compact:
+ * @trie: the trie.
+ *
+ * Checks, if the trie uses compact layout of its internal states.
+ *
+ * Returns: %TRUE, if trie uses compact layout, %FALSE otherwise.
+ */
+gboolean
+purple_trie_get_compact(PurpleTrie *trie);
+
+/**
+ * purple_trie_set_compact:
+ * @trie: the trie.
+ * @compact: %TRUE, if trie should use compact layout, %FALSE otherwise.
+ *
+ * Selects the layout of trie's internal states. By default, every internal
+ * state holds a table of 256 pointers to its children, which makes searching
+ * fast, but takes a lot of memory. The compact layout keeps sorted arrays of
+ * children for all states but the root and the ones with many children.
+ *
+ * Changing the layout invalidates trie's internal structure, so it will be
+ * rebuilt on the next search.
+ */
+void
+purple_trie_set_compact(PurpleTrie *trie, gboolean compact);
+
 /**
  * purple_trie_add:
  * @trie: the trie.
@@ -148,10 +176,11 @@ purple_trie_set_reset_on_match(PurpleTrie *trie, gboolean reset);
  * Adds a word to the trie. Current implementation doesn't allow for duplicates,
  * so please avoid adding those.
  *
- * Please note, that altering a trie invalidates its internal structure, so by
- * the occasion of next search, it will be rebuilt. It's done in
- * <literal>O(n)</literal>, where n is the total length of strings
- * in #PurpleTrie.
+ * If the trie's internal structure is already built, it's updated in place.
+ * It takes time proportional to the length of @word and the number of
+ * internal states having its prefixes as a suffix, instead of rebuilding
+ * the whole structure in <literal>O(n)</literal>, where n is the total length
+ * of strings in #PurpleTrie.
  *
  * Returns: %TRUE if succeeded, %FALSE otherwise.
  */
@@ -167,8 +196,7 @@ purple_trie_add(PurpleTrie *trie, const gchar *word, gpointer data);
  * free allocated memory (that will be freed when destroying the whole
  * collection), so use it wisely. See #purple_memory_pool_free.
  *
- * Please note, that altering a trie invalidates its internal structure.
- * See #purple_trie_add.
+ * The trie's internal structure is updated in place, see #purple_trie_add.
  */
 void
 purple_trie_remove(PurpleTrie *trie, const gchar *word);
@@ -2578,36 +2578,210 @@ purple_socket_speaks_ipv4(int fd)
 /**************************************************************************
  * String Functions
  **************************************************************************/
+/* Normalizing a string can be a lot of work for the protocol (for XMPP it
+ * means running stringprep on it), while the same few names are normalized
+ * over and over again. So the results are cached, separately for every
+ * account, in a small LRU cache.
+ *
+ * The cache owns its strings. Results are copied out into a buffer of the
+ * calling thread, so an entry can be evicted by another thread while the
+ * caller is still using what was returned for it. The lock is not held
+ * while the protocol normalizes, which may take a while. */
+#define PURPLE_NORMALIZE_CACHE_SIZE 1024
+
+typedef struct
+{
+	GList link;
+	char *str;
+	char *normalized;
+} PurpleNormalizeEntry;
+
+typedef struct
+{
+	GHashTable *entries;
+	GQueue lru;
+	guint64 hits;
+	guint64 misses;
+} PurpleNormalizeCache;
+
+static GRecMutex normalize_cache_mutex;
+static GPrivate normalize_buf = G_PRIVATE_INIT(g_free);
+
+G_DEFINE_QUARK(purple-normalize-cache, purple_normalize_cache);
+
+static void
+purple_normalize_entry_free(PurpleNormalizeEntry *entry)
+{
+	g_free(entry->str);
+	g_free(entry->normalized);
+	g_free(entry);
+}
+
+static void
+purple_normalize_cache_free(PurpleNormalizeCache *cache)
+{
+	g_hash_table_destroy(cache->entries);
+	g_free(cache);
+}
+
+static PurpleNormalizeCache *
+purple_normalize_cache_get(PurpleAccount *account, gboolean create)
+{
+	PurpleNormalizeCache *cache;
+
+	cache = g_object_get_qdata(G_OBJECT(account),
+			purple_normalize_cache_quark());
+
+	if (cache == NULL && create) {
+		cache = g_new0(PurpleNormalizeCache, 1);
+		cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+				NULL, (GDestroyNotify)purple_normalize_entry_free);
+		g_queue_init(&cache->lru);
+
+		g_object_set_qdata_full(G_OBJECT(account),
+				purple_normalize_cache_quark(), cache,
+				(GDestroyNotify)purple_normalize_cache_free);
+	}
+
+	return cache;
+}
+
+static void
+purple_normalize_cache_add(PurpleAccount *account, const char *str,
+		const char *normalized)
+{
+	PurpleNormalizeCache *cache;
+	PurpleNormalizeEntry *entry;
+	GList *link;
+
+	cache = purple_normalize_cache_get(account, TRUE);
+	cache->misses++;
+
+	/* another thread may have normalized the same string meanwhile */
+	if (g_hash_table_contains(cache->entries, str))
+		return;
+
+	entry = g_new(PurpleNormalizeEntry, 1);
+	entry->str = g_strdup(str);
+	entry->normalized = g_strdup(normalized);
+	entry->link.data = entry;
+	entry->link.prev = entry->link.next = NULL;
+
+	g_hash_table_insert(cache->entries, entry->str, entry);
+	g_queue_push_head_link(&cache->lru, &entry->link);
+
+	if (cache->lru.length > PURPLE_NORMALIZE_CACHE_SIZE) {
+		link = g_queue_pop_tail_link(&cache->lru);
+		g_hash_table_remove(cache->entries,
+				((PurpleNormalizeEntry *)link->data)->str);
+	}
+}
+
+void
+purple_normalize_cache_clear(PurpleAccount *account)
+{
+	PurpleNormalizeCache *cache;
+
+	g_return_if_fail(PURPLE_IS_ACCOUNT(account));
+
+	g_rec_mutex_lock(&normalize_cache_mutex);
+
+	cache = purple_normalize_cache_get(account, FALSE);
+	if (cache != NULL) {
+		g_hash_table_remove_all(cache->entries);
+		g_queue_init(&cache->lru);
+	}
+
+	g_rec_mutex_unlock(&normalize_cache_mutex);
+}
+
+void
+purple_normalize_cache_get_stats(PurpleAccount *account, guint64 *hits,
+		guint64 *misses)
+{
+	PurpleNormalizeCache *cache;
+
+	g_return_if_fail(PURPLE_IS_ACCOUNT(account));
+
+	g_rec_mutex_lock(&normalize_cache_mutex);
+
+	cache = purple_normalize_cache_get(account, FALSE);
+
+	if (hits != NULL)
+		*hits = (cache != NULL) ? cache->hits : 0;
+	if (misses != NULL)
+		*misses = (cache != NULL) ? cache->misses : 0;
+
+	g_rec_mutex_unlock(&normalize_cache_mutex);
+}
+
 const char *
 purple_normalize(PurpleAccount *account, const char *str)
 {
 	const char *ret = NULL;
-	static char buf[BUF_LEN];
+	PurpleNormalizeCache *cache;
+	PurpleNormalizeEntry *entry;
+	char *buf;
 
 	/* This should prevent a crash if purple_normalize gets called with NULL str, see #10115 */
 	g_return_val_if_fail(str != NULL, "");
 
+	buf = g_private_get(&normalize_buf);
+	if (buf == NULL) {
+		buf = g_malloc(BUF_LEN);
+		g_private_set(&normalize_buf, buf);
+	}
+
 	if (account != NULL)
 	{
-		PurpleProtocol *protocol =
-				purple_protocols_find(purple_account_get_protocol_id(account));
+		PurpleProtocol *protocol;
+
+		g_rec_mutex_lock(&normalize_cache_mutex);
+
+		cache = purple_normalize_cache_get(account, FALSE);
+		entry = (cache != NULL) ? g_hash_table_lookup(cache->entries, str) : NULL;
+
+		if (entry != NULL) {
+			cache->hits++;
+			g_queue_unlink(&cache->lru, &entry->link);
+			g_queue_push_head_link(&cache->lru, &entry->link);
+			g_strlcpy(buf, entry->normalized, BUF_LEN);
+
+			g_rec_mutex_unlock(&normalize_cache_mutex);
+			return buf;
+		}
+
+		g_rec_mutex_unlock(&normalize_cache_mutex);
+
+		protocol = purple_protocols_find(purple_account_get_protocol_id(account));
 
 		if (protocol != NULL)
 			ret = purple_protocol_client_iface_normalize(protocol, account, str);
 	}
 
-	if (ret == NULL)
+	if (ret != NULL)
+	{
+		/* the protocol may have used purple_normalize() itself */
+		if (ret != buf)
+			g_strlcpy(buf, ret, BUF_LEN);
+	}
+	else
 	{
 		char *tmp;
 
 		tmp = g_utf8_normalize(str, -1, G_NORMALIZE_DEFAULT);
-		g_snprintf(buf, sizeof(buf), "%s", tmp);
+		g_strlcpy(buf, tmp ? tmp : "", BUF_LEN);
 		g_free(tmp);
+	}
 
-		ret = buf;
+	if (account != NULL)
+	{
+		g_rec_mutex_lock(&normalize_cache_mutex);
+		purple_normalize_cache_add(account, str, buf);
+		g_rec_mutex_unlock(&normalize_cache_mutex);
 	}
 
-	return ret;
+	return buf;
 }
 
 /*
@@ -946,12 +946,44 @@ purple_strequal(const gchar *left, const gchar *right)
  * The returned string will point to a static buffer, so if the
  * string is intended to be kept long-term, you <emphasis>must</emphasis>
  * g_strdup() it. Also, calling normalize() twice in the same line
- * will lead to problems.
+ * will lead to problems. Every thread has a buffer of its own.
+ *
+ * Results are cached for every account, so normalizing the same string
+ * again only costs a hash table lookup. Protocols whose normalization
+ * depends on their state must call purple_normalize_cache_clear() when that
+ * state changes.
  *
  * Returns: A pointer to the normalized version stored in a static buffer.
  */
 const char *purple_normalize(PurpleAccount *account, const char *str);
 
+/**
+ * purple_normalize_cache_clear:
+ * @account:  The account.
+ *
+ * Forgets all strings normalized for an account by purple_normalize(). This
+ * is done automatically when the account connects or disconnects, and when
+ * its protocol changes.
+ *
+ * Since: 3.0.0
+ */
+void purple_normalize_cache_clear(PurpleAccount *account);
+
+/**
+ * purple_normalize_cache_get_stats:
+ * @account:  The account.
+ * @hits:     (out) (optional): Return location for the number of strings
+ *            found in the cache.
+ * @misses:   (out) (optional): Return location for the number of strings
+ *            which had to be normalized by the protocol.
+ *
+ * Gets statistics of the purple_normalize() cache of an account.
+ *
+ * Since: 3.0.0
+ */
+void purple_normalize_cache_get_stats(PurpleAccount *account, guint64 *hits,
+		guint64 *misses);
+
 /**
  * purple_normalize_nocase:
  * @account:  The account the string belongs to.
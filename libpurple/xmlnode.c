@@ -25,6 +25,7 @@
  * as I want to be.  Thank you libxode for giving me a good starting point */
 
 #include "internal.h"
+#include "binaryio.h"
 #include "debug.h"
 
 #include <libxml/parser.h>
@@ -40,12 +41,99 @@
 # define NEWLINE_S "\n"
 #endif
 
+/* Names of elements and attributes, namespaces and prefixes come from a small
+ * set, so they are shared between all nodes instead of being copied for every
+ * one of them. The table is bounded, because a remote party may send arbitrary
+ * names - when it's full, strings are copied and freed as they used to be. */
+#define PURPLE_XMLNODE_STRINGS_LIMIT 8192
+
+/* flags for PurpleXmlNode and PurpleXmlAttrib strings, that aren't shared
+ * and were allocated on the heap */
+#define PURPLE_XMLNODE_NAME_OWNED   (1 << 0)
+#define PURPLE_XMLNODE_XMLNS_OWNED  (1 << 1)
+#define PURPLE_XMLNODE_PREFIX_OWNED (1 << 2)
+/* the node holds a reference to its memory pool (it's a root of pooled tree) */
+#define PURPLE_XMLNODE_POOL_REF     (1 << 3)
+
+/* attributes array grows by this number of elements */
+#define PURPLE_XMLNODE_ATTRIBS_CHUNK 4
+
+static GHashTable *xmlnode_strings = NULL;
+G_LOCK_DEFINE_STATIC(xmlnode_strings);
+
+static gchar *
+xmlnode_strdup(PurpleMemoryPool *pool, const char *str)
+{
+	if (pool != NULL)
+		return purple_memory_pool_strdup(pool, str);
+	return g_strdup(str);
+}
+
+static const char *
+xmlnode_intern(PurpleMemoryPool *pool, const char *str, guint *flags,
+	guint owned_flag)
+{
+	const char *interned;
+
+	if (str == NULL) {
+		*flags &= ~owned_flag;
+		return NULL;
+	}
+
+	G_LOCK(xmlnode_strings);
+	if (G_UNLIKELY(xmlnode_strings == NULL))
+		xmlnode_strings = g_hash_table_new(g_str_hash, g_str_equal);
+	interned = g_hash_table_lookup(xmlnode_strings, str);
+	if (interned == NULL &&
+		g_hash_table_size(xmlnode_strings) < PURPLE_XMLNODE_STRINGS_LIMIT)
+	{
+		interned = g_strdup(str);
+		g_hash_table_add(xmlnode_strings, (gpointer)interned);
+	}
+	G_UNLOCK(xmlnode_strings);
+
+	if (interned != NULL || pool != NULL) {
+		*flags &= ~owned_flag;
+		if (interned == NULL)
+			interned = purple_memory_pool_strdup(pool, str);
+		return interned;
+	}
+
+	*flags |= owned_flag;
+	return g_strdup(str);
+}
+
+static void
+xmlnode_release(const char *str, guint flags, guint owned_flag)
+{
+	if (flags & owned_flag)
+		g_free((char *)str);
+}
+
+/* Compares the node's name with a (possibly not NUL-terminated) name. */
+static inline gboolean
+xmlnode_name_equal(const char *node_name, const char *name, gsize len)
+{
+	if (node_name == NULL)
+		return FALSE;
+	return strncmp(node_name, name, len) == 0 && node_name[len] == '\0';
+}
+
 static PurpleXmlNode*
-new_node(const char *name, PurpleXmlNodeType type)
+new_node(PurpleMemoryPool *pool, const char *name, PurpleXmlNodeType type)
 {
-	PurpleXmlNode *node = g_new0(PurpleXmlNode, 1);
+	PurpleXmlNode *node;
+
+	if (pool != NULL) {
+		node = purple_memory_pool_alloc0(pool, sizeof(PurpleXmlNode),
+			sizeof(gpointer));
+		node->pool = pool;
+	} else {
+		node = g_new0(PurpleXmlNode, 1);
+	}
 
-	node->name = g_strdup(name);
+	node->name = (char *)xmlnode_intern(pool, name, &node->flags,
+		PURPLE_XMLNODE_NAME_OWNED);
 	node->type = type;
 
 	return node;
@@ -56,7 +144,22 @@ purple_xmlnode_new(const char *name)
 {
 	g_return_val_if_fail(name != NULL && *name != '\0', NULL);
 
-	return new_node(name, PURPLE_XMLNODE_TYPE_TAG);
+	return new_node(NULL, name, PURPLE_XMLNODE_TYPE_TAG);
+}
+
+PurpleXmlNode *
+purple_xmlnode_new_in_pool(PurpleMemoryPool *pool, const char *name)
+{
+	PurpleXmlNode *node;
+
+	g_return_val_if_fail(PURPLE_IS_MEMORY_POOL(pool), NULL);
+	g_return_val_if_fail(name != NULL && *name != '\0', NULL);
+
+	node = new_node(pool, name, PURPLE_XMLNODE_TYPE_TAG);
+	node->flags |= PURPLE_XMLNODE_POOL_REF;
+	g_object_ref(pool);
+
+	return node;
 }
 
 PurpleXmlNode *
@@ -67,7 +170,7 @@ purple_xmlnode_new_child(PurpleXmlNode *parent, const char *name)
 	g_return_val_if_fail(parent != NULL, NULL);
 	g_return_val_if_fail(name != NULL && *name != '\0', NULL);
 
-	node = new_node(name, PURPLE_XMLNODE_TYPE_TAG);
+	node = new_node(parent->pool, name, PURPLE_XMLNODE_TYPE_TAG);
 
 	purple_xmlnode_insert_child(parent, node);
 
@@ -103,75 +206,111 @@ purple_xmlnode_insert_data(PurpleXmlNode *node, const char *data, gssize size)
 
 	real_size = size == -1 ? strlen(data) : (gsize)size;
 
-	child = new_node(NULL, PURPLE_XMLNODE_TYPE_DATA);
+	child = new_node(node->pool, NULL, PURPLE_XMLNODE_TYPE_DATA);
 
-	child->data = g_memdup(data, real_size);
+	if (node->pool != NULL) {
+		child->data = purple_memory_pool_alloc(node->pool, real_size,
+			sizeof(gchar));
+		if (child->data != NULL)
+			memcpy(child->data, data, real_size);
+	} else {
+		child->data = g_memdup(data, real_size);
+	}
 	child->data_sz = real_size;
 
 	purple_xmlnode_insert_child(node, child);
 }
 
+static PurpleXmlAttrib *
+xmlnode_attrib_append(PurpleXmlNode *node, const char *attr,
+	const char *xmlns, const char *prefix)
+{
+	PurpleXmlAttrib *attrib;
+
+	if (node->n_attribs % PURPLE_XMLNODE_ATTRIBS_CHUNK != 0) {
+		/* there is still some room */
+	} else if (node->pool != NULL) {
+		PurpleXmlAttrib *attribs;
+
+		attribs = purple_memory_pool_alloc(node->pool,
+			(node->n_attribs + PURPLE_XMLNODE_ATTRIBS_CHUNK) *
+			sizeof(PurpleXmlAttrib), sizeof(gpointer));
+		if (node->n_attribs > 0) {
+			memcpy(attribs, node->attribs,
+				node->n_attribs * sizeof(PurpleXmlAttrib));
+		}
+		purple_memory_pool_free(node->pool, node->attribs);
+		node->attribs = attribs;
+	} else {
+		node->attribs = g_renew(PurpleXmlAttrib, node->attribs,
+			node->n_attribs + PURPLE_XMLNODE_ATTRIBS_CHUNK);
+	}
+
+	attrib = &node->attribs[node->n_attribs++];
+	attrib->flags = 0;
+	attrib->name = xmlnode_intern(node->pool, attr, &attrib->flags,
+		PURPLE_XMLNODE_NAME_OWNED);
+	attrib->xmlns = xmlnode_intern(node->pool, xmlns, &attrib->flags,
+		PURPLE_XMLNODE_XMLNS_OWNED);
+	attrib->prefix = xmlnode_intern(node->pool, prefix, &attrib->flags,
+		PURPLE_XMLNODE_PREFIX_OWNED);
+	attrib->value = NULL;
+
+	return attrib;
+}
+
+static void
+xmlnode_attrib_clear(PurpleXmlNode *node, PurpleXmlAttrib *attrib)
+{
+	xmlnode_release(attrib->name, attrib->flags, PURPLE_XMLNODE_NAME_OWNED);
+	xmlnode_release(attrib->xmlns, attrib->flags, PURPLE_XMLNODE_XMLNS_OWNED);
+	xmlnode_release(attrib->prefix, attrib->flags,
+		PURPLE_XMLNODE_PREFIX_OWNED);
+	if (node->pool == NULL)
+		g_free(attrib->value);
+}
+
+static void
+xmlnode_attrib_remove_index(PurpleXmlNode *node, guint i)
+{
+	xmlnode_attrib_clear(node, &node->attribs[i]);
+
+	node->n_attribs--;
+	memmove(&node->attribs[i], &node->attribs[i + 1],
+		(node->n_attribs - i) * sizeof(PurpleXmlAttrib));
+}
+
 void
 purple_xmlnode_remove_attrib(PurpleXmlNode *node, const char *attr)
 {
-	PurpleXmlNode *attr_node, *sibling = NULL;
+	guint i = 0;
 
 	g_return_if_fail(node != NULL);
 	g_return_if_fail(attr != NULL);
 
-	attr_node = node->child;
-	while (attr_node) {
-		if(attr_node->type == PURPLE_XMLNODE_TYPE_ATTRIB &&
-				purple_strequal(attr_node->name, attr))
-		{
-			if (node->lastchild == attr_node) {
-				node->lastchild = sibling;
-			}
-			if (sibling == NULL) {
-				node->child = attr_node->next;
-				purple_xmlnode_free(attr_node);
-				attr_node = node->child;
-			} else {
-				sibling->next = attr_node->next;
-				sibling = attr_node->next;
-				purple_xmlnode_free(attr_node);
-				attr_node = sibling;
-			}
-		}
+	while (i < node->n_attribs) {
+		if (purple_strequal(node->attribs[i].name, attr))
+			xmlnode_attrib_remove_index(node, i);
 		else
-		{
-			attr_node = attr_node->next;
-		}
-		sibling = attr_node;
+			i++;
 	}
 }
 
 void
 purple_xmlnode_remove_attrib_with_namespace(PurpleXmlNode *node, const char *attr, const char *xmlns)
 {
-	PurpleXmlNode *attr_node, *sibling = NULL;
+	guint i;
 
 	g_return_if_fail(node != NULL);
 	g_return_if_fail(attr != NULL);
 
-	for(attr_node = node->child; attr_node; attr_node = attr_node->next)
-	{
-		if(attr_node->type == PURPLE_XMLNODE_TYPE_ATTRIB &&
-		   purple_strequal(attr,  attr_node->name) &&
-		   purple_strequal(xmlns, attr_node->xmlns))
+	for (i = 0; i < node->n_attribs; i++) {
+		if (purple_strequal(attr, node->attribs[i].name) &&
+		    purple_strequal(xmlns, node->attribs[i].xmlns))
 		{
-			if(sibling == NULL) {
-				node->child = attr_node->next;
-			} else {
-				sibling->next = attr_node->next;
-			}
-			if (node->lastchild == attr_node) {
-				node->lastchild = sibling;
-			}
-			purple_xmlnode_free(attr_node);
+			xmlnode_attrib_remove_index(node, i);
 			return;
 		}
-		sibling = attr_node;
 	}
 }
 
@@ -185,35 +324,32 @@ purple_xmlnode_set_attrib(PurpleXmlNode *node, const char *attr, const char *val
 void
 purple_xmlnode_set_attrib_full(PurpleXmlNode *node, const char *attr, const char *xmlns, const char *prefix, const char *value)
 {
-	PurpleXmlNode *attrib_node;
+	PurpleXmlAttrib *attrib;
 
 	g_return_if_fail(node != NULL);
 	g_return_if_fail(attr != NULL);
 	g_return_if_fail(value != NULL);
 
 	purple_xmlnode_remove_attrib_with_namespace(node, attr, xmlns);
-	attrib_node = new_node(attr, PURPLE_XMLNODE_TYPE_ATTRIB);
 
-	attrib_node->data = g_strdup(value);
-	attrib_node->xmlns = g_strdup(xmlns);
-	attrib_node->prefix = g_strdup(prefix);
-
-	purple_xmlnode_insert_child(node, attrib_node);
+	attrib = xmlnode_attrib_append(node, attr, xmlns, prefix);
+	attrib->value = xmlnode_strdup(node->pool, value);
 }
 
 
 const char *
 purple_xmlnode_get_attrib(const PurpleXmlNode *node, const char *attr)
 {
-	PurpleXmlNode *x;
+	guint i;
 
 	g_return_val_if_fail(node != NULL, NULL);
 	g_return_val_if_fail(attr != NULL, NULL);
 
-	for(x = node->child; x; x = x->next) {
-		if(x->type == PURPLE_XMLNODE_TYPE_ATTRIB && purple_strequal(attr, x->name)) {
-			return x->data;
-		}
+	for (i = 0; i < node->n_attribs; i++) {
+		const PurpleXmlAttrib *attrib = &node->attribs[i];
+
+		if (attrib->name == attr || purple_strequal(attr, attrib->name))
+			return attrib->value;
 	}
 
 	return NULL;
@@ -222,16 +358,17 @@ purple_xmlnode_get_attrib(const PurpleXmlNode *node, const char *attr)
 const char *
 purple_xmlnode_get_attrib_with_namespace(const PurpleXmlNode *node, const char *attr, const char *xmlns)
 {
-	const PurpleXmlNode *x;
+	guint i;
 
 	g_return_val_if_fail(node != NULL, NULL);
 	g_return_val_if_fail(attr != NULL, NULL);
 
-	for(x = node->child; x; x = x->next) {
-		if(x->type == PURPLE_XMLNODE_TYPE_ATTRIB &&
-		   purple_strequal(attr,  x->name) &&
-		   purple_strequal(xmlns, x->xmlns)) {
-			return x->data;
+	for (i = 0; i < node->n_attribs; i++) {
+		const PurpleXmlAttrib *attrib = &node->attribs[i];
+
+		if (purple_strequal(attr, attrib->name) &&
+		    purple_strequal(xmlns, attrib->xmlns)) {
+			return attrib->value;
 		}
 	}
 
@@ -242,17 +379,21 @@ purple_xmlnode_get_attrib_with_namespace(const PurpleXmlNode *node, const char *
 void purple_xmlnode_set_namespace(PurpleXmlNode *node, const char *xmlns)
 {
 	char *tmp;
+	guint tmp_flags;
 	g_return_if_fail(node != NULL);
 
+	/* xmlns may point to the current namespace, so release it later */
 	tmp = node->xmlns;
-	node->xmlns = g_strdup(xmlns);
+	tmp_flags = node->flags;
+	node->xmlns = (char *)xmlnode_intern(node->pool, xmlns, &node->flags,
+		PURPLE_XMLNODE_XMLNS_OWNED);
 
 	if (node->namespace_map) {
 		g_hash_table_insert(node->namespace_map,
 			g_strdup(""), g_strdup(xmlns));
 	}
 
-	g_free(tmp);
+	xmlnode_release(tmp, tmp_flags, PURPLE_XMLNODE_XMLNS_OWNED);
 }
 
 const char *purple_xmlnode_get_namespace(const PurpleXmlNode *node)
@@ -290,10 +431,16 @@ const char *purple_xmlnode_get_default_namespace(const PurpleXmlNode *node)
 
 void purple_xmlnode_set_prefix(PurpleXmlNode *node, const char *prefix)
 {
+	char *tmp;
+	guint tmp_flags;
 	g_return_if_fail(node != NULL);
 
-	g_free(node->prefix);
-	node->prefix = g_strdup(prefix);
+	tmp = node->prefix;
+	tmp_flags = node->flags;
+	node->prefix = (char *)xmlnode_intern(node->pool, prefix, &node->flags,
+		PURPLE_XMLNODE_PREFIX_OWNED);
+
+	xmlnode_release(tmp, tmp_flags, PURPLE_XMLNODE_PREFIX_OWNED);
 }
 
 const char *purple_xmlnode_get_prefix(const PurpleXmlNode *node)
@@ -359,6 +506,7 @@ void
 purple_xmlnode_free(PurpleXmlNode *node)
 {
 	PurpleXmlNode *x, *y;
+	guint i;
 
 	g_return_if_fail(node != NULL);
 
@@ -389,16 +537,25 @@ purple_xmlnode_free(PurpleXmlNode *node)
 		x = y;
 	}
 
+	for (i = 0; i < node->n_attribs; i++)
+		xmlnode_attrib_clear(node, &node->attribs[i]);
+
 	/* now dispose of ourselves */
-	g_free(node->name);
-	g_free(node->data);
-	g_free(node->xmlns);
-	g_free(node->prefix);
+	xmlnode_release(node->name, node->flags, PURPLE_XMLNODE_NAME_OWNED);
+	xmlnode_release(node->xmlns, node->flags, PURPLE_XMLNODE_XMLNS_OWNED);
+	xmlnode_release(node->prefix, node->flags, PURPLE_XMLNODE_PREFIX_OWNED);
 
 	if(node->namespace_map)
 		g_hash_table_destroy(node->namespace_map);
 
-	g_free(node);
+	if (node->pool == NULL) {
+		g_free(node->attribs);
+		g_free(node->data);
+		g_free(node);
+	} else if (node->flags & PURPLE_XMLNODE_POOL_REF) {
+		/* the memory of the whole tree is released at once */
+		g_object_unref(node->pool);
+	}
 }
 
 PurpleXmlNode*
@@ -411,15 +568,20 @@ PurpleXmlNode *
 purple_xmlnode_get_child_with_namespace(const PurpleXmlNode *parent, const char *name, const char *ns)
 {
 	PurpleXmlNode *x, *ret = NULL;
-	char **names;
-	char *parent_name, *child_name;
+	const char *child_name;
+	gsize parent_name_len;
 
 	g_return_val_if_fail(parent != NULL, NULL);
 	g_return_val_if_fail(name != NULL, NULL);
 
-	names = g_strsplit(name, "/", 2);
-	parent_name = names[0];
-	child_name = names[1];
+	/* name may be a path, like "parent/child" */
+	child_name = strchr(name, '/');
+	if (child_name) {
+		parent_name_len = child_name - name;
+		child_name++;
+	} else {
+		parent_name_len = strlen(name);
+	}
 
 	for(x = parent->child; x; x = x->next) {
 		/* XXX: Is it correct to ignore the namespace for the match if none was specified? */
@@ -427,7 +589,8 @@ purple_xmlnode_get_child_with_namespace(const PurpleXmlNode *parent, const char
 		if(ns)
 			xmlns = purple_xmlnode_get_namespace(x);
 
-		if(x->type == PURPLE_XMLNODE_TYPE_TAG && purple_strequal(parent_name, x->name)
+		if(x->type == PURPLE_XMLNODE_TYPE_TAG &&
+				xmlnode_name_equal(x->name, name, parent_name_len)
 				&& purple_strequal(ns, xmlns)) {
 			ret = x;
 			break;
@@ -437,7 +600,6 @@ purple_xmlnode_get_child_with_namespace(const PurpleXmlNode *parent, const char
 	if(child_name && ret)
 		ret = purple_xmlnode_get_child(ret, child_name);
 
-	g_strfreev(names);
 	return ret;
 }
 
@@ -495,6 +657,7 @@ purple_xmlnode_to_str_helper(const PurpleXmlNode *node, int *len, gboolean forma
 	const PurpleXmlNode *c;
 	char *node_name, *esc, *esc2, *tab = NULL;
 	gboolean need_end = FALSE, pretty = formatting;
+	guint i;
 
 	g_return_val_if_fail(node != NULL, NULL);
 
@@ -535,20 +698,22 @@ purple_xmlnode_to_str_helper(const PurpleXmlNode *node, int *len, gboolean forma
 			g_free(escaped_xmlns);
 		}
 	}
+	for(i = 0; i < node->n_attribs; i++)
+	{
+		const PurpleXmlAttrib *attrib = &node->attribs[i];
+		esc = g_markup_escape_text(attrib->name, -1);
+		esc2 = g_markup_escape_text(attrib->value, -1);
+		if (attrib->prefix) {
+			g_string_append_printf(text, " %s:%s='%s'", attrib->prefix, esc, esc2);
+		} else {
+			g_string_append_printf(text, " %s='%s'", esc, esc2);
+		}
+		g_free(esc);
+		g_free(esc2);
+	}
 	for(c = node->child; c; c = c->next)
 	{
-		if(c->type == PURPLE_XMLNODE_TYPE_ATTRIB) {
-			const char *aprefix = purple_xmlnode_get_prefix(c);
-			esc = g_markup_escape_text(c->name, -1);
-			esc2 = g_markup_escape_text(c->data, -1);
-			if (aprefix) {
-				g_string_append_printf(text, " %s:%s='%s'", aprefix, esc, esc2);
-			} else {
-				g_string_append_printf(text, " %s='%s'", esc, esc2);
-			}
-			g_free(esc);
-			g_free(esc2);
-		} else if(c->type == PURPLE_XMLNODE_TYPE_TAG || c->type == PURPLE_XMLNODE_TYPE_DATA) {
+		if(c->type == PURPLE_XMLNODE_TYPE_TAG || c->type == PURPLE_XMLNODE_TYPE_DATA) {
 			if(c->type == PURPLE_XMLNODE_TYPE_DATA)
 				pretty = FALSE;
 			need_end = TRUE;
@@ -876,6 +1041,366 @@ purple_xmlnode_from_file(const char *dir, const char *filename, const char *desc
 	return node;
 }
 
+/**************************************************************************
+ * Binary snapshots
+ **************************************************************************/
+
+/* A snapshot is a binary copy of a PurpleXmlNode tree, stored next to the
+ * XML file it was made from. Loading it only copies strings out of the
+ * mapped file, which is a lot cheaper than parsing the XML again. The XML
+ * file stays the source of truth: the snapshot records the size, mtime and
+ * inode of the file it matches and is ignored as soon as any of them
+ * differ.
+ *
+ * All numbers are little-endian. A node is its type (one byte) followed by
+ * either the data of a data node, or for a tag: name, namespace, prefix,
+ * the attributes (name, namespace, prefix, value), the namespace map
+ * (prefix, namespace) and the children. Strings are stored with their
+ * length and a terminating NUL, a length of G_MAXUINT32 stands for NULL.
+ */
+#define PURPLE_XMLNODE_SNAPSHOT_MAGIC   "PURPLEXS"
+#define PURPLE_XMLNODE_SNAPSHOT_VERSION 1
+#define PURPLE_XMLNODE_SNAPSHOT_SUFFIX  ".snapshot"
+#define PURPLE_XMLNODE_SNAPSHOT_DEPTH   128
+
+typedef struct
+{
+	gchar magic[8];
+	guint32 version;
+	guint32 checksum;
+	guint64 xml_size;
+	gint64 xml_mtime;
+	guint64 xml_ino;
+	guint64 payload_size;
+} PurpleXmlNodeSnapshotHeader;
+
+static void
+xmlnode_snapshot_put_data(GByteArray *out, const char *data, gsize len)
+{
+	_purple_binary_put_uint32(out, len);
+	g_byte_array_append(out, (const guint8 *)data, len);
+	g_byte_array_append(out, (const guint8 *)"", 1);
+}
+
+static void
+xmlnode_snapshot_put_ns(gpointer key, gpointer value, gpointer user_data)
+{
+	_purple_binary_put_string(user_data, key);
+	_purple_binary_put_string(user_data, value);
+}
+
+static void
+xmlnode_snapshot_put_node(GByteArray *out, const PurpleXmlNode *node)
+{
+	const PurpleXmlNode *child;
+	guint8 type = node->type;
+	guint32 n_children = 0;
+	guint i;
+
+	g_byte_array_append(out, &type, 1);
+
+	if (node->type == PURPLE_XMLNODE_TYPE_DATA) {
+		xmlnode_snapshot_put_data(out, node->data, node->data_sz);
+		return;
+	}
+
+	_purple_binary_put_string(out, node->name);
+	_purple_binary_put_string(out, node->xmlns);
+	_purple_binary_put_string(out, node->prefix);
+
+	_purple_binary_put_uint32(out, node->n_attribs);
+	for (i = 0; i < node->n_attribs; i++) {
+		const PurpleXmlAttrib *attrib = &node->attribs[i];
+
+		_purple_binary_put_string(out, attrib->name);
+		_purple_binary_put_string(out, attrib->xmlns);
+		_purple_binary_put_string(out, attrib->prefix);
+		_purple_binary_put_string(out, attrib->value);
+	}
+
+	if (node->namespace_map != NULL) {
+		_purple_binary_put_uint32(out,
+			g_hash_table_size(node->namespace_map));
+		g_hash_table_foreach(node->namespace_map,
+			xmlnode_snapshot_put_ns, out);
+	} else {
+		_purple_binary_put_uint32(out, 0);
+	}
+
+	for (child = node->child; child != NULL; child = child->next) {
+		if (child->type == PURPLE_XMLNODE_TYPE_TAG ||
+			child->type == PURPLE_XMLNODE_TYPE_DATA)
+			n_children++;
+	}
+
+	_purple_binary_put_uint32(out, n_children);
+	for (child = node->child; child != NULL; child = child->next) {
+		if (child->type == PURPLE_XMLNODE_TYPE_TAG ||
+			child->type == PURPLE_XMLNODE_TYPE_DATA)
+			xmlnode_snapshot_put_node(out, child);
+	}
+}
+
+/* On success, *str points into the snapshot and is NUL-terminated. */
+static gboolean
+xmlnode_snapshot_get_data(PurpleBinaryReader *reader,
+	const char **str, guint32 *len)
+{
+	if (!_purple_binary_get_uint32(reader, len) || *len == G_MAXUINT32)
+		return FALSE;
+
+	if ((gsize)(reader->end - reader->cur) <= *len ||
+		reader->cur[*len] != '\0')
+		return FALSE;
+
+	*str = (const char *)reader->cur;
+	reader->cur += *len + 1;
+
+	return TRUE;
+}
+
+static PurpleXmlNode *
+xmlnode_snapshot_get_node(PurpleBinaryReader *reader, int depth)
+{
+	PurpleXmlNode *node, *child;
+	PurpleXmlAttrib *attrib;
+	const char *name, *xmlns, *prefix, *value;
+	guint32 count, len, i;
+	guint8 type;
+
+	if (reader->cur >= reader->end || depth > PURPLE_XMLNODE_SNAPSHOT_DEPTH)
+		return NULL;
+
+	type = *reader->cur++;
+
+	if (type == PURPLE_XMLNODE_TYPE_DATA) {
+		if (!xmlnode_snapshot_get_data(reader, &value, &len))
+			return NULL;
+
+		/* along with the nul after it, so empty data isn't NULL */
+		node = new_node(NULL, NULL, PURPLE_XMLNODE_TYPE_DATA);
+		node->data = g_memdup(value, len + 1);
+		node->data_sz = len;
+		return node;
+	}
+
+	if (type != PURPLE_XMLNODE_TYPE_TAG ||
+		!_purple_binary_get_string(reader, &name) || name == NULL ||
+		!_purple_binary_get_string(reader, &xmlns) ||
+		!_purple_binary_get_string(reader, &prefix))
+		return NULL;
+
+	node = new_node(NULL, name, PURPLE_XMLNODE_TYPE_TAG);
+	node->xmlns = (char *)xmlnode_intern(NULL, xmlns, &node->flags,
+		PURPLE_XMLNODE_XMLNS_OWNED);
+	node->prefix = (char *)xmlnode_intern(NULL, prefix, &node->flags,
+		PURPLE_XMLNODE_PREFIX_OWNED);
+
+	if (!_purple_binary_get_uint32(reader, &count))
+		goto error;
+
+	for (i = 0; i < count; i++) {
+		if (!_purple_binary_get_string(reader, &name) || name == NULL ||
+			!_purple_binary_get_string(reader, &xmlns) ||
+			!_purple_binary_get_string(reader, &prefix) ||
+			!_purple_binary_get_string(reader, &value) || value == NULL)
+			goto error;
+
+		attrib = xmlnode_attrib_append(node, name, xmlns, prefix);
+		attrib->value = g_strdup(value);
+	}
+
+	if (!_purple_binary_get_uint32(reader, &count))
+		goto error;
+
+	if (count > 0) {
+		node->namespace_map = g_hash_table_new_full(g_str_hash,
+			g_str_equal, g_free, g_free);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!_purple_binary_get_string(reader, &name) || name == NULL ||
+			!_purple_binary_get_string(reader, &value) || value == NULL)
+			goto error;
+
+		g_hash_table_insert(node->namespace_map,
+			g_strdup(name), g_strdup(value));
+	}
+
+	if (!_purple_binary_get_uint32(reader, &count))
+		goto error;
+
+	for (i = 0; i < count; i++) {
+		child = xmlnode_snapshot_get_node(reader, depth + 1);
+		if (child == NULL)
+			goto error;
+
+		purple_xmlnode_insert_child(node, child);
+	}
+
+	return node;
+
+error:
+	purple_xmlnode_free(node);
+	return NULL;
+}
+
+static void
+xmlnode_snapshot_header_init(PurpleXmlNodeSnapshotHeader *header,
+	const GStatBuf *st)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, PURPLE_XMLNODE_SNAPSHOT_MAGIC,
+		sizeof(header->magic));
+	header->version = GUINT32_TO_LE(PURPLE_XMLNODE_SNAPSHOT_VERSION);
+	header->xml_size = GUINT64_TO_LE(st->st_size);
+	header->xml_mtime = GINT64_TO_LE(st->st_mtime);
+	header->xml_ino = GUINT64_TO_LE(st->st_ino);
+}
+
+/* Returns the snapshot payload of dir/filename, if it's there and still
+ * matches the XML file. */
+static GMappedFile *
+xmlnode_snapshot_map(const char *dir, const char *filename,
+	const guchar **payload, gsize *payload_size)
+{
+	PurpleXmlNodeSnapshotHeader expected, header;
+	GMappedFile *mapped;
+	GStatBuf st;
+	gchar *filename_full, *snapshot_full;
+	const gchar *contents;
+	gsize length;
+
+	filename_full = g_build_filename(dir, filename, NULL);
+	snapshot_full = g_strconcat(filename_full,
+		PURPLE_XMLNODE_SNAPSHOT_SUFFIX, NULL);
+
+	if (g_stat(filename_full, &st) != 0) {
+		g_free(filename_full);
+		g_free(snapshot_full);
+		return NULL;
+	}
+
+	mapped = g_mapped_file_new(snapshot_full, FALSE, NULL);
+	g_free(filename_full);
+	g_free(snapshot_full);
+
+	if (mapped == NULL)
+		return NULL;
+
+	contents = g_mapped_file_get_contents(mapped);
+	length = g_mapped_file_get_length(mapped);
+
+	xmlnode_snapshot_header_init(&expected, &st);
+
+	if (contents == NULL || length < sizeof(header)) {
+		g_mapped_file_unref(mapped);
+		return NULL;
+	}
+
+	memcpy(&header, contents, sizeof(header));
+	expected.checksum = header.checksum;
+	expected.payload_size = header.payload_size;
+
+	if (memcmp(&header, &expected, sizeof(header)) != 0 ||
+		GUINT64_FROM_LE(header.payload_size) != length - sizeof(header))
+	{
+		g_mapped_file_unref(mapped);
+		return NULL;
+	}
+
+	*payload = (const guchar *)contents + sizeof(header);
+	*payload_size = length - sizeof(header);
+
+	if (_purple_fnv1a(*payload, *payload_size) !=
+		GUINT32_FROM_LE(header.checksum))
+	{
+		g_mapped_file_unref(mapped);
+		return NULL;
+	}
+
+	return mapped;
+}
+
+PurpleXmlNode *
+_purple_xmlnode_from_snapshot(const char *dir, const char *filename)
+{
+	PurpleBinaryReader reader;
+	PurpleXmlNode *node;
+	GMappedFile *mapped;
+	const guchar *payload;
+	gsize payload_size;
+
+	g_return_val_if_fail(dir != NULL, NULL);
+	g_return_val_if_fail(filename != NULL, NULL);
+
+	mapped = xmlnode_snapshot_map(dir, filename, &payload, &payload_size);
+	if (mapped == NULL)
+		return NULL;
+
+	reader.cur = payload;
+	reader.end = payload + payload_size;
+	node = xmlnode_snapshot_get_node(&reader, 0);
+
+	if (node != NULL && reader.cur != reader.end) {
+		purple_xmlnode_free(node);
+		node = NULL;
+	}
+
+	g_mapped_file_unref(mapped);
+
+	if (node == NULL) {
+		purple_debug_warning("xmlnode", "Ignoring invalid snapshot of "
+			"%s\n", filename);
+	} else {
+		purple_debug_misc("xmlnode", "Read %s from its snapshot\n",
+			filename);
+	}
+
+	return node;
+}
+
+void
+_purple_xmlnode_write_snapshot(const char *dir, const char *filename,
+	const PurpleXmlNode *node)
+{
+	PurpleXmlNodeSnapshotHeader header;
+	GByteArray *out;
+	GStatBuf st;
+	gchar *filename_full, *snapshot_full;
+
+	g_return_if_fail(dir != NULL);
+	g_return_if_fail(filename != NULL);
+	g_return_if_fail(node != NULL);
+
+	filename_full = g_build_filename(dir, filename, NULL);
+	snapshot_full = g_strconcat(filename_full,
+		PURPLE_XMLNODE_SNAPSHOT_SUFFIX, NULL);
+
+	if (g_stat(filename_full, &st) != 0) {
+		g_free(filename_full);
+		g_free(snapshot_full);
+		return;
+	}
+
+	out = g_byte_array_new();
+	g_byte_array_set_size(out, sizeof(header));
+	xmlnode_snapshot_put_node(out, node);
+
+	xmlnode_snapshot_header_init(&header, &st);
+	header.payload_size = GUINT64_TO_LE(out->len - sizeof(header));
+	header.checksum = GUINT32_TO_LE(_purple_fnv1a(
+		out->data + sizeof(header), out->len - sizeof(header)));
+	memcpy(out->data, &header, sizeof(header));
+
+	purple_util_write_data_to_file_absolute(snapshot_full,
+		(const char *)out->data, out->len);
+
+	g_byte_array_free(out, TRUE);
+	g_free(filename_full);
+	g_free(snapshot_full);
+}
+
 static void
 purple_xmlnode_copy_foreach_ns(gpointer key, gpointer value, gpointer user_data)
 {
@@ -889,11 +1414,13 @@ purple_xmlnode_copy(const PurpleXmlNode *src)
 	PurpleXmlNode *ret;
 	PurpleXmlNode *child;
 	PurpleXmlNode *sibling = NULL;
+	guint i;
 
 	g_return_val_if_fail(src != NULL, NULL);
 
-	ret = new_node(src->name, src->type);
-	ret->xmlns = g_strdup(src->xmlns);
+	ret = new_node(NULL, src->name, src->type);
+	ret->xmlns = (char *)xmlnode_intern(NULL, src->xmlns, &ret->flags,
+		PURPLE_XMLNODE_XMLNS_OWNED);
 	if (src->data) {
 		if (src->data_sz) {
 			ret->data = g_memdup(src->data, src->data_sz);
@@ -902,7 +1429,16 @@ purple_xmlnode_copy(const PurpleXmlNode *src)
 			ret->data = g_strdup(src->data);
 		}
 	}
-	ret->prefix = g_strdup(src->prefix);
+	ret->prefix = (char *)xmlnode_intern(NULL, src->prefix, &ret->flags,
+		PURPLE_XMLNODE_PREFIX_OWNED);
+	for (i = 0; i < src->n_attribs; i++) {
+		const PurpleXmlAttrib *attrib = &src->attribs[i];
+		PurpleXmlAttrib *attrib_copy;
+
+		attrib_copy = xmlnode_attrib_append(ret, attrib->name,
+			attrib->xmlns, attrib->prefix);
+		attrib_copy->value = g_strdup(attrib->value);
+	}
 	if (src->namespace_map) {
 		ret->namespace_map = g_hash_table_new_full(g_str_hash, g_str_equal,
 		                                           g_free, g_free);
@@ -939,7 +1475,8 @@ purple_xmlnode_get_next_twin(PurpleXmlNode *node)
 		if(ns)
 			xmlns = purple_xmlnode_get_namespace(sibling);
 
-		if(sibling->type == PURPLE_XMLNODE_TYPE_TAG && purple_strequal(node->name, sibling->name) &&
+		if(sibling->type == PURPLE_XMLNODE_TYPE_TAG &&
+				(node->name == sibling->name || purple_strequal(node->name, sibling->name)) &&
 				purple_strequal(ns, xmlns))
 			return sibling;
 	}
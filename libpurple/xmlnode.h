@@ -31,12 +31,15 @@
 #include <glib.h>
 #include <glib-object.h>
 
+#include "memorypool.h"
+
 #define PURPLE_TYPE_XMLNODE  (purple_xmlnode_get_type())
 
 /**
  * PurpleXmlNodeType:
  * @PURPLE_XMLNODE_TYPE_TAG:    Just a tag
- * @PURPLE_XMLNODE_TYPE_ATTRIB: Has attributes
+ * @PURPLE_XMLNODE_TYPE_ATTRIB: An attribute. Attributes are no longer stored
+ *                              as nodes, see #PurpleXmlAttrib.
  * @PURPLE_XMLNODE_TYPE_DATA:   Has data
  *
  * The valid types for an PurpleXmlNode
@@ -49,6 +52,27 @@ typedef enum
 
 } PurpleXmlNodeType;
 
+/**
+ * PurpleXmlAttrib:
+ * @name:   The name of the attribute.
+ * @xmlns:  The namespace of the attribute or %NULL.
+ * @prefix: The namespace prefix of the attribute or %NULL.
+ * @value:  The value of the attribute.
+ *
+ * An attribute of a #PurpleXmlNode. Attributes are kept in an array of their
+ * tag node, separately from its children.
+ */
+typedef struct
+{
+	const char *name;
+	const char *xmlns;
+	const char *prefix;
+	char *value;
+
+	/*< private >*/
+	guint flags;
+} PurpleXmlAttrib;
+
 /**
  * PurpleXmlNode:
  * @name:          The name of the node.
@@ -62,8 +86,16 @@ typedef enum
  * @next:          The next node or %NULL.
  * @prefix:        The namespace prefix if any.
  * @namespace_map: The namespace map.
+ * @attribs:       The attributes of the node.
+ * @n_attribs:     The number of attributes.
  *
  * An PurpleXmlNode.
+ *
+ * Names of nodes and attributes, namespaces and prefixes are shared between
+ * nodes, so they must not be modified or freed directly.
+ *
+ * Nodes created with purple_xmlnode_new_in_pool() (and all of their
+ * descendants) are allocated within a #PurpleMemoryPool.
  */
 typedef struct _PurpleXmlNode PurpleXmlNode;
 struct _PurpleXmlNode
@@ -79,6 +111,12 @@ struct _PurpleXmlNode
 	PurpleXmlNode *next;
 	char *prefix;
 	GHashTable *namespace_map;
+	PurpleXmlAttrib *attribs;
+	guint n_attribs;
+
+	/*< private >*/
+	guint flags;
+	PurpleMemoryPool *pool;
 };
 
 G_BEGIN_DECLS
@@ -100,6 +138,24 @@ GType purple_xmlnode_get_type(void);
  */
 PurpleXmlNode *purple_xmlnode_new(const char *name);
 
+/**
+ * purple_xmlnode_new_in_pool:
+ * @pool: The memory pool to allocate the tree within.
+ * @name: The name of the node.
+ *
+ * Creates a new PurpleXmlNode, which (along with every child, attribute and
+ * data added to it later) is allocated within the @pool. The node keeps a
+ * reference to the @pool until it's freed.
+ *
+ * Freeing such tree doesn't return its memory - it's released when the @pool
+ * is cleaned up or destroyed. Use purple_xmlnode_copy() to keep any part of
+ * the tree past that point.
+ *
+ * Returns: The new node.
+ */
+PurpleXmlNode *
+purple_xmlnode_new_in_pool(PurpleMemoryPool *pool, const char *name);
+
 /**
  * purple_xmlnode_new_child:
  * @parent: The parent node.
@@ -390,7 +446,8 @@ PurpleXmlNode *purple_xmlnode_from_str(const char *str, gssize size);
  * purple_xmlnode_copy:
  * @src: The node to copy.
  *
- * Creates a new node from the source node.
+ * Creates a new node from the source node. The copy is always allocated on
+ * the heap, even if the source node is allocated within a #PurpleMemoryPool.
  *
  * Returns: A new copy of the src node.
  */
@@ -125,6 +125,8 @@ typedef struct
 
 	guint select_notebook_page_timeout;
 
+	/* Idle source loading the buddy icons of the rows on screen. */
+	guint prefetch_icons_timeout;
 
 } PidginBuddyListPrivate;
 
@@ -165,6 +167,7 @@ static void pidgin_blist_selection_changed(GtkTreeSelection *selection, gpointer
 static void pidgin_blist_update(PurpleBuddyList *list, PurpleBlistNode *node);
 static void pidgin_blist_update_group(PurpleBuddyList *list, PurpleBlistNode *node);
 static void pidgin_blist_update_contact(PurpleBuddyList *list, PurpleBlistNode *node);
+static void pidgin_blist_forget_node(PurpleBlistNode *node);
 static char *pidgin_get_tooltip_text(PurpleBlistNode *node, gboolean full);
 static gboolean get_iter_from_node(PurpleBlistNode *node, GtkTreeIter *iter);
 static gboolean buddy_is_displayable(PurpleBuddy *buddy);
@@ -631,6 +634,8 @@ chat_components_edit_ok(PurpleChat *chat, PurpleRequestFields *allfields)
 			}
 		}
 	}
+
+	purple_blist_save_node(purple_blist_get_default(), PURPLE_BLIST_NODE(chat));
 }
 
 static void chat_components_edit(GtkWidget *w, PurpleBlistNode *node)
@@ -2645,18 +2650,18 @@ do_alphashift(GdkPixbuf *pixbuf, int shift)
 }
 
 
+static void pidgin_blist_queue_icon_prefetch(void);
+
 static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
                                               gboolean scaled, gboolean greyed)
 {
-	gsize len;
 	PurpleBuddy *buddy = NULL;
 	PurpleGroup *group = NULL;
-	const guchar *data = NULL;
 	GdkPixbuf *buf, *ret = NULL;
 	PurpleBuddyIcon *icon = NULL;
 	PurpleAccount *account = NULL;
 	PurpleContact *contact = NULL;
-	PurpleImage *custom_img;
+	PurpleImage *custom_img, *img = NULL;
 	PurpleProtocol *protocol = NULL;
 	PurpleBuddyIconSpec *icon_spec = NULL;
 	gint orig_width, orig_height, scale_width, scale_height;
@@ -2699,24 +2704,38 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 		custom_img = purple_buddy_icons_node_find_custom_icon(node);
 	}
 
-	if (custom_img) {
-		data = purple_image_get_data(custom_img);
-		len = purple_image_get_data_size(custom_img);
+	if (custom_img && purple_image_get_data(custom_img) != NULL) {
+		img = custom_img;
+	} else if (buddy) {
+		/* Reading the icon from disk would stall scrolling, so draw
+		 * no icon for now.  The row is updated once it has loaded.
+		 * Buddies without an icon file have nothing to load; a file
+		 * that fails to load has its setting removed. */
+		icon = purple_buddy_icons_find_cached(account, purple_buddy_get_name(buddy));
+		if (icon != NULL)
+			img = purple_buddy_icon_get_image(icon);
+		else if (purple_blist_node_get_string(PURPLE_BLIST_NODE(buddy), "buddy_icon") != NULL)
+			pidgin_blist_queue_icon_prefetch();
 	}
 
-	if (data == NULL) {
-		if (buddy) {
-			/* Not sure I like this...*/
-			if (!(icon = purple_buddy_icons_find(purple_buddy_get_account(buddy), purple_buddy_get_name(buddy))))
-				return NULL;
-			data = purple_buddy_icon_get_data(icon, &len);
-		}
-
-		if(data == NULL)
-			return NULL;
+	if (img == NULL || purple_image_get_data(img) == NULL) {
+		purple_buddy_icon_unref(icon);
+		if (custom_img)
+			g_object_unref(custom_img);
+		return NULL;
 	}
 
-	buf = pidgin_pixbuf_from_data(data, len);
+	/* The decoded icon is shared, so it is only ever scaled into a copy,
+	 * and that copy is what gets greyed below. */
+	buf = (GdkPixbuf *)purple_buddy_icons_get_decoded(img);
+	if (buf == NULL) {
+		buf = pidgin_pixbuf_from_data(purple_image_get_data(img),
+		                              purple_image_get_data_size(img));
+		if (buf) {
+			purple_buddy_icons_set_decoded(img, G_OBJECT(buf),
+			                               gdk_pixbuf_get_byte_length(buf));
+		}
+	}
 	purple_buddy_icon_unref(icon);
 	if (!buf) {
 		purple_debug_warning("gtkblist", "Couldn't load buddy icon on "
@@ -2732,27 +2751,6 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 	if (custom_img)
 		g_object_unref(custom_img);
 
-	if (greyed) {
-		gboolean offline = FALSE, idle = FALSE;
-
-		if (buddy) {
-			PurplePresence *presence = purple_buddy_get_presence(buddy);
-			if (!PURPLE_BUDDY_IS_ONLINE(buddy))
-				offline = TRUE;
-			if (purple_presence_is_idle(presence))
-				idle = TRUE;
-		} else if (group) {
-			if (purple_counting_node_get_online_count(PURPLE_COUNTING_NODE(group)) == 0)
-				offline = TRUE;
-		}
-
-		if (offline)
-			gdk_pixbuf_saturate_and_pixelate(buf, buf, 0.0, FALSE);
-
-		if (idle)
-			gdk_pixbuf_saturate_and_pixelate(buf, buf, 0.25, FALSE);
-	}
-
 	/* I'd use the pidgin_buddy_icon_get_scale_size() thing, but it won't
 	 * tell me the original size, which I need for scaling purposes. */
 	scale_width = orig_width = gdk_pixbuf_get_width(buf);
@@ -2790,9 +2788,129 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 	}
 	g_object_unref(G_OBJECT(buf));
 
+	if (greyed) {
+		gboolean offline = FALSE, idle = FALSE;
+
+		if (buddy) {
+			PurplePresence *presence = purple_buddy_get_presence(buddy);
+			if (!PURPLE_BUDDY_IS_ONLINE(buddy))
+				offline = TRUE;
+			if (purple_presence_is_idle(presence))
+				idle = TRUE;
+		} else if (group) {
+			if (purple_counting_node_get_online_count(PURPLE_COUNTING_NODE(group)) == 0)
+				offline = TRUE;
+		}
+
+		if (offline)
+			gdk_pixbuf_saturate_and_pixelate(ret, ret, 0.0, FALSE);
+
+		if (idle)
+			gdk_pixbuf_saturate_and_pixelate(ret, ret, 0.25, FALSE);
+	}
+
 	return ret;
 }
 
+/* Moves iter to the next row shown by the tree view, walking into
+ * expanded rows. */
+static gboolean
+pidgin_blist_iter_next_visible(GtkTreeView *tv, GtkTreeModel *model,
+                               GtkTreeIter *iter)
+{
+	GtkTreeIter next;
+	GtkTreePath *path;
+	gboolean expanded;
+
+	path = gtk_tree_model_get_path(model, iter);
+	expanded = gtk_tree_view_row_expanded(tv, path);
+	gtk_tree_path_free(path);
+
+	if (expanded && gtk_tree_model_iter_children(model, &next, iter)) {
+		*iter = next;
+		return TRUE;
+	}
+
+	while (TRUE) {
+		next = *iter;
+		if (gtk_tree_model_iter_next(model, &next)) {
+			*iter = next;
+			return TRUE;
+		}
+		if (!gtk_tree_model_iter_parent(model, &next, iter))
+			return FALSE;
+		*iter = next;
+	}
+}
+
+static gboolean
+pidgin_blist_prefetch_icons_cb(gpointer data)
+{
+	PidginBuddyListPrivate *priv = pidgin_buddy_list_get_instance_private(gtkblist);
+	GtkTreeModel *model;
+	GtkTreePath *start, *end, *path;
+	GtkTreeIter iter;
+	GList *buddies = NULL;
+	gboolean valid;
+
+	priv->prefetch_icons_timeout = 0;
+
+	if (gtkblist->treeview == NULL ||
+	    !gtk_tree_view_get_visible_range(GTK_TREE_VIEW(gtkblist->treeview), &start, &end))
+		return FALSE;
+
+	model = GTK_TREE_MODEL(gtkblist->treemodel);
+	valid = gtk_tree_model_get_iter(model, &iter, start);
+
+	while (valid) {
+		PurpleBlistNode *node;
+
+		gtk_tree_model_get(model, &iter, NODE_COLUMN, &node, -1);
+
+		if (PURPLE_IS_CONTACT(node))
+			node = PURPLE_BLIST_NODE(purple_contact_get_priority_buddy(PURPLE_CONTACT(node)));
+		if (PURPLE_IS_BUDDY(node))
+			buddies = g_list_prepend(buddies, node);
+
+		path = gtk_tree_model_get_path(model, &iter);
+		valid = gtk_tree_path_compare(path, end) < 0 &&
+		        pidgin_blist_iter_next_visible(GTK_TREE_VIEW(gtkblist->treeview), model, &iter);
+		gtk_tree_path_free(path);
+	}
+
+	purple_buddy_icons_prefetch(buddies);
+
+	g_list_free(buddies);
+	gtk_tree_path_free(start);
+	gtk_tree_path_free(end);
+
+	return FALSE;
+}
+
+/* Loads the icons of the rows that are on screen, once the tree view has
+ * settled.  The rows are updated as each icon is set on its buddy. */
+static void
+pidgin_blist_queue_icon_prefetch(void)
+{
+	PidginBuddyListPrivate *priv;
+
+	if (gtkblist == NULL)
+		return;
+
+	priv = pidgin_buddy_list_get_instance_private(gtkblist);
+
+	if (priv->prefetch_icons_timeout == 0) {
+		priv->prefetch_icons_timeout = g_idle_add(
+			pidgin_blist_prefetch_icons_cb, NULL);
+	}
+}
+
+static void
+pidgin_blist_scrolled_cb(GtkAdjustment *adjustment, gpointer data)
+{
+	pidgin_blist_queue_icon_prefetch();
+}
+
 /* # - Status Icon
  * P - Protocol Icon
  * A - Buddy Icon
@@ -5717,6 +5835,7 @@ static void pidgin_blist_show(PurpleBuddyList *list)
 	GError *error;
 	GtkAccelGroup *accel_group;
 	GtkTreeSelection *selection;
+	GtkAdjustment *vadjustment;
 	GtkTargetEntry dte[] = {{"PURPLE_BLIST_NODE", GTK_TARGET_SAME_APP, DRAG_ROW},
 				{"application/x-im-contact", 0, DRAG_BUDDY},
 				{"text/x-vcard", 0, DRAG_VCARD },
@@ -5956,6 +6075,13 @@ static void pidgin_blist_show(PurpleBuddyList *list)
 		pidgin_make_scrollable(gtkblist->treeview, GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC, GTK_SHADOW_NONE, -1, -1),
 		TRUE, TRUE, 0);
 
+	/* Load the buddy icons of rows as they are scrolled into view. */
+	vadjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(gtkblist->treeview));
+	g_signal_connect(G_OBJECT(vadjustment), "value-changed",
+	                 G_CALLBACK(pidgin_blist_scrolled_cb), NULL);
+	g_signal_connect(G_OBJECT(vadjustment), "changed",
+	                 G_CALLBACK(pidgin_blist_scrolled_cb), NULL);
+
 	sep = gtk_separator_new(GTK_ORIENTATION_HORIZONTAL);
 	gtk_box_pack_start(GTK_BOX(gtkblist->vbox), sep, FALSE, FALSE, 0);
 
@@ -6126,6 +6252,20 @@ void pidgin_blist_refresh(PurpleBuddyList *list)
 	redo_buddy_list(list, FALSE, TRUE);
 }
 
+static void
+pidgin_blist_bulk_update(PurpleBuddyList *list, GList *removed)
+{
+	for (; removed != NULL; removed = removed->next) {
+		PurpleBlistNode *node = removed->data;
+
+		purple_request_close_with_handle(node);
+		pidgin_blist_hide_node(list, node, FALSE);
+		pidgin_blist_forget_node(node);
+	}
+
+	redo_buddy_list(list, FALSE, FALSE);
+}
+
 void
 pidgin_blist_update_refresh_timeout()
 {
@@ -6168,8 +6308,6 @@ static gboolean get_iter_from_node(PurpleBlistNode *node, GtkTreeIter *iter) {
 
 static void pidgin_blist_remove(PurpleBuddyList *list, PurpleBlistNode *node)
 {
-	PidginBlistNode *gtknode = purple_blist_node_get_ui_data(node);
-
 	purple_request_close_with_handle(node);
 
 	pidgin_blist_hide_node(list, node, TRUE);
@@ -6177,6 +6315,14 @@ static void pidgin_blist_remove(PurpleBuddyList *list, PurpleBlistNode *node)
 	if(node->parent)
 		pidgin_blist_update(list, node->parent);
 
+	pidgin_blist_forget_node(node);
+}
+
+/* Frees the UI data of a node that is no longer shown. */
+static void pidgin_blist_forget_node(PurpleBlistNode *node)
+{
+	PidginBlistNode *gtknode = purple_blist_node_get_ui_data(node);
+
 	/* There's something I don't understand here - Ethan */
 	/* Ethan said that back in 2003, but this g_free has been left commented
 	 * out ever since. I can't find any reason at all why this is bad and
@@ -7544,6 +7690,9 @@ pidgin_buddy_list_finalize(GObject *obj)
 	if (priv->select_notebook_page_timeout) {
 		g_source_remove(priv->select_notebook_page_timeout);
 	}
+	if (priv->prefetch_icons_timeout) {
+		g_source_remove(priv->prefetch_icons_timeout);
+	}
 
 	purple_prefs_disconnect_by_handle(pidgin_blist_get_handle());
 
@@ -7567,6 +7716,7 @@ pidgin_buddy_list_class_init(PidginBuddyListClass *klass)
 	purple_blist_class->request_add_buddy = pidgin_blist_request_add_buddy;
 	purple_blist_class->request_add_chat = pidgin_blist_request_add_chat;
 	purple_blist_class->request_add_group = pidgin_blist_request_add_group;
+	purple_blist_class->bulk_update = pidgin_blist_bulk_update;
 }
 
 /*********************************************************************
@@ -4550,6 +4550,7 @@ pidgin_conv_destroy(PurpleConversation *conv)
 	if (gtkconv->attach_timer) {
 		g_source_remove(gtkconv->attach_timer);
 	}
+	g_list_free_full(g_list_first(gtkconv->attach_current), g_object_unref);
 
 	g_array_unref(gtkconv->nick_colors);
 
@@ -6271,8 +6272,14 @@ add_message_history_to_gtkconv(gpointer data)
 		if (im) {
 			gtkconv->attach_current = g_list_delete_link(gtkconv->attach_current, gtkconv->attach_current);
 		} else {
-			gtkconv->attach_current = gtkconv->attach_current->prev;
+			/* chats are added from the end of the list */
+			GList *prev = gtkconv->attach_current->prev;
+			if (prev)
+				prev->next = NULL;
+			g_list_free_1(gtkconv->attach_current);
+			gtkconv->attach_current = prev;
 		}
+		g_object_unref(msg);
 		count++;
 	}
 	gtkconv->attach_timer = timer;
@@ -6352,14 +6359,18 @@ gboolean pidgin_conv_attach_to_conversation(PurpleConversation *conv)
 
 	list = purple_conversation_get_message_history(conv);
 	if (list) {
+		/* The history may be trimmed while we add it bit by bit, so hold
+		 * on to our own copy. */
+		list = g_list_copy_deep(list, (GCopyFunc)g_object_ref, NULL);
 		if (PURPLE_IS_IM_CONVERSATION(conv)) {
 			GList *convs;
-			list = g_list_copy(list);
 			for (convs = purple_conversations_get_ims(); convs; convs = convs->next)
 				if (convs->data != conv &&
 						pidgin_conv_find_gtkconv(convs->data) == gtkconv) {
 					pidgin_conv_attach(convs->data);
-					list = g_list_concat(list, g_list_copy(purple_conversation_get_message_history(convs->data)));
+					list = g_list_concat(list, g_list_copy_deep(
+						purple_conversation_get_message_history(convs->data),
+						(GCopyFunc)g_object_ref, NULL));
 				}
 			list = g_list_sort(list, (GCompareFunc)message_compare);
 			gtkconv->attach_current = list;
@@ -1512,6 +1512,7 @@ pounce_cb(PurplePounce *pounce, PurplePounceEvent events, void *data)
 			pmsg = purple_message_new_outgoing(pouncee, message, 0);
 			purple_serv_send_im(purple_account_get_connection(account), pmsg);
 			purple_conversation_write_message(PURPLE_CONVERSATION(im), pmsg);
+			g_object_unref(pmsg);
 		}
 	}
 
@@ -26,6 +26,7 @@
 #include "account.h"
 #include "debug.h"
 #include "log.h"
+#include "logindex.h"
 #include "notify.h"
 #include "request.h"
 #include "util.h"
@@ -195,7 +196,9 @@ entry_search_changed_cb(GtkWidget *button, PidginLogViewer *lv)
 	gtk_tree_store_clear(lv->treestore);
 	talkatu_buffer_clear(TALKATU_BUFFER(lv->log_buffer));
 
-	for (logs = lv->logs; logs != NULL; logs = logs->next) {
+	/* The index rules most of the logs out without reading them */
+	logs = purple_log_index_narrow(lv->logs, search_term);
+	for (; logs != NULL; logs = g_list_delete_link(logs, logs)) {
 		char *read = purple_log_read((PurpleLog*)logs->data, NULL);
 		if (read && *read && purple_strcasestr(read, search_term)) {
 			GtkTreeIter iter;
@@ -142,20 +142,24 @@ purple_xmlnode_append_to_buffer(PurpleXmlNode *node, gint indent_level, GtkTextI
 			                                 tag, NULL);
 		}
 	}
+	for (i = 0; i < (gint)node->n_attribs; i++)
+	{
+		const PurpleXmlAttrib *attrib = &node->attribs[i];
+
+		gtk_text_buffer_insert_with_tags(console->buffer, iter, " ", 1,
+		                                 tag, NULL);
+		gtk_text_buffer_insert_with_tags(console->buffer, iter, attrib->name, -1,
+		                                 tag, console->tags.attr, NULL);
+		gtk_text_buffer_insert_with_tags(console->buffer, iter, "='", 2,
+		                                 tag, NULL);
+		gtk_text_buffer_insert_with_tags(console->buffer, iter, attrib->value, -1,
+		                                 tag, console->tags.value, NULL);
+		gtk_text_buffer_insert_with_tags(console->buffer, iter, "'", 1,
+		                                 tag, NULL);
+	}
 	for (c = node->child; c; c = c->next)
 	{
-		if (c->type == PURPLE_XMLNODE_TYPE_ATTRIB) {
-			gtk_text_buffer_insert_with_tags(console->buffer, iter, " ", 1,
-			                                 tag, NULL);
-			gtk_text_buffer_insert_with_tags(console->buffer, iter, c->name, -1,
-			                                 tag, console->tags.attr, NULL);
-			gtk_text_buffer_insert_with_tags(console->buffer, iter, "='", 2,
-			                                 tag, NULL);
-			gtk_text_buffer_insert_with_tags(console->buffer, iter, c->data, -1,
-			                                 tag, console->tags.value, NULL);
-			gtk_text_buffer_insert_with_tags(console->buffer, iter, "'", 1,
-			                                 tag, NULL);
-		} else if (c->type == PURPLE_XMLNODE_TYPE_TAG || c->type == PURPLE_XMLNODE_TYPE_DATA) {
+		if (c->type == PURPLE_XMLNODE_TYPE_TAG || c->type == PURPLE_XMLNODE_TYPE_DATA) {
 			if (c->type == PURPLE_XMLNODE_TYPE_DATA)
 				pretty = FALSE;
 			need_end = TRUE;